@@ -152,6 +152,9 @@ static int print_deref( LDAP *ld, LDAPControl *ctrl );
 #ifdef LDAP_CONTROL_X_WHATFAILED
 static int print_whatfailed( LDAP *ld, LDAPControl *ctrl );
 #endif
+#ifdef LDAP_CONTROL_X_SEARCH_EXPLAIN
+static int print_explain( LDAP *ld, LDAPControl *ctrl );
+#endif
 static int print_syncstate( LDAP *ld, LDAPControl *ctrl );
 static int print_syncdone( LDAP *ld, LDAPControl *ctrl );
 #ifdef LDAP_CONTROL_X_DIRSYNC
@@ -188,6 +191,9 @@ static struct tool_ctrls_t {
 #endif
 #ifdef LDAP_CONTROL_X_WHATFAILED
 	{ LDAP_CONTROL_X_WHATFAILED,			TOOL_ALL,	print_whatfailed },
+#endif
+#ifdef LDAP_CONTROL_X_SEARCH_EXPLAIN
+	{ LDAP_CONTROL_X_SEARCH_EXPLAIN,		TOOL_SEARCH,	print_explain },
 #endif
 	{ LDAP_CONTROL_SYNC_STATE,			TOOL_SEARCH,	print_syncstate },
 	{ LDAP_CONTROL_SYNC_DONE,			TOOL_SEARCH,	print_syncdone },
@@ -2340,6 +2346,72 @@ print_whatfailed( LDAP *ld, LDAPControl *ctrl )
 }
 #endif
 
+#ifdef LDAP_CONTROL_X_SEARCH_EXPLAIN
+static int
+print_explain( LDAP *ld, LDAPControl *ctrl )
+{
+	BerElement *ber;
+	ber_tag_t tag;
+	ber_len_t len;
+	char *last;
+	struct berval plan, filter;
+	ber_int_t cand, scanned, returned, ctime, stime;
+	ber_int_t depth, est, size;
+	char buf[ BUFSIZ ];
+	int n;
+
+	ber = ber_init( &ctrl->ldctl_value );
+	if ( ber == NULL ) {
+		return LDAP_NO_MEMORY;
+	}
+
+	tag = ber_scanf( ber, "{miiiii", &plan, &cand, &scanned, &returned,
+		&ctime, &stime );
+	if ( tag == LBER_ERROR ) {
+		ber_free( ber, 1 );
+		return 1;
+	}
+
+	n = snprintf( buf, sizeof( buf ),
+		" explain: plan=%.*s candidates=%d scanned=%d returned=%d",
+		(int)plan.bv_len, plan.bv_val, cand, scanned, returned );
+	tool_write_ldif( LDIF_PUT_COMMENT, NULL, buf, n );
+	n = snprintf( buf, sizeof( buf ),
+		" explain: candidate time=%dus scan time=%dus", ctime, stime );
+	tool_write_ldif( LDIF_PUT_COMMENT, NULL, buf, n );
+
+	for ( tag = ber_first_element( ber, &len, &last );
+		tag != LBER_DEFAULT;
+		tag = ber_next_element( ber, &len, last ) )
+	{
+		char ebuf[ 16 ], sbuf[ 16 ];
+
+		if ( ber_scanf( ber, "{imii}", &depth, &filter, &est, &size )
+			== LBER_ERROR )
+		{
+			break;
+		}
+		if ( est < 0 )
+			strcpy( ebuf, "-" );
+		else
+			snprintf( ebuf, sizeof( ebuf ), "%d", est );
+		if ( size < 0 )
+			strcpy( sbuf, "skipped" );
+		else
+			snprintf( sbuf, sizeof( sbuf ), "%d", size );
+		n = snprintf( buf, sizeof( buf ), " explain: %*s%.*s est=%s size=%s",
+			2 * depth, "", (int)filter.bv_len, filter.bv_val, ebuf, sbuf );
+		if ( n >= sizeof( buf ))
+			n = sizeof( buf ) - 1;
+		tool_write_ldif( LDIF_PUT_COMMENT, NULL, buf, n );
+	}
+
+	ber_free( ber, 1 );
+
+	return 0;
+}
+#endif
+
 static int
 print_syncstate( LDAP *ld, LDAPControl *ctrl )
 {
@@ -155,6 +155,9 @@ usage( void )
 #endif
 #ifdef LDAP_CONTROL_X_SERVER_NOTIFICATION
 	fprintf( stderr, _("             [!]serverNotif              (MS AD Server Notification)\n"));
+#endif
+#ifdef LDAP_CONTROL_X_SEARCH_EXPLAIN
+	fprintf( stderr, _("             [!]explain                  (back-mdb search plan and timing)\n"));
 #endif
 	fprintf( stderr, _("             [!]<oid>[=:<value>|::<b64value>] (generic control; no response handling)\n"));
 	fprintf( stderr, _("  -f file    read operations from `file'\n"));
@@ -289,6 +292,10 @@ static int showDeleted;
 static int serverNotif;
 #endif
 
+#ifdef LDAP_CONTROL_X_SEARCH_EXPLAIN
+static int explain;
+#endif
+
 static int
 ctrl_add( void )
 {
@@ -815,6 +822,22 @@ handle_private_option( int i )
 			serverNotif = 1 + crit;
 #endif /* LDAP_CONTROL_X_SERVER_NOTIFICATION */
 
+#ifdef LDAP_CONTROL_X_SEARCH_EXPLAIN
+		} else if ( strcasecmp( control, "explain" ) == 0 ) {
+			if( explain ) {
+				fprintf( stderr,
+					_("explain control previously specified\n"));
+				exit( EXIT_FAILURE );
+			}
+			if ( cvalue != NULL ) {
+				fprintf( stderr,
+			         _("explain: no control value expected\n") );
+				usage();
+			}
+
+			explain = 1 + crit;
+#endif /* LDAP_CONTROL_X_SEARCH_EXPLAIN */
+
 #ifdef LDAP_CONTROL_X_ACCOUNT_USABILITY
 		} else if ( strcasecmp( control, "accountUsability" ) == 0 ) {
 			if( accountUsability ) {
@@ -1144,6 +1167,9 @@ getNextPage:
 #endif
 #ifdef LDAP_CONTROL_X_SERVER_NOTIFICATION
 		|| serverNotif
+#endif
+#ifdef LDAP_CONTROL_X_SEARCH_EXPLAIN
+		|| explain
 #endif
 		|| domainScope
 		|| pagedResults
@@ -1434,6 +1460,19 @@ getNextPage:
 			c[i].ldctl_iscritical = serverNotif > 1;
 			i++;
 		}
+#endif
+#ifdef LDAP_CONTROL_X_SEARCH_EXPLAIN
+		if ( explain ) {
+			if ( ctrl_add() ) {
+				tool_exit( ld, EXIT_FAILURE );
+			}
+
+			c[i].ldctl_oid = LDAP_CONTROL_X_SEARCH_EXPLAIN;
+			c[i].ldctl_value.bv_val = NULL;
+			c[i].ldctl_value.bv_len = 0;
+			c[i].ldctl_iscritical = explain > 1;
+			i++;
+		}
 #endif
 	}
 
@@ -1536,6 +1575,12 @@ getNextPage:
 				derefcrit > 1 ? _("critical ") : "" );
 		}
 #endif
+#ifdef LDAP_CONTROL_X_SEARCH_EXPLAIN
+		if ( explain ) {
+			printf(_("\n# with explain %scontrol"),
+				explain > 1 ? _("critical ") : "" );
+		}
+#endif
 
 		printf( _("\n#\n\n") );
 
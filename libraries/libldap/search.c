@@ -515,7 +515,7 @@ ldap_bv2escaped_filter_value_x( struct berval *in, struct berval *out, int inpla
 		if ( inplace ) {
 			*out = *in;
 		} else {
-			ber_dupbv( out, in );
+			ber_dupbv_x( out, in, ctx );
 		}
 		return 0;
 	}
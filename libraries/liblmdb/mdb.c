@@ -1250,6 +1250,7 @@ typedef struct MDB_xcursor {
 typedef struct MDB_pgstate {
 	pgno_t		*mf_pghead;	/**< Reclaimed freeDB pages, or NULL before use */
 	txnid_t		mf_pglast;	/**< ID of last used record, or 0 if !mf_pghead */
+	pgno_t		mf_pgrun;	/**< No run of pages in mf_pghead is longer */
 } MDB_pgstate;
 
 	/** The database environment. */
@@ -1289,9 +1290,11 @@ struct MDB_env {
 	unsigned int	*me_dbiseqs;	/**< array of dbi sequence numbers */
 	pthread_key_t	me_txkey;	/**< thread-key for readers */
 	txnid_t		me_pgoldest;	/**< ID of oldest reader last time we looked */
+	unsigned int	me_rdoldest;	/**< reader slot that held #me_pgoldest */
 	MDB_pgstate	me_pgstate;		/**< state of old pages from freeDB */
 #	define		me_pglast	me_pgstate.mf_pglast
 #	define		me_pghead	me_pgstate.mf_pghead
+#	define		me_pgrun	me_pgstate.mf_pgrun
 	MDB_page	*me_dpages;		/**< list of malloc'd blocks for re-use */
 	/** IDL of pages that became unused in a write txn */
 	MDB_IDL		me_free_pgs;
@@ -2093,21 +2096,40 @@ done:
 	return rc;
 }
 
-/** Find oldest txnid still referenced. Expects txn->mt_txnid > 0. */
+/** Find oldest txnid still referenced. Expects txn->mt_txnid > 0.
+ *
+ *	Readers only start at the latest snapshot, so none can be older
+ *	than what we found last time. The scan starts at the slot of the
+ *	oldest reader we found and stops at a reader that is still that
+ *	old. While one long-lived reader pins the freelist, that is the
+ *	first slot we look at, whatever the size of the reader table.
+ */
 static txnid_t
 mdb_find_oldest(MDB_txn *txn)
 {
-	int i;
+	MDB_env *env = txn->mt_env;
+	unsigned int i, j, nr, slot;
 	txnid_t mr, oldest = txn->mt_txnid - 1;
-	if (txn->mt_env->me_txns) {
-		MDB_reader *r = txn->mt_env->me_txns->mti_readers;
-		for (i = txn->mt_env->me_txns->mti_numreaders; --i >= 0; ) {
+	if (env->me_txns && oldest > env->me_pgoldest) {
+		MDB_reader *r = env->me_txns->mti_readers;
+		nr = env->me_txns->mti_numreaders;
+		slot = env->me_rdoldest;
+		if (slot >= nr)
+			slot = 0;
+		for (i = slot, j = nr; j; j--) {
 			if (r[i].mr_pid) {
 				mr = r[i].mr_txnid;
-				if (oldest > mr)
+				if (oldest > mr) {
 					oldest = mr;
+					slot = i;
+					if (mr <= env->me_pgoldest)
+						break;
+				}
 			}
+			if (++i == nr)
+				i = 0;
 		}
+		env->me_rdoldest = slot;
 	}
 	return oldest;
 }
@@ -2131,6 +2153,60 @@ mdb_page_dirty(MDB_txn *txn, MDB_page *mp)
 	txn->mt_dirty_room--;
 }
 
+/** Account for a page just added to me_pghead in me_pgrun.
+ *
+ * me_pgrun bounds the length of the runs of contiguous pages in
+ * me_pghead, so that #mdb_page_alloc() need not scan all of it for
+ * a run that isn't there. Taking pages out can only shorten runs,
+ * adding them may join runs: only the run that includes an added
+ * page has to be measured. A run longer than the bound makes it
+ * unknown until the next scan that fails.
+ * @param[in] env the environment
+ * @param[in] pg the page added
+ * @return the index in me_pghead of the last page of its run, or
+ * of the last page of me_pghead if the bound became unknown.
+ */
+static unsigned
+mdb_pgrun_add(MDB_env *env, pgno_t pg)
+{
+	pgno_t *mop = env->me_pghead;
+	unsigned i, j, n = mop[0];
+
+	if (env->me_pgrun == (pgno_t)-1)
+		return n;
+	i = j = mdb_midl_search(mop, pg);
+	/* me_pghead is in descending order. Measure no further
+	 * than needed to tell if the run is within the bound.
+	 */
+	while (i > 1 && mop[i-1] == mop[i]+1 && j - i < env->me_pgrun)
+		i--;
+	while (j < n && mop[j+1] == mop[j]-1 && j - i < env->me_pgrun)
+		j++;
+	if (j - i >= env->me_pgrun) {
+		env->me_pgrun = (pgno_t)-1;
+		return n;
+	}
+	return j;
+}
+
+/** Account for a sorted list of pages just merged into me_pghead.
+ * @param[in] env the environment
+ * @param[in] pgs the pages added
+ */
+static void
+mdb_pgrun_merge(MDB_env *env, MDB_IDL pgs)
+{
+	pgno_t *mop = env->me_pghead;
+	unsigned i, j;
+
+	for (i = 1; i <= pgs[0] && env->me_pgrun != (pgno_t)-1; ) {
+		j = mdb_pgrun_add(env, pgs[i]);
+		/* skip the other added pages of the same run */
+		while (++i <= pgs[0] && pgs[i] >= mop[j])
+			;
+	}
+}
+
 /** Allocate page numbers and memory for writing.  Maintain me_pglast,
  * me_pghead and mt_next_pgno.  Set #MDB_TXN_ERROR on failure.
  *
@@ -2197,14 +2273,18 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 
 		/* Seek a big enough contiguous page range. Prefer
 		 * pages at the tail, just truncating the list.
+		 * Skip the scan if there is no such range.
 		 */
 		if (mop_len > n2) {
-			i = mop_len;
-			do {
-				pgno = mop[i];
-				if (mop[i-n2] == pgno+n2)
-					goto search_done;
-			} while (--i > n2);
+			if (env->me_pgrun > n2) {
+				i = mop_len;
+				do {
+					pgno = mop[i];
+					if (mop[i-n2] == pgno+n2)
+						goto search_done;
+				} while (--i > n2);
+				env->me_pgrun = n2;
+			}
 			if (--retry < 0)
 				break;
 		}
@@ -2279,6 +2359,7 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 		/* Merge in descending sorted order */
 		mdb_midl_xmerge(mop, idl);
 		mop_len = mop[0];
+		mdb_pgrun_merge(env, idl);
 	}
 
 	/* Use new pages from the map when nothing suitable in the freeDB */
@@ -3018,6 +3099,7 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 			/* me_pgstate: */
 			env->me_pghead = NULL;
 			env->me_pglast = 0;
+			env->me_pgrun = 0;
 
 			env->me_txn = NULL;
 			mode = 0;	/* txn == env->me_txn0, do not free() it */
@@ -3254,6 +3336,7 @@ mdb_freelist_save(MDB_txn *txn)
 		loose[0] = count;
 		mdb_midl_sort(loose);
 		mdb_midl_xmerge(mop, loose);
+		mdb_pgrun_merge(env, loose);
 		txn->mt_loose_pgs = NULL;
 		txn->mt_loose_count = 0;
 		mop_len = mop[0];
@@ -5750,6 +5833,7 @@ release:
 		while (j>i)
 			mop[j--] = pg++;
 		mop[0] += ovpages;
+		mdb_pgrun_add(env, pg-1);
 	} else {
 		rc = mdb_midl_append_range(&txn->mt_free_pgs, pg, ovpages);
 		if (rc)
@@ -102,6 +102,62 @@ void ucstr2upper(
 	}
 }
 
+/*
+ * Most values are pure ASCII, so the ASCII runs between non-ASCII
+ * characters are scanned and casefolded a machine word at a time.
+ * slapd runs in the C locale, where TOLOWER() only maps A-Z.
+ */
+typedef unsigned long uc_word_t;
+
+#define UC_ONES		((uc_word_t)-1 / 0xff)
+#define UC_HIGHS	(UC_ONES * 0x80)
+
+/* lowercase the A-Z bytes of a word holding only ASCII */
+#define UC_WORD_TOLOWER(w) \
+	((w) | ((((w) + UC_ONES * (0x80 - 'A')) & \
+		~((w) + UC_ONES * (0x80 - 'Z' - 1)) & UC_HIGHS) >> 2))
+
+/* length of the run of ASCII characters at the start of s */
+static int
+ascii_span( const char *s, int len )
+{
+	int i = 0;
+	uc_word_t w;
+
+	for ( ; i + (int)sizeof(w) <= len; i += sizeof(w) ) {
+		memcpy( &w, s + i, sizeof(w) );
+		if ( w & UC_HIGHS ) {
+			break;
+		}
+	}
+	while ( i < len && LDAP_UTF8_ISASCII( s + i ) ) {
+		i++;
+	}
+	return i;
+}
+
+/* copy n ASCII characters, optionally casefolding them */
+static void
+ascii_copy( char *out, const char *s, int n, unsigned casefold )
+{
+	int i = 0;
+	uc_word_t w;
+
+	if ( !casefold ) {
+		memcpy( out, s, n );
+		return;
+	}
+
+	for ( ; i + (int)sizeof(w) <= n; i += sizeof(w) ) {
+		memcpy( &w, s + i, sizeof(w) );
+		w = UC_WORD_TOLOWER( w );
+		memcpy( out + i, &w, sizeof(w) );
+	}
+	for ( ; i < n; i++ ) {
+		out[i] = TOLOWER( s[i] );
+	}
+}
+
 struct berval * UTF8bvnormalize(
 	struct berval *bv,
 	struct berval *newbv,
@@ -142,55 +198,32 @@ struct berval * UTF8bvnormalize(
 	 */
 
 	/* finish off everything up to character before first non-ascii */
-	if ( LDAP_UTF8_ISASCII( s ) ) {
-		if ( casefold ) {
-			outsize = len + 7;
-			out = (char *) ber_memalloc_x( outsize, ctx );
-			if ( out == NULL ) {
-fail:
-				if ( didnewbv )
-					ber_memfree_x( newbv, ctx );
-				return NULL;
-			}
-			outpos = 0;
+	i = ascii_span( s, len );
+	if ( i == len && !casefold ) {
+		return ber_str2bv_x( s, len, 1, newbv, ctx );
+	}
 
-			for ( i = 1; (i < len) && LDAP_UTF8_ISASCII(s + i); i++ ) {
-				out[outpos++] = TOLOWER( s[i-1] );
-			}
-			if ( i == len ) {
-				out[outpos++] = TOLOWER( s[len-1] );
-				out[outpos] = '\0';
-				newbv->bv_val = out;
-				newbv->bv_len = outpos;
-				return newbv;
-			}
-		} else {
-			for ( i = 1; (i < len) && LDAP_UTF8_ISASCII(s + i); i++ ) {
-				/* empty */
-			}
+	outsize = len + 7;
+	out = (char *) ber_memalloc_x( outsize, ctx );
+	if ( out == NULL ) {
+fail:
+		if ( didnewbv )
+			ber_memfree_x( newbv, ctx );
+		return NULL;
+	}
 
-			if ( i == len ) {
-				return ber_str2bv_x( s, len, 1, newbv, ctx );
-			}
-				
-			outsize = len + 7;
-			out = (char *) ber_memalloc_x( outsize, ctx );
-			if ( out == NULL ) {
-				goto fail;
-			}
-			outpos = i - 1;
-			memcpy(out, s, outpos);
-		}
-	} else {
-		outsize = len + 7;
-		out = (char *) ber_memalloc_x( outsize, ctx );
-		if ( out == NULL ) {
-			goto fail;
-		}
-		outpos = 0;
-		i = 0;
+	if ( i == len ) {
+		ascii_copy( out, s, len, casefold );
+		out[len] = '\0';
+		newbv->bv_val = out;
+		newbv->bv_len = len;
+		return newbv;
 	}
 
+	/* the character before a non-ascii one may combine with it */
+	outpos = i > 0 ? i - 1 : 0;
+	ascii_copy( out, s, outpos, casefold );
+
 	p = ucs = ber_memalloc_x( len * sizeof(*ucs), ctx );
 	if ( ucs == NULL ) {
 		ber_memfree_x(out, ctx);
@@ -287,13 +320,15 @@ fail:
 
 		/* s[i] is ascii */
 		/* finish off everything up to char before next non-ascii */
-		for ( i++; (i < len) && LDAP_UTF8_ISASCII(s + i); i++ ) {
-			out[outpos++] = casefold ? TOLOWER( s[i-1] ) : s[i-1];
-		}
-		if ( i == len ) {
-			out[outpos++] = casefold ? TOLOWER( s[len-1] ) : s[len-1];
+		j = i + ascii_span( s + i, len - i );
+		if ( j == len ) {
+			ascii_copy( out + outpos, s + i, len - i, casefold );
+			outpos += len - i;
 			break;
 		}
+		ascii_copy( out + outpos, s + i, j - i - 1, casefold );
+		outpos += j - i - 1;
+		i = j;
 
 		/* convert character before next non-ascii to ucs-4 */
 		*ucs = casefold ? TOLOWER( s[i-1] ) : s[i-1];
@@ -342,6 +377,26 @@ int UTF8bvnormcmp(
 	s2 = bv2->bv_val;
 	done = s1 + len;
 
+	/* skip the common ASCII prefix a word at a time */
+	while ( s1 + sizeof(uc_word_t) <= done ) {
+		uc_word_t w1, w2;
+
+		memcpy( &w1, s1, sizeof(w1) );
+		memcpy( &w2, s2, sizeof(w2) );
+		if ( (w1 | w2) & UC_HIGHS ) {
+			break;
+		}
+		if ( casefold ) {
+			w1 = UC_WORD_TOLOWER( w1 );
+			w2 = UC_WORD_TOLOWER( w2 );
+		}
+		if ( w1 != w2 ) {
+			break;
+		}
+		s1 += sizeof(uc_word_t);
+		s2 += sizeof(uc_word_t);
+	}
+
 	while ( (s1 < done) && LDAP_UTF8_ISASCII(s1) && LDAP_UTF8_ISASCII(s2) ) {
 		if (casefold) {
 			char c1 = TOLOWER(*s1);
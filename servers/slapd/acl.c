@@ -230,7 +230,9 @@ slap_access_allowed(
 			state->as_fe_done--;
 		ACL_PRIV_ASSIGN( mask, state->as_vd_mask );
 	} else {
-		*state = state_init;
+		/* the per-entry rule memo at the end stays valid */
+		AC_MEMCPY( state, &state_init,
+			offsetof( AccessControlState, as_dn_e ) );
 
 		a = NULL;
 		count = 0;
@@ -538,6 +540,16 @@ slap_acl_get(
 
 	dnlen = e->e_nname.bv_len;
 
+	/* The "to" DN and filter only depend on the entry; remember
+	 * which rules they ruled out while the same entry is being
+	 * checked attribute by attribute.
+	 */
+	if ( state->as_dn_e != e || state->as_dn_be != op->o_bd ) {
+		state->as_dn_e = e;
+		state->as_dn_be = op->o_bd;
+		memset( state->as_dn_miss, 0, sizeof( state->as_dn_miss ) );
+	}
+
  retry:
 	for ( ; a != NULL; prev = a, a = a->acl_next ) {
 		(*count) ++;
@@ -545,15 +557,25 @@ slap_acl_get(
 		if ( a != frontendDB->be_acl && state->as_fe_done )
 			state->as_fe_done++;
 
+		if ( a->acl_memo >= 0 &&
+			( state->as_dn_miss[a->acl_memo >> 3] & ( 1 << (a->acl_memo & 7) ) ) )
+			continue;
+
 		if ( a->acl_dn_pat.bv_len || ( a->acl_dn_style != ACL_STYLE_REGEX )) {
 			if ( a->acl_dn_style == ACL_STYLE_REGEX ) {
 				Debug( LDAP_DEBUG_ACL, "=> dnpat: [%d] %s nsub: %d\n", 
 					*count, a->acl_dn_pat.bv_val, (int) a->acl_dn_re.re_nsub );
+				/* cheap check of the literal tail first */
+				if ( a->acl_dn_sfx.bv_len && ( dnlen < a->acl_dn_sfx.bv_len ||
+					strncasecmp( e->e_ndn + dnlen - a->acl_dn_sfx.bv_len,
+						a->acl_dn_sfx.bv_val, a->acl_dn_sfx.bv_len ) ) )
+					goto nomatch;
+
 				if ( regexec ( &a->acl_dn_re, 
 					       e->e_ndn, 
 				 	       matches->dn_count, 
 					       matches->dn_data, 0 ) )
-					continue;
+					goto nomatch;
 
 			} else {
 				ber_len_t patlen;
@@ -562,43 +584,43 @@ slap_acl_get(
 					*count, a->acl_dn_pat.bv_val );
 				patlen = a->acl_dn_pat.bv_len;
 				if ( dnlen < patlen )
-					continue;
+					goto nomatch;
 
 				if ( a->acl_dn_style == ACL_STYLE_BASE ) {
 					/* base dn -- entire object DN must match */
 					if ( dnlen != patlen )
-						continue;
+						goto nomatch;
 
 				} else if ( a->acl_dn_style == ACL_STYLE_ONE ) {
 					ber_len_t	rdnlen = 0;
 					ber_len_t	sep = 0;
 
 					if ( dnlen <= patlen )
-						continue;
+						goto nomatch;
 
 					if ( patlen > 0 ) {
 						if ( !DN_SEPARATOR( e->e_ndn[dnlen - patlen - 1] ) )
-							continue;
+							goto nomatch;
 						sep = 1;
 					}
 
 					rdnlen = dn_rdnlen( NULL, &e->e_nname );
 					if ( rdnlen + patlen + sep != dnlen )
-						continue;
+						goto nomatch;
 
 				} else if ( a->acl_dn_style == ACL_STYLE_SUBTREE ) {
 					if ( dnlen > patlen && !DN_SEPARATOR( e->e_ndn[dnlen - patlen - 1] ) )
-						continue;
+						goto nomatch;
 
 				} else if ( a->acl_dn_style == ACL_STYLE_CHILDREN ) {
 					if ( dnlen <= patlen )
-						continue;
+						goto nomatch;
 					if ( !DN_SEPARATOR( e->e_ndn[dnlen - patlen - 1] ) )
-						continue;
+						goto nomatch;
 				}
 
 				if ( strcmp( a->acl_dn_pat.bv_val, e->e_ndn + dnlen - patlen ) != 0 )
-					continue;
+					goto nomatch;
 			}
 
 			Debug( LDAP_DEBUG_ACL, "=> acl_get: [%d] matched\n",
@@ -696,13 +718,17 @@ slap_acl_get(
 		if ( a->acl_filter != NULL ) {
 			ber_int_t rc = test_filter( NULL, e, a->acl_filter );
 			if ( rc != LDAP_COMPARE_TRUE ) {
-				continue;
+				goto nomatch;
 			}
 		}
 
 		Debug( LDAP_DEBUG_ACL, "=> acl_get: [%d] attr %s\n",
 		       *count, attr );
 		return a;
+
+nomatch:
+		if ( a->acl_memo >= 0 )
+			state->as_dn_miss[a->acl_memo >> 3] |= 1 << (a->acl_memo & 7);
 	}
 
 	if ( !state->as_fe_done ) {
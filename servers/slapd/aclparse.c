@@ -66,6 +66,7 @@ static void		access_free( Access *a );
 static int		acl_usage(void);
 
 static void		acl_regex_normalized_dn(const char *src, struct berval *pat);
+static void		acl_regex_suffix(struct berval *pat, struct berval *sfx);
 
 #ifdef LDAP_DEBUG
 static void		print_acl(Backend *be, AccessControl *a);
@@ -675,6 +676,7 @@ parse_acl(
 						      fname, lineno, right, err );
 						goto fail;
 					}
+					acl_regex_suffix( &a->acl_dn_pat, &a->acl_dn_sfx );
 				}
 			}
 
@@ -2272,6 +2274,45 @@ acl_regex_normalized_dn(
 	return;
 }
 
+/*
+ * Find the literal text that every DN matching an anchored regex must
+ * end with, so that acl_get() can reject most entries with a string
+ * compare before running the regex.  Anything that is not plainly
+ * literal ends the suffix; an empty suffix means there is no shortcut.
+ */
+static void
+acl_regex_suffix(
+	struct berval *pat,
+	struct berval *sfx )
+{
+	char *end = pat->bv_val + pat->bv_len;
+	char *s;
+
+	BER_BVZERO( sfx );
+
+	/* with alternation the anchor may only bind one branch */
+	if ( pat->bv_len < 2 || strchr( pat->bv_val, '|' ) != NULL ) {
+		return;
+	}
+	if ( end[-1] != '$' || end[-2] == '\\' ) {
+		return;
+	}
+
+	for ( s = end - 1; s > pat->bv_val; s-- ) {
+		if ( strchr( ".[]()*+?{}^$\\", s[-1] ) != NULL ) {
+			break;
+		}
+		if ( s - 1 > pat->bv_val && s[-2] == '\\' ) {
+			break;
+		}
+	}
+
+	if ( s < end - 1 ) {
+		sfx->bv_val = s;
+		sfx->bv_len = end - 1 - s;
+	}
+}
+
 static void
 split(
     char	*line,
@@ -2298,7 +2339,8 @@ access_append( Access **l, Access *a )
 void
 acl_append( AccessControl **l, AccessControl *a, int pos )
 {
-	int i;
+	AccessControl **head = l;
+	int i, base;
 
 	for (i=0 ; i != pos && *l != NULL; l = &(*l)->acl_next, i++ ) {
 		;	/* Empty */
@@ -2306,6 +2348,12 @@ acl_append( AccessControl **l, AccessControl *a, int pos )
 	if ( *l && a )
 		a->acl_next = *l;
 	*l = a;
+
+	/* renumber the list for the per-entry memo in slap_acl_get() */
+	base = ( frontendDB && head == &frontendDB->be_acl ) ? SLAP_ACL_MEMO : 0;
+	for ( i = 0, a = *head; a; a = a->acl_next, i++ ) {
+		a->acl_memo = i < SLAP_ACL_MEMO ? base + i : -1;
+	}
 }
 
 static void
@@ -77,6 +77,10 @@ static Avlnode	*attr_cache = NULL;
 static LDAP_STAILQ_HEAD(ATList, AttributeType) attr_list
 	= LDAP_STAILQ_HEAD_INITIALIZER(attr_list);
 
+/* Bumped whenever attribute types come or go; cached DN
+ * normalizations from an older generation are not used */
+unsigned long slap_schema_gen;
+
 /* Last hardcoded attribute registered */
 AttributeType *at_sys_tail;
 
@@ -254,6 +258,7 @@ void
 at_delete( AttributeType *at )
 {
 	at->sat_flags |= SLAP_AT_DELETED;
+	slap_schema_gen++;
 
 	LDAP_STAILQ_REMOVE(&attr_list, at, AttributeType, sat_next);
 
@@ -444,6 +449,8 @@ at_insert(
 	char			**names = NULL;
 	AttributeType	*sat = *rat;
 
+	slap_schema_gen++;
+
 	if ( sat->sat_oid ) {
 		air = (struct aindexrec *)
 			ch_calloc( 1, sizeof(struct aindexrec) );
@@ -360,13 +360,13 @@ mdb_add(Operation *op, SlapReply *rs )
 		opinfo.moi_oe.oe_key = NULL;
 		if ( op->o_noop ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_txngroup_abort( mdb, moi, txn );
 			rs->sr_err = LDAP_X_NO_OPERATION;
 			txn = NULL;
 			goto return_results;
 		}
 
-		rs->sr_err = mdb_txn_commit( txn );
+		rs->sr_err = mdb_txngroup_commit( mdb, moi, txn );
 		txn = NULL;
 		if ( rs->sr_err != 0 ) {
 			mdb->mi_numads = numads;
@@ -394,7 +394,7 @@ return_results:
 	if( moi == &opinfo ) {
 		if( txn != NULL ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_txngroup_abort( mdb, moi, txn );
 		}
 		if ( opinfo.moi_oe.oe_key ) {
 			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
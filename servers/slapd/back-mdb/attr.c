@@ -110,7 +110,7 @@ mdb_attr_dbs_open(
 				cr->msg );
 			return rc;
 		}
-		dbis = ch_calloc( 1, mdb->mi_nattrs * sizeof(MDB_dbi) );
+		dbis = ch_calloc( 2, mdb->mi_nattrs * sizeof(MDB_dbi) );
 	} else {
 		rc = 0;
 	}
@@ -120,26 +120,70 @@ mdb_attr_dbs_open(
 		flags |= MDB_CREATE;
 
 	for ( i=0; i<mdb->mi_nattrs; i++ ) {
-		if ( mdb->mi_attrs[i]->ai_dbi )	/* already open */
+		AttrInfo *ai = mdb->mi_attrs[i];
+		char *name;
+
+		if ( !( ai->ai_indexmask || ai->ai_newmask ))	/* not an index record */
 			continue;
-		if ( !( mdb->mi_attrs[i]->ai_indexmask || mdb->mi_attrs[i]->ai_newmask ))	/* not an index record */
+		if ( !ai->ai_dbi ) {
+			rc = mdb_dbi_open( txn, ai->ai_desc->ad_type->sat_cname.bv_val,
+				flags, &ai->ai_dbi );
+			if ( rc ) {
+				snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
+					"mdb_dbi_open(%s) failed: %s (%d).",
+					be->be_suffix[0].bv_val,
+					ai->ai_desc->ad_type->sat_cname.bv_val,
+					mdb_strerror(rc), rc );
+				Debug( LDAP_DEBUG_ANY,
+					LDAP_XSTRING(mdb_attr_dbs) ": %s\n",
+					cr->msg );
+				break;
+			}
+			/* Remember newly opened DBI handles */
+			if ( dbis )
+				dbis[i] = ai->ai_dbi;
+		}
+		/* the tools don't keep the statistics, count them once here */
+		if ( ai->ai_indexmask && !( slapMode & SLAP_TOOL_MODE )) {
+			mdb_idxstats st;
+			rc = mdb_idxstats_get( txn, mdb, ai, &st );
+			if ( rc == MDB_NOTFOUND )
+				rc = mdb_idxstats_scan( txn, mdb, ai );
+			if ( rc ) {
+				snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
+					"counting index %s failed: %s (%d).",
+					be->be_suffix[0].bv_val,
+					ai->ai_desc->ad_type->sat_cname.bv_val,
+					mdb_strerror(rc), rc );
+				Debug( LDAP_DEBUG_ANY,
+					LDAP_XSTRING(mdb_attr_dbs) ": %s\n",
+					cr->msg );
+				break;
+			}
+		}
+		if ( ai->ai_odbi ||
+			!(( ai->ai_indexmask | ai->ai_newmask ) & SLAP_INDEX_ORDERED ))
 			continue;
-		rc = mdb_dbi_open( txn, mdb->mi_attrs[i]->ai_desc->ad_type->sat_cname.bv_val,
-			flags, &mdb->mi_attrs[i]->ai_dbi );
+		/* ordered keys are plain values, keep them apart */
+		name = ch_malloc( ai->ai_desc->ad_cname.bv_len +
+			STRLENOF(";ordered") + 1 );
+		lutil_strcopy( lutil_strcopy( name,
+			ai->ai_desc->ad_cname.bv_val ), ";ordered" );
+		rc = mdb_dbi_open( txn, name, flags, &ai->ai_odbi );
+		ch_free( name );
 		if ( rc ) {
 			snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
-				"mdb_dbi_open(%s) failed: %s (%d).",
+				"mdb_dbi_open(%s;ordered) failed: %s (%d).",
 				be->be_suffix[0].bv_val,
-				mdb->mi_attrs[i]->ai_desc->ad_type->sat_cname.bv_val,
+				ai->ai_desc->ad_cname.bv_val,
 				mdb_strerror(rc), rc );
 			Debug( LDAP_DEBUG_ANY,
 				LDAP_XSTRING(mdb_attr_dbs) ": %s\n",
 				cr->msg );
 			break;
 		}
-		/* Remember newly opened DBI handles */
 		if ( dbis )
-			dbis[i] = mdb->mi_attrs[i]->ai_dbi;
+			dbis[mdb->mi_nattrs + i] = ai->ai_odbi;
 	}
 
 	/* Only commit if this is our txn */
@@ -164,6 +208,10 @@ mdb_attr_dbs_open(
 					mdb->mi_attrs[i]->ai_dbi = 0;
 					mdb->mi_attrs[i]->ai_indexmask |= MDB_INDEX_DELETING;
 				}
+				if ( dbis[mdb->mi_nattrs + i] ) {
+					mdb->mi_attrs[i]->ai_odbi = 0;
+					mdb->mi_attrs[i]->ai_indexmask |= MDB_INDEX_DELETING;
+				}
 			}
 			mdb_attr_flush( mdb );
 		}
@@ -183,9 +231,69 @@ mdb_attr_dbs_close(
 		if ( mdb->mi_attrs[i]->ai_dbi ) {
 			mdb_dbi_close( mdb->mi_dbenv, mdb->mi_attrs[i]->ai_dbi );
 			mdb->mi_attrs[i]->ai_dbi = 0;
+			if ( mdb->mi_attrs[i]->ai_odbi ) {
+				mdb_dbi_close( mdb->mi_dbenv, mdb->mi_attrs[i]->ai_odbi );
+				mdb->mi_attrs[i]->ai_odbi = 0;
+			}
 		}
 }
 
+/* Drop the ordered indexes that were removed from the config, a walk
+ * would still return their stale keys. Readers may be using the
+ * handles, so only with the server paused.
+ */
+#define ORDER_DROPPED(ai)	((ai)->ai_odbi && \
+	(( (ai)->ai_indexmask & MDB_INDEX_DELETING ) || \
+	( (ai)->ai_newmask && !( (ai)->ai_newmask & SLAP_INDEX_ORDERED ))))
+
+int
+mdb_attr_order_drop( BackendDB *be, ConfigReply *cr )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	MDB_txn *txn = NULL;
+	AttrInfo *ai;
+	int i, rc = 0;
+
+	for ( i=0; i<mdb->mi_nattrs; i++ ) {
+		ai = mdb->mi_attrs[i];
+		if ( !ORDER_DROPPED( ai ))
+			continue;
+		if ( !txn ) {
+			rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+			if ( rc )
+				break;
+		}
+		rc = mdb_drop( txn, ai->ai_odbi, 1 );
+		if ( rc )
+			break;
+	}
+	if ( txn ) {
+		if ( rc )
+			mdb_txn_abort( txn );
+		else
+			rc = mdb_txn_commit( txn );
+	}
+	if ( rc ) {
+		snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
+			"dropping ordered index failed: %s (%d).",
+			be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_attr_order_drop) ": %s\n",
+			cr->msg );
+		return rc;
+	}
+
+	/* the handles are gone now, stop using them */
+	for ( i=0; i<mdb->mi_nattrs; i++ ) {
+		ai = mdb->mi_attrs[i];
+		if ( !ORDER_DROPPED( ai ))
+			continue;
+		ai->ai_odbi = 0;
+		ai->ai_indexmask &= ~SLAP_INDEX_ORDERED;
+	}
+	return 0;
+}
+
 int
 mdb_attr_index_config(
 	struct mdb_info	*mdb,
@@ -196,7 +304,7 @@ mdb_attr_index_config(
 	struct		config_reply_s *c_reply)
 {
 	int rc = 0;
-	int	i;
+	int	i, order;
 	slap_mask_t mask;
 	char **attrs;
 	char **indexes = NULL;
@@ -374,6 +482,33 @@ fail:
 			goto fail;
 		}
 
+		if( IS_SLAP_INDEX( mask, SLAP_INDEX_NGRAM ) &&
+			!mdb_ngram_ok( ad->ad_type->sat_substr ) )
+		{
+			if (c_reply) {
+				snprintf(c_reply->msg, sizeof(c_reply->msg),
+					"ngram index of attribute \"%s\" disallowed", attrs[i] );
+				fprintf( stderr, "%s: line %d: %s\n",
+					fname, lineno, c_reply->msg );
+			}
+			rc = LDAP_INAPPROPRIATE_MATCHING;
+			goto fail;
+		}
+
+		/* without an ordering rule, values are sorted as octet strings */
+		order = ad->ad_type->sat_ordering ?
+			mdb_order_kind( ad->ad_type->sat_ordering ) : MDB_ORDER_OCTET;
+		if( IS_SLAP_INDEX( mask, SLAP_INDEX_ORDERED ) && !order ) {
+			if (c_reply) {
+				snprintf(c_reply->msg, sizeof(c_reply->msg),
+					"ordered index of attribute \"%s\" disallowed", attrs[i] );
+				fprintf( stderr, "%s: line %d: %s\n",
+					fname, lineno, c_reply->msg );
+			}
+			rc = LDAP_INAPPROPRIATE_MATCHING;
+			goto fail;
+		}
+
 		Debug( LDAP_DEBUG_CONFIG, "index %s 0x%04lx\n",
 			ad->ad_cname.bv_val, mask );
 
@@ -386,8 +521,11 @@ fail:
 		a->ai_root = NULL;
 		a->ai_desc = ad;
 		a->ai_dbi = 0;
+		a->ai_odbi = 0;
+		a->ai_order = order;
 		a->ai_multi_hi = UINT_MAX;
 		a->ai_multi_lo = UINT_MAX;
+		memset( &a->ai_stats, 0, sizeof( a->ai_stats ));
 
 		if ( mdb->mi_flags & MDB_IS_OPEN ) {
 			a->ai_indexmask = 0;
@@ -432,6 +570,7 @@ fail:
 			if ( !( b->ai_indexmask || b->ai_newmask ) && b->ai_multi_lo < UINT_MAX ) {
 				b->ai_indexmask = a->ai_indexmask;
 				b->ai_newmask = a->ai_newmask;
+				b->ai_order = a->ai_order;
 				ch_free( a );
 				rc = 0;
 				continue;
@@ -447,6 +586,7 @@ fail:
 					if ( b->ai_newmask )
 						b->ai_indexmask = b->ai_newmask;
 					b->ai_newmask = a->ai_newmask;
+					b->ai_order = a->ai_order;
 					ch_free( a );
 					rc = 0;
 					continue;
@@ -520,10 +660,21 @@ mdb_attr_multi_config(
 	struct		config_reply_s *c_reply)
 {
 	int rc = 0;
-	int	i;
+	int	i, runs = 0;
 	unsigned hi,lo;
 	char **attrs, *next, *s;
 
+	if ( argc > 2 ) {
+		if ( strcasecmp( argv[2], "runs" )) {
+			snprintf(c_reply->msg, sizeof(c_reply->msg),
+				"invalid multival storage \"%s\"", argv[2] );
+			fprintf( stderr, "%s: line %d: %s\n",
+				fname, lineno, c_reply->msg );
+			return LDAP_PARAM_ERROR;
+		}
+		runs = 1;
+	}
+
 	attrs = ldap_str2charray( argv[0], "," );
 
 	if( attrs == NULL ) {
@@ -558,6 +709,7 @@ badval:
 		if( strcasecmp( attrs[i], "default" ) == 0 ) {
 			mdb->mi_multi_hi = hi;
 			mdb->mi_multi_lo = lo;
+			mdb->mi_multi_runs = runs;
 			continue;
 		}
 
@@ -583,6 +735,7 @@ fail:
 		a->ai_desc = ad;
 		a->ai_multi_hi = hi;
 		a->ai_multi_lo = lo;
+		a->ai_multi_runs = runs;
 
 		rc = ainfo_insert( mdb, a );
 		if( rc ) {
@@ -591,6 +744,7 @@ fail:
 			if ( b->ai_multi_lo == UINT_MAX ) {
 				b->ai_multi_hi = a->ai_multi_hi;
 				b->ai_multi_lo = a->ai_multi_lo;
+				b->ai_multi_runs = a->ai_multi_runs;
 				ch_free( a );
 				rc = 0;
 				continue;
@@ -620,11 +774,11 @@ mdb_attr_multi_unparser( void *v1, void *v2 )
 	AttrInfo *ai = v1;
 	BerVarray *bva = v2;
 	struct berval bv;
-	char digbuf[sizeof("4294967296,4294967296")];
+	char digbuf[sizeof("4294967296,4294967296 runs")];
 	char *ptr;
 
-	bv.bv_len = snprintf( digbuf, sizeof(digbuf), "%u,%u",
-		ai->ai_multi_hi, ai->ai_multi_lo );
+	bv.bv_len = snprintf( digbuf, sizeof(digbuf), "%u,%u%s",
+		ai->ai_multi_hi, ai->ai_multi_lo, ai->ai_multi_runs ? " runs" : "" );
 	if ( bv.bv_len ) {
 		bv.bv_len += ai->ai_desc->ad_cname.bv_len + 1;
 		ptr = ch_malloc( bv.bv_len+1 );
@@ -645,6 +799,7 @@ mdb_attr_multi_unparse( struct mdb_info *mdb, BerVarray *bva )
 	if ( mdb->mi_multi_hi < UINT_MAX ) {
 		aidef.ai_multi_hi = mdb->mi_multi_hi;
 		aidef.ai_multi_lo = mdb->mi_multi_lo;
+		aidef.ai_multi_runs = mdb->mi_multi_runs;
 		mdb_attr_multi_unparser( &aidef, bva );
 	}
 	for ( i=0; i<mdb->mi_nattrs; i++ )
@@ -671,6 +826,16 @@ mdb_attr_multi_thresh( struct mdb_info *mdb, AttributeDescription *ad, unsigned
 	}
 }
 
+/* Whether the split out values of ad are kept in sorted runs */
+int
+mdb_attr_multi_runs( struct mdb_info *mdb, AttributeDescription *ad )
+{
+	AttrInfo *ai = mdb_attr_mask( mdb, ad );
+	if ( ai && ai->ai_multi_hi < UINT_MAX )
+		return ai->ai_multi_runs;
+	return mdb->mi_multi_runs;
+}
+
 void
 mdb_attr_info_free( AttrInfo *ai )
 {
@@ -33,7 +33,8 @@ LDAP_BEGIN_DECL
 #define MDB_DN2ID		1
 #define MDB_ID2ENTRY	2
 #define MDB_ID2VAL		3
-#define MDB_NDB			4
+#define MDB_IDXSTATS	4
+#define MDB_NDB			5
 
 /* The default search IDL stack cache depth */
 #define DEFAULT_SEARCH_STACK_DEPTH	16
@@ -51,6 +52,20 @@ LDAP_BEGIN_DECL
 /* Most users will never see this */
 #define DEFAULT_RTXN_SIZE	10000
 
+/* Default to 256 writes per group commit */
+#define MDB_TXNG_MAX	256
+
+/* Default to 4 tasks reading ahead of a search */
+#define MDB_PREFETCH_TASKS	4
+
+/* Don't bother compressing less than this many bytes of values */
+#define MDB_ZIP_MIN	128
+
+/* In the size of the attributeDescription passed to mdb_id2v_dupsort,
+ * the id2v records are blocks of values, see mvruns.c
+ */
+#define MDB_MV_RUNS	1
+
 #ifdef LDAP_DEVEL
 #define MDB_MONITOR_IDX
 #endif
@@ -63,6 +78,14 @@ typedef struct mdb_monitor_t {
 /* From ldap_rq.h */
 struct re_s;
 
+typedef struct mdb_dnfilter mdb_dnfilter;
+typedef struct mdb_ecache mdb_ecache;
+typedef struct mdb_txngroup mdb_txngroup;
+typedef struct mdb_ixbuild mdb_ixbuild;
+typedef struct mdb_flusher mdb_flusher;
+typedef struct mdb_rdwatch mdb_rdwatch;
+typedef struct mdb_prefetch mdb_prefetch;
+
 struct mdb_info {
 	MDB_env		*mi_dbenv;
 
@@ -103,6 +126,10 @@ struct mdb_info {
 #define	MDB_DEL_INDEX	0x08
 #define	MDB_RE_OPEN		0x10
 #define	MDB_NEED_UPGRADE	0x20
+#define	MDB_DNF_OPEN	0x40
+#define	MDB_EC_OPEN		0x80
+#define	MDB_BULK_LOAD	0x100	/* slapadd is collecting index keys */
+#define	MDB_IX_BUILD	0x200	/* an online index build tracks writes */
 
 	int mi_numads;
 
@@ -112,6 +139,49 @@ struct mdb_info {
 	unsigned	mi_multi_lo;
 		/* less than this many values in an attr goes
 		 * back into main blob */
+	int		mi_multi_runs;
+		/* split out values are stored in sorted runs */
+
+	int		mi_idl_runs;
+		/* don't collapse large index slots into ranges */
+
+	unsigned	mi_search_threads;
+		/* pool threads helping to scan a large candidate range */
+
+	unsigned	mi_prefetch;
+	unsigned	mi_prefetch_tasks;
+		/* candidates of a search to read ahead, see prefetch.c */
+
+	AttributeDescription	**mi_zip_ads;
+	int		mi_zip_default;
+	unsigned	mi_zip_min;
+		/* attrs whose values are stored compressed, see compress.c */
+
+	unsigned long	mi_dnf_size;
+	mdb_dnfilter	*mi_dnf;
+		/* filter of the DNs in dn2id, to skip looking up missing ones */
+
+	unsigned long	mi_ecache_size;
+	mdb_ecache	*mi_ecache;
+		/* decoded copies of the most used entries */
+
+	unsigned	mi_txng_window;
+	unsigned	mi_txng_max;
+	mdb_txngroup	*mi_txngroup;
+		/* write txns sharing one commit, see txngroup.c */
+
+	mdb_ixbuild	*mi_ixbuild;
+		/* state of the online index build, see ixbuild.c */
+
+	unsigned	mi_trickle;
+	mdb_flusher	*mi_flusher;
+		/* background writeback of dirty pages, see flush.c */
+
+	unsigned	mi_rdage;
+	int		mi_rdabort;
+	size_t		mi_rdstale;
+	mdb_rdwatch	*mi_rdwatch;
+		/* old read txns pinning the freelist, see rdwatch.c */
 
 	MDB_dbi	mi_dbis[MDB_NDB];
 	AttributeDescription *mi_ads[MDB_MAXADS];
@@ -122,6 +192,7 @@ struct mdb_info {
 #define mi_dn2id	mi_dbis[MDB_DN2ID]
 #define mi_ad2id	mi_dbis[MDB_AD2ID]
 #define mi_id2val	mi_dbis[MDB_ID2VAL]
+#define mi_idxstats	mi_dbis[MDB_IDXSTATS]
 
 typedef struct mdb_op_info {
 	OpExtra		moi_oe;
@@ -132,9 +203,35 @@ typedef struct mdb_op_info {
 #define MOI_READER	0x01
 #define MOI_FREEIT	0x02
 #define MOI_KEEPER	0x04
+#define MOI_GROUPED	0x08	/* moi_txn is nested in a txngroup's */
 
 LDAP_END_DECL
 
+/* Shape of an index database. Stored in the idxstats database, keyed
+ * by the name of the index database, and kept up to date by the index
+ * writers in their own txns. See mdb_idxstats_seed().
+ */
+typedef struct mdb_idxstats {
+	unsigned long is_keys;		/* distinct keys */
+	unsigned long is_ids;		/* IDs stored in list slots */
+	unsigned long is_ranges;	/* slots collapsed to a range */
+} mdb_idxstats;
+
+/* The counts are estimates and may already be low, don't wrap them */
+#define MDB_STAT_SUB(v, n)	( (v) = (v) > (n) ? (v) - (n) : 0 )
+
+/* Index keys collected to be written in key order, see keysort.c */
+typedef struct mdb_keysort {
+	char *ks_buf;		/* records not spilled yet */
+	size_t ks_used;
+	size_t ks_size;
+	size_t ks_mark;		/* for the caller, reset by a spill */
+	unsigned long ks_count;	/* records added */
+	FILE *ks_fp;		/* the sorted runs */
+	off_t *ks_runs;		/* run i spans ks_runs[i] to ks_runs[i+1] */
+	int ks_nruns;
+} mdb_keysort;
+
 /* for the cache of attribute information (which are indexed, etc.) */
 typedef struct mdb_attrinfo {
 	AttributeDescription *ai_desc; /* attribute description cn;lang-en */
@@ -147,10 +244,21 @@ typedef struct mdb_attrinfo {
 	MDB_cursor *ai_cursor;	/* for tools */
 	int ai_idx;	/* position in AI array */
 	MDB_dbi ai_dbi;
+	MDB_dbi ai_odbi;	/* ordered index */
+	int ai_order;	/* MDB_ORDER_* encoding of its keys */
 	unsigned ai_multi_hi;
 	unsigned ai_multi_lo;
+	int ai_multi_runs;
+	mdb_idxstats ai_stats;	/* scratch for writers that don't store them */
 } AttrInfo;
 
+/* Encodings of ordered index keys, chosen so that the default
+ * LMDB key order matches the attribute's ordering rule.
+ */
+#define MDB_ORDER_OCTET	1	/* normalized value as is */
+#define MDB_ORDER_TIME	2	/* generalizedTime without the trailing Z */
+#define MDB_ORDER_INT	3	/* sign, digit count and digits */
+
 /* tool threaded indexer state */
 typedef struct mdb_attrixinfo {
 	OpExtra ai_oe;
@@ -202,6 +310,52 @@ typedef struct IndexRec {
 
 #define MAXRDNS	SLAP_LDAPDN_MAXLEN/4
 
+/* One filter component evaluated (or passed over) by the candidate
+ * selection of a search carrying the explain control.
+ */
+typedef struct mdb_trace_comp {
+	int tc_depth;
+	struct berval tc_filter;
+	ID tc_est;		/* planner estimate, NOID if none */
+	ID tc_size;		/* candidates found, NOID if skipped */
+} mdb_trace_comp;
+
+typedef struct mdb_trace {
+	const char *mt_plan;
+	int mt_depth;
+	int mt_ncomp;
+	int mt_maxcomp;
+	mdb_trace_comp *mt_comps;
+	ID mt_est;		/* estimate for the next component */
+	ID mt_candidates;
+	ID mt_scanned;
+	struct timeval mt_start;
+	long mt_cand_usec;
+	long mt_scan_usec;
+} mdb_trace;
+
+/* op->o_controls slot of the explain control */
+extern int mdb_explain_cid;
+#define mdb_trace_get(op)	( (op)->o_ctrlflag[mdb_explain_cid] ? \
+	(mdb_trace *)(op)->o_controls[mdb_explain_cid] : NULL )
+
+/* The attributes a search may look at in its candidates, so the
+ * rest need not be decoded. See mdb_attrwant_test().
+ */
+#define MDB_AW_MAXADS	16
+
+typedef struct mdb_attrwant {
+	AttributeName *aw_attrs;	/* to be returned, NULL if none */
+	int aw_ntested;
+	AttributeDescription *aw_tested[MDB_AW_MAXADS];
+		/* used by the filter or the ACLs, with their subtypes */
+	int aw_nads;
+	unsigned char *aw_want;		/* by attr index, 0 if not known yet */
+} mdb_attrwant;
+
+/* A search returning its entries in ordered index order */
+typedef struct mdb_ordwalk mdb_ordwalk;
+
 #include "proto-mdb.h"
 
 #endif /* _BACK_MDB_H_ */
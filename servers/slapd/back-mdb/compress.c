@@ -0,0 +1,62 @@
+/* compress.c - ldap mdb back-end compression of attribute values */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-mdb.h"
+
+/* The values of the attributes named by the compress option are
+ * stored in id2entry as one compressed block per attribute, when
+ * that saves at least an eighth of their size. All the values of an
+ * attribute go in the same block, so the parts that repeat from one
+ * value to the next, like the suffix of the DNs of a member list,
+ * are stored once. The value lengths stay uncompressed, and a search
+ * that doesn't look at an attribute steps over its block without
+ * expanding it, see mdb_entry_partial().
+ *
+ * The codec itself is in zipcodec.c.
+ */
+
+/* Whether the values of a are to be compressed, given their size */
+int
+mdb_zip_want( struct mdb_info *mdb, Attribute *a, ber_len_t size )
+{
+	int i;
+
+	if ( !mdb->mi_zip_default && !mdb->mi_zip_ads )
+		return 0;
+	if ( size < mdb->mi_zip_min || ( a->a_flags & SLAP_ATTR_BIG_MULTI ))
+		return 0;
+	if ( mdb->mi_zip_default )
+		return 1;
+	for ( i=0; mdb->mi_zip_ads[i]; i++ ) {
+		if ( is_ad_subtype( a->a_desc, mdb->mi_zip_ads[i] ))
+			return 1;
+	}
+	return 0;
+}
+
+void
+mdb_zip_free( struct mdb_info *mdb )
+{
+	ch_free( mdb->mi_zip_ads );
+	mdb->mi_zip_ads = NULL;
+	mdb->mi_zip_default = 0;
+	mdb->mi_zip_min = MDB_ZIP_MIN;
+}
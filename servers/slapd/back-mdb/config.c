@@ -34,10 +34,13 @@ static ConfigDriver mdb_cf_gen;
 static ConfigDriver mdb_bk_cfg;
 
 enum {
-	MDB_CHKPT = 1,
+	MDB_CACHESIZE = 1,
+	MDB_CHKPT,
 	MDB_DIRECTORY,
 	MDB_DBNOSYNC,
+	MDB_DNFILTER,
 	MDB_ENVFLAGS,
+	MDB_GROUPCOMMIT,
 	MDB_INDEX,
 	MDB_MAXREADERS,
 	MDB_MAXSIZE,
@@ -45,6 +48,10 @@ enum {
 	MDB_SSTACK,
 	MDB_MULTIVAL,
 	MDB_IDLEXP,
+	MDB_TRICKLE,
+	MDB_RDAGE,
+	MDB_PREFETCH,
+	MDB_COMPRESS,
 };
 
 static ConfigTable mdbcfg[] = {
@@ -63,16 +70,42 @@ static ConfigTable mdbcfg[] = {
 			"DESC 'Database checkpoint interval in kbytes and minutes' "
 			"EQUALITY caseIgnoreMatch "
 			"SYNTAX OMsDirectoryString SINGLE-VALUE )",NULL, NULL },
+	{ "compress", "attrs> <[minsize]", 2, 3, 0, ARG_MAGIC|MDB_COMPRESS,
+		mdb_cf_gen, "( OLcfgDbAt:12.15 NAME 'olcDbCompress' "
+			"DESC 'Attributes whose values are stored compressed, and their minimum size' "
+			"EQUALITY caseIgnoreMatch "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "dbnosync", NULL, 1, 2, 0, ARG_ON_OFF|ARG_MAGIC|MDB_DBNOSYNC,
 		mdb_cf_gen, "( OLcfgDbAt:1.4 NAME 'olcDbNoSync' "
 			"DESC 'Disable synchronous database writes' "
 			"EQUALITY booleanMatch "
 			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
+	{ "cachesize", "entries", 2, 2, 0, ARG_ULONG|ARG_MAGIC|MDB_CACHESIZE,
+		mdb_cf_gen, "( OLcfgDbAt:12.10 NAME 'olcDbCacheSize' "
+			"DESC 'Number of decoded entries to keep in memory' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "dnfilter", "size", 2, 2, 0, ARG_ULONG|ARG_MAGIC|MDB_DNFILTER,
+		mdb_cf_gen, "( OLcfgDbAt:12.9 NAME 'olcDbDNFilter' "
+			"DESC 'Size in bytes of the filter of DNs used to skip looking up missing entries' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "envflags", "flags", 2, 0, 0, ARG_MAGIC|MDB_ENVFLAGS,
 		mdb_cf_gen, "( OLcfgDbAt:12.3 NAME 'olcDbEnvFlags' "
 			"DESC 'Database environment flags' "
 			"EQUALITY caseIgnoreMatch "
 			"SYNTAX OMsDirectoryString )", NULL, NULL },
+	{ "groupcommit", "usec> <[maxops]", 2, 3, 0, ARG_MAGIC|MDB_GROUPCOMMIT,
+		mdb_cf_gen, "( OLcfgDbAt:12.11 NAME 'olcDbGroupCommit' "
+			"DESC 'Window in microseconds and maximum number of writes sharing one commit' "
+			"EQUALITY caseIgnoreMatch "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
+	{ "idlruns", NULL, 1, 2, 0, ARG_ON_OFF|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_idl_runs),
+		"( OLcfgDbAt:12.7 NAME 'olcDbIdlRuns' "
+		"DESC 'Keep large index slots exact using run-length ID lists' "
+		"EQUALITY booleanMatch "
+		"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
 	{ "index", "attr> <[pres,eq,approx,sub]", 2, 3, 0, ARG_MAGIC|MDB_INDEX,
 		mdb_cf_gen, "( OLcfgDbAt:0.2 NAME 'olcDbIndex' "
 		"DESC 'Attribute index parameters' "
@@ -99,23 +132,44 @@ static ConfigTable mdbcfg[] = {
 		"DESC 'Unix permissions of database files' "
 		"EQUALITY caseIgnoreMatch "
 		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
-	{ "multival", "attr> <hi,lo", 3, 3, 0, ARG_MAGIC|MDB_MULTIVAL,
+	{ "multival", "attr> <hi,lo> <[runs]", 3, 4, 0, ARG_MAGIC|MDB_MULTIVAL,
 		mdb_cf_gen,
 		"( OLcfgDbAt:12.6 NAME 'olcDbMultival' "
 		"DESC 'Hi/Lo thresholds for splitting multivalued attr out of main blob' "
 		"EQUALITY caseIgnoreMatch "
 		"SYNTAX OMsDirectoryString )", NULL, NULL },
+	{ "prefetch", "entries> <[tasks]", 2, 3, 0, ARG_MAGIC|MDB_PREFETCH,
+		mdb_cf_gen, "( OLcfgDbAt:12.14 NAME 'olcDbPrefetch' "
+		"DESC 'Number of search candidates to read ahead, and tasks reading them' "
+		"EQUALITY caseIgnoreMatch "
+		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
+	{ "readerage", "seconds> <[abort]", 2, 3, 0, ARG_MAGIC|MDB_RDAGE,
+		mdb_cf_gen, "( OLcfgDbAt:12.13 NAME 'olcDbReaderAge' "
+		"DESC 'Age in seconds at which read transactions are reported, and searches aborted' "
+		"EQUALITY caseIgnoreMatch "
+		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ "rtxnsize", "entries", 2, 2, 0, ARG_UINT|ARG_OFFSET,
 		(void *)offsetof(struct mdb_info, mi_rtxn_size),
 		"( OLcfgDbAt:12.5 NAME 'olcDbRtxnSize' "
 		"DESC 'Number of entries to process in one read transaction' "
 		"EQUALITY integerMatch "
 		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "searchthreads", "num", 2, 2, 0, ARG_UINT|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_search_threads),
+		"( OLcfgDbAt:12.8 NAME 'olcDbSearchThreads' "
+		"DESC 'Number of extra threads scanning large candidate ranges of one search' "
+		"EQUALITY integerMatch "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "searchstack", "depth", 2, 2, 0, ARG_INT|ARG_MAGIC|MDB_SSTACK,
 		mdb_cf_gen, "( OLcfgDbAt:1.9 NAME 'olcDbSearchStack' "
 		"DESC 'Depth of search stack in IDLs' "
 		"EQUALITY integerMatch "
 		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "trickle", "kbyte", 2, 2, 0, ARG_UINT|ARG_MAGIC|MDB_TRICKLE,
+		mdb_cf_gen, "( OLcfgDbAt:12.12 NAME 'olcDbTrickle' "
+		"DESC 'Kbytes of dirty pages per second to write back between checkpoints' "
+		"EQUALITY integerMatch "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ NULL, NULL, 0, 0, 0, ARG_IGNORED,
 		NULL, NULL, NULL, NULL }
 };
@@ -137,7 +191,9 @@ static ConfigOCs mdbocs[] = {
 		"MAY ( olcDbCheckpoint $ olcDbEnvFlags $ "
 		"olcDbNoSync $ olcDbIndex $ olcDbMaxReaders $ olcDbMaxSize $ "
 		"olcDbMode $ olcDbSearchStack $ olcDbMaxEntrySize $ olcDbRtxnSize $ "
-		"olcDbMultival ) )",
+		"olcDbMultival $ olcDbIdlRuns $ olcDbSearchThreads $ "
+		"olcDbDNFilter $ olcDbCacheSize $ olcDbGroupCommit $ "
+		"olcDbTrickle $ olcDbReaderAge $ olcDbPrefetch $ olcDbCompress ) )",
 			Cft_Database, mdbcfg+1 },
 	{ NULL, 0, NULL }
 };
@@ -184,116 +240,13 @@ mdb_checkpoint( void *ctx, void *arg )
 	struct re_s *rtask = arg;
 	struct mdb_info *mdb = rtask->arg;
 
-	mdb_env_sync( mdb->mi_dbenv, 1 );
+	mdb_flush_sync( mdb );
 	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
 	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
 	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
 	return NULL;
 }
 
-/* reindex entries on the fly */
-static void *
-mdb_online_index( void *ctx, void *arg )
-{
-	struct re_s *rtask = arg;
-	BackendDB *be = rtask->arg;
-	struct mdb_info *mdb = be->be_private;
-
-	Connection conn = {0};
-	OperationBuffer opbuf;
-	Operation *op;
-
-	MDB_cursor *curs;
-	MDB_val key, data;
-	MDB_txn *txn;
-	ID id;
-	Entry *e;
-	int rc, getnext = 1;
-	int i;
-
-	connection_fake_init( &conn, &opbuf, ctx );
-	op = &opbuf.ob_op;
-
-	op->o_bd = be;
-
-	id = 1;
-	key.mv_size = sizeof(ID);
-
-	while ( 1 ) {
-		if ( slapd_shutdown )
-			break;
-
-		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
-		if ( rc )
-			break;
-		rc = mdb_cursor_open( txn, mdb->mi_id2entry, &curs );
-		if ( rc ) {
-			mdb_txn_abort( txn );
-			break;
-		}
-		if ( getnext ) {
-			getnext = 0;
-			key.mv_data = &id;
-			rc = mdb_cursor_get( curs, &key, &data, MDB_SET_RANGE );
-			if ( rc ) {
-				mdb_txn_abort( txn );
-				if ( rc == MDB_NOTFOUND )
-					rc = 0;
-				break;
-			}
-			memcpy( &id, key.mv_data, sizeof( id ));
-		}
-
-		rc = mdb_id2entry( op, curs, id, &e );
-		mdb_cursor_close( curs );
-		if ( rc ) {
-			mdb_txn_abort( txn );
-			if ( rc == MDB_NOTFOUND ) {
-				id++;
-				getnext = 1;
-				continue;
-			}
-			break;
-		}
-		rc = mdb_index_entry( op, txn, MDB_INDEX_UPDATE_OP, e );
-		mdb_entry_return( op, e );
-		if ( rc == 0 ) {
-			rc = mdb_txn_commit( txn );
-			txn = NULL;
-		} else {
-			mdb_txn_abort( txn );
-			txn = NULL;
-		}
-		if ( rc ) {
-			Debug( LDAP_DEBUG_ANY,
-				LDAP_XSTRING(mdb_online_index) ": database %s: "
-				"txn_commit failed: %s (%d)\n",
-				be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
-			break;
-		}
-		id++;
-		getnext = 1;
-	}
-
-	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
-		if ( mdb->mi_attrs[ i ]->ai_indexmask & MDB_INDEX_DELETING
-			|| mdb->mi_attrs[ i ]->ai_newmask == 0 )
-		{
-			continue;
-		}
-		mdb->mi_attrs[ i ]->ai_indexmask = mdb->mi_attrs[ i ]->ai_newmask;
-		mdb->mi_attrs[ i ]->ai_newmask = 0;
-	}
-
-	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
-	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
-	mdb->mi_index_task = NULL;
-	ldap_pvt_runqueue_remove( &slapd_rq, rtask );
-	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
-
-	return NULL;
-}
-
 /* Cleanup loose ends after Modify completes */
 static int
 mdb_cf_cleanup( ConfigArgs *c )
@@ -302,6 +255,8 @@ mdb_cf_cleanup( ConfigArgs *c )
 	int rc = 0;
 
 	if ( mdb->mi_flags & MDB_DEL_INDEX ) {
+		if ( mdb_attr_order_drop( c->be, &c->reply ))
+			rc = LDAP_OTHER;
 		mdb_attr_flush( mdb );
 		mdb->mi_flags ^= MDB_DEL_INDEX;
 	}
@@ -328,6 +283,18 @@ mdb_cf_cleanup( ConfigArgs *c )
 		if ( rc )
 			rc = LDAP_OTHER;
 	}
+
+	if ( mdb->mi_flags & MDB_DNF_OPEN ) {
+		mdb->mi_flags ^= MDB_DNF_OPEN;
+		if ( mdb_dnfilter_open( c->be, NULL ))
+			rc = LDAP_OTHER;
+	}
+
+	if ( mdb->mi_flags & MDB_EC_OPEN ) {
+		mdb->mi_flags ^= MDB_EC_OPEN;
+		if ( mdb_ecache_open( c->be ))
+			rc = LDAP_OTHER;
+	}
 	return rc;
 }
 
@@ -382,6 +349,108 @@ mdb_cf_gen( ConfigArgs *c )
 				c->value_int = 1;
 			break;
 
+		case MDB_DNFILTER:
+			if ( mdb->mi_dnf_size )
+				c->value_ulong = mdb->mi_dnf_size;
+			else
+				rc = 1;
+			break;
+
+		case MDB_CACHESIZE:
+			if ( mdb->mi_ecache_size )
+				c->value_ulong = mdb->mi_ecache_size;
+			else
+				rc = 1;
+			break;
+
+		case MDB_TRICKLE:
+			if ( mdb->mi_trickle )
+				c->value_uint = mdb->mi_trickle;
+			else
+				rc = 1;
+			break;
+
+		case MDB_PREFETCH:
+			if ( mdb->mi_prefetch ) {
+				char buf[64];
+				struct berval bv;
+				bv.bv_len = snprintf( buf, sizeof(buf), "%u %u",
+					mdb->mi_prefetch, mdb->mi_prefetch_tasks );
+				if ( bv.bv_len > 0 && bv.bv_len < sizeof(buf) ) {
+					bv.bv_val = buf;
+					value_add_one( &c->rvalue_vals, &bv );
+				} else {
+					rc = 1;
+				}
+			} else {
+				rc = 1;
+			}
+			break;
+
+		case MDB_COMPRESS:
+			if ( mdb->mi_zip_default || mdb->mi_zip_ads ) {
+				char buf[sizeof(" 4294967295")];
+				struct berval bv;
+				char *ptr;
+				int i;
+
+				snprintf( buf, sizeof(buf), " %u", mdb->mi_zip_min );
+				bv.bv_len = sizeof("default") + strlen( buf );
+				for ( i=0; mdb->mi_zip_ads && mdb->mi_zip_ads[i]; i++ )
+					bv.bv_len += mdb->mi_zip_ads[i]->ad_cname.bv_len + 1;
+				ptr = bv.bv_val = ch_malloc( bv.bv_len );
+				if ( mdb->mi_zip_default ) {
+					ptr = lutil_strcopy( ptr, "default" );
+				} else {
+					for ( i=0; mdb->mi_zip_ads[i]; i++ ) {
+						if ( i )
+							*ptr++ = ',';
+						ptr = lutil_strcopy( ptr,
+							mdb->mi_zip_ads[i]->ad_cname.bv_val );
+					}
+				}
+				ptr = lutil_strcopy( ptr, buf );
+				bv.bv_len = ptr - bv.bv_val;
+				ber_bvarray_add( &c->rvalue_vals, &bv );
+			} else {
+				rc = 1;
+			}
+			break;
+
+		case MDB_RDAGE:
+			if ( mdb->mi_rdage ) {
+				char buf[64];
+				struct berval bv;
+				bv.bv_len = snprintf( buf, sizeof(buf), "%u%s",
+					mdb->mi_rdage, mdb->mi_rdabort ? " abort" : "" );
+				if ( bv.bv_len > 0 && bv.bv_len < sizeof(buf) ) {
+					bv.bv_val = buf;
+					value_add_one( &c->rvalue_vals, &bv );
+				} else {
+					rc = 1;
+				}
+			} else {
+				rc = 1;
+			}
+			break;
+
+		case MDB_GROUPCOMMIT:
+			if ( mdb->mi_txng_window ) {
+				char buf[64];
+				struct berval bv;
+				bv.bv_len = snprintf( buf, sizeof(buf), "%u %u",
+					mdb->mi_txng_window, mdb->mi_txng_max );
+				if ( bv.bv_len > 0 && bv.bv_len < sizeof(buf) ) {
+					bv.bv_val = buf;
+					value_add_one( &c->rvalue_vals, &bv );
+				} else {
+					rc = 1;
+				}
+			} else {
+				rc = 1;
+			}
+			break;
+
 		case MDB_ENVFLAGS:
 			if ( mdb->mi_dbenv_flags ) {
 				mask_to_verbs( mdb_envflags, mdb->mi_dbenv_flags, &c->rvalue_vals );
@@ -453,6 +522,48 @@ mdb_cf_gen( ConfigArgs *c )
 			mdb->mi_dbenv_flags &= ~MDB_NOSYNC;
 			break;
 
+		case MDB_DNFILTER:
+			mdb->mi_dnf_size = 0;
+			if ( mdb->mi_flags & MDB_IS_OPEN ) {
+				mdb->mi_flags |= MDB_DNF_OPEN;
+				config_push_cleanup( c, mdb_cf_cleanup );
+			}
+			break;
+
+		case MDB_GROUPCOMMIT:
+			mdb->mi_txng_window = 0;
+			mdb->mi_txng_max = MDB_TXNG_MAX;
+			break;
+
+		case MDB_CACHESIZE:
+			mdb->mi_ecache_size = 0;
+			if ( mdb->mi_flags & MDB_IS_OPEN ) {
+				mdb->mi_flags |= MDB_EC_OPEN;
+				config_push_cleanup( c, mdb_cf_cleanup );
+			}
+			break;
+
+		case MDB_TRICKLE:
+			mdb->mi_trickle = 0;
+			mdb_flush_close( mdb );
+			break;
+
+		case MDB_PREFETCH:
+			mdb->mi_prefetch = 0;
+			mdb->mi_prefetch_tasks = MDB_PREFETCH_TASKS;
+			break;
+
+		case MDB_COMPRESS:
+			/* entries already stored stay readable */
+			mdb_zip_free( mdb );
+			break;
+
+		case MDB_RDAGE:
+			mdb->mi_rdage = 0;
+			mdb->mi_rdabort = 0;
+			mdb_rdwatch_close( mdb );
+			break;
+
 		case MDB_ENVFLAGS:
 			if ( c->valx == -1 ) {
 				int i;
@@ -498,6 +609,7 @@ mdb_cf_gen( ConfigArgs *c )
 				}
 				mdb->mi_defaultmask = 0;
 				mdb->mi_flags |= MDB_DEL_INDEX;
+				mdb_ixbuild_restart( mdb );
 				config_push_cleanup( c, mdb_cf_cleanup );
 
 			} else {
@@ -535,6 +647,7 @@ mdb_cf_gen( ConfigArgs *c )
 
 						ai->ai_indexmask |= MDB_INDEX_DELETING;
 						mdb->mi_flags |= MDB_DEL_INDEX;
+						mdb_ixbuild_restart( mdb );
 						config_push_cleanup( c, mdb_cf_cleanup );
 					}
 
@@ -551,9 +664,11 @@ mdb_cf_gen( ConfigArgs *c )
 				for ( i = 0; i < mdb->mi_nattrs; i++ ) {
 					mdb->mi_attrs[i]->ai_multi_hi = UINT_MAX;
 					mdb->mi_attrs[i]->ai_multi_lo = UINT_MAX;
+					mdb->mi_attrs[i]->ai_multi_runs = 0;
 				}
 				mdb->mi_multi_hi = UINT_MAX;
 				mdb->mi_multi_lo = UINT_MAX;
+				mdb->mi_multi_runs = 0;
 
 			} else {
 				struct berval bv, def = BER_BVC("default");
@@ -566,6 +681,7 @@ mdb_cf_gen( ConfigArgs *c )
 				if ( bvmatch( &bv, &def )) {
 					mdb->mi_multi_hi = UINT_MAX;
 					mdb->mi_multi_lo = UINT_MAX;
+					mdb->mi_multi_runs = 0;
 
 				} else {
 					int i;
@@ -591,6 +707,7 @@ mdb_cf_gen( ConfigArgs *c )
 
 						ai->ai_multi_hi = UINT_MAX;
 						ai->ai_multi_lo = UINT_MAX;
+						ai->ai_multi_runs = 0;
 					}
 
 					bv.bv_val[ bv.bv_len ] = sep;
@@ -683,6 +800,25 @@ mdb_cf_gen( ConfigArgs *c )
 		}
 		} break;
 
+	case MDB_GROUPCOMMIT: {
+		unsigned window, max = MDB_TXNG_MAX;
+		if ( lutil_atoux( &window, c->argv[1], 0 ) != 0 ) {
+			fprintf( stderr, "%s: "
+				"invalid window \"%s\" in \"groupcommit\".\n",
+				c->log, c->argv[1] );
+			return 1;
+		}
+		if ( c->argc > 2 && ( lutil_atoux( &max, c->argv[2], 0 ) != 0 || !max )) {
+			fprintf( stderr, "%s: "
+				"invalid maxops \"%s\" in \"groupcommit\".\n",
+				c->log, c->argv[2] );
+			return 1;
+		}
+		/* the server is paused, no group is open */
+		mdb->mi_txng_window = window;
+		mdb->mi_txng_max = max;
+		} break;
+
 	case MDB_DIRECTORY: {
 		FILE *f;
 		char *ptr, *testpath;
@@ -760,6 +896,8 @@ mdb_cf_gen( ConfigArgs *c )
 		if ( mdb->mi_flags & MDB_IS_OPEN ) {
 			mdb->mi_flags |= MDB_OPEN_INDEX;
 			config_push_cleanup( c, mdb_cf_cleanup );
+			/* a build already running starts over */
+			mdb_ixbuild_restart( mdb );
 			if ( !mdb->mi_index_task ) {
 				/* Start the task as soon as we finish here. Set a long
 				 * interval (10 hours) so that it only gets scheduled once.
@@ -772,8 +910,8 @@ mdb_cf_gen( ConfigArgs *c )
 				}
 				ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
 				mdb->mi_index_task = ldap_pvt_runqueue_insert( &slapd_rq, 36000,
-					mdb_online_index, c->be,
-					LDAP_XSTRING(mdb_online_index), c->be->be_suffix[0].bv_val );
+					mdb_ixbuild_run, c->be,
+					LDAP_XSTRING(mdb_ixbuild_run), c->be->be_suffix[0].bv_val );
 				ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
 			}
 		}
@@ -805,6 +943,119 @@ mdb_cf_gen( ConfigArgs *c )
 		}
 		break;
 
+	case MDB_DNFILTER:
+		mdb->mi_dnf_size = c->value_ulong;
+		if ( mdb->mi_flags & MDB_IS_OPEN ) {
+			mdb->mi_flags |= MDB_DNF_OPEN;
+			config_push_cleanup( c, mdb_cf_cleanup );
+		}
+		break;
+
+	case MDB_CACHESIZE:
+		mdb->mi_ecache_size = c->value_ulong;
+		if ( mdb->mi_flags & MDB_IS_OPEN ) {
+			mdb->mi_flags |= MDB_EC_OPEN;
+			config_push_cleanup( c, mdb_cf_cleanup );
+		}
+		break;
+
+	case MDB_TRICKLE:
+		mdb->mi_trickle = c->value_uint;
+		if ( !mdb->mi_trickle )
+			mdb_flush_close( mdb );
+		else if ( mdb->mi_flags & MDB_IS_OPEN )
+			mdb_flush_open( c->be );
+		break;
+
+	case MDB_PREFETCH: {
+		unsigned entries, tasks = MDB_PREFETCH_TASKS;
+		if ( lutil_atoux( &entries, c->argv[1], 0 ) != 0 ) {
+			fprintf( stderr, "%s: "
+				"invalid entries \"%s\" in \"prefetch\".\n",
+				c->log, c->argv[1] );
+			return 1;
+		}
+		if ( c->argc > 2 && ( lutil_atoux( &tasks, c->argv[2], 0 ) != 0 || !tasks )) {
+			fprintf( stderr, "%s: "
+				"invalid tasks \"%s\" in \"prefetch\".\n",
+				c->log, c->argv[2] );
+			return 1;
+		}
+		/* searches pick them up when they start */
+		mdb->mi_prefetch = entries;
+		mdb->mi_prefetch_tasks = tasks;
+		} break;
+
+	case MDB_COMPRESS: {
+		AttributeDescription **ads = NULL;
+		unsigned min = MDB_ZIP_MIN;
+		int def = 0;
+
+		if ( c->argc > 2 && lutil_atoux( &min, c->argv[2], 0 ) != 0 ) {
+			fprintf( stderr, "%s: "
+				"invalid minsize \"%s\" in \"compress\".\n",
+				c->log, c->argv[2] );
+			return 1;
+		}
+		if ( strcasecmp( c->argv[1], "default" ) == 0 ) {
+			def = 1;
+		} else {
+			char **attrs = ldap_str2charray( c->argv[1], "," );
+			const char *text;
+			int i;
+
+			if ( !attrs ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"no attributes in \"compress\"" );
+				Debug( LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg );
+				return 1;
+			}
+			for ( i=0; attrs[i]; i++ )
+				;
+			ads = ch_calloc( i+1, sizeof( AttributeDescription * ));
+			for ( i=0; attrs[i]; i++ ) {
+				if ( slap_str2ad( attrs[i], &ads[i], &text ) != LDAP_SUCCESS ) {
+					snprintf( c->cr_msg, sizeof( c->cr_msg ),
+						"compress attribute \"%s\" undefined", attrs[i] );
+					Debug( LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg );
+					ldap_charray_free( attrs );
+					ch_free( ads );
+					return 1;
+				}
+			}
+			ldap_charray_free( attrs );
+		}
+		/* writes pick it up from here on, entries already stored
+		 * keep the form they were written in
+		 */
+		mdb_zip_free( mdb );
+		mdb->mi_zip_ads = ads;
+		mdb->mi_zip_default = def;
+		mdb->mi_zip_min = min;
+		} break;
+
+	case MDB_RDAGE: {
+		unsigned age;
+		if ( lutil_atoux( &age, c->argv[1], 0 ) != 0 ) {
+			fprintf( stderr, "%s: "
+				"invalid seconds \"%s\" in \"readerage\".\n",
+				c->log, c->argv[1] );
+			return 1;
+		}
+		if ( c->argc > 2 && strcasecmp( c->argv[2], "abort" )) {
+			fprintf( stderr, "%s: "
+				"unknown keyword \"%s\" in \"readerage\".\n",
+				c->log, c->argv[2] );
+			return 1;
+		}
+		/* restart the watchdog, its interval depends on the age */
+		mdb_rdwatch_close( mdb );
+		mdb->mi_rdage = age;
+		mdb->mi_rdabort = c->argc > 2;
+		if ( mdb->mi_flags & MDB_IS_OPEN )
+			mdb_rdwatch_open( c->be );
+		} break;
+
 	case MDB_MULTIVAL:
 		rc = mdb_attr_multi_config( mdb, c->fname, c->lineno,
 			c->argc - 1, &c->argv[1], &c->reply);
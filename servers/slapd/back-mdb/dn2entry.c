@@ -48,6 +48,15 @@ mdb_dn2entry(
 
 	*e = NULL;
 
+	/* nothing to look up if it's not there and its closest
+	 * ancestor isn't wanted either
+	 */
+	if ( !matched && mdb->mi_dnf && dn->bv_len &&
+		!mdb_dnfilter_has( mdb->mi_dnf, dn )) {
+		mdb_dnfilter_miss( mdb->mi_dnf, 1 );
+		return MDB_NOTFOUND;
+	}
+
 	rc = mdb_dn2id( op, tid, m2, dn, &id, nsubs, &mbv, &nmbv );
 	if ( rc ) {
 		if ( matched ) {
@@ -194,6 +194,14 @@ mdb_dn2id_add(
 		} while ( nid );
 	}
 
+	/* before anyone can see it. A renamed subtree gets new DNs too */
+	if ( rc == 0 && mdb->mi_dnf ) {
+		mdb_dnfilter_add( mdb->mi_dnf, &e->e_nname );
+		if ( nsubs > 1 )
+			rc = mdb_dn2id_filter( mdb_cursor_txn( mcp ), mdb,
+				mdb->mi_dnf, e->e_id, &e->e_nname );
+	}
+
 	Debug( LDAP_DEBUG_TRACE, "<= mdb_dn2id_add 0x%lx: %d\n", e->e_id, rc );
 
 	return rc;
@@ -306,6 +314,7 @@ mdb_dn2id(
 	char dn[SLAP_LDAPDN_MAXLEN];
 	ID pid, nid;
 	struct berval tmp;
+	int absent = 0;
 
 	Debug( LDAP_DEBUG_TRACE, "=> mdb_dn2id(\"%s\")\n", in->bv_val ? in->bv_val : "" );
 
@@ -325,6 +334,17 @@ mdb_dn2id(
 		goto done;
 	}
 
+	/* Only walk down as far as the filter says the DN may exist */
+	if ( mdb->mi_dnf && !mdb_dnfilter_has( mdb->mi_dnf, in )) {
+		absent = 1;
+		if ( !matched && !nmatched ) {
+			*id = 0;
+			nid = 0;
+			rc = MDB_NOTFOUND;
+			goto done;
+		}
+	}
+
 	tmp = *in;
 
 	if ( op->o_bd->be_nsuffix[0].bv_len ) {
@@ -353,6 +373,16 @@ mdb_dn2id(
 		key.mv_data = &pid;
 		pid = nid;
 
+		if ( absent ) {
+			struct berval sub;
+			sub.bv_val = tmp.bv_val;
+			sub.bv_len = in->bv_len - ( tmp.bv_val - in->bv_val );
+			if ( !mdb_dnfilter_has( mdb->mi_dnf, &sub )) {
+				rc = MDB_NOTFOUND;
+				break;
+			}
+		}
+
 		data.mv_size = sizeof(diskNode) + tmp.bv_len;
 		d = op->o_tmpalloc( data.mv_size, op->o_tmpmemctx );
 		d->nrdnlen[1] = tmp.bv_len & 0xff;
@@ -426,6 +456,9 @@ done:
 		}
 	}
 
+	if ( rc == MDB_NOTFOUND && mdb->mi_dnf )
+		mdb_dnfilter_miss( mdb->mi_dnf, absent );
+
 	if( rc != 0 ) {
 		Debug( LDAP_DEBUG_TRACE, "<= mdb_dn2id: get failed: %s (%d)\n",
 			mdb_strerror( rc ), rc );
@@ -657,8 +690,8 @@ mdb_idscope(
 
 	ida = mdb_idl_first( ids, &cid );
 
-	/* Don't bother moving out of ids if it's a range */
-	if (!MDB_IDL_IS_RANGE(ids)) {
+	/* Don't bother moving out of ids if it's a range or runs */
+	if (!MDB_IDL_IS_RANGE(ids) && !MDB_IDL_IS_RUNS(ids)) {
 		idc = ids[0];
 		ci0 = cid;
 	}
@@ -701,7 +734,7 @@ mdb_idscope(
 		}
 		ida = mdb_idl_next( ids, &cid );
 	}
-	if (!MDB_IDL_IS_RANGE( ids ))
+	if (!MDB_IDL_IS_RANGE( ids ) && !MDB_IDL_IS_RUNS( ids ))
 		ids[0] = idc;
 
 leave:
@@ -979,3 +1012,84 @@ void mdb_dn2id_wrestore (
 		isc->rdns[n].bv_val = d->nrdn+isc->nrdns[n].bv_len+1;
 	}
 }
+
+/* Add the DNs below a node to the filter. dn..end holds the node's
+ * own DN, the children's RDNs are prepended in front of it.
+ */
+static int
+mdb_dn2id_fill(
+	MDB_txn *txn,
+	struct mdb_info *mdb,
+	mdb_dnfilter *df,
+	ID id,
+	char *buf,
+	char *dn,
+	char *end )
+{
+	MDB_cursor *mc;
+	MDB_val key, data;
+	diskNode *d;
+	struct berval bv;
+	char *ptr;
+	ID nid, nsubs;
+	int rc, nrlen;
+
+	rc = mdb_cursor_open( txn, mdb->mi_dn2id, &mc );
+	if ( rc )
+		return rc;
+
+	key.mv_size = sizeof(ID);
+	key.mv_data = &id;
+	rc = mdb_cursor_get( mc, &key, &data, MDB_SET );
+	while ( rc == 0 ) {
+		d = data.mv_data;
+		/* the first item is the node itself */
+		if ( d->nrdnlen[0] & 0x80 ) {
+			nrlen = ((d->nrdnlen[0] & 0x7f) << 8) | d->nrdnlen[1];
+			ptr = dn;
+			if ( ptr - buf > nrlen ) {
+				if ( ptr < end )
+					*--ptr = ',';
+				ptr -= nrlen;
+				memcpy( ptr, d->nrdn, nrlen );
+				bv.bv_val = ptr;
+				bv.bv_len = end - ptr;
+				mdb_dnfilter_add( df, &bv );
+
+				memcpy( &nsubs, (char *)data.mv_data + data.mv_size - sizeof(ID),
+					sizeof(ID));
+				if ( nsubs > 1 ) {
+					memcpy( &nid, (char *)data.mv_data + data.mv_size - 2*sizeof(ID),
+						sizeof(ID));
+					rc = mdb_dn2id_fill( txn, mdb, df, nid, buf, ptr, end );
+					if ( rc )
+						break;
+				}
+			}
+		}
+		rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_DUP );
+	}
+	mdb_cursor_close( mc );
+	return rc == MDB_NOTFOUND ? 0 : rc;
+}
+
+/* Add the DNs of the subtree below id, whose DN is ndn, to the
+ * filter. With id 0 and an empty ndn that's the whole database.
+ */
+int
+mdb_dn2id_filter(
+	MDB_txn *txn,
+	struct mdb_info *mdb,
+	mdb_dnfilter *df,
+	ID id,
+	struct berval *ndn )
+{
+	char buf[SLAP_LDAPDN_MAXLEN];
+	char *end = buf + sizeof(buf);
+
+	if ( ndn->bv_len >= sizeof(buf) )
+		return 0;
+	if ( ndn->bv_len )
+		memcpy( end - ndn->bv_len, ndn->bv_val, ndn->bv_len );
+	return mdb_dn2id_fill( txn, mdb, df, id, buf, end - ndn->bv_len, end );
+}
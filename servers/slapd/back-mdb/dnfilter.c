@@ -0,0 +1,247 @@
+/* dnfilter.c - ldap mdb back-end negative DN lookup filter */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-mdb.h"
+#include "lutil_hash.h"
+
+/* A Bloom filter of the normalized DNs in the database. A DN the
+ * filter doesn't know can't be in dn2id, so looking it up there is
+ * skipped. Writers add DNs before their txn commits, so no reader
+ * can see an entry whose DN isn't in the filter yet. Bits are never
+ * cleared: deleted and renamed DNs only raise the false positive
+ * rate, until the filter is rebuilt by reopening the database or
+ * resizing it.
+ */
+struct mdb_dnfilter {
+	unsigned char *df_bits;
+	unsigned long df_nbits;
+	int df_hashes;
+	/* kept by the writer */
+	unsigned long df_set;	/* bits set */
+	unsigned long df_dns;	/* DNs added */
+	/* kept by the readers */
+	ldap_pvt_thread_mutex_t df_mutex;
+	unsigned long df_negative;	/* misses the filter caught */
+	unsigned long df_falsepos;	/* misses it let through */
+};
+
+/* Bits per DN to plan for when the database is still small */
+#define MDB_DNF_BITS	10
+#define MDB_DNF_MAXHASH	16
+
+static void
+dnf_hash( struct berval *ndn, unsigned long *h1, unsigned long *h2 )
+{
+	lutil_HASH_CTX ctx;
+#ifdef LUTIL_HASH64_BYTES
+	unsigned long long h;
+
+	lutil_HASH64Init( &ctx );
+	lutil_HASH64Update( &ctx, (unsigned char *)ndn->bv_val, ndn->bv_len );
+	h = ctx.hash64;
+	/* FNV leaves the high bits poorly mixed */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	*h1 = h & 0xffffffffUL;
+	*h2 = ( h >> 32 ) | 1;
+#else
+	static const unsigned char salt = 0x5c;
+
+	lutil_HASHInit( &ctx );
+	lutil_HASHUpdate( &ctx, (unsigned char *)ndn->bv_val, ndn->bv_len );
+	*h1 = ctx.hash;
+	lutil_HASHUpdate( &ctx, &salt, 1 );
+	*h2 = ctx.hash | 1;
+#endif
+}
+
+mdb_dnfilter *
+mdb_dnfilter_new( unsigned long size, unsigned long entries )
+{
+	mdb_dnfilter *df;
+	unsigned long nbits = size * 8;
+
+	if ( entries < nbits / MDB_DNF_BITS )
+		entries = nbits / MDB_DNF_BITS;
+	if ( !entries )
+		return NULL;
+
+	df = ch_calloc( 1, sizeof( mdb_dnfilter ) + size );
+	df->df_bits = (unsigned char *)(df + 1);
+	df->df_nbits = nbits;
+	/* ln 2 * bits per DN */
+	df->df_hashes = 0.693 * nbits / entries + 0.5;
+	if ( df->df_hashes < 1 )
+		df->df_hashes = 1;
+	else if ( df->df_hashes > MDB_DNF_MAXHASH )
+		df->df_hashes = MDB_DNF_MAXHASH;
+	ldap_pvt_thread_mutex_init( &df->df_mutex );
+	return df;
+}
+
+void
+mdb_dnfilter_free( mdb_dnfilter *df )
+{
+	ldap_pvt_thread_mutex_destroy( &df->df_mutex );
+	ch_free( df );
+}
+
+/* Only called by the writer */
+void
+mdb_dnfilter_add( mdb_dnfilter *df, struct berval *ndn )
+{
+	unsigned long h1, h2, bit;
+	int i;
+
+	dnf_hash( ndn, &h1, &h2 );
+	for ( i = 0; i < df->df_hashes; i++, h1 += h2 ) {
+		bit = h1 % df->df_nbits;
+		if ( !( df->df_bits[bit >> 3] & ( 1 << ( bit & 7 )))) {
+			df->df_bits[bit >> 3] |= 1 << ( bit & 7 );
+			df->df_set++;
+		}
+	}
+	df->df_dns++;
+}
+
+/* Zero if ndn is certainly not in the database */
+int
+mdb_dnfilter_has( mdb_dnfilter *df, struct berval *ndn )
+{
+	unsigned long h1, h2, bit;
+	int i;
+
+	dnf_hash( ndn, &h1, &h2 );
+	for ( i = 0; i < df->df_hashes; i++, h1 += h2 ) {
+		bit = h1 % df->df_nbits;
+		if ( !( df->df_bits[bit >> 3] & ( 1 << ( bit & 7 ))))
+			return 0;
+	}
+	return 1;
+}
+
+/* Count a DN that wasn't found, and whether the filter knew */
+void
+mdb_dnfilter_miss( mdb_dnfilter *df, int caught )
+{
+	ldap_pvt_thread_mutex_lock( &df->df_mutex );
+	if ( caught )
+		df->df_negative++;
+	else
+		df->df_falsepos++;
+	ldap_pvt_thread_mutex_unlock( &df->df_mutex );
+}
+
+/* (Re)build the filter of a database, or drop it if it's been
+ * turned off. The server must be paused or not running yet.
+ */
+int
+mdb_dnfilter_open( BackendDB *be, MDB_txn *txn )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	mdb_dnfilter *df = NULL;
+	MDB_txn *rtxn = NULL;
+	MDB_stat ms;
+	struct berval bv = BER_BVNULL;
+	int rc = 0;
+
+	if ( mdb->mi_dnf ) {
+		mdb_dnfilter_free( mdb->mi_dnf );
+		mdb->mi_dnf = NULL;
+	}
+	/* the tools don't keep it up to date */
+	if ( !mdb->mi_dnf_size || ( slapMode & SLAP_TOOL_MODE ))
+		return 0;
+
+	if ( !txn ) {
+		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, MDB_RDONLY, &rtxn );
+		if ( rc )
+			return rc;
+		txn = rtxn;
+	}
+	rc = mdb_stat( txn, mdb->mi_id2entry, &ms );
+	if ( rc == 0 ) {
+		df = mdb_dnfilter_new( mdb->mi_dnf_size, ms.ms_entries );
+		if ( df )
+			rc = mdb_dn2id_filter( txn, mdb, df, 0, &bv );
+	}
+	if ( rtxn )
+		mdb_txn_abort( rtxn );
+
+	if ( rc == 0 && df ) {
+		Debug( LDAP_DEBUG_TRACE, LDAP_XSTRING(mdb_dnfilter_open)
+			": \"%s\" %lu DNs in %lu bytes, %d hashes\n",
+			be->be_suffix[0].bv_val, df->df_dns,
+			mdb->mi_dnf_size, df->df_hashes );
+		mdb->mi_dnf = df;
+	} else if ( df ) {
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_dnfilter_open)
+			": \"%s\" failed to read dn2id: %s (%d)\n",
+			be->be_suffix[0].bv_val, mdb_strerror( rc ), rc );
+		mdb_dnfilter_free( df );
+	}
+	return rc;
+}
+
+void
+mdb_dnfilter_close( struct mdb_info *mdb )
+{
+	if ( mdb->mi_dnf ) {
+		mdb_dnfilter_free( mdb->mi_dnf );
+		mdb->mi_dnf = NULL;
+	}
+}
+
+/* Describe the filter in bv, which holds the buffer to use:
+ * bytes=<n>#hashes=<n>#dns=<n>#fill=<%>#estFP=<%>#negative=<n>#falsePositive=<n>
+ * Fill and the estimated rate come from the bits set, the observed
+ * rate is falsePositive / (negative + falsePositive).
+ */
+int
+mdb_dnfilter_stats( mdb_dnfilter *df, struct berval *bv )
+{
+	unsigned long neg, fp, fill, est;
+	double f, p;
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &df->df_mutex );
+	neg = df->df_negative;
+	fp = df->df_falsepos;
+	ldap_pvt_thread_mutex_unlock( &df->df_mutex );
+
+	f = (double)df->df_set / df->df_nbits;
+	for ( i = 0, p = 1; i < df->df_hashes; i++ )
+		p *= f;
+	/* in hundredths of a percent */
+	fill = f * 10000 + 0.5;
+	est = p * 10000 + 0.5;
+
+	i = snprintf( bv->bv_val, bv->bv_len,
+		"bytes=%lu#hashes=%d#dns=%lu#fill=%lu.%02lu#estFP=%lu.%02lu"
+		"#negative=%lu#falsePositive=%lu",
+		df->df_nbits / 8, df->df_hashes, df->df_dns,
+		fill / 100, fill % 100, est / 100, est % 100, neg, fp );
+	if ( i < 0 || i >= bv->bv_len )
+		return -1;
+	bv->bv_len = i;
+	return 0;
+}
@@ -0,0 +1,451 @@
+/* ecache.c - ldap mdb back-end cache of decoded entries */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-mdb.h"
+
+/* A cache of decoded entries, for the few that are read over and over.
+ * A cached entry owns copies of its values, since the ones a decode
+ * returns point into the map and only live as long as the read txn.
+ * Readers get their own Entry and Attributes, sharing the cached
+ * values, and hold a reference on the cache node until the entry is
+ * returned.
+ *
+ * Writers drop the entries they change, and stamp the stripe with
+ * their txn ID. An entry cached from a snapshot older than that stamp
+ * may be out of date, so it isn't cached, and a cached entry is only
+ * used by readers whose snapshot is at least as new as the stamp it
+ * was cached under. Writers never use the cache.
+ *
+ * Entries must be missed twice before they're cached, so a scan that
+ * reads everything once doesn't push out the hot ones.
+ */
+
+#define MDB_EC_STRIPES	32	/* power of 2 */
+#define MDB_EC_SEEN	8192	/* bits remembering first misses, per stripe */
+
+typedef struct mdb_ecnode {
+	struct mdb_ecnode *en_next;		/* hash chain */
+	struct mdb_ecnode *en_lprev, *en_lnext;	/* LRU list, head is newest */
+	struct mdb_ecstripe *en_stripe;
+	ID en_id;
+	size_t en_valid;	/* first txn it's known to be current in */
+	int en_refs;
+	int en_dead;	/* dropped from the cache while in use */
+	int en_nattrs;
+	slap_mask_t en_ocflags;
+	Attribute *en_attrs;
+	size_t en_size;
+} mdb_ecnode;
+
+typedef struct mdb_ecstripe {
+	ldap_pvt_thread_mutex_t es_mutex;
+	mdb_ecnode **es_hash;
+	mdb_ecnode *es_head, *es_tail;
+	unsigned long es_count;
+	unsigned long es_bytes;
+	size_t es_lastmod;	/* last writer that dropped anything here */
+	unsigned es_nseen;
+	unsigned long es_hits;
+	unsigned long es_misses;
+	unsigned long es_evicted;
+	unsigned char es_seen[MDB_EC_SEEN / 8];
+} mdb_ecstripe;
+
+struct mdb_ecache {
+	unsigned long ec_max;	/* entries per stripe */
+	unsigned ec_nhash;	/* buckets per stripe, power of 2 */
+	mdb_ecstripe ec_stripes[MDB_EC_STRIPES];
+};
+
+#define EC_STRIPE(ec, id)	(&(ec)->ec_stripes[(id) & (MDB_EC_STRIPES-1)])
+#define EC_BUCKET(ec, id)	(((id) / MDB_EC_STRIPES) & ((ec)->ec_nhash-1))
+#define EC_SEENBIT(id)	((((id) / MDB_EC_STRIPES) * 2654435761U) % MDB_EC_SEEN)
+
+mdb_ecache *
+mdb_ecache_new( unsigned long size )
+{
+	mdb_ecache *ec;
+	mdb_ecnode **hash;
+	unsigned long max;
+	unsigned nhash;
+	int i;
+
+	if ( !size )
+		return NULL;
+
+	max = ( size + MDB_EC_STRIPES - 1 ) / MDB_EC_STRIPES;
+	for ( nhash = 16; nhash < max && nhash < 0x10000000U; nhash <<= 1 )
+		;
+
+	ec = ch_calloc( 1, sizeof( mdb_ecache ));
+	hash = ch_calloc( (size_t)nhash * MDB_EC_STRIPES, sizeof( mdb_ecnode * ));
+	ec->ec_max = max;
+	ec->ec_nhash = nhash;
+	for ( i = 0; i < MDB_EC_STRIPES; i++ ) {
+		ldap_pvt_thread_mutex_init( &ec->ec_stripes[i].es_mutex );
+		ec->ec_stripes[i].es_hash = hash + (size_t)i * nhash;
+	}
+	return ec;
+}
+
+/* No entries may still be in use */
+void
+mdb_ecache_free( mdb_ecache *ec )
+{
+	mdb_ecnode *en, *next;
+	int i;
+
+	for ( i = 0; i < MDB_EC_STRIPES; i++ ) {
+		mdb_ecstripe *es = &ec->ec_stripes[i];
+		for ( en = es->es_head; en; en = next ) {
+			next = en->en_lnext;
+			assert( en->en_refs == 0 );
+			ch_free( en );
+		}
+		ldap_pvt_thread_mutex_destroy( &es->es_mutex );
+	}
+	ch_free( ec->ec_stripes[0].es_hash );
+	ch_free( ec );
+}
+
+static void
+ec_unlink( mdb_ecache *ec, mdb_ecstripe *es, mdb_ecnode *en )
+{
+	mdb_ecnode **prev;
+
+	for ( prev = &es->es_hash[EC_BUCKET( ec, en->en_id )]; *prev != en;
+		prev = &(*prev)->en_next )
+		;
+	*prev = en->en_next;
+
+	if ( en->en_lprev )
+		en->en_lprev->en_lnext = en->en_lnext;
+	else
+		es->es_head = en->en_lnext;
+	if ( en->en_lnext )
+		en->en_lnext->en_lprev = en->en_lprev;
+	else
+		es->es_tail = en->en_lprev;
+
+	es->es_count--;
+	es->es_bytes -= en->en_size;
+}
+
+static void
+ec_lru_head( mdb_ecstripe *es, mdb_ecnode *en )
+{
+	if ( es->es_head == en )
+		return;
+	/* not the head, so it has a predecessor */
+	en->en_lprev->en_lnext = en->en_lnext;
+	if ( en->en_lnext )
+		en->en_lnext->en_lprev = en->en_lprev;
+	else
+		es->es_tail = en->en_lprev;
+	en->en_lprev = NULL;
+	en->en_lnext = es->es_head;
+	es->es_head->en_lprev = en;
+	es->es_head = en;
+}
+
+static mdb_ecnode *
+ec_find( mdb_ecache *ec, mdb_ecstripe *es, ID id )
+{
+	mdb_ecnode *en;
+
+	for ( en = es->es_hash[EC_BUCKET( ec, id )]; en; en = en->en_next )
+		if ( en->en_id == id )
+			break;
+	return en;
+}
+
+/* Get a cached entry current in txn's snapshot. Returns 0 and an
+ * entry to be given back by mdb_entry_return, or MDB_NOTFOUND.
+ */
+int
+mdb_ecache_get( Operation *op, mdb_ecache *ec, MDB_txn *txn, ID id, Entry **e )
+{
+	mdb_ecstripe *es = EC_STRIPE( ec, id );
+	mdb_ecnode *en;
+	Entry *x;
+	Attribute *a;
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &es->es_mutex );
+	en = ec_find( ec, es, id );
+	if ( !en || en->en_valid > mdb_txn_id( txn )) {
+		es->es_misses++;
+		ldap_pvt_thread_mutex_unlock( &es->es_mutex );
+		return MDB_NOTFOUND;
+	}
+	en->en_refs++;
+	es->es_hits++;
+	ec_lru_head( es, en );
+	ldap_pvt_thread_mutex_unlock( &es->es_mutex );
+
+	x = op->o_tmpalloc( sizeof(Entry) + en->en_nattrs * sizeof(Attribute),
+		op->o_tmpmemctx );
+	x->e_id = id;
+	BER_BVZERO( &x->e_name );
+	BER_BVZERO( &x->e_nname );
+	BER_BVZERO( &x->e_bv );
+	x->e_ocflags = en->en_ocflags;
+	x->e_private = en;
+	if ( en->en_nattrs ) {
+		a = (Attribute *)(x+1);
+		AC_MEMCPY( a, en->en_attrs, en->en_nattrs * sizeof(Attribute));
+		for ( i = 1; i < en->en_nattrs; i++ )
+			a[i-1].a_next = &a[i];
+		a[i-1].a_next = NULL;
+		x->e_attrs = a;
+	} else {
+		x->e_attrs = NULL;
+	}
+	*e = x;
+	return 0;
+}
+
+/* Give back an entry from mdb_ecache_get */
+void
+mdb_ecache_return( Entry *e )
+{
+	mdb_ecnode *en = e->e_private;
+	mdb_ecstripe *es = en->en_stripe;
+	int dead;
+
+	ldap_pvt_thread_mutex_lock( &es->es_mutex );
+	dead = !--en->en_refs && en->en_dead;
+	ldap_pvt_thread_mutex_unlock( &es->es_mutex );
+	if ( dead )
+		ch_free( en );
+}
+
+/* Whether an entry just decoded in txn may be cached */
+static int
+ec_admit( mdb_ecache *ec, mdb_ecstripe *es, ID id, size_t txnid, int doorkeep )
+{
+	unsigned bit;
+
+	if ( txnid < es->es_lastmod || ec_find( ec, es, id ))
+		return 0;
+	if ( !doorkeep )
+		return 1;
+	bit = EC_SEENBIT( id );
+	if ( es->es_seen[bit >> 3] & ( 1 << ( bit & 7 )))
+		return 1;
+	/* first miss, only remember it */
+	if ( ++es->es_nseen > MDB_EC_SEEN / 2 ) {
+		memset( es->es_seen, 0, sizeof( es->es_seen ));
+		es->es_nseen = 1;
+	}
+	es->es_seen[bit >> 3] |= 1 << ( bit & 7 );
+	return 0;
+}
+
+/* Offer a fully decoded entry, read in txn, to the cache */
+void
+mdb_ecache_put( mdb_ecache *ec, MDB_txn *txn, Entry *e )
+{
+	mdb_ecstripe *es = EC_STRIPE( ec, e->e_id );
+	mdb_ecnode *en, *old;
+	size_t txnid = mdb_txn_id( txn );
+	Attribute *a, *b;
+	struct berval *bv;
+	char *ptr;
+	size_t size;
+	int nattrs = 0, nvals = 0;
+	unsigned i;
+
+	ldap_pvt_thread_mutex_lock( &es->es_mutex );
+	i = ec_admit( ec, es, e->e_id, txnid, 1 );
+	ldap_pvt_thread_mutex_unlock( &es->es_mutex );
+	if ( !i )
+		return;
+
+	/* copy it into one block, outside the lock */
+	size = 0;
+	for ( a = e->e_attrs; a; a = a->a_next ) {
+		nattrs++;
+		nvals += a->a_numvals + 1;
+		for ( i = 0; i < a->a_numvals; i++ )
+			size += a->a_vals[i].bv_len + 1;
+		if ( a->a_nvals != a->a_vals ) {
+			nvals += a->a_numvals + 1;
+			for ( i = 0; i < a->a_numvals; i++ )
+				size += a->a_nvals[i].bv_len + 1;
+		}
+	}
+	size += sizeof(mdb_ecnode) + nattrs * sizeof(Attribute) +
+		nvals * sizeof(struct berval);
+
+	en = ch_malloc( size );
+	en->en_id = e->e_id;
+	en->en_refs = 0;
+	en->en_dead = 0;
+	en->en_nattrs = nattrs;
+	en->en_ocflags = e->e_ocflags;
+	en->en_size = size;
+	en->en_stripe = es;
+	en->en_attrs = (Attribute *)(en+1);
+	bv = (struct berval *)(en->en_attrs + nattrs);
+	ptr = (char *)(bv + nvals);
+	for ( a = e->e_attrs, b = en->en_attrs; a; a = a->a_next, b++ ) {
+		*b = *a;
+		b->a_flags = ( a->a_flags & SLAP_ATTR_PERSISTENT_FLAGS ) |
+			SLAP_ATTR_DONT_FREE_DATA | SLAP_ATTR_DONT_FREE_VALS;
+		b->a_next = NULL;
+		b->a_vals = bv;
+		for ( i = 0; i < a->a_numvals; i++, bv++ ) {
+			bv->bv_len = a->a_vals[i].bv_len;
+			bv->bv_val = ptr;
+			AC_MEMCPY( ptr, a->a_vals[i].bv_val, bv->bv_len );
+			ptr += bv->bv_len;
+			*ptr++ = '\0';
+		}
+		BER_BVZERO( bv );
+		bv++;
+		if ( a->a_nvals != a->a_vals ) {
+			b->a_nvals = bv;
+			for ( i = 0; i < a->a_numvals; i++, bv++ ) {
+				bv->bv_len = a->a_nvals[i].bv_len;
+				bv->bv_val = ptr;
+				AC_MEMCPY( ptr, a->a_nvals[i].bv_val, bv->bv_len );
+				ptr += bv->bv_len;
+				*ptr++ = '\0';
+			}
+			BER_BVZERO( bv );
+			bv++;
+		} else {
+			b->a_nvals = b->a_vals;
+		}
+	}
+
+	ldap_pvt_thread_mutex_lock( &es->es_mutex );
+	/* a writer or another reader may have been here meanwhile */
+	if ( !ec_admit( ec, es, e->e_id, txnid, 0 )) {
+		ldap_pvt_thread_mutex_unlock( &es->es_mutex );
+		ch_free( en );
+		return;
+	}
+	en->en_valid = es->es_lastmod;
+	i = EC_BUCKET( ec, en->en_id );
+	en->en_next = es->es_hash[i];
+	es->es_hash[i] = en;
+	en->en_lprev = NULL;
+	en->en_lnext = es->es_head;
+	if ( es->es_head )
+		es->es_head->en_lprev = en;
+	else
+		es->es_tail = en;
+	es->es_head = en;
+	es->es_count++;
+	es->es_bytes += size;
+
+	/* push out the oldest ones nobody is using */
+	for ( old = es->es_tail; old && es->es_count > ec->ec_max; ) {
+		en = old;
+		old = old->en_lprev;
+		if ( en->en_refs )
+			continue;
+		ec_unlink( ec, es, en );
+		es->es_evicted++;
+		ch_free( en );
+	}
+	ldap_pvt_thread_mutex_unlock( &es->es_mutex );
+}
+
+/* A writer is changing or deleting the entry in txn */
+void
+mdb_ecache_del( mdb_ecache *ec, MDB_txn *txn, ID id )
+{
+	mdb_ecstripe *es = EC_STRIPE( ec, id );
+	mdb_ecnode *en;
+	size_t txnid = mdb_txn_id( txn );
+
+	ldap_pvt_thread_mutex_lock( &es->es_mutex );
+	if ( es->es_lastmod < txnid )
+		es->es_lastmod = txnid;
+	en = ec_find( ec, es, id );
+	if ( en ) {
+		ec_unlink( ec, es, en );
+		if ( en->en_refs ) {
+			en->en_dead = 1;
+			en = NULL;
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &es->es_mutex );
+	if ( en )
+		ch_free( en );
+}
+
+/* (Re)create the cache of a database, or drop it if it's been
+ * turned off. The server must be paused or not running yet.
+ */
+int
+mdb_ecache_open( BackendDB *be )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+
+	mdb_ecache_close( mdb );
+	/* the tools don't keep it up to date */
+	if ( !mdb->mi_ecache_size || ( slapMode & SLAP_TOOL_MODE ))
+		return 0;
+	mdb->mi_ecache = mdb_ecache_new( mdb->mi_ecache_size );
+	return 0;
+}
+
+void
+mdb_ecache_close( struct mdb_info *mdb )
+{
+	if ( mdb->mi_ecache ) {
+		mdb_ecache_free( mdb->mi_ecache );
+		mdb->mi_ecache = NULL;
+	}
+}
+
+/* Describe the cache in bv, which holds the buffer to use:
+ * entries=<n>#max=<n>#bytes=<n>#hits=<n>#misses=<n>#evicted=<n>
+ */
+int
+mdb_ecache_stats( mdb_ecache *ec, struct berval *bv )
+{
+	unsigned long count = 0, bytes = 0, hits = 0, misses = 0, evicted = 0;
+	int i;
+
+	for ( i = 0; i < MDB_EC_STRIPES; i++ ) {
+		mdb_ecstripe *es = &ec->ec_stripes[i];
+		ldap_pvt_thread_mutex_lock( &es->es_mutex );
+		count += es->es_count;
+		bytes += es->es_bytes;
+		hits += es->es_hits;
+		misses += es->es_misses;
+		evicted += es->es_evicted;
+		ldap_pvt_thread_mutex_unlock( &es->es_mutex );
+	}
+
+	i = snprintf( bv->bv_val, bv->bv_len,
+		"entries=%lu#max=%lu#bytes=%lu#hits=%lu#misses=%lu#evicted=%lu",
+		count, ec->ec_max * MDB_EC_STRIPES, bytes, hits, misses, evicted );
+	if ( i < 0 || i >= bv->bv_len )
+		return -1;
+	bv->bv_len = i;
+	return 0;
+}
@@ -97,6 +97,41 @@ ava_comp_candidates (
 		ID *stack);
 #endif
 
+/* Record a filter component in the explain trace, return its slot */
+static int
+trace_component(
+	Operation *op,
+	mdb_trace *mt,
+	Filter *f,
+	ID size )
+{
+	mdb_trace_comp *tc;
+
+	if ( mt->mt_ncomp == mt->mt_maxcomp ) {
+		mt->mt_maxcomp = mt->mt_maxcomp ? mt->mt_maxcomp * 2 : 8;
+		mt->mt_comps = op->o_tmprealloc( mt->mt_comps,
+			mt->mt_maxcomp * sizeof(mdb_trace_comp), op->o_tmpmemctx );
+	}
+	tc = &mt->mt_comps[mt->mt_ncomp];
+	tc->tc_depth = mt->mt_depth;
+	/* the components of a list are traced on their own */
+	switch ( f->f_choice ) {
+	case LDAP_FILTER_AND:
+		ber_str2bv_x( "(&)", STRLENOF("(&)"), 1, &tc->tc_filter, op->o_tmpmemctx );
+		break;
+	case LDAP_FILTER_OR:
+		ber_str2bv_x( "(|)", STRLENOF("(|)"), 1, &tc->tc_filter, op->o_tmpmemctx );
+		break;
+	default:
+		filter2bv_x( op, f, &tc->tc_filter );
+	}
+	tc->tc_est = mt->mt_est;
+	tc->tc_size = size;
+	mt->mt_est = NOID;
+
+	return mt->mt_ncomp++;
+}
+
 int
 mdb_filter_candidates(
 	Operation *op,
@@ -106,12 +141,18 @@ mdb_filter_candidates(
 	ID *tmp,
 	ID *stack )
 {
-	int rc = 0;
+	int rc = 0, slot = -1;
+	mdb_trace *mt = mdb_trace_get( op );
 #ifdef LDAP_COMP_MATCH
 	AttributeAliasing *aa;
 #endif
 	Debug( LDAP_DEBUG_FILTER, "=> mdb_filter_candidates\n" );
 
+	if ( mt ) {
+		slot = trace_component( op, mt, f, NOID );
+		mt->mt_depth++;
+	}
+
 	if ( f->f_choice & SLAPD_FILTER_UNDEFINED ) {
 		MDB_IDL_ZERO( ids );
 		goto out;
@@ -238,6 +279,11 @@ mdb_filter_candidates(
 	}
 
 out:
+	if ( slot >= 0 ) {
+		mt->mt_comps[slot].tc_size = MDB_IDL_N( ids );
+		mt->mt_depth--;
+	}
+
 	Debug( LDAP_DEBUG_FILTER,
 		"<= mdb_filter_candidates: id=%ld first=%ld last=%ld\n",
 		(long) ids[0],
@@ -284,7 +330,7 @@ comp_list_candidates(
 			if ( f == flist ) {
 				MDB_IDL_CPY( ids, save );
 			} else {
-				mdb_idl_intersection( ids, save );
+				mdb_idl_intersection( op, ids, save );
 			}
 			if( MDB_IDL_IS_ZERO( ids ) )
 				break;
@@ -292,7 +338,7 @@ comp_list_candidates(
 			if ( f == flist ) {
 				MDB_IDL_CPY( ids, save );
 			} else {
-				mdb_idl_union( ids, save );
+				mdb_idl_union( op, ids, save );
 			}
 		}
 	}
@@ -407,7 +453,7 @@ comp_equality_candidates (
 		if ( i == 0 ) {
 			MDB_IDL_CPY( ids, tmp );
 		} else {
-			mdb_idl_intersection( ids, tmp );
+			mdb_idl_intersection( op, ids, tmp );
 		}
 
 		if( MDB_IDL_IS_ZERO( ids ) )
@@ -558,6 +604,246 @@ base:
 	return 0;
 }
 
+/* Estimate the number of IDs under the index keys for an assertion.
+ * Several keys are intersected, so the smallest slot is the estimate.
+ */
+static ID
+keys_estimate(
+	Operation *op,
+	MDB_txn *rtxn,
+	AttributeDescription *desc,
+	int ftype,
+	MatchingRule *mr,
+	void *assertion )
+{
+	MDB_dbi dbi;
+	int i, rc;
+	slap_mask_t mask;
+	struct berval prefix = {0, NULL};
+	struct berval *keys = NULL;
+	ID count, est = NOID;
+
+	rc = mdb_index_param( op->o_bd, desc, ftype, &dbi, &mask, &prefix );
+	if ( rc != LDAP_SUCCESS || prefix.bv_val == NULL )
+		return NOID;
+
+	if ( ftype == LDAP_FILTER_PRESENT ) {
+		rc = mdb_key_count( rtxn, dbi, &prefix, &est );
+		if ( rc == MDB_NOTFOUND )
+			return 0;
+		return rc ? NOID : est;
+	}
+
+	if ( !mr || !mr->smr_filter )
+		return NOID;
+
+	rc = (mr->smr_filter)( ftype, mask, desc->ad_type->sat_syntax, mr,
+		&prefix, assertion, &keys, op->o_tmpmemctx );
+	if ( rc != LDAP_SUCCESS || keys == NULL )
+		return NOID;
+
+	for ( i = 0; keys[i].bv_val != NULL; i++ ) {
+		rc = mdb_key_count( rtxn, dbi, &keys[i], &count );
+		if ( rc == MDB_NOTFOUND ) {
+			est = 0;
+			break;
+		}
+		if ( rc == 0 && count < est )
+			est = count;
+	}
+	ber_bvarray_free_x( keys, op->o_tmpmemctx );
+
+	return est;
+}
+
+/* Estimate how many candidates a filter will produce, without reading
+ * any IDLs. NOID means unknown or unindexed, i.e. every entry.
+ */
+static ID
+filter_estimate(
+	Operation *op,
+	MDB_txn *rtxn,
+	Filter *f )
+{
+	AttributeDescription *ad;
+	MatchingRule *mr;
+	Filter *fc;
+	ID est, n;
+
+	switch ( f->f_choice ) {
+	case SLAPD_FILTER_COMPUTED:
+		return f->f_result == LDAP_COMPARE_TRUE ? NOID : 0;
+
+	case LDAP_FILTER_PRESENT:
+		if ( f->f_desc == slap_schema.si_ad_objectClass )
+			return NOID;
+		return keys_estimate( op, rtxn, f->f_desc, LDAP_FILTER_PRESENT,
+			NULL, NULL );
+
+	case LDAP_FILTER_EQUALITY:
+		ad = f->f_ava->aa_desc;
+		if ( ad == slap_schema.si_ad_entryDN )
+			return 1;
+#ifdef LDAP_COMP_MATCH
+		if ( is_aliased_attribute && is_aliased_attribute( ad ))
+			return NOID;
+#endif
+		return keys_estimate( op, rtxn, ad, LDAP_FILTER_EQUALITY,
+			ad->ad_type->sat_equality, &f->f_ava->aa_value );
+
+	case LDAP_FILTER_APPROX:
+		ad = f->f_ava->aa_desc;
+		mr = ad->ad_type->sat_approx;
+		if ( !mr )
+			mr = ad->ad_type->sat_equality;
+		return keys_estimate( op, rtxn, ad, LDAP_FILTER_APPROX,
+			mr, &f->f_ava->aa_value );
+
+	case LDAP_FILTER_SUBSTRINGS:
+		ad = f->f_sub->sa_desc;
+		{
+			MDB_dbi dbi;
+			slap_mask_t mask;
+			struct berval prefix = BER_BVNULL;
+
+			if ( mdb_index_param( op->o_bd, ad, LDAP_FILTER_SUBSTRINGS,
+					&dbi, &mask, &prefix ) == LDAP_SUCCESS &&
+				IS_SLAP_INDEX( mask, SLAP_INDEX_NGRAM ) )
+			{
+				est = mdb_ngram_estimate( rtxn, dbi, f->f_sub );
+				if ( est != NOID || !IS_SLAP_INDEX( mask, SLAP_INDEX_SUBSTR ))
+					return est;
+			}
+		}
+		return keys_estimate( op, rtxn, ad, LDAP_FILTER_SUBSTRINGS,
+			ad->ad_type->sat_substr, f->f_sub );
+
+	case LDAP_FILTER_GE:
+	case LDAP_FILTER_LE:
+		/* at most everything that has the attribute */
+		return keys_estimate( op, rtxn, f->f_ava->aa_desc,
+			LDAP_FILTER_PRESENT, NULL, NULL );
+
+	case LDAP_FILTER_AND:
+		est = NOID;
+		for ( fc = f->f_and; fc; fc = fc->f_next ) {
+			if ( fc->f_choice == SLAPD_FILTER_COMPUTED &&
+				fc->f_result == LDAP_SUCCESS )
+				continue;
+			n = filter_estimate( op, rtxn, fc );
+			if ( n < est )
+				est = n;
+			if ( !est )
+				break;
+		}
+		return est;
+
+	case LDAP_FILTER_OR:
+		est = 0;
+		for ( fc = f->f_or; fc; fc = fc->f_next ) {
+			n = filter_estimate( op, rtxn, fc );
+			if ( n >= NOID - est )
+				return NOID;
+			est += n;
+		}
+		return est;
+
+	default:
+		return NOID;
+	}
+}
+
+/* A planned component of an AND filter */
+typedef struct mdb_fplan {
+	Filter *fp_f;
+	ID fp_est;
+} mdb_fplan;
+
+/* Fetching an index slot costs roughly this many IDs' worth of I/O
+ * per candidate entry it would save from being tested directly.
+ */
+#define MDB_PLAN_ENTRY_COST	64
+
+static int
+and_candidates(
+	Operation *op,
+	MDB_txn *rtxn,
+	Filter	*flist,
+	ID *ids,
+	ID *tmp,
+	ID *save )
+{
+	mdb_fplan *plan, fp;
+	mdb_trace *mt = mdb_trace_get( op );
+	Filter *f;
+	int rc = 0, i, j, n = 0, first = 1;
+
+	for ( f = flist; f != NULL; f = f->f_next )
+		n++;
+	plan = op->o_tmpalloc( n * sizeof(mdb_fplan), op->o_tmpmemctx );
+
+	/* Order the components by estimated size, smallest first.
+	 * Insertion sort keeps the client's order for equal estimates.
+	 */
+	n = 0;
+	for ( f = flist; f != NULL; f = f->f_next ) {
+		/* ignore precomputed scopes */
+		if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
+		     f->f_result == LDAP_SUCCESS ) {
+			continue;
+		}
+		fp.fp_f = f;
+		fp.fp_est = filter_estimate( op, rtxn, f );
+		for ( j = n; j > 0 && plan[j-1].fp_est > fp.fp_est; j-- )
+			plan[j] = plan[j-1];
+		plan[j] = fp;
+		n++;
+	}
+
+	for ( i = 0; i < n; i++ ) {
+		f = plan[i].fp_f;
+
+		/* Once only a few candidates are left, testing them
+		 * directly is cheaper than fetching any more IDLs.
+		 */
+		if ( !first && !MDB_IDL_IS_RANGE( ids ) && !MDB_IDL_IS_RUNS( ids ) &&
+			( plan[i].fp_est == NOID ||
+			  ids[0] * MDB_PLAN_ENTRY_COST < plan[i].fp_est )) {
+			Debug( LDAP_DEBUG_FILTER,
+				"<= mdb_list_candidates: %ld candidates, "
+				"skipping %d filters\n", (long) ids[0], n - i );
+			for ( ; mt && i < n; i++ ) {
+				mt->mt_est = plan[i].fp_est;
+				trace_component( op, mt, plan[i].fp_f, NOID );
+			}
+			break;
+		}
+
+		if ( mt )
+			mt->mt_est = plan[i].fp_est;
+		MDB_IDL_ZERO( save );
+		rc = mdb_filter_candidates( op, rtxn, f, save, tmp,
+			save+MDB_idl_um_size );
+
+		if ( rc != 0 ) {
+			rc = 0;
+			continue;
+		}
+
+		if ( first ) {
+			MDB_IDL_CPY( ids, save );
+			first = 0;
+		} else {
+			mdb_idl_intersection( op, ids, save );
+		}
+		if( MDB_IDL_IS_ZERO( ids ) )
+			break;
+	}
+
+	op->o_tmpfree( plan, op->o_tmpmemctx );
+	return rc;
+}
+
 static int
 list_candidates(
 	Operation *op,
@@ -572,6 +858,11 @@ list_candidates(
 	Filter	*f;
 
 	Debug( LDAP_DEBUG_FILTER, "=> mdb_list_candidates 0x%x\n", ftype );
+	if ( ftype == LDAP_FILTER_AND ) {
+		rc = and_candidates( op, rtxn, flist, ids, tmp, save );
+		goto done;
+	}
+
 	for ( f = flist; f != NULL; f = f->f_next ) {
 		/* ignore precomputed scopes */
 		if ( f->f_choice == SLAPD_FILTER_COMPUTED &&
@@ -583,31 +874,17 @@ list_candidates(
 			save+MDB_idl_um_size );
 
 		if ( rc != 0 ) {
-			if ( ftype == LDAP_FILTER_AND ) {
-				rc = 0;
-				continue;
-			}
 			break;
 		}
 
-		
-		if ( ftype == LDAP_FILTER_AND ) {
-			if ( f == flist ) {
-				MDB_IDL_CPY( ids, save );
-			} else {
-				mdb_idl_intersection( ids, save );
-			}
-			if( MDB_IDL_IS_ZERO( ids ) )
-				break;
+		if ( f == flist ) {
+			MDB_IDL_CPY( ids, save );
 		} else {
-			if ( f == flist ) {
-				MDB_IDL_CPY( ids, save );
-			} else {
-				mdb_idl_union( ids, save );
-			}
+			mdb_idl_union( op, ids, save );
 		}
 	}
 
+done:
 	if( rc == LDAP_SUCCESS ) {
 		Debug( LDAP_DEBUG_FILTER,
 			"<= mdb_list_candidates: id=%ld first=%ld last=%ld\n",
@@ -807,7 +1084,7 @@ equality_candidates(
 		if ( i == 0 ) {
 			MDB_IDL_CPY( ids, tmp );
 		} else {
-			mdb_idl_intersection( ids, tmp );
+			mdb_idl_intersection( op, ids, tmp );
 		}
 
 		if( MDB_IDL_IS_ZERO( ids ) )
@@ -928,7 +1205,7 @@ approx_candidates(
 		if ( i == 0 ) {
 			MDB_IDL_CPY( ids, tmp );
 		} else {
-			mdb_idl_intersection( ids, tmp );
+			mdb_idl_intersection( op, ids, tmp );
 		}
 
 		if( MDB_IDL_IS_ZERO( ids ) )
@@ -983,6 +1260,29 @@ substring_candidates(
 		return 0;
 	}
 
+	if( IS_SLAP_INDEX( mask, SLAP_INDEX_NGRAM ) ) {
+		ID all[MDB_IDL_RANGE_SIZE];
+
+		rc = mdb_ngram_candidates( op, rtxn, dbi, sub, ids, tmp );
+		if( rc != LDAP_SUCCESS ) {
+			Debug( LDAP_DEBUG_TRACE,
+				"<= mdb_substring_candidates: (%s) "
+				"ngram read failed (%d)\n",
+				sub->sa_desc->ad_cname.bv_val, rc );
+			MDB_IDL_ALL( ids );
+			return rc;
+		}
+		/* fall back to the sub index if no fragment was long enough */
+		MDB_IDL_ALL( all );
+		if( !MDB_IDL_IS_ALL( all, ids ) ||
+			!IS_SLAP_INDEX( mask, SLAP_INDEX_SUBSTR ) ) {
+			Debug( LDAP_DEBUG_TRACE,
+				"<= mdb_substring_candidates: ngram %ld\n",
+				(long) ids[0] );
+			return 0;
+		}
+	}
+
 	mr = sub->sa_desc->ad_type->sat_substr;
 
 	if( !mr ) {
@@ -1043,7 +1343,7 @@ substring_candidates(
 		if ( i == 0 ) {
 			MDB_IDL_CPY( ids, tmp );
 		} else {
-			mdb_idl_intersection( ids, tmp );
+			mdb_idl_intersection( op, ids, tmp );
 		}
 
 		if( MDB_IDL_IS_ZERO( ids ) )
@@ -1154,7 +1454,7 @@ inequality_candidates(
 			break;
 		}
 
-		mdb_idl_union( ids, tmp );
+		mdb_idl_union( op, ids, tmp );
 
 		if( op->ors_limit && op->ors_limit->lms_s_unchecked != -1 &&
 			MDB_IDL_N( ids ) >= (unsigned) op->ors_limit->lms_s_unchecked ) {
@@ -0,0 +1,330 @@
+/* flush.c - ldap mdb back-end background flushing of dirty pages */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1			/* Needed for sync_file_range */
+#endif
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+#include <ac/errno.h>
+#include <ac/time.h>
+#include <fcntl.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "back-mdb.h"
+
+#include "ldap_rq.h"
+
+/* With dbnosync or mapasync, commits leave their pages dirty in the
+ * page cache and the checkpoint task syncs them all at once. Writes
+ * that come in meanwhile wait behind that flush, which shows up as a
+ * spike in their latency every checkpoint.
+ *
+ * The trickle task runs every second and starts the writeback of the
+ * pages dirtied since, at most trickle kbytes of them, without waiting
+ * for it to finish. Where the kernel can tell how many pages of the
+ * file are dirty (cachestat, Linux 6.5), windows of the file without
+ * any are skipped and the backlog is published. That is also the
+ * measure of the write volume the checkpoint kbyte threshold needs.
+ * Elsewhere the whole limit is spent on windows of the file in turn.
+ */
+
+#define MDB_FLUSH_WINDOW	(1024*1024)	/* bytes written back at a time */
+
+/* cachestat(2) isn't in the C library headers yet. Its number is the
+ * same on all architectures that use the generic syscall table.
+ */
+#if defined(__linux__) && !defined(__alpha__)
+#ifndef __NR_cachestat
+#define __NR_cachestat	451
+#endif
+struct mdb_cachestat_range {
+	uint64_t off;
+	uint64_t len;
+};
+struct mdb_cachestat {
+	uint64_t nr_cache;
+	uint64_t nr_dirty;
+	uint64_t nr_writeback;
+	uint64_t nr_evicted;
+	uint64_t nr_recently_evicted;
+};
+#define HAVE_CACHESTAT	1
+#endif
+
+struct mdb_flusher {
+	ldap_pvt_thread_mutex_t fl_mutex;
+	struct re_s *fl_task;
+	off_t fl_pos;		/* where the next tick starts */
+	int fl_cstat;		/* cachestat works */
+	long fl_left;		/* dirty bytes left by the last tick */
+	unsigned long fl_written;	/* bytes dirtied since the last sync */
+	/* totals */
+	unsigned long fl_ticks;
+	unsigned long fl_flushed;	/* kbytes */
+	unsigned long fl_rate;		/* bytes in the last tick */
+	long fl_backlog;		/* dirty bytes, -1 if unknown */
+	unsigned long fl_tickusec;
+	unsigned long fl_tickmax;
+	unsigned long fl_syncs;
+	unsigned long fl_syncusec;
+	unsigned long fl_syncmax;
+};
+
+/* Dirty bytes in the range, or -1 if that can't be told */
+static long
+mdb_flush_dirty( mdb_flusher *fl, int fd, off_t off, size_t len, size_t psize )
+{
+#ifdef HAVE_CACHESTAT
+	struct mdb_cachestat_range cr;
+	struct mdb_cachestat cs;
+
+	if ( fl->fl_cstat ) {
+		cr.off = off;
+		cr.len = len;
+		if ( syscall( __NR_cachestat, fd, &cr, &cs, 0 ) == 0 )
+			return cs.nr_dirty * psize;
+		/* not supported by this kernel */
+		fl->fl_cstat = 0;
+	}
+#endif
+	return -1;
+}
+
+/* Start writing the range back, without waiting for it */
+static int
+mdb_flush_range( int fd, char *map, off_t off, size_t len )
+{
+#if defined(SYNC_FILE_RANGE_WRITE)
+	return sync_file_range( fd, off, len, SYNC_FILE_RANGE_WRITE );
+#elif defined(MS_ASYNC)
+	/* only pages written through the map can be dirty in it */
+	if ( map )
+		return msync( map + off, len, MS_ASYNC );
+	return 0;
+#else
+	return 0;
+#endif
+}
+
+static unsigned long
+mdb_flush_usec( struct timeval *start )
+{
+	struct timeval now;
+
+	gettimeofday( &now, NULL );
+	return ( now.tv_sec - start->tv_sec ) * 1000000 +
+		now.tv_usec - start->tv_usec;
+}
+
+/* Sync the environment, which is what a checkpoint does */
+int
+mdb_flush_sync( struct mdb_info *mdb )
+{
+	mdb_flusher *fl = mdb->mi_flusher;
+	struct timeval start;
+	unsigned long usec;
+	int rc;
+
+	gettimeofday( &start, NULL );
+	rc = mdb_env_sync( mdb->mi_dbenv, 1 );
+	usec = mdb_flush_usec( &start );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_flush_sync)
+			": mdb_env_sync failed: %s (%d)\n",
+			mdb_strerror(rc), rc );
+	}
+	if ( fl ) {
+		ldap_pvt_thread_mutex_lock( &fl->fl_mutex );
+		fl->fl_syncs++;
+		fl->fl_syncusec = usec;
+		if ( usec > fl->fl_syncmax )
+			fl->fl_syncmax = usec;
+		fl->fl_written = 0;
+		fl->fl_left = 0;
+		ldap_pvt_thread_mutex_unlock( &fl->fl_mutex );
+	}
+	return rc;
+}
+
+static void
+mdb_flush_tick( struct mdb_info *mdb, mdb_flusher *fl )
+{
+	MDB_envinfo ei;
+	MDB_stat st;
+	struct timeval start;
+	char *map = NULL;
+	unsigned int flags;
+	off_t end, covered;
+	long backlog, dirty, left;
+	unsigned long budget, flushed = 0, usec;
+	size_t len;
+	int fd, sync = 0;
+	char ebuf[128];
+
+	if ( mdb_env_get_flags( mdb->mi_dbenv, &flags ) ||
+		!( flags & ( MDB_NOSYNC|MDB_MAPASYNC )))
+		return;	/* every commit syncs */
+	if ( mdb_env_get_fd( mdb->mi_dbenv, &fd ) ||
+		mdb_env_info( mdb->mi_dbenv, &ei ) ||
+		mdb_env_stat( mdb->mi_dbenv, &st ))
+		return;
+	if ( flags & MDB_WRITEMAP )
+		map = ei.me_mapaddr;
+
+	gettimeofday( &start, NULL );
+	end = (off_t)( ei.me_last_pgno + 1 ) * st.ms_psize;
+	budget = (unsigned long)mdb->mi_trickle * 1024;
+
+	backlog = mdb_flush_dirty( fl, fd, 0, end, st.ms_psize );
+	if ( backlog > 0 ) {
+		/* what the writers added since the last tick */
+		ldap_pvt_thread_mutex_lock( &fl->fl_mutex );
+		if ( backlog > fl->fl_left )
+			fl->fl_written += backlog - fl->fl_left;
+		ldap_pvt_thread_mutex_unlock( &fl->fl_mutex );
+	}
+	for ( covered = 0; covered < end && flushed < budget && backlog;
+		covered += len ) {
+		if ( fl->fl_pos >= end )
+			fl->fl_pos = 0;
+		len = MDB_FLUSH_WINDOW;
+		if ( len > end - fl->fl_pos )
+			len = end - fl->fl_pos;
+		dirty = backlog < 0 ? (long)len :
+			mdb_flush_dirty( fl, fd, fl->fl_pos, len, st.ms_psize );
+		if ( dirty < 0 )
+			dirty = len;
+		if ( dirty && mdb_flush_range( fd, map, fl->fl_pos, len )) {
+			int saved_errno = errno;
+			Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_flush_tick)
+				": writing back pages failed: %s (%d)\n",
+				AC_STRERROR_R( saved_errno, ebuf, sizeof(ebuf) ),
+				saved_errno );
+			break;
+		}
+		flushed += dirty;
+		fl->fl_pos += len;
+	}
+	usec = mdb_flush_usec( &start );
+	left = backlog < 0 ? -1 :
+		(unsigned long)backlog > flushed ? backlog - flushed : 0;
+
+	ldap_pvt_thread_mutex_lock( &fl->fl_mutex );
+	if ( left >= 0 )
+		fl->fl_left = left;
+	fl->fl_ticks++;
+	fl->fl_flushed += flushed / 1024;
+	fl->fl_rate = flushed;
+	fl->fl_backlog = left;
+	fl->fl_tickusec = usec;
+	if ( usec > fl->fl_tickmax )
+		fl->fl_tickmax = usec;
+	if ( mdb->mi_txn_cp && mdb->mi_txn_cp_kbyte &&
+		fl->fl_written / 1024 >= mdb->mi_txn_cp_kbyte )
+		sync = 1;
+	ldap_pvt_thread_mutex_unlock( &fl->fl_mutex );
+
+	if ( sync )
+		mdb_flush_sync( mdb );
+}
+
+static void *
+mdb_flush_task( void *ctx, void *arg )
+{
+	struct re_s *rtask = arg;
+	struct mdb_info *mdb = rtask->arg;
+
+	if ( mdb->mi_flusher && mdb->mi_dbenv )
+		mdb_flush_tick( mdb, mdb->mi_flusher );
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	return NULL;
+}
+
+int
+mdb_flush_open( BackendDB *be )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	mdb_flusher *fl;
+
+	if ( mdb->mi_flusher || !mdb->mi_trickle ||
+		!( slapMode & SLAP_SERVER_MODE ))
+		return 0;
+
+	fl = ch_calloc( 1, sizeof( mdb_flusher ));
+	ldap_pvt_thread_mutex_init( &fl->fl_mutex );
+#ifdef HAVE_CACHESTAT
+	fl->fl_cstat = 1;
+#endif
+	fl->fl_backlog = -1;
+	mdb->mi_flusher = fl;
+
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	fl->fl_task = ldap_pvt_runqueue_insert( &slapd_rq, 1,
+		mdb_flush_task, mdb, LDAP_XSTRING(mdb_flush_task),
+		be->be_suffix[0].bv_val );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	return 0;
+}
+
+void
+mdb_flush_close( struct mdb_info *mdb )
+{
+	mdb_flusher *fl = mdb->mi_flusher;
+
+	if ( !fl )
+		return;
+
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	if ( ldap_pvt_runqueue_isrunning( &slapd_rq, fl->fl_task ) )
+		ldap_pvt_runqueue_stoptask( &slapd_rq, fl->fl_task );
+	ldap_pvt_runqueue_remove( &slapd_rq, fl->fl_task );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+
+	mdb->mi_flusher = NULL;
+	ldap_pvt_thread_mutex_destroy( &fl->fl_mutex );
+	ch_free( fl );
+}
+
+int
+mdb_flush_stats( mdb_flusher *fl, struct berval *bv )
+{
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &fl->fl_mutex );
+	i = snprintf( bv->bv_val, bv->bv_len,
+		"ticks=%lu#flushed=%lu#rate=%lu#backlog=%ld#tick=%lu#tickmax=%lu"
+		"#syncs=%lu#sync=%lu#syncmax=%lu",
+		fl->fl_ticks, fl->fl_flushed, fl->fl_rate / 1024,
+		fl->fl_backlog < 0 ? -1L : fl->fl_backlog / 1024,
+		fl->fl_tickusec, fl->fl_tickmax,
+		fl->fl_syncs, fl->fl_syncusec, fl->fl_syncmax );
+	ldap_pvt_thread_mutex_unlock( &fl->fl_mutex );
+	if ( i < 0 || i >= bv->bv_len )
+		return -1;
+	bv->bv_len = i;
+	return 0;
+}
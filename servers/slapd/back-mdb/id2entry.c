@@ -21,6 +21,15 @@
 #include <ac/errno.h>
 
 #include "back-mdb.h"
+#include "zipcodec.h"
+
+/* The compressed values of an attribute, see compress.c */
+typedef struct Ezip {
+	struct Ezip *next;
+	Attribute *attr;
+	unsigned len;
+	unsigned char data[1];
+} Ezip;
 
 typedef struct Ecount {
 	ber_len_t len;	/* total entry size */
@@ -29,13 +38,17 @@ typedef struct Ecount {
 	int nvals;
 	int offset;
 	Attribute *multi;
+	Ezip *zip;	/* in the order of the attrs */
+	ber_len_t zlen;	/* room their values and runs need once expanded */
 } Ecount;
 
-static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
+static int mdb_entry_partsize(Operation *op, MDB_txn *txn, Entry *e,
 	Ecount *eh);
+static void mdb_entry_zipfree(Operation *op, Ecount *eh);
 static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data,
 	Ecount *ec);
-static Entry *mdb_entry_alloc( Operation *op, int nattrs, int nvals );
+static Entry *mdb_entry_alloc( Operation *op, int nattrs, int nvals,
+	ber_len_t extra );
 
 #define ID2VKSZ	(sizeof(ID)+2)
 
@@ -60,9 +73,34 @@ mdb_id2v_compare(
 	return uv[sizeof(ID)/2] - cv[sizeof(ID)/2];
 }
 
+/* Order two normalized values of ad, or plain bytes if ad is NULL */
+int
+mdb_id2v_match(
+	AttributeDescription *ad,
+	struct berval *bv1,
+	struct berval *bv2
+)
+{
+	int rc, match;
+
+	if (ad) {
+		MatchingRule *mr = ad->ad_type->sat_equality;
+		rc = mr->smr_match(&match, SLAP_MR_EQUALITY
+		| SLAP_MR_VALUE_OF_ASSERTION_SYNTAX
+		| SLAP_MR_ASSERTED_VALUE_NORMALIZED_MATCH
+		| SLAP_MR_ATTRIBUTE_VALUE_NORMALIZED_MATCH,
+		ad->ad_type->sat_syntax, mr, bv1, bv2);
+	} else {
+		match = ber_bvcmp(bv1, bv2);
+	}
+
+	return match;
+}
+
 /* usrkey[0] is the key in DB format, as described at mdb_mval_put.
  * usrkey[1] is the value we'll actually match against.
- * usrkey[2] is the attributeDescription for this value.
+ * usrkey[2] is the attributeDescription for this value, its size
+ * is MDB_MV_RUNS if the records are blocks of values.
  */
 int
 mdb_id2v_dupsort(
@@ -70,42 +108,36 @@ mdb_id2v_dupsort(
 	const MDB_val *curkey
 )
 {
-	AttributeDescription *ad = usrkey[2].mv_data;
 	struct berval bv1, bv2;
-	int rc, match, olen;
 	unsigned short s;
 	char *ptr;
 
-	ptr = curkey->mv_data + curkey->mv_size - 2;
-	memcpy(&s, ptr, 2);
-	bv2.bv_val = curkey->mv_data;
-	bv2.bv_len = curkey->mv_size - 3;
-	if (s)
-		bv2.bv_len -= (s+1);
+	if (usrkey[2].mv_size == MDB_MV_RUNS) {
+		/* blocks sort on their first value */
+		if (mdb_mvrun_first(curkey, &bv2))
+			return -1;
+	} else {
+		ptr = curkey->mv_data + curkey->mv_size - 2;
+		memcpy(&s, ptr, 2);
+		bv2.bv_val = curkey->mv_data;
+		bv2.bv_len = curkey->mv_size - 3;
+		if (s)
+			bv2.bv_len -= (s+1);
+	}
 
 	bv1.bv_val = usrkey[1].mv_data;
 	bv1.bv_len = usrkey[1].mv_size;
 
-	if (ad) {
-		MatchingRule *mr = ad->ad_type->sat_equality;
-		rc = mr->smr_match(&match, SLAP_MR_EQUALITY
-		| SLAP_MR_VALUE_OF_ASSERTION_SYNTAX
-		| SLAP_MR_ASSERTED_VALUE_NORMALIZED_MATCH
-		| SLAP_MR_ATTRIBUTE_VALUE_NORMALIZED_MATCH,
-		ad->ad_type->sat_syntax, mr, &bv1, &bv2);
-	} else {
-		match = ber_bvcmp(&bv1, &bv2);
-	}
-
-	return match;
+	return mdb_id2v_match(usrkey[2].mv_data, &bv1, &bv2);
 }
 
 /* Values are stored as
  * [normalized-value NUL ] original-value NUL 2-byte-len
  * The trailing 2-byte-len is zero if there is no normalized value.
  * Otherwise, it is the length of the original-value.
+ * With runs set they are stored in blocks instead, see mvruns.c.
  */
-int mdb_mval_put(Operation *op, MDB_cursor *mc, ID id, Attribute *a)
+int mdb_mval_put(Operation *op, MDB_cursor *mc, ID id, Attribute *a, int runs)
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	MDB_val key, data[3];
@@ -115,6 +147,9 @@ int mdb_mval_put(Operation *op, MDB_cursor *mc, ID id, Attribute *a)
 	unsigned short s;
 	int rc, len;
 
+	if (runs)
+		return mdb_mvrun_put(op, mc, id, a);
+
 	memcpy(ivk, &id, sizeof(id));
 	s = mdb->mi_adxs[a->a_desc->ad_index];
 	memcpy(ivk+sizeof(ID), &s, 2);
@@ -124,6 +159,7 @@ int mdb_mval_put(Operation *op, MDB_cursor *mc, ID id, Attribute *a)
 		data[2].mv_data = NULL;
 	else
 		data[2].mv_data = a->a_desc;
+	data[2].mv_size = 0;
 
 	for (i=0; i<a->a_numvals; i++) {
 		len = a->a_nvals[i].bv_len + 1 + 2;
@@ -159,7 +195,7 @@ int mdb_mval_put(Operation *op, MDB_cursor *mc, ID id, Attribute *a)
 	return 0;
 }
 
-int mdb_mval_del(Operation *op, MDB_cursor *mc, ID id, Attribute *a)
+int mdb_mval_del(Operation *op, MDB_cursor *mc, ID id, Attribute *a, int runs)
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	MDB_val key, data[3];
@@ -178,8 +214,11 @@ int mdb_mval_del(Operation *op, MDB_cursor *mc, ID id, Attribute *a)
 		data[2].mv_data = NULL;
 	else
 		data[2].mv_data = a->a_desc;
+	data[2].mv_size = 0;
 
-	if (a->a_numvals) {
+	if (a->a_numvals && runs) {
+		rc = mdb_mvrun_del(op, mc, id, a);
+	} else if (a->a_numvals) {
 		for (i=0; i<a->a_numvals; i++) {
 			data[0].mv_data = a->a_nvals[i].bv_val;
 			data[0].mv_size = a->a_nvals[i].bv_len+1;
@@ -227,6 +266,7 @@ static int mdb_mval_get(Operation *op, MDB_cursor *mc, ID id, Attribute *a, int
 		data[2].mv_data = NULL;
 	else
 		data[2].mv_data = a->a_desc;
+	data[2].mv_size = 0;
 
 	if (have_nvals)
 		a->a_nvals = a->a_vals + a->a_numvals + 1;
@@ -279,7 +319,11 @@ static int mdb_id2entry_put(
 	key.mv_data = &e->e_id;
 	key.mv_size = sizeof(ID);
 
-	rc = mdb_entry_partsize( mdb, txn, e, &ec );
+	/* readers mustn't keep using the old version */
+	if ( !adding && mdb->mi_ecache )
+		mdb_ecache_del( mdb->mi_ecache, txn, e->e_id );
+
+	rc = mdb_entry_partsize( op, txn, e, &ec );
 	if (rc) {
 		rc = LDAP_OTHER;
 		goto fail;
@@ -316,7 +360,8 @@ again:
 				for ( a = ec.multi; a; a=a->a_next ) {
 					if (!(a->a_flags & SLAP_ATTR_BIG_MULTI))
 						continue;
-					rc = mdb_mval_put( op, mvc, e->e_id, a );
+					rc = mdb_mval_put( op, mvc, e->e_id, a,
+						a->a_flags & SLAP_ATTR_BIG_RUNS );
 					if( rc )
 						break;
 				}
@@ -346,6 +391,7 @@ again:
 			rc = LDAP_OTHER;
 	}
 fail:
+	mdb_entry_zipfree( op, &ec );
 	if (rc) {
 		mdb_ad_unwind( mdb, prev_ads );
 	}
@@ -399,11 +445,17 @@ int mdb_id2entry(
 	ID id,
 	Entry **e )
 {
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_ecache *ec;
 	MDB_val key, data;
 	int rc = 0;
 
 	*e = NULL;
 
+	ec = mdb_opinfo_ecache( op, mdb, mdb_cursor_txn( mc ));
+	if ( ec && mdb_ecache_get( op, ec, mdb_cursor_txn( mc ), id, e ) == 0 )
+		return MDB_SUCCESS;
+
 	key.mv_data = &id;
 	key.mv_size = sizeof(ID);
 
@@ -413,7 +465,7 @@ int mdb_id2entry(
 		/* Looking for root entry on an empty-dn suffix? */
 		if ( !id && BER_BVISEMPTY( &op->o_bd->be_nsuffix[0] )) {
 			struct berval gluebv = BER_BVC("glue");
-			Entry *r = mdb_entry_alloc(op, 2, 4);
+			Entry *r = mdb_entry_alloc(op, 2, 4, 0);
 			Attribute *a = r->e_attrs;
 			struct berval *bptr;
 
@@ -453,6 +505,9 @@ int mdb_id2entry(
 	(*e)->e_name.bv_val = NULL;
 	(*e)->e_nname.bv_val = NULL;
 
+	if ( ec )
+		mdb_ecache_put( ec, mdb_cursor_txn( mc ), *e );
+
 	return rc;
 }
 
@@ -470,6 +525,9 @@ int mdb_id2entry_delete(
 	key.mv_data = &e->e_id;
 	key.mv_size = sizeof(ID);
 
+	if ( mdb->mi_ecache )
+		mdb_ecache_del( mdb->mi_ecache, tid, e->e_id );
+
 	/* delete from database */
 	rc = mdb_del( tid, dbi, &key, NULL );
 	if (rc)
@@ -498,14 +556,16 @@ int mdb_id2entry_delete(
 	return rc;
 }
 
+/* extra bytes are left after the bervals */
 static Entry * mdb_entry_alloc(
 	Operation *op,
 	int nattrs,
-	int nvals )
+	int nvals,
+	ber_len_t extra )
 {
 	Entry *e = op->o_tmpalloc( sizeof(Entry) +
 		nattrs * sizeof(Attribute) +
-		nvals * sizeof(struct berval), op->o_tmpmemctx );
+		nvals * sizeof(struct berval) + extra, op->o_tmpmemctx );
 	BER_BVZERO(&e->e_bv);
 	e->e_private = e;
 	if (nattrs) {
@@ -526,6 +586,9 @@ int mdb_entry_return(
 	if ( !e )
 		return 0;
 	if ( e->e_private ) {
+		/* from the entry cache */
+		if ( e->e_private != e )
+			mdb_ecache_return( e );
 		if ( op->o_hdr && op->o_tmpmfuncs ) {
 			op->o_tmpfree( e->e_nname.bv_val, op->o_tmpmemctx );
 			op->o_tmpfree( e->e_name.bv_val, op->o_tmpmemctx );
@@ -748,7 +811,16 @@ mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **m
 				if ( get_lazyCommit( op ))
 					flag |= MDB_NOMETASYNC;
 #endif
-				rc = mdb_txn_begin( mdb->mi_dbenv, NULL, flag, &moi->moi_txn );
+				/* only the ops' own txns are grouped, not those of
+				 * LDAP transactions or entry_get */
+				if ( !flag && !( moi->moi_flag & MOI_FREEIT ) &&
+					mdb_txngroup_active( mdb )) {
+					rc = mdb_txngroup_begin( mdb, &moi->moi_txn );
+					if ( rc == 0 )
+						moi->moi_flag |= MOI_GROUPED;
+				} else {
+					rc = mdb_txn_begin( mdb->mi_dbenv, NULL, flag, &moi->moi_txn );
+				}
 				if (rc) {
 					Debug( LDAP_DEBUG_ANY, "mdb_opinfo_get: err %s(%d)\n",
 						mdb_strerror(rc), rc );
@@ -811,6 +883,25 @@ ok:
 	return 0;
 }
 
+/* The entry cache, if txn is this op's read txn. Writers must
+ * neither see cached entries nor cache their own.
+ */
+mdb_ecache *
+mdb_opinfo_ecache( Operation *op, struct mdb_info *mdb, MDB_txn *txn )
+{
+	OpExtra *oex;
+
+	if ( !mdb->mi_ecache )
+		return NULL;
+
+	LDAP_SLIST_FOREACH( oex, &op->o_extra, oe_next ) {
+		mdb_op_info *moi = (mdb_op_info *)oex;
+		if ( oex->oe_key == mdb && moi->moi_txn == txn )
+			return ( moi->moi_flag & MOI_READER ) ? mdb->mi_ecache : NULL;
+	}
+	return NULL;
+}
+
 int mdb_txn( Operation *op, int txnop, OpExtra **ptr )
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
@@ -840,16 +931,21 @@ int mdb_txn( Operation *op, int txnop, OpExtra **ptr )
 	return LDAP_OTHER;
 }
 
-/* Count up the sizes of the components of an entry */
-static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
+/* Count up the sizes of the components of an entry, and compress
+ * the values of the attributes that ask for it.
+ */
+static int mdb_entry_partsize(Operation *op, MDB_txn *txn, Entry *e,
 	Ecount *eh)
 {
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	ber_len_t len, dlen;
-	int i, nat = 0, nval = 0, nnval = 0, doff = 0;
+	int i, nat = 0, nval = 0, nnval = 0, doff = 0, nzip = 0;
 	Attribute *a;
 	unsigned hi;
 
 	eh->multi = NULL;
+	eh->zip = NULL;
+	eh->zlen = 0;
 	len = 4*sizeof(int);	/* nattrs, nvals, ocflags, offset */
 	dlen = len;
 	for (a=e->e_attrs; a; a=a->a_next) {
@@ -868,16 +964,24 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
 		dlen += 2*sizeof(int);
 		nval += a->a_numvals + 1;	/* empty berval at end */
 		mdb_attr_multi_thresh( mdb, a->a_desc, &hi, NULL );
-		if (a->a_numvals > hi)
+		if (a->a_numvals > hi && !(a->a_flags & SLAP_ATTR_BIG_MULTI)) {
 			a->a_flags |= SLAP_ATTR_BIG_MULTI;
+			if (mdb_attr_multi_runs( mdb, a->a_desc ))
+				a->a_flags |= SLAP_ATTR_BIG_RUNS;
+		}
 		if (a->a_flags & SLAP_ATTR_BIG_MULTI)
 			doff += a->a_numvals;
+		else
+			a->a_flags &= ~SLAP_ATTR_BIG_RUNS;
 		for (i=0; i<a->a_numvals; i++) {
 			int alen = a->a_vals[i].bv_len + 1 + sizeof(int);	/* len */
 			len += alen;
 			if (a->a_flags & SLAP_ATTR_BIG_MULTI) {
 				if (!eh->multi)
 					eh->multi = a;
+				/* runs are expanded after the bervals */
+				if (a->a_flags & SLAP_ATTR_BIG_RUNS)
+					eh->zlen += alen - sizeof(int);
 			} else {
 				dlen += alen;
 			}
@@ -892,28 +996,105 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
 				len += alen;
 				if (!(a->a_flags & SLAP_ATTR_BIG_MULTI))
 					dlen += alen;
+				else if (a->a_flags & SLAP_ATTR_BIG_RUNS)
+					eh->zlen += alen - sizeof(int);
 			}
 		}
 	}
+	if (mdb->mi_zip_default || mdb->mi_zip_ads) {
+		Ezip *z, **zp = &eh->zip;
+		unsigned char *raw, *ptr;
+		ber_len_t rlen;
+		unsigned cap;
+
+		for (a=e->e_attrs; a; a=a->a_next) {
+			if (a->a_flags & SLAP_ATTR_BIG_MULTI)
+				continue;
+			rlen = 0;
+			for (i=0; i<a->a_numvals; i++)
+				rlen += a->a_vals[i].bv_len + 1;
+			if (a->a_nvals != a->a_vals)
+				for (i=0; i<a->a_numvals; i++)
+					rlen += a->a_nvals[i].bv_len + 1;
+			if (rlen > UINT_MAX / 2 || !mdb_zip_want(mdb, a, rlen))
+				continue;
+
+			/* laid out as mdb_entry_encode would store them */
+			raw = op->o_tmpalloc(rlen, op->o_tmpmemctx);
+			ptr = raw;
+			for (i=0; i<a->a_numvals; i++) {
+				memcpy(ptr, a->a_vals[i].bv_val, a->a_vals[i].bv_len);
+				ptr += a->a_vals[i].bv_len;
+				*ptr++ = '\0';
+			}
+			if (a->a_nvals != a->a_vals) {
+				for (i=0; i<a->a_numvals; i++) {
+					memcpy(ptr, a->a_nvals[i].bv_val, a->a_nvals[i].bv_len);
+					ptr += a->a_nvals[i].bv_len;
+					*ptr++ = '\0';
+				}
+			}
+			/* only worth it if it saves an eighth */
+			cap = rlen - rlen / 8;
+			z = op->o_tmpalloc(sizeof(Ezip) + cap, op->o_tmpmemctx);
+			z->len = mdb_zip_pack(raw, rlen, z->data, cap);
+			op->o_tmpfree(raw, op->o_tmpmemctx);
+			if (!z->len) {
+				op->o_tmpfree(z, op->o_tmpmemctx);
+				continue;
+			}
+			z->attr = a;
+			z->next = NULL;
+			*zp = z;
+			zp = &z->next;
+			nzip++;
+			eh->zlen += rlen;
+			dlen -= rlen;
+			dlen += z->len + sizeof(int);	/* compressed size */
+		}
+	}
+	if (eh->zlen) {
+		nzip++;		/* expanded size */
+		dlen += sizeof(int);
+	}
 	/* padding */
 	dlen = (dlen + sizeof(ID)-1) & ~(sizeof(ID)-1);
 	eh->len = len;
 	eh->dlen = dlen;
 	eh->nattrs = nat;
 	eh->nvals = nval;
-	eh->offset = nat + nval - nnval - doff;
+	eh->offset = nat + nval - nnval - doff + nzip;
 	return 0;
 }
 
+static void mdb_entry_zipfree(Operation *op, Ecount *eh)
+{
+	Ezip *z;
+
+	while ((z = eh->zip)) {
+		eh->zip = z->next;
+		op->o_tmpfree(z, op->o_tmpmemctx);
+	}
+}
+
 /* Flag bits for an encoded attribute */
 #define MDB_AT_SORTED	(1U<<(sizeof(unsigned int)*CHAR_BIT-1))
 	/* the values are in sorted order */
 #define MDB_AT_MULTI	(1<<(sizeof(unsigned int)*CHAR_BIT-2))
 	/* the values of this multi-valued attr are stored separately */
 
+#define MDB_AT_ZIPPED	(1<<(sizeof(unsigned int)*CHAR_BIT-3))
+	/* the values of this attr are compressed */
+
+#define MDB_AT_RUNS	(1<<(sizeof(unsigned int)*CHAR_BIT-4))
+	/* the separately stored values are in sorted runs */
+
 #define MDB_AT_NVALS	(1U<<(sizeof(unsigned int)*CHAR_BIT-1))
 	/* this attribute has normalized values */
 
+#define MDB_EN_EXPAND	(1U<<(sizeof(unsigned int)*CHAR_BIT-1))
+	/* some attrs of this entry are compressed or in runs */
+
 /* Flatten an Entry into a buffer. The buffer starts with the count of the
  * number of attributes in the entry, the total number of values in the
  * entry, and the e_ocflags. It then contains a list of integers for each
@@ -921,7 +1102,10 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
  * matching AttributeDescription, followed by the number of values in the
  * attribute. If the MDB_AT_SORTED bit of the attr index is set, the
  * attribute's values are already sorted. If the MDB_AT_MULTI bit of the
- * attr index is set, the values are stored separately.
+ * attr index is set, the values are stored separately, and if the
+ * MDB_AT_RUNS bit is also set they are stored in sorted runs.
+ * If the MDB_AT_ZIPPED bit of the attr index is set, the values are
+ * compressed, see below.
  *
  * If the MDB_AT_NVALS bit of numvals is set, the attribute also has
  * normalized values present. (Note - a_numvals is an unsigned int, so this
@@ -934,12 +1118,21 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
  * with a NUL terminator after each value.
  * The buffer is padded to the sizeof(ID). The entire buffer size is
  * precomputed so that a single malloc can be performed.
+ *
+ * If any attribute is compressed or in runs, the MDB_EN_EXPAND bit of
+ * the count of attributes is set, and the integer after the e_ocflags
+ * and the offset gives the room their values need once expanded.
+ * The lengths of the values of a compressed attribute are listed as
+ * usual, followed by the size of the compressed block, and the block
+ * takes the place of the values. It expands to the values with their
+ * NUL terminators, as they would be stored otherwise.
  */
 static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	ber_len_t i;
 	Attribute *a;
+	Ezip *z = eh->zip;
 	unsigned char *ptr;
 	unsigned int *lp, l;
 
@@ -951,11 +1144,13 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
 		;	/* empty */
 
 	lp = (unsigned int *)data->mv_data;
-	*lp++ = eh->nattrs;
+	*lp++ = eh->nattrs | (eh->zlen ? MDB_EN_EXPAND : 0);
 	*lp++ = eh->nvals;
 	*lp++ = (unsigned int)e->e_ocflags;
 	*lp++ = eh->offset;
 	ptr = (unsigned char *)(lp + eh->offset);
+	if (eh->zlen)
+		*lp++ = eh->zlen;
 
 	for (a=e->e_attrs; a; a=a->a_next) {
 		if (!a->a_desc->ad_index)
@@ -963,8 +1158,12 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
 		l = mdb->mi_adxs[a->a_desc->ad_index];
 		if (a->a_flags & SLAP_ATTR_BIG_MULTI)
 			l |= MDB_AT_MULTI;
+		if (a->a_flags & SLAP_ATTR_BIG_RUNS)
+			l |= MDB_AT_RUNS;
 		if (a->a_flags & SLAP_ATTR_SORTED_VALS)
 			l |= MDB_AT_SORTED;
+		if (z && z->attr == a)
+			l |= MDB_AT_ZIPPED;
 		*lp++ = l;
 		l = a->a_numvals;
 		if (a->a_nvals != a->a_vals)
@@ -972,6 +1171,16 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
 		*lp++ = l;
 		if (a->a_flags & SLAP_ATTR_BIG_MULTI) {
 			continue;
+		} else if (z && z->attr == a) {
+			for (i=0; i<a->a_numvals; i++)
+				*lp++ = a->a_vals[i].bv_len;
+			if (a->a_nvals != a->a_vals)
+				for (i=0; i<a->a_numvals; i++)
+					*lp++ = a->a_nvals[i].bv_len;
+			*lp++ = z->len;
+			memcpy(ptr, z->data, z->len);
+			ptr += z->len;
+			z = z->next;
 		} else {
 			if (a->a_vals) {
 				for (i=0; a->a_vals[i].bv_val; i++);
@@ -1007,9 +1216,12 @@ static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data, Ecount *eh)
  * Note: everything is stored in a single contiguous block, so
  * you can not free individual attributes or names from this
  * structure. Attempting to do so will likely corrupt memory.
+ *
+ * If aw is set, only the attributes it asks for are set up, the
+ * values of the others are skipped without being looked at.
  */
-
-int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **e)
+static int mdb_entry_decode_aw(Operation *op, MDB_txn *txn, MDB_val *data, ID id,
+	mdb_attrwant *aw, Entry **e)
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	int i, j, nattrs, nvals;
@@ -1018,7 +1230,8 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 	Entry *x;
 	const char *text;
 	unsigned int *lp = (unsigned int *)data->mv_data;
-	unsigned char *ptr;
+	unsigned char *ptr, *vptr, *zptr = NULL;
+	ber_len_t zlen = 0;
 	BerVarray bptr;
 	MDB_cursor *mvc = NULL;
 
@@ -1026,19 +1239,27 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 		"=> mdb_entry_decode:\n" );
 
 	nattrs = *lp++;
+	if (nattrs & MDB_EN_EXPAND) {
+		nattrs ^= MDB_EN_EXPAND;
+		zlen = lp[3];
+	}
 	nvals = *lp++;
-	x = mdb_entry_alloc(op, nattrs, nvals);
+	x = mdb_entry_alloc(op, nattrs, nvals, zlen);
 	x->e_ocflags = *lp++;
 	if (!nvals) {
 		goto done;
 	}
 	a = x->e_attrs;
 	bptr = a->a_vals;
+	if (zlen)
+		zptr = (unsigned char *)(bptr + nvals);
 	i = *lp++;
 	ptr = (unsigned char *)(lp + i);
+	if (zlen)
+		lp++;
 
 	for (;nattrs>0; nattrs--) {
-		int have_nval = 0, multi = 0;
+		int have_nval = 0, multi = 0, zipped = 0;
 		a->a_flags = SLAP_ATTR_DONT_FREE_DATA | SLAP_ATTR_DONT_FREE_VALS;
 		i = *lp++;
 		if (i & MDB_AT_SORTED) {
@@ -1050,6 +1271,14 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 			a->a_flags |= SLAP_ATTR_BIG_MULTI;
 			multi = 1;
 		}
+		if (i & MDB_AT_ZIPPED) {
+			i ^= MDB_AT_ZIPPED;
+			zipped = 1;
+		}
+		if (i & MDB_AT_RUNS) {
+			i ^= MDB_AT_RUNS;
+			a->a_flags |= SLAP_ATTR_BIG_RUNS;
+		}
 		if (i > mdb->mi_numads) {
 			rc = mdb_ad_read(mdb, txn);
 			if (rc)
@@ -1068,6 +1297,22 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 			a->a_numvals ^= MDB_AT_NVALS;
 			have_nval = 1;
 		}
+		if (aw && !mdb_attrwant_test(aw, i, a->a_desc)) {
+			/* step over the values, multi ones aren't here */
+			if (!multi) {
+				j = a->a_numvals;
+				if (have_nval)
+					j <<= 1;
+				if (zipped) {
+					lp += j;
+					ptr += *lp++;
+				} else {
+					for (; j>0; j--)
+						ptr += *lp++ + 1;
+				}
+			}
+			continue;
+		}
 		a->a_vals = bptr;
 		if (multi) {
 			if (!mvc) {
@@ -1076,15 +1321,47 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 					goto leave;
 			}
 			i = a->a_numvals;
-			mdb_mval_get(op, mvc, id, a, have_nval);
+			if (a->a_flags & SLAP_ATTR_BIG_RUNS) {
+				rc = mdb_mvrun_get(op, mvc, id, a, have_nval, &zptr, &zlen);
+				if (rc) {
+					Debug( LDAP_DEBUG_ANY,
+						"mdb_entry_decode: damaged runs of %s in entry %lu\n",
+						a->a_desc->ad_cname.bv_val, (unsigned long) id );
+					rc = LDAP_OTHER;
+					goto leave;
+				}
+			} else {
+				mdb_mval_get(op, mvc, id, a, have_nval);
+			}
 			bptr += i + 1;
 			if (have_nval)
 				bptr += i + 1;
 		} else {
+			vptr = ptr;
+			if (zipped) {
+				/* expand the values into the space after the bervals */
+				ber_len_t rlen = 0;
+				j = a->a_numvals;
+				if (have_nval)
+					j <<= 1;
+				for (i=0; i<j; i++)
+					rlen += lp[i] + 1;
+				if (rlen > zlen || mdb_zip_unpack(ptr, lp[j], zptr, rlen)) {
+					Debug( LDAP_DEBUG_ANY,
+						"mdb_entry_decode: damaged compressed values of %s in entry %lu\n",
+						a->a_desc->ad_cname.bv_val, (unsigned long) id );
+					rc = LDAP_OTHER;
+					goto leave;
+				}
+				ptr += lp[j];
+				vptr = zptr;
+				zptr += rlen;
+				zlen -= rlen;
+			}
 			for (i=0; i<a->a_numvals; i++) {
 				bptr->bv_len = *lp++;
-				bptr->bv_val = (char *)ptr;
-				ptr += bptr->bv_len+1;
+				bptr->bv_val = (char *)vptr;
+				vptr += bptr->bv_len+1;
 				bptr++;
 			}
 			bptr->bv_val = NULL;
@@ -1095,8 +1372,8 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 				a->a_nvals = bptr;
 				for (i=0; i<a->a_numvals; i++) {
 					bptr->bv_len = *lp++;
-					bptr->bv_val = (char *)ptr;
-					ptr += bptr->bv_len+1;
+					bptr->bv_val = (char *)vptr;
+					vptr += bptr->bv_len+1;
 					bptr++;
 				}
 				bptr->bv_val = NULL;
@@ -1105,6 +1382,10 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 			} else {
 				a->a_nvals = a->a_vals;
 			}
+			if (zipped)
+				lp++;	/* compressed size */
+			else
+				ptr = vptr;
 		}
 
 		/* FIXME: This is redundant once a sorted entry is saved into the DB */
@@ -1124,7 +1405,10 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 		a->a_next = a+1;
 		a = a->a_next;
 	}
-	a[-1].a_next = NULL;
+	if (a == x->e_attrs)
+		x->e_attrs = NULL;
+	else
+		a[-1].a_next = NULL;
 done:
 	Debug(LDAP_DEBUG_TRACE, "<= mdb_entry_decode\n" );
 	*e = x;
@@ -1135,3 +1419,17 @@ leave:
 		mdb_cursor_close(mvc);
 	return rc;
 }
+
+int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **e)
+{
+	return mdb_entry_decode_aw(op, txn, data, id, NULL, e);
+}
+
+/* Decode only the attributes a search can look at. The entry must not
+ * be passed on to anything that didn't set up aw.
+ */
+int mdb_entry_partial(Operation *op, MDB_txn *txn, MDB_val *data, ID id,
+	mdb_attrwant *aw, Entry **e)
+{
+	return mdb_entry_decode_aw(op, txn, data, id, aw, e);
+}
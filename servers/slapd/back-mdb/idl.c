@@ -21,6 +21,7 @@
 
 #include "back-mdb.h"
 #include "idl.h"
+#include "idlmerge.h"
 
 unsigned int MDB_idl_logn = MDB_IDL_LOGN;
 unsigned int MDB_idl_db_size = 1 << MDB_IDL_LOGN;
@@ -37,6 +38,13 @@ static void idl_check( ID *ids )
 {
 	if( MDB_IDL_IS_RANGE( ids ) ) {
 		assert( MDB_IDL_RANGE_FIRST(ids) <= MDB_IDL_RANGE_LAST(ids) );
+	} else if( MDB_IDL_IS_RUNS( ids ) ) {
+		ID i;
+		for( i=0; i < MDB_IDL_RUNS_N(ids); i++ ) {
+			assert( MDB_IDL_RUN_LO(ids, i) <= MDB_IDL_RUN_HI(ids, i) );
+			if ( i )
+				assert( MDB_IDL_RUN_LO(ids, i) > MDB_IDL_RUN_HI(ids, i-1) + 1 );
+		}
 	} else {
 		ID i;
 		for( i=1; i < ids[0]; i++ ) {
@@ -54,6 +62,21 @@ static void idl_dump( ID *ids )
 			(long) MDB_IDL_RANGE_FIRST( ids ),
 			(long) MDB_IDL_RANGE_LAST( ids ) );
 
+	} else if( MDB_IDL_IS_RUNS( ids ) ) {
+		ID i;
+		Debug( LDAP_DEBUG_ANY, "IDL: runs %ld", (long) MDB_IDL_RUNS_N( ids ) );
+
+		for( i=0; i<MDB_IDL_RUNS_N( ids ); i++ ) {
+			if( i % 8 == 0 ) {
+				Debug( LDAP_DEBUG_ANY, "\n" );
+			}
+			Debug( LDAP_DEBUG_ANY, "  %02lx-%02lx",
+				(long) MDB_IDL_RUN_LO( ids, i ),
+				(long) MDB_IDL_RUN_HI( ids, i ) );
+		}
+
+		Debug( LDAP_DEBUG_ANY, "\n" );
+
 	} else {
 		ID i;
 		Debug( LDAP_DEBUG_ANY, "IDL: size %ld", (long) ids[0] );
@@ -93,36 +116,11 @@ unsigned mdb_idl_search( ID *ids, ID id )
 	 * if found, returns position of id
 	 * if not found, returns first postion greater than id
 	 */
-	unsigned base = 0;
-	unsigned cursor = 1;
-	int val = 0;
-	unsigned n = ids[0];
-
 #if IDL_DEBUG > 0
 	idl_check( ids );
 #endif
 
-	while( 0 < n ) {
-		unsigned pivot = n >> 1;
-		cursor = base + pivot + 1;
-		val = IDL_CMP( id, ids[cursor] );
-
-		if( val < 0 ) {
-			n = pivot;
-
-		} else if ( val > 0 ) {
-			base = cursor;
-			n -= pivot + 1;
-
-		} else {
-			return cursor;
-		}
-	}
-	
-	if( val > 0 ) {
-		++cursor;
-	}
-	return cursor;
+	return mdb_idk_search( ids+1, ids[0], id ) + 1;
 
 #else
 	/* (reverse) linear search */
@@ -142,6 +140,206 @@ unsigned mdb_idl_search( ID *ids, ID id )
 #endif
 }
 
+ID mdb_idl_runs_count( ID *ids )
+{
+	ID i, n = 0;
+
+	for ( i=0; i<MDB_IDL_RUNS_N( ids ); i++ )
+		n += MDB_IDL_RUN_HI( ids, i ) - MDB_IDL_RUN_LO( ids, i ) + 1;
+	return n;
+}
+
+unsigned mdb_idl_runs_search( ID *ids, ID id )
+{
+	/*
+	 * binary search on the upper bound of each run
+	 * returns index of the first run whose hi >= id,
+	 * or the number of runs if there is none
+	 */
+	unsigned base = 0;
+	unsigned n = MDB_IDL_RUNS_N( ids );
+
+	while( 0 < n ) {
+		unsigned pivot = n >> 1;
+		if ( MDB_IDL_RUN_HI( ids, base + pivot ) < id ) {
+			base += pivot + 1;
+			n -= pivot + 1;
+		} else {
+			n = pivot;
+		}
+	}
+	return base;
+}
+
+/* Walk any kind of IDL as a sequence of [lo,hi] runs.
+ * Consecutive IDs in a plain list are folded into one run.
+ */
+typedef struct idl_runiter {
+	ID *ids;
+	ID pos;
+	ID lo, hi;
+} idl_runiter;
+
+static int
+idl_run_next( idl_runiter *ri )
+{
+	ID *ids = ri->ids;
+
+	if ( MDB_IDL_IS_RANGE( ids )) {
+		if ( ri->pos )
+			return 0;
+		ri->pos = 1;
+		ri->lo = MDB_IDL_RANGE_FIRST( ids );
+		ri->hi = MDB_IDL_RANGE_LAST( ids );
+		return 1;
+	}
+	if ( MDB_IDL_IS_RUNS( ids )) {
+		if ( ri->pos >= MDB_IDL_RUNS_N( ids ))
+			return 0;
+		ri->lo = MDB_IDL_RUN_LO( ids, ri->pos );
+		ri->hi = MDB_IDL_RUN_HI( ids, ri->pos );
+		ri->pos++;
+		return 1;
+	}
+	if ( ri->pos >= ids[0] )
+		return 0;
+	ri->lo = ri->hi = ids[++ri->pos];
+	while ( ri->pos < ids[0] && ids[ri->pos+1] == ri->hi + 1 ) {
+		ri->hi++;
+		ri->pos++;
+	}
+	return 1;
+}
+
+static int
+idl_run_first( idl_runiter *ri, ID *ids )
+{
+	ri->ids = ids;
+	ri->pos = 0;
+	if ( MDB_IDL_IS_ZERO( ids ))
+		return 0;
+	return idl_run_next( ri );
+}
+
+/* Accumulate an ordered sequence of runs. With a NULL output
+ * buffer only the number of runs and IDs are counted.
+ */
+typedef struct idl_runbuf {
+	ID *out;
+	ID nruns;
+	ID count;
+	ID first, last;
+} idl_runbuf;
+
+static void
+idl_run_emit( idl_runbuf *rb, ID lo, ID hi )
+{
+	if ( rb->nruns && lo <= rb->last + 1 ) {
+		/* overlaps or adjoins the previous run */
+		if ( hi <= rb->last )
+			return;
+		rb->count += hi - rb->last;
+		rb->last = hi;
+		if ( rb->out )
+			MDB_IDL_RUN_HI( rb->out, rb->nruns-1 ) = hi;
+		return;
+	}
+	if ( !rb->nruns )
+		rb->first = lo;
+	if ( rb->out ) {
+		MDB_IDL_RUN_LO( rb->out, rb->nruns ) = lo;
+		MDB_IDL_RUN_HI( rb->out, rb->nruns ) = hi;
+	}
+	rb->nruns++;
+	rb->count += hi - lo + 1;
+	rb->last = hi;
+}
+
+#define IDL_RUNS_AND	0
+#define IDL_RUNS_OR	1
+
+static void
+idl_runs_merge( ID *a, ID *b, int type, idl_runbuf *rb )
+{
+	idl_runiter ra, rb2;
+	int va, vb;
+
+	rb->nruns = rb->count = 0;
+	va = idl_run_first( &ra, a );
+	vb = idl_run_first( &rb2, b );
+
+	switch( type ) {
+	case IDL_RUNS_AND:
+		while ( va && vb ) {
+			ID lo = IDL_MAX( ra.lo, rb2.lo );
+			ID hi = IDL_MIN( ra.hi, rb2.hi );
+			if ( lo <= hi )
+				idl_run_emit( rb, lo, hi );
+			if ( ra.hi < rb2.hi )
+				va = idl_run_next( &ra );
+			else
+				vb = idl_run_next( &rb2 );
+		}
+		break;
+
+	case IDL_RUNS_OR:
+		while ( va || vb ) {
+			if ( vb && ( !va || rb2.lo < ra.lo )) {
+				idl_run_emit( rb, rb2.lo, rb2.hi );
+				vb = idl_run_next( &rb2 );
+			} else {
+				idl_run_emit( rb, ra.lo, ra.hi );
+				va = idl_run_next( &ra );
+			}
+		}
+		break;
+	}
+}
+
+/* Store the result of a run merge in the most compact form that
+ * still fits: a plain list if small enough, else a run-length IDL,
+ * and only as a last resort a range.
+ */
+static void
+idl_runs_store( Operation *op, ID *a, ID *b, int type )
+{
+	idl_runbuf rb;
+	ID *out, i, j, k;
+
+	rb.out = NULL;
+	idl_runs_merge( a, b, type, &rb );
+
+	if ( !rb.nruns ) {
+		a[0] = 0;
+		return;
+	}
+	if ( rb.nruns == 1 ) {
+		MDB_IDL_RANGE( a, rb.first, rb.last );
+		return;
+	}
+	if ( rb.count > MDB_idl_db_max && rb.nruns > MDB_IDL_RUNS_MAX ) {
+		MDB_IDL_RANGE( a, rb.first, rb.last );
+		return;
+	}
+
+	out = op->o_tmpalloc(( 2 * rb.nruns + 1 ) * sizeof(ID), op->o_tmpmemctx );
+	rb.out = out;
+	idl_runs_merge( a, b, type, &rb );
+
+	if ( rb.count <= MDB_idl_db_max ) {
+		k = 0;
+		for ( i=0; i<rb.nruns; i++ ) {
+			for ( j = MDB_IDL_RUN_LO( out, i ); j <= MDB_IDL_RUN_HI( out, i ); j++ )
+				a[++k] = j;
+		}
+		a[0] = k;
+	} else {
+		out[0] = rb.nruns | MDB_IDL_RUNS_FLAG;
+		AC_MEMCPY( a, out, MDB_IDL_SIZEOF( out ));
+	}
+	op->o_tmpfree( out, op->o_tmpmemctx );
+}
+
 int mdb_idl_insert( ID *ids, ID id )
 {
 	unsigned x;
@@ -164,6 +362,37 @@ int mdb_idl_insert( ID *ids, ID id )
 		return 0;
 	}
 
+	if (MDB_IDL_IS_RUNS( ids )) {
+		ID n = MDB_IDL_RUNS_N( ids );
+
+		x = mdb_idl_runs_search( ids, id );
+		if ( x < n && id >= MDB_IDL_RUN_LO( ids, x ))
+			return -1;
+		if ( x > 0 && MDB_IDL_RUN_HI( ids, x-1 ) + 1 == id ) {
+			/* extend previous run, join with next one if they touch */
+			MDB_IDL_RUN_HI( ids, x-1 ) = id;
+			if ( x < n && MDB_IDL_RUN_LO( ids, x ) == id + 1 ) {
+				MDB_IDL_RUN_HI( ids, x-1 ) = MDB_IDL_RUN_HI( ids, x );
+				AC_MEMCPY( &MDB_IDL_RUN_LO( ids, x ), &MDB_IDL_RUN_LO( ids, x+1 ),
+					2 * (n-x-1) * sizeof(ID) );
+				ids[0]--;
+			}
+		} else if ( x < n && MDB_IDL_RUN_LO( ids, x ) == id + 1 ) {
+			MDB_IDL_RUN_LO( ids, x ) = id;
+		} else if ( n >= MDB_IDL_RUNS_MAX ) {
+			ID lo = IDL_MIN( id, MDB_IDL_RUN_LO( ids, 0 ));
+			ID hi = IDL_MAX( id, MDB_IDL_RUN_HI( ids, n-1 ));
+			MDB_IDL_RANGE( ids, lo, hi );
+		} else {
+			AC_MEMCPY( &MDB_IDL_RUN_LO( ids, x+1 ), &MDB_IDL_RUN_LO( ids, x ),
+				2 * (n-x) * sizeof(ID) );
+			MDB_IDL_RUN_LO( ids, x ) = id;
+			MDB_IDL_RUN_HI( ids, x ) = id;
+			ids[0]++;
+		}
+		return 0;
+	}
+
 	x = mdb_idl_search( ids, id );
 	assert( x > 0 );
 
@@ -203,6 +432,10 @@ int mdb_idl_insert( ID *ids, ID id )
 	return 0;
 }
 
+#if 0
+/* Nothing deletes from an IDL in memory, the index writers delete
+ * from the DB directly. Kept with mdb_idl_notin, below.
+ */
 static int mdb_idl_delete( ID *ids, ID id )
 {
 	unsigned x;
@@ -230,6 +463,34 @@ static int mdb_idl_delete( ID *ids, ID id )
 		return 0;
 	}
 
+	if (MDB_IDL_IS_RUNS( ids )) {
+		ID n = MDB_IDL_RUNS_N( ids );
+
+		x = mdb_idl_runs_search( ids, id );
+		if ( x >= n || id < MDB_IDL_RUN_LO( ids, x ))
+			return -1;
+		if ( MDB_IDL_RUN_LO( ids, x ) == MDB_IDL_RUN_HI( ids, x )) {
+			AC_MEMCPY( &MDB_IDL_RUN_LO( ids, x ), &MDB_IDL_RUN_LO( ids, x+1 ),
+				2 * (n-x-1) * sizeof(ID) );
+			ids[0]--;
+		} else if ( MDB_IDL_RUN_LO( ids, x ) == id ) {
+			MDB_IDL_RUN_LO( ids, x )++;
+		} else if ( MDB_IDL_RUN_HI( ids, x ) == id ) {
+			MDB_IDL_RUN_HI( ids, x )--;
+		} else if ( n < MDB_IDL_RUNS_MAX ) {
+			/* split the run */
+			AC_MEMCPY( &MDB_IDL_RUN_LO( ids, x+1 ), &MDB_IDL_RUN_LO( ids, x ),
+				2 * (n-x) * sizeof(ID) );
+			MDB_IDL_RUN_HI( ids, x ) = id - 1;
+			MDB_IDL_RUN_LO( ids, x+1 ) = id + 1;
+			ids[0]++;
+		}
+		/* else no room to split, deleting is a no-op like in a range */
+		if ( MDB_IDL_RUNS_N( ids ) == 1 )
+			MDB_IDL_RANGE( ids, MDB_IDL_RUN_LO( ids, 0 ), MDB_IDL_RUN_HI( ids, 0 ));
+		return 0;
+	}
+
 	x = mdb_idl_search( ids, id );
 	assert( x > 0 );
 
@@ -259,6 +520,7 @@ static int mdb_idl_delete( ID *ids, ID id )
 
 	return 0;
 }
+#endif
 
 static char *
 mdb_show_key(
@@ -288,7 +550,7 @@ mdb_idl_fetch_key(
 	MDB_val data, key2, *kptr;
 	MDB_cursor *cursor;
 	ID *i;
-	size_t len;
+	size_t len, count;
 	int rc;
 	MDB_cursor_op opflag;
 
@@ -349,6 +611,55 @@ mdb_idl_fetch_key(
 		rc = MDB_NOTFOUND;
 	}
 	if (rc == 0) {
+		rc = mdb_cursor_count( cursor, &count );
+	}
+	if (rc == 0 && count > MDB_idl_db_max) {
+		/* Too many IDs for a list, fold them into runs */
+		ID n = 0, lo = 0, hi = 0, *ptr = NULL, *end = NULL;
+
+		rc = mdb_cursor_get( cursor, key, &data, MDB_GET_MULTIPLE );
+		while (rc == 0) {
+			ptr = data.mv_data;
+			end = ptr + data.mv_size / sizeof(ID);
+			for (; ptr < end; ptr++) {
+				if ( n && *ptr == hi + 1 ) {
+					hi++;
+					continue;
+				}
+				if ( n ) {
+					MDB_IDL_RUN_HI( ids, n-1 ) = hi;
+					if ( n >= MDB_IDL_RUNS_MAX )
+						break;
+				}
+				lo = hi = *ptr;
+				MDB_IDL_RUN_LO( ids, n ) = lo;
+				n++;
+			}
+			if ( ptr < end )
+				break;
+			rc = mdb_cursor_get( cursor, key, &data, MDB_NEXT_MULTIPLE );
+		}
+		if ( rc == MDB_NOTFOUND ) rc = 0;
+		if ( rc == 0 ) {
+			MDB_IDL_RUN_HI( ids, n-1 ) = hi;
+			if ( ptr < end ) {
+				/* Too fragmented, fall back to a range */
+				lo = MDB_IDL_RUN_LO( ids, 0 );
+				rc = mdb_cursor_get( cursor, key, &data, MDB_LAST_DUP );
+				if ( rc == 0 ) {
+					memcpy( &hi, data.mv_data, sizeof(ID) );
+					MDB_IDL_RANGE( ids, lo, hi );
+				}
+			} else if ( n == 1 ) {
+				MDB_IDL_RANGE( ids, lo, hi );
+			} else {
+				ids[0] = n | MDB_IDL_RUNS_FLAG;
+			}
+		}
+		Debug( LDAP_DEBUG_ARGS, "mdb_idl_fetch_key: "
+			"%ld IDs in %ld runs\n", (long) count, (long) n );
+		data.mv_size = MDB_IDL_SIZEOF(ids);
+	} else if (rc == 0) {
 		i = ids+1;
 		rc = mdb_cursor_get( cursor, key, &data, MDB_GET_MULTIPLE );
 		while (rc == 0) {
@@ -406,18 +717,162 @@ mdb_idl_fetch_key(
 	return rc;
 }
 
+/* Count the IDs stored under a key without reading them all,
+ * for estimating filter selectivity. Returns MDB_NOTFOUND if
+ * the key doesn't exist.
+ */
+int
+mdb_idl_count_key(
+	MDB_txn		*txn,
+	MDB_dbi		dbi,
+	MDB_val		*key,
+	ID			*count )
+{
+	MDB_cursor *cursor;
+	MDB_val data;
+	size_t n = 0;
+	ID lo, hi;
+	int rc;
+
+	rc = mdb_cursor_open( txn, dbi, &cursor );
+	if ( rc )
+		return rc;
+
+	rc = mdb_cursor_get( cursor, key, &data, MDB_SET );
+	if ( rc == 0 ) {
+		memcpy( &lo, data.mv_data, sizeof(ID) );
+		rc = mdb_cursor_count( cursor, &n );
+	}
+	/* On disk, a range is denoted by 0 in the first element */
+	if ( rc == 0 && lo == 0 && n == MDB_IDL_RANGE_SIZE ) {
+		rc = mdb_cursor_get( cursor, key, &data, MDB_NEXT_DUP );
+		if ( rc == 0 ) {
+			memcpy( &lo, data.mv_data, sizeof(ID) );
+			rc = mdb_cursor_get( cursor, key, &data, MDB_LAST_DUP );
+		}
+		if ( rc == 0 ) {
+			memcpy( &hi, data.mv_data, sizeof(ID) );
+			n = hi - lo + 1;
+		}
+	}
+	mdb_cursor_close( cursor );
+
+	*count = rc ? 0 : n;
+	return rc;
+}
+
+/* Walk an index database and tally up its keys and slots, to seed
+ * the statistics that the index writers keep up to date.
+ */
+int
+mdb_idl_stats(
+	MDB_txn		*txn,
+	MDB_dbi		dbi,
+	mdb_idxstats	*st )
+{
+	MDB_cursor *cursor;
+	MDB_val key, data;
+	size_t n;
+	ID lo;
+	int rc;
+
+	st->is_keys = st->is_ids = st->is_ranges = 0;
+
+	rc = mdb_cursor_open( txn, dbi, &cursor );
+	if ( rc )
+		return rc;
+
+	while (( rc = mdb_cursor_get( cursor, &key, &data, MDB_NEXT_NODUP )) == 0 ) {
+		memcpy( &lo, data.mv_data, sizeof(ID) );
+		rc = mdb_cursor_count( cursor, &n );
+		if ( rc )
+			break;
+		st->is_keys++;
+		if ( lo == 0 && n == MDB_IDL_RANGE_SIZE )
+			st->is_ranges++;
+		else
+			st->is_ids += n;
+	}
+	mdb_cursor_close( cursor );
+
+	if ( rc == MDB_NOTFOUND )
+		rc = 0;
+	return rc;
+}
+
+/* The stored statistics of an index, MDB_NOTFOUND if there are none */
+int
+mdb_idxstats_get(
+	MDB_txn		*txn,
+	struct mdb_info	*mdb,
+	AttrInfo	*ai,
+	mdb_idxstats	*st )
+{
+	MDB_val key, data;
+	int rc;
+
+	if ( !mdb->mi_idxstats )
+		return MDB_NOTFOUND;
+
+	key.mv_data = ai->ai_desc->ad_type->sat_cname.bv_val;
+	key.mv_size = ai->ai_desc->ad_type->sat_cname.bv_len;
+	rc = mdb_get( txn, mdb->mi_idxstats, &key, &data );
+	if ( rc == 0 ) {
+		if ( data.mv_size != sizeof(*st) )
+			return MDB_NOTFOUND;
+		memcpy( st, data.mv_data, sizeof(*st) );
+	}
+	return rc;
+}
+
+int
+mdb_idxstats_put(
+	MDB_txn		*txn,
+	struct mdb_info	*mdb,
+	AttrInfo	*ai,
+	mdb_idxstats	*st )
+{
+	MDB_val key, data;
+
+	key.mv_data = ai->ai_desc->ad_type->sat_cname.bv_val;
+	key.mv_size = ai->ai_desc->ad_type->sat_cname.bv_len;
+	data.mv_data = st;
+	data.mv_size = sizeof(*st);
+	return mdb_put( txn, mdb->mi_idxstats, &key, &data, 0 );
+}
+
+/* Count an index from scratch and store the result. Used when an
+ * index is opened without stored statistics, i.e. after the tools
+ * have written to it, and when an online index build finishes.
+ */
+int
+mdb_idxstats_scan(
+	MDB_txn		*txn,
+	struct mdb_info	*mdb,
+	AttrInfo	*ai )
+{
+	mdb_idxstats st;
+	int rc;
+
+	rc = mdb_idl_stats( txn, ai->ai_dbi, &st );
+	if ( rc == 0 )
+		rc = mdb_idxstats_put( txn, mdb, ai, &st );
+	return rc;
+}
+
 int
 mdb_idl_insert_keys(
 	BackendDB	*be,
 	MDB_cursor	*cursor,
 	struct berval *keys,
-	ID			id )
+	ID			id,
+	mdb_idxstats	*st )
 {
 	struct mdb_info *mdb = be->be_private;
 	MDB_val key, data;
 	ID lo, hi, *i;
 	char *err;
-	int	rc = 0, k;
+	int	rc = 0, k, newkey;
 	unsigned int flag = MDB_NODUPDATA;
 #ifndef	MISALIGNED_OK
 	int kbuf[2];
@@ -464,7 +919,8 @@ mdb_idl_insert_keys(
 				err = "c_count";
 				goto fail;
 			}
-			if ( count >= MDB_idl_db_max ) {
+			/* with idlruns, slots never collapse and are read back as runs */
+			if ( count >= MDB_idl_db_max && !mdb->mi_idl_runs ) {
 			/* No room, convert to a range */
 				lo = *i;
 				rc = mdb_cursor_get( cursor, &key, &data, MDB_LAST_DUP );
@@ -486,6 +942,8 @@ mdb_idl_insert_keys(
 					err = "c_del dups";
 					goto fail;
 				}
+				MDB_STAT_SUB( st->is_ids, count );
+				st->is_ranges++;
 				/* Store the range */
 				data.mv_size = sizeof(ID);
 				data.mv_data = &id;
@@ -511,6 +969,7 @@ mdb_idl_insert_keys(
 			/* There's room, just store it */
 				if (id == mdb->mi_nextid)
 					flag |= MDB_APPENDDUP;
+				newkey = 0;
 				goto put1;
 			}
 		} else {
@@ -546,12 +1005,17 @@ mdb_idl_insert_keys(
 		}
 	} else if ( rc == MDB_NOTFOUND ) {
 		flag &= ~MDB_APPENDDUP;
+		newkey = 1;
 put1:	data.mv_data = &id;
 		data.mv_size = sizeof(ID);
 		rc = mdb_cursor_put( cursor, &key, &data, flag );
 		/* Don't worry if it's already there */
-		if ( rc == MDB_KEYEXIST )
+		if ( rc == MDB_KEYEXIST ) {
 			rc = 0;
+		} else if ( rc == 0 ) {
+			st->is_keys += newkey;
+			st->is_ids++;
+		}
 		if ( rc ) {
 			err = "c_put id";
 			goto fail;
@@ -572,7 +1036,8 @@ mdb_idl_delete_keys(
 	BackendDB	*be,
 	MDB_cursor	*cursor,
 	struct berval *keys,
-	ID			id )
+	ID			id,
+	mdb_idxstats	*st )
 {
 	int	rc = 0, k;
 	MDB_val key, data;
@@ -616,17 +1081,26 @@ mdb_idl_delete_keys(
 		i = data.mv_data;
 		if ( tmp != 0 ) {
 			/* Not a range, just delete it */
+			size_t count;
 			data.mv_data = &id;
 			rc = mdb_cursor_get( cursor, &key, &data, MDB_GET_BOTH );
 			if ( rc != 0 ) {
 				err = "c_get id";
 				goto fail;
 			}
+			rc = mdb_cursor_count( cursor, &count );
+			if ( rc != 0 ) {
+				err = "c_count";
+				goto fail;
+			}
 			rc = mdb_cursor_del( cursor, 0 );
 			if ( rc != 0 ) {
 				err = "c_del id";
 				goto fail;
 			}
+			if ( count == 1 )
+				MDB_STAT_SUB( st->is_keys, 1 );
+			MDB_STAT_SUB( st->is_ids, 1 );
 		} else {
 			/* It's a range, see if we need to rewrite
 			 * the boundaries
@@ -668,6 +1142,9 @@ mdb_idl_delete_keys(
 						err = "c_del dup2";
 						goto fail;
 					}
+					/* the other bound is left as a plain ID */
+					MDB_STAT_SUB( st->is_ranges, 1 );
+					st->is_ids++;
 				} else {
 					/* position on lo */
 					rc = mdb_cursor_get( cursor, &key, &data, MDB_NEXT_DUP );
@@ -709,12 +1186,12 @@ fail:
  */
 int
 mdb_idl_intersection(
+	Operation *op,
 	ID *a,
 	ID *b )
 {
-	ID ida, idb;
 	ID idmax, idmin;
-	ID cursora = 0, cursorb = 0, cursorc;
+	ID cursora, cursorb, cursorc;
 	int swap = 0;
 
 	if ( MDB_IDL_IS_ZERO( a ) || MDB_IDL_IS_ZERO( b ) ) {
@@ -733,6 +1210,11 @@ mdb_idl_intersection(
 		return 0;
 	}
 
+	if ( MDB_IDL_IS_RUNS( a ) || MDB_IDL_IS_RUNS( b ) ) {
+		idl_runs_store( op, a, b, IDL_RUNS_AND );
+		return 0;
+	}
+
 	if ( MDB_IDL_IS_RANGE( a ) ) {
 		if ( MDB_IDL_IS_RANGE(b) ) {
 		/* If both are ranges, just shrink the boundaries */
@@ -757,24 +1239,17 @@ mdb_idl_intersection(
 		goto done;
 	}
 
-	/* Fine, do the intersection one element at a time.
-	 * First advance to idmin in both IDLs.
-	 */
-	cursora = cursorb = idmin;
-	ida = mdb_idl_first( a, &cursora );
-	idb = mdb_idl_first( b, &cursorb );
-	cursorc = 0;
-
-	while( ida <= idmax || idb <= idmax ) {
-		if( ida == idb ) {
-			a[++cursorc] = ida;
-			ida = mdb_idl_next( a, &cursora );
-			idb = mdb_idl_next( b, &cursorb );
-		} else if ( ida < idb ) {
-			ida = mdb_idl_next( a, &cursora );
-		} else {
-			idb = mdb_idl_next( b, &cursorb );
-		}
+	if ( MDB_IDL_IS_RANGE( b ) ) {
+		/* Keep the part of the list inside the range */
+		cursora = mdb_idl_search( a, idmin );
+		cursorb = mdb_idl_search( a, idmax );
+		if ( cursorb <= a[0] && a[cursorb] == idmax )
+			cursorb++;
+		cursorc = cursorb - cursora;
+		if ( cursora > 1 )
+			AC_MEMCPY( a+1, a+cursora, cursorc * sizeof(ID) );
+	} else {
+		cursorc = mdb_idk_intersect( a+1, a[0], b+1, b[0], a+1 );
 	}
 	a[0] = cursorc;
 done:
@@ -790,11 +1265,12 @@ done:
  */
 int
 mdb_idl_union(
+	Operation *op,
 	ID	*a,
 	ID	*b )
 {
 	ID ida, idb;
-	ID cursora = 0, cursorb = 0, cursorc;
+	ID cursorc;
 
 	if ( MDB_IDL_IS_ZERO( b ) ) {
 		return 0;
@@ -806,7 +1282,7 @@ mdb_idl_union(
 	}
 
 	if ( MDB_IDL_IS_RANGE( a ) || MDB_IDL_IS_RANGE(b) ) {
-over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
+		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 		idb = IDL_MAX( MDB_IDL_LAST(a), MDB_IDL_LAST(b) );
 		a[0] = NOID;
 		a[1] = ida;
@@ -814,44 +1290,17 @@ over:		ida = IDL_MIN( MDB_IDL_FIRST(a), MDB_IDL_FIRST(b) );
 		return 0;
 	}
 
-	ida = mdb_idl_first( a, &cursora );
-	idb = mdb_idl_first( b, &cursorb );
-
-	cursorc = b[0];
-
-	/* The distinct elements of a are cat'd to b */
-	while( ida != NOID || idb != NOID ) {
-		if ( ida < idb ) {
-			if( ++cursorc > MDB_idl_um_max ) {
-				goto over;
-			}
-			b[cursorc] = ida;
-			ida = mdb_idl_next( a, &cursora );
-
-		} else {
-			if ( ida == idb )
-				ida = mdb_idl_next( a, &cursora );
-			idb = mdb_idl_next( b, &cursorb );
-		}
+	if ( MDB_IDL_IS_RUNS( a ) || MDB_IDL_IS_RUNS( b ) ) {
+runs:	idl_runs_store( op, a, b, IDL_RUNS_OR );
+		return 0;
 	}
 
-	/* b is copied back to a in sorted order */
-	a[0] = cursorc;
-	cursora = 1;
-	cursorb = 1;
-	cursorc = b[0]+1;
-	while (cursorb <= b[0] || cursorc <= a[0]) {
-		if (cursorc > a[0])
-			idb = NOID;
-		else
-			idb = b[cursorc];
-		if (cursorb <= b[0] && b[cursorb] < idb)
-			a[cursora++] = b[cursorb++];
-		else {
-			a[cursora++] = idb;
-			cursorc++;
-		}
+	cursorc = mdb_idk_union( a+1, a[0], b+1, b[0], MDB_idl_um_max );
+	if ( cursorc > MDB_idl_um_max ) {
+		/* too big for a list, try to keep it exact */
+		goto runs;
 	}
+	a[0] = cursorc;
 
 	return 0;
 }
@@ -927,6 +1376,18 @@ ID mdb_idl_first( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+	/* run-length IDLs use the ID itself as the cursor, like ranges */
+	if ( MDB_IDL_IS_RUNS( ids ) ) {
+		pos = mdb_idl_runs_search( ids, *cursor );
+		if( pos >= MDB_IDL_RUNS_N( ids ) ) {
+			return NOID;
+		}
+		if( *cursor < MDB_IDL_RUN_LO( ids, pos ) ) {
+			*cursor = MDB_IDL_RUN_LO( ids, pos );
+		}
+		return *cursor;
+	}
+
 	if ( *cursor == 0 )
 		pos = 1;
 	else
@@ -949,6 +1410,21 @@ ID mdb_idl_next( ID *ids, ID *cursor )
 		return *cursor;
 	}
 
+	if ( MDB_IDL_IS_RUNS( ids ) ) {
+		unsigned pos;
+		if ( ++(*cursor) == 0 ) {
+			return NOID;
+		}
+		pos = mdb_idl_runs_search( ids, *cursor );
+		if( pos >= MDB_IDL_RUNS_N( ids ) ) {
+			return NOID;
+		}
+		if( *cursor < MDB_IDL_RUN_LO( ids, pos ) ) {
+			*cursor = MDB_IDL_RUN_LO( ids, pos );
+		}
+		return *cursor;
+	}
+
 	if ( ++(*cursor) <= ids[0] ) {
 		return ids[*cursor];
 	}
@@ -962,6 +1438,9 @@ ID mdb_idl_next( ID *ids, ID *cursor )
  */
 int mdb_idl_append_one( ID *ids, ID id )
 {
+	if (MDB_IDL_IS_RUNS( ids )) {
+		MDB_IDL_RANGE( ids, MDB_IDL_FIRST( ids ), MDB_IDL_LAST( ids ));
+	}
 	if (MDB_IDL_IS_RANGE( ids )) {
 		/* if already in range, treat as a dup */
 		if (id >= MDB_IDL_RANGE_FIRST(ids) && id <= MDB_IDL_RANGE_LAST(ids))
@@ -1015,6 +1494,7 @@ int mdb_idl_append( ID *a, ID *b )
 	ida = MDB_IDL_LAST( a );
 	idb = MDB_IDL_LAST( b );
 	if ( MDB_IDL_IS_RANGE( a ) || MDB_IDL_IS_RANGE(b) ||
+		MDB_IDL_IS_RUNS( a ) || MDB_IDL_IS_RUNS(b) ||
 		a[0] + b[0] >= MDB_idl_um_max ) {
 		a[2] = IDL_MAX( ida, idb );
 		a[1] = IDL_MIN( a[1], b[1] );
@@ -1062,7 +1542,7 @@ mdb_idl_sort( ID *ids, ID *tmp )
 	int i,j,k,l,ir,jstack;
 	ID a, itmp;
 
-	if ( MDB_IDL_IS_RANGE( ids ))
+	if ( MDB_IDL_IS_RANGE( ids ) || MDB_IDL_IS_RUNS( ids ))
 		return;
 
 	ir = ids[0];
@@ -1141,7 +1621,7 @@ mdb_idl_sort( ID *ids, ID *tmp )
 	ID *idls[2];
 	unsigned char *maxv = (unsigned char *)&ids[size];
 
- 	if ( MDB_IDL_IS_RANGE( ids ))
+ 	if ( MDB_IDL_IS_RANGE( ids ) || MDB_IDL_IS_RUNS( ids ))
  		return;
 
 	/* Use insertion sort for small lists */
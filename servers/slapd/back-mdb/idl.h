@@ -17,6 +17,15 @@
 #ifndef _MDB_IDL_H_
 #define _MDB_IDL_H_
 
+/* idlmerge.h needs MDB_ID from midl.h, which also has simpler versions
+ * of some of the macros below. Take it in first so that ours, which
+ * know about ranges and runs, are the ones in effect.
+ */
+#include "midl.h"
+#undef MDB_IDL_SIZEOF
+#undef MDB_IDL_CPY
+#undef MDB_IDL_LAST
+
 /* IDL sizes - likely should be even bigger
  *   limiting factors: sizeof(ID), thread stack size
  */
@@ -30,8 +39,24 @@ extern unsigned int MDB_idl_um_max;
 #define MDB_IDL_IS_RANGE(ids)	((ids)[0] == NOID)
 #define MDB_IDL_RANGE_SIZE		(3)
 #define MDB_IDL_RANGE_SIZEOF	(MDB_IDL_RANGE_SIZE * sizeof(ID))
+
+/* A run-length IDL holds a sorted list of disjoint [lo,hi] runs.
+ * The first element is the number of runs with the high bit set,
+ * followed by the lo/hi pairs. It is used when an index slot is
+ * too large for a plain list but must not degrade to a range.
+ */
+#define MDB_IDL_RUNS_FLAG	((ID)1 << (sizeof(ID) * CHAR_BIT - 1))
+#define MDB_IDL_IS_RUNS(ids)	(((ids)[0] & MDB_IDL_RUNS_FLAG) \
+	&& !MDB_IDL_IS_RANGE(ids))
+#define MDB_IDL_RUNS_N(ids)		((ids)[0] & ~MDB_IDL_RUNS_FLAG)
+#define MDB_IDL_RUN_LO(ids,i)	((ids)[2*(i)+1])
+#define MDB_IDL_RUN_HI(ids,i)	((ids)[2*(i)+2])
+/* max number of runs, keeps a run IDL within DB_SIZE */
+#define MDB_IDL_RUNS_MAX	((MDB_idl_db_size - 1) >> 1)
+
 #define MDB_IDL_SIZEOF(ids)		((MDB_IDL_IS_RANGE(ids) \
-	? MDB_IDL_RANGE_SIZE : ((ids)[0]+1)) * sizeof(ID))
+	? MDB_IDL_RANGE_SIZE : MDB_IDL_IS_RUNS(ids) \
+	? 2*MDB_IDL_RUNS_N(ids)+1 : ((ids)[0]+1)) * sizeof(ID))
 
 #define MDB_IDL_RANGE_FIRST(ids)	((ids)[1])
 #define MDB_IDL_RANGE_LAST(ids)		((ids)[2])
@@ -62,10 +87,12 @@ extern unsigned int MDB_idl_um_max;
 #define MDB_IDL_FIRST( ids )	( (ids)[1] )
 #define MDB_IDL_LLAST( ids )	( (ids)[(ids)[0]] )
 #define MDB_IDL_LAST( ids )		( MDB_IDL_IS_RANGE(ids) \
-	? (ids)[2] : (ids)[(ids)[0]] )
+	? (ids)[2] : MDB_IDL_IS_RUNS(ids) \
+	? MDB_IDL_RUN_HI(ids, MDB_IDL_RUNS_N(ids)-1) : (ids)[(ids)[0]] )
 
 #define MDB_IDL_N( ids )		( MDB_IDL_IS_RANGE(ids) \
-	? ((ids)[2]-(ids)[1])+1 : (ids)[0] )
+	? ((ids)[2]-(ids)[1])+1 : MDB_IDL_IS_RUNS(ids) \
+	? mdb_idl_runs_count(ids) : (ids)[0] )
 
 	/** An ID2 is an ID/value pair.
 	 */
@@ -98,6 +125,17 @@ LDAP_BEGIN_DECL
 	/** Reset IDL params after changing logn */
 void mdb_idl_reset();
 
+	/** Count the IDs covered by a run-length IDL. */
+ID mdb_idl_runs_count( ID *ids );
+
+	/** Search for an ID in a run-length IDL.
+	 * @param[in] ids	The run-length IDL to search.
+	 * @param[in] id	The ID to search for.
+	 * @return	The index of the first run whose upper bound is
+	 *	greater than or equal to \b id.
+	 */
+unsigned mdb_idl_runs_search( ID *ids, ID id );
+
 
 	/** Search for an ID in an ID2L.
 	 * @param[in] ids	The ID2L to search.
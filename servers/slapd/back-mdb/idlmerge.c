@@ -0,0 +1,325 @@
+/* idlmerge.c - ldap mdb back-end ID list merge kernels */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <limits.h>
+#include <ac/string.h>
+
+#include "idlmerge.h"
+
+/* Vector kernels need 64 bit IDs and a compiler that can build
+ * them for a target other than the baseline one.
+ */
+#if defined(__x86_64__) && ULONG_MAX > 0xffffffffUL && \
+	(defined(__clang__) || __GNUC__ > 4 || \
+	(__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define IDK_X86	1
+#include <immintrin.h>
+#endif
+
+/* Switch from a linear merge to galloping when one list is
+ * this many times longer than the other.
+ */
+#define IDK_GALLOP_RATIO	32
+
+/* Binary searches stop and scan linearly below this many elements */
+#define IDK_WINDOW	16
+
+typedef unsigned (idk_count_fn)( const MDB_ID *ids, unsigned n, MDB_ID id );
+typedef unsigned (idk_merge_fn)( const MDB_ID *a, unsigned na,
+	const MDB_ID *b, unsigned nb, MDB_ID *out );
+
+/* count the elements < id */
+static unsigned
+idk_count_scalar( const MDB_ID *ids, unsigned n, MDB_ID id )
+{
+	unsigned i;
+
+	for ( i = 0; i < n && ids[i] < id; i++ )
+		;
+	return i;
+}
+
+static unsigned
+idk_merge_scalar( const MDB_ID *a, unsigned na, const MDB_ID *b, unsigned nb,
+	MDB_ID *out )
+{
+	unsigned i = 0, j = 0, k = 0;
+
+	while ( i < na && j < nb ) {
+		MDB_ID x = a[i], y = b[j];
+		if ( x == y )
+			out[k++] = x;
+		i += x <= y;
+		j += y <= x;
+	}
+	return k;
+}
+
+#ifdef IDK_X86
+/* Unsigned compares are done as signed ones with the top bit flipped */
+#define IDK_BIAS	LLONG_MIN
+
+__attribute__((target("sse4.2")))
+static unsigned
+idk_count_sse42( const MDB_ID *ids, unsigned n, MDB_ID id )
+{
+	__m128i bias = _mm_set1_epi64x( IDK_BIAS );
+	__m128i key = _mm_xor_si128( _mm_set1_epi64x( id ), bias );
+	unsigned i = 0, c = 0;
+
+	for ( ; i + 2 <= n; i += 2 ) {
+		__m128i v = _mm_xor_si128(
+			_mm_loadu_si128( (const __m128i *)(ids + i) ), bias );
+		int m = _mm_movemask_pd( _mm_castsi128_pd(
+			_mm_cmpgt_epi64( key, v )));
+		c += __builtin_popcount( m );
+		if ( m != 3 )
+			return c;
+	}
+	return c + idk_count_scalar( ids + i, n - i, id );
+}
+
+/* Compare blocks of two IDs from each list against each other,
+ * and advance whichever block has the smaller maximum.
+ */
+__attribute__((target("sse4.2")))
+static unsigned
+idk_merge_sse42( const MDB_ID *a, unsigned na, const MDB_ID *b, unsigned nb,
+	MDB_ID *out )
+{
+	unsigned i = 0, j = 0, k = 0;
+
+	while ( i + 2 <= na && j + 2 <= nb ) {
+		__m128i va = _mm_loadu_si128( (const __m128i *)(a + i) );
+		__m128i vb = _mm_loadu_si128( (const __m128i *)(b + j) );
+		__m128i m = _mm_or_si128( _mm_cmpeq_epi64( va, vb ),
+			_mm_cmpeq_epi64( va, _mm_shuffle_epi32( vb, 0x4e )));
+		int mask = _mm_movemask_pd( _mm_castsi128_pd( m ));
+		MDB_ID amax = a[i+1], bmax = b[j+1];
+
+		if ( mask & 1 ) out[k++] = a[i];
+		if ( mask & 2 ) out[k++] = a[i+1];
+		i += ( amax <= bmax ) << 1;
+		j += ( bmax <= amax ) << 1;
+	}
+	return k + idk_merge_scalar( a + i, na - i, b + j, nb - j, out + k );
+}
+
+__attribute__((target("avx2")))
+static unsigned
+idk_count_avx2( const MDB_ID *ids, unsigned n, MDB_ID id )
+{
+	__m256i bias = _mm256_set1_epi64x( IDK_BIAS );
+	__m256i key = _mm256_xor_si256( _mm256_set1_epi64x( id ), bias );
+	unsigned i = 0, c = 0;
+
+	for ( ; i + 4 <= n; i += 4 ) {
+		__m256i v = _mm256_xor_si256(
+			_mm256_loadu_si256( (const __m256i *)(ids + i) ), bias );
+		int m = _mm256_movemask_pd( _mm256_castsi256_pd(
+			_mm256_cmpgt_epi64( key, v )));
+		c += __builtin_popcount( m );
+		if ( m != 15 )
+			return c;
+	}
+	return c + idk_count_scalar( ids + i, n - i, id );
+}
+
+__attribute__((target("avx2")))
+static unsigned
+idk_merge_avx2( const MDB_ID *a, unsigned na, const MDB_ID *b, unsigned nb,
+	MDB_ID *out )
+{
+	unsigned i = 0, j = 0, k = 0;
+
+	while ( i + 4 <= na && j + 4 <= nb ) {
+		__m256i va = _mm256_loadu_si256( (const __m256i *)(a + i) );
+		__m256i vb = _mm256_loadu_si256( (const __m256i *)(b + j) );
+		__m256i m;
+		MDB_ID amax = a[i+3], bmax = b[j+3];
+		int mask;
+
+		/* compare against all four rotations of the b block */
+		m = _mm256_cmpeq_epi64( va, vb );
+		vb = _mm256_permute4x64_epi64( vb, 0x39 );
+		m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+		vb = _mm256_permute4x64_epi64( vb, 0x39 );
+		m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+		vb = _mm256_permute4x64_epi64( vb, 0x39 );
+		m = _mm256_or_si256( m, _mm256_cmpeq_epi64( va, vb ));
+		mask = _mm256_movemask_pd( _mm256_castsi256_pd( m ));
+
+		/* out may be a, but never gets ahead of the block */
+		while ( mask ) {
+			out[k++] = a[i + __builtin_ctz( mask )];
+			mask &= mask - 1;
+		}
+		i += ( amax <= bmax ) << 2;
+		j += ( bmax <= amax ) << 2;
+	}
+	return k + idk_merge_scalar( a + i, na - i, b + j, nb - j, out + k );
+}
+#endif /* IDK_X86 */
+
+static idk_count_fn *idk_count = idk_count_scalar;
+static idk_merge_fn *idk_merge = idk_merge_scalar;
+
+const char *
+mdb_idk_init( int flags )
+{
+	idk_count = idk_count_scalar;
+	idk_merge = idk_merge_scalar;
+
+#ifdef IDK_X86
+	if ( !( flags & MDB_IDK_SCALAR )) {
+		__builtin_cpu_init();
+		if ( __builtin_cpu_supports( "avx2" )) {
+			idk_count = idk_count_avx2;
+			idk_merge = idk_merge_avx2;
+			return "avx2";
+		}
+		if ( __builtin_cpu_supports( "sse4.2" )) {
+			idk_count = idk_count_sse42;
+			idk_merge = idk_merge_sse42;
+			return "sse4.2";
+		}
+	}
+#endif
+	return "scalar";
+}
+
+unsigned
+mdb_idk_search( const MDB_ID *ids, unsigned n, MDB_ID id )
+{
+	unsigned base = 0;
+
+	while ( n > IDK_WINDOW ) {
+		unsigned half = n >> 1;
+		if ( ids[base + half] < id ) {
+			base += half + 1;
+			n -= half + 1;
+		} else {
+			n = half;
+		}
+	}
+	return base + idk_count( ids + base, n, id );
+}
+
+/* Return the index of the first element >= id, starting at i.
+ * Probes at doubling distances, then searches the last interval.
+ */
+static unsigned
+idk_gallop( const MDB_ID *ids, unsigned i, unsigned n, MDB_ID id )
+{
+	unsigned step = 1, lo = i;
+
+	if ( i >= n || ids[i] >= id )
+		return i;
+
+	while ( i + step < n && ids[i + step] < id ) {
+		lo = i + step;
+		step <<= 1;
+	}
+	/* ids[lo] < id, and the answer is no further than i+step */
+	lo++;
+	if ( i + step < n )
+		n = i + step + 1;
+	return lo + mdb_idk_search( ids + lo, n - lo, id );
+}
+
+unsigned
+mdb_idk_intersect( const MDB_ID *a, unsigned na, const MDB_ID *b, unsigned nb,
+	MDB_ID *out )
+{
+	unsigned i, j, k;
+
+	/* make a the shorter list */
+	if ( na > nb ) {
+		const MDB_ID *tmp = a;
+		a = b;
+		b = tmp;
+		i = na;
+		na = nb;
+		nb = i;
+	}
+
+	if ( !na || a[na-1] < b[0] || b[nb-1] < a[0] )
+		return 0;
+
+	if ( nb / na >= IDK_GALLOP_RATIO ) {
+		for ( i = j = k = 0; i < na; i++ ) {
+			j = idk_gallop( b, j, nb, a[i] );
+			if ( j == nb )
+				break;
+			if ( b[j] == a[i] )
+				out[k++] = a[i];
+		}
+		return k;
+	}
+
+	/* skip to where the lists overlap */
+	i = a[0] < b[0] ? mdb_idk_search( a, na, b[0] ) : 0;
+	j = b[0] < a[0] ? mdb_idk_search( b, nb, a[0] ) : 0;
+	k = idk_merge( a + i, na - i, b + j, nb - j, out );
+	return k;
+}
+
+unsigned
+mdb_idk_union( MDB_ID *a, unsigned na, const MDB_ID *b, unsigned nb,
+	unsigned max )
+{
+	unsigned i, j, w, end;
+
+	if ( na + nb > max ) {
+		/* find the real size first */
+		w = 0;
+		for ( i = j = 0; i < na && j < nb; ) {
+			w += a[i] == b[j];
+			if ( a[i] <= b[j] ) i++;
+			else j++;
+		}
+		end = na + nb - w;
+		if ( end > max )
+			return end;
+	} else {
+		end = na + nb;
+	}
+
+	/* Merge from the top down. The write position never drops
+	 * below the read position in a, so this works in place.
+	 */
+	i = na;
+	j = nb;
+	w = end;
+	while ( j ) {
+		if ( i && a[i-1] >= b[j-1] ) {
+			if ( a[i-1] == b[j-1] )
+				j--;
+			a[--w] = a[--i];
+		} else {
+			a[--w] = b[--j];
+		}
+	}
+
+	/* close the gap left by any duplicates */
+	if ( w > i ) {
+		AC_MEMCPY( a + i, a + w, ( end - w ) * sizeof(MDB_ID) );
+		end -= w - i;
+	}
+	return end;
+}
@@ -0,0 +1,49 @@
+/* idlmerge.h - ldap mdb back-end ID list merge kernels */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#ifndef _MDB_IDLMERGE_H_
+#define _MDB_IDLMERGE_H_
+
+#include "midl.h"
+
+/* The kernels operate on bare sorted MDB_ID arrays, without the count
+ * in element 0, and have no slapd dependencies so that they can also
+ * be linked into tests/progs/idl-bench.
+ */
+
+/* flags for mdb_idk_init() */
+#define MDB_IDK_SCALAR	0x01	/* don't use vector instructions */
+
+/* Select the kernels to use for this CPU, returns their name */
+const char *mdb_idk_init( int flags );
+
+/* Return the index of the first element >= id, or n if none */
+unsigned mdb_idk_search( const MDB_ID *ids, unsigned n, MDB_ID id );
+
+/* Store the elements common to a and b in out, return their count.
+ * out may be the same array as a or b.
+ */
+unsigned mdb_idk_intersect( const MDB_ID *a, unsigned na,
+	const MDB_ID *b, unsigned nb, MDB_ID *out );
+
+/* Merge b into a, which has room for max elements, and return the
+ * number of elements in the union. If that is more than max, a is
+ * left untouched.
+ */
+unsigned mdb_idk_union( MDB_ID *a, unsigned na,
+	const MDB_ID *b, unsigned nb, unsigned max );
+
+#endif
@@ -140,7 +140,8 @@ int mdb_index_param(
 
 	case LDAP_FILTER_SUBSTRINGS:
 		type = SLAP_INDEX_SUBSTR;
-		if( IS_SLAP_INDEX( mask, SLAP_INDEX_SUBSTR ) ) {
+		if( IS_SLAP_INDEX( mask, SLAP_INDEX_SUBSTR ) ||
+			IS_SLAP_INDEX( mask, SLAP_INDEX_NGRAM ) ) {
 			goto done;
 		}
 		break;
@@ -161,6 +162,67 @@ done:
 	return LDAP_SUCCESS;
 }
 
+static int
+ix_keycmp( const void *v1, const void *v2 )
+{
+	const struct berval *k1 = v1, *k2 = v2;
+
+	if ( k1->bv_len != k2->bv_len )
+		return k1->bv_len < k2->bv_len ? -1 : 1;
+	return memcmp( k1->bv_val, k2->bv_val, k1->bv_len );
+}
+
+/* Take the keys that the kept values also produce out of keys, they
+ * must stay in the index. The keys are freed one by one if each is set.
+ */
+static void
+ix_drop_kept( Operation *op, BerVarray keys, BerVarray kept, int each )
+{
+	int i, j, n;
+
+	for ( n = 0; !BER_BVISNULL( &kept[n] ); n++ )
+		;
+	qsort( kept, n, sizeof(struct berval), ix_keycmp );
+	for ( i = j = 0; !BER_BVISNULL( &keys[i] ); i++ ) {
+		if ( bsearch( &keys[i], kept, n, sizeof(struct berval), ix_keycmp )) {
+			if ( each )
+				op->o_tmpfree( keys[i].bv_val, op->o_tmpmemctx );
+			continue;
+		}
+		keys[j++] = keys[i];
+	}
+	BER_BVZERO( &keys[j] );
+}
+
+/* Same for the keys of a matching rule */
+static int
+ix_mr_keep(
+	Operation *op,
+	MatchingRule *mr,
+	unsigned ftype,
+	slap_mask_t mask,
+	AttributeDescription *ad,
+	struct berval *atname,
+	BerVarray keep,
+	BerVarray keys )
+{
+	BerVarray kept = NULL;
+	int rc;
+
+	rc = mr->smr_indexer( ftype, mask, ad->ad_type->sat_syntax, mr,
+		atname, keep, &kept, op->o_tmpmemctx );
+	if ( rc == LDAP_SUCCESS && kept != NULL ) {
+		ix_drop_kept( op, keys, kept, 1 );
+		ber_bvarray_free_x( kept, op->o_tmpmemctx );
+	}
+	return rc;
+}
+
+/* With keep set, vals are values being deleted and keep the values
+ * the attribute still has. Only the index keys that belong to the
+ * deleted values alone are deleted, instead of deleting all of them
+ * and adding those of the kept values again.
+ */
 static int indexer(
 	Operation *op,
 	MDB_txn *txn,
@@ -168,6 +230,7 @@ static int indexer(
 	AttributeDescription *ad,
 	struct berval *atname,
 	BerVarray vals,
+	BerVarray keep,
 	ID id,
 	int opid,
 	slap_mask_t mask )
@@ -176,10 +239,31 @@ static int indexer(
 	struct berval *keys;
 	MDB_cursor *mc = ai->ai_cursor;
 	mdb_idl_keyfunc *keyfunc;
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_keysort *ks = NULL;
+	mdb_idxstats st, *stp = &ai->ai_stats;
+	int collect = 0, stored = 0;
 	char *err;
 
 	assert( mask != 0 );
 
+	/* slapadd sorts the keys and writes them at the end */
+	if ( opid == SLAP_INDEX_ADD_OP && ( mdb->mi_flags & MDB_BULK_LOAD )) {
+		keyfunc = mdb_tool_bulk_add;
+		mc = (MDB_cursor *)ai;
+		collect = 1;
+		goto index;
+	}
+
+	/* so does an online index build, for the entries it reads */
+	if ( opid == SLAP_INDEX_ADD_OP && ( mdb->mi_flags & MDB_IX_BUILD ) &&
+		( ks = mdb_ixbuild_sorter( op, ai, 0 ))) {
+		keyfunc = mdb_keysort_keys;
+		mc = (MDB_cursor *)ks;
+		collect = 1;
+		goto index;
+	}
+
 	if ( !mc ) {
 		err = "c_open";
 		rc = mdb_cursor_open( txn, ai->ai_dbi, &mc );
@@ -201,8 +285,26 @@ static int indexer(
 	} else
 		keyfunc = mdb_idl_delete_keys;
 
-	if( IS_SLAP_INDEX( mask, SLAP_INDEX_PRESENT ) ) {
-		rc = keyfunc( op->o_bd, mc, presence_key, id );
+	/* keep the stored statistics current in our own txn */
+	if ( !( slapMode & SLAP_TOOL_MODE )) {
+		err = "idxstats";
+		rc = mdb_idxstats_get( txn, mdb, ai, &st );
+		if ( rc == 0 ) {
+			stp = &st;
+			stored = 1;
+		} else if ( rc != MDB_NOTFOUND ) {
+			goto done;
+		}
+		rc = 0;
+	}
+
+index:
+	if ( keep && BER_BVISNULL( keep ))
+		keep = NULL;
+
+	/* the attribute is still present */
+	if( IS_SLAP_INDEX( mask, SLAP_INDEX_PRESENT ) && !keep ) {
+		rc = keyfunc( op->o_bd, mc, presence_key, id, stp );
 		if( rc ) {
 			err = "presence";
 			goto done;
@@ -217,8 +319,12 @@ static int indexer(
 			ad->ad_type->sat_equality,
 			atname, vals, &keys, op->o_tmpmemctx );
 
+		if( rc == LDAP_SUCCESS && keys != NULL && keep )
+			rc = ix_mr_keep( op, ad->ad_type->sat_equality, LDAP_FILTER_EQUALITY,
+				mask, ad, atname, keep, keys );
+
 		if( rc == LDAP_SUCCESS && keys != NULL ) {
-			rc = keyfunc( op->o_bd, mc, keys, id );
+			rc = keyfunc( op->o_bd, mc, keys, id, stp );
 			ber_bvarray_free_x( keys, op->o_tmpmemctx );
 			if ( rc ) {
 				err = "equality";
@@ -236,8 +342,12 @@ static int indexer(
 			ad->ad_type->sat_approx,
 			atname, vals, &keys, op->o_tmpmemctx );
 
+		if( rc == LDAP_SUCCESS && keys != NULL && keep )
+			rc = ix_mr_keep( op, ad->ad_type->sat_approx, LDAP_FILTER_APPROX,
+				mask, ad, atname, keep, keys );
+
 		if( rc == LDAP_SUCCESS && keys != NULL ) {
-			rc = keyfunc( op->o_bd, mc, keys, id );
+			rc = keyfunc( op->o_bd, mc, keys, id, stp );
 			ber_bvarray_free_x( keys, op->o_tmpmemctx );
 			if ( rc ) {
 				err = "approx";
@@ -256,8 +366,12 @@ static int indexer(
 			ad->ad_type->sat_substr,
 			atname, vals, &keys, op->o_tmpmemctx );
 
+		if( rc == LDAP_SUCCESS && keys != NULL && keep )
+			rc = ix_mr_keep( op, ad->ad_type->sat_substr, LDAP_FILTER_SUBSTRINGS,
+				mask, ad, atname, keep, keys );
+
 		if( rc == LDAP_SUCCESS && keys != NULL ) {
-			rc = keyfunc( op->o_bd, mc, keys, id );
+			rc = keyfunc( op->o_bd, mc, keys, id, stp );
 			ber_bvarray_free_x( keys, op->o_tmpmemctx );
 			if( rc ) {
 				err = "substr";
@@ -268,8 +382,63 @@ static int indexer(
 		rc = LDAP_SUCCESS;
 	}
 
+	if( IS_SLAP_INDEX( mask, SLAP_INDEX_NGRAM ) ) {
+		rc = mdb_ngram_keys( op, vals, &keys );
+
+		if( rc == LDAP_SUCCESS && keys != NULL && keep ) {
+			BerVarray kept;
+			/* all in one allocation */
+			rc = mdb_ngram_keys( op, keep, &kept );
+			if ( rc == LDAP_SUCCESS && kept != NULL ) {
+				ix_drop_kept( op, keys, kept, 0 );
+				op->o_tmpfree( kept, op->o_tmpmemctx );
+			}
+		}
+
+		if( rc == LDAP_SUCCESS && keys != NULL ) {
+			rc = keyfunc( op->o_bd, mc, keys, id, stp );
+			op->o_tmpfree( keys, op->o_tmpmemctx );
+			if( rc ) {
+				err = "ngram";
+				goto done;
+			}
+		}
+
+		rc = LDAP_SUCCESS;
+	}
+
+	if( IS_SLAP_INDEX( mask, SLAP_INDEX_ORDERED ) && ai->ai_odbi ) {
+		if ( ks )
+			rc = mdb_order_keys( op, ai, vals, id,
+				mdb_ixbuild_sorter( op, ai, 1 ));
+		else
+			rc = mdb_order_index( op, txn, ai, vals, id, opid );
+		if ( !rc && keep ) {
+			/* long values are cut short in their keys, which
+			 * a kept value may share
+			 */
+			int i, max = mdb_env_get_maxkeysize( mdb->mi_dbenv ) - 5;
+			for ( i = 0; !BER_BVISNULL( &vals[i] ); i++ ) {
+				if ( vals[i].bv_len >= max ) {
+					rc = mdb_order_index( op, txn, ai, keep, id,
+						SLAP_INDEX_ADD_OP );
+					break;
+				}
+			}
+		}
+		if( rc ) {
+			err = "ordered";
+			goto done;
+		}
+	}
+
+	if ( stored ) {
+		err = "idxstats";
+		rc = mdb_idxstats_put( txn, mdb, ai, &st );
+	}
+
 done:
-	if ( !(slapMode & SLAP_TOOL_QUICK))
+	if ( !collect && !(slapMode & SLAP_TOOL_QUICK))
 		mdb_cursor_close( mc );
 	switch( rc ) {
 	/* The callers all know how to deal with these results */
@@ -289,6 +458,7 @@ static int index_at_values(
 	AttributeType *type,
 	struct berval *tags,
 	BerVarray vals,
+	BerVarray keep,
 	ID id,
 	int opid )
 {
@@ -296,6 +466,7 @@ static int index_at_values(
 	slap_mask_t mask = 0;
 	int ixop = opid;
 	AttrInfo *ai = NULL;
+	AttributeDescription *orig = ad;
 
 	if ( opid == MDB_INDEX_UPDATE_OP )
 		ixop = SLAP_INDEX_ADD_OP;
@@ -304,7 +475,7 @@ static int index_at_values(
 		/* recurse */
 		rc = index_at_values( op, txn, NULL,
 			type->sat_sup, tags,
-			vals, id, opid );
+			vals, keep, id, opid );
 
 		if( rc ) return rc;
 	}
@@ -319,7 +490,7 @@ static int index_at_values(
 				ComponentReference *cr;
 				for( cr = ai->ai_cr ; cr ; cr = cr->cr_next ) {
 					rc = indexer( op, txn, ai, cr->cr_ad, &type->sat_cname,
-						cr->cr_nvals, id, ixop,
+						cr->cr_nvals, NULL, id, ixop,
 						cr->cr_indexmask );
 				}
 			}
@@ -335,9 +506,12 @@ static int index_at_values(
 			 * just use the old mask.
 			 */
 				mask = ai->ai_newmask ? ai->ai_newmask : ai->ai_indexmask;
+			/* ordered keys only come from the attribute itself */
+			if ( orig != ad )
+				mask &= ~SLAP_INDEX_ORDERED;
 			if( mask ) {
 				rc = indexer( op, txn, ai, ad, &type->sat_cname,
-					vals, id, ixop, mask );
+					vals, keep, id, ixop, mask );
 
 				if( rc ) return rc;
 			}
@@ -356,9 +530,11 @@ static int index_at_values(
 					mask = ai->ai_newmask & ~ai->ai_indexmask;
 				else
 					mask = ai->ai_newmask ? ai->ai_newmask : ai->ai_indexmask;
+				if ( orig != desc )
+					mask &= ~SLAP_INDEX_ORDERED;
 				if ( mask ) {
 					rc = indexer( op, txn, ai, desc, &desc->ad_cname,
-						vals, id, ixop, mask );
+						vals, keep, id, ixop, mask );
 
 					if( rc ) {
 						return rc;
@@ -379,19 +555,46 @@ int mdb_index_values(
 	ID id,
 	int opid )
 {
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	int rc;
 
 	/* Never index ID 0 */
 	if ( id == 0 )
 		return 0;
 
+	/* an online index build redoes the entries changed meanwhile */
+	if (( mdb->mi_flags & MDB_IX_BUILD ) && opid != MDB_INDEX_UPDATE_OP )
+		mdb_ixbuild_dirty( mdb, id );
+
 	rc = index_at_values( op, txn, desc,
 		desc->ad_type, &desc->ad_tags,
-		vals, id, opid );
+		vals, NULL, id, opid );
 
 	return rc;
 }
 
+/* Delete the index keys of vals that none of the values in keep has */
+int mdb_index_values_keep(
+	Operation *op,
+	MDB_txn *txn,
+	AttributeDescription *desc,
+	BerVarray vals,
+	BerVarray keep,
+	ID id )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+
+	if ( id == 0 )
+		return 0;
+
+	if ( mdb->mi_flags & MDB_IX_BUILD )
+		mdb_ixbuild_dirty( mdb, id );
+
+	return index_at_values( op, txn, desc,
+		desc->ad_type, &desc->ad_tags,
+		vals, keep, id, SLAP_INDEX_DELETE_OP );
+}
+
 /* Get the list of which indices apply to this attr */
 int
 mdb_index_recset(
@@ -449,6 +652,7 @@ int mdb_index_recrun(
 {
 	IndexRec *ir;
 	AttrList *al;
+	slap_mask_t mask;
 	int i, rc = 0;
 
 	/* Never index ID 0 */
@@ -460,10 +664,14 @@ int mdb_index_recrun(
 		if ( !ir->ir_ai ) continue;
 		while (( al = ir->ir_attrs )) {
 			ir->ir_attrs = al->next;
-			rc = indexer( op, txn, ir->ir_ai, ir->ir_ai->ai_desc,
-				&ir->ir_ai->ai_desc->ad_type->sat_cname,
-				al->attr->a_nvals, id, SLAP_INDEX_ADD_OP,
-				ir->ir_ai->ai_indexmask );
+			mask = ir->ir_ai->ai_indexmask;
+			if ( al->attr->a_desc != ir->ir_ai->ai_desc )
+				mask &= ~SLAP_INDEX_ORDERED;
+			rc = 0;
+			if ( mask )
+				rc = indexer( op, txn, ir->ir_ai, ir->ir_ai->ai_desc,
+					&ir->ir_ai->ai_desc->ad_type->sat_cname,
+					al->attr->a_nvals, NULL, id, SLAP_INDEX_ADD_OP, mask );
 			free( al );
 			if ( rc ) break;
 		}
@@ -23,6 +23,7 @@
 #include <ac/errno.h>
 #include <sys/stat.h>
 #include "back-mdb.h"
+#include "idlmerge.h"
 #include <lutil.h>
 #include <ldap_rq.h>
 #include "config.h"
@@ -32,6 +33,7 @@ static const struct berval mdmi_databases[] = {
 	BER_BVC("dn2i"),
 	BER_BVC("id2e"),
 	BER_BVC("id2v"),
+	BER_BVC("ixst"),
 	BER_BVNULL
 };
 
@@ -65,6 +67,9 @@ mdb_db_init( BackendDB *be, ConfigReply *cr )
 	mdb->mi_rtxn_size = DEFAULT_RTXN_SIZE;
 	mdb->mi_multi_hi = UINT_MAX;
 	mdb->mi_multi_lo = UINT_MAX;
+	mdb->mi_txng_max = MDB_TXNG_MAX;
+	mdb->mi_prefetch_tasks = MDB_PREFETCH_TASKS;
+	mdb->mi_zip_min = MDB_ZIP_MIN;
 
 	be->be_private = mdb;
 	be->be_cf_ocs = be->bd_info->bi_cf_ocs+1;
@@ -205,6 +210,8 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 				flags |= MDB_DUPSORT;
 			if ( i == MDB_ID2VAL )
 				flags ^= MDB_INTEGERKEY|MDB_DUPSORT;
+			if ( i == MDB_IDXSTATS )
+				flags ^= MDB_INTEGERKEY;
 			if ( !(slapMode & SLAP_TOOL_READONLY) )
 				flags |= MDB_CREATE;
 		}
@@ -214,6 +221,12 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 			flags,
 			&mdb->mi_dbis[i] );
 
+		/* older databases don't have it, it isn't needed to read them */
+		if ( rc == MDB_NOTFOUND && i == MDB_IDXSTATS ) {
+			mdb->mi_dbis[i] = 0;
+			continue;
+		}
+
 		if ( rc != 0 ) {
 			snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
 				"mdb_dbi_open(%s/%s) failed: %s (%d).", 
@@ -272,6 +285,17 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 		goto fail;
 	}
 
+	/* The tools write the indexes without counting, the server
+	 * counts again from scratch once it opens the database.
+	 */
+	if (( slapMode & SLAP_TOOL_MODE ) && !( slapMode & SLAP_TOOL_READONLY )) {
+		rc = mdb_drop( txn, mdb->mi_idxstats, 0 );
+		if ( rc ) {
+			mdb_txn_abort( txn );
+			goto fail;
+		}
+	}
+
 	/* slapcat doesn't need indexes. avoid a failure if
 	 * a configured index wasn't created yet.
 	 */
@@ -283,6 +307,16 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 		}
 	}
 
+	rc = mdb_dnfilter_open( be, txn );
+	if ( rc ) {
+		mdb_txn_abort( txn );
+		goto fail;
+	}
+	mdb_ecache_open( be );
+	mdb_txngroup_open( mdb );
+	mdb_flush_open( be );
+	mdb_rdwatch_open( be );
+
 	rc = mdb_txn_commit(txn);
 	if ( rc != 0 ) {
 		Debug( LDAP_DEBUG_ANY,
@@ -318,6 +352,14 @@ mdb_db_close( BackendDB *be, ConfigReply *cr )
 
 	mdb->mi_flags &= ~MDB_IS_OPEN;
 
+	mdb_dnfilter_close( mdb );
+	mdb_ecache_close( mdb );
+	mdb_txngroup_close( mdb );
+	mdb_flush_close( mdb );
+	mdb_rdwatch_close( mdb );
+	/* an index build can't go on with the old env */
+	mdb_ixbuild_restart( mdb );
+
 	if( mdb->mi_dbenv ) {
 		mdb_reader_flush( mdb->mi_dbenv );
 	}
@@ -370,9 +412,12 @@ mdb_db_destroy( BackendDB *be, ConfigReply *cr )
 	/* monitor handling */
 	(void)mdb_monitor_db_destroy( be );
 
+	mdb_ixbuild_free( mdb );
+
 	if( mdb->mi_dbenv_home ) ch_free( mdb->mi_dbenv_home );
 
 	mdb_attr_index_destroy( mdb );
+	mdb_zip_free( mdb );
 
 	ch_free( mdb );
 	be->be_private = NULL;
@@ -395,6 +440,7 @@ mdb_back_initialize(
 		LDAP_CONTROL_POST_READ,
 		LDAP_CONTROL_SUBENTRIES,
 		LDAP_CONTROL_X_PERMISSIVE_MODIFY,
+		LDAP_CONTROL_X_SEARCH_EXPLAIN,
 		LDAP_CONTROL_TXN_SPEC,
 		NULL
 	};
@@ -441,6 +487,20 @@ mdb_back_initialize(
 			": %s\n", version );
 	}
 
+	{	/* pick the IDL merge kernels for this CPU */
+		const char *kern = mdb_idk_init( 0 );
+		Debug( LDAP_DEBUG_TRACE, LDAP_XSTRING(mdb_back_initialize)
+			": using %s IDL kernels\n", kern );
+	}
+
+	rc = register_supported_control( LDAP_CONTROL_X_SEARCH_EXPLAIN,
+		SLAP_CTRL_SEARCH, NULL, mdb_explain_parse, &mdb_explain_cid );
+	if ( rc != LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_back_initialize)
+			": unable to register explain control: %d\n", rc );
+		return rc;
+	}
+
 	bi->bi_open = 0;
 	bi->bi_close = 0;
 	bi->bi_config = 0;
@@ -0,0 +1,827 @@
+/* ixbuild.c - ldap mdb back-end online index build */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+#include <ac/time.h>
+
+#include "back-mdb.h"
+#include "idl.h"
+
+#include "ldap_rq.h"
+
+/* Indexes added to a running server are built without holding up
+ * the writers for longer than a short write txn at a time.
+ *
+ * In the scan, tasks from the connection pool take chunks of the ID
+ * range, read their entries in a read txn renewed for every chunk and
+ * collect the keys of the new indexes in sorted runs (keysort.c). The
+ * runs are then merged, and the keys written to the index DBs in key
+ * order, a limited number of IDs per write txn.
+ *
+ * Writers maintain the new indexes all along. Keys read from an entry
+ * that has been changed since may be stale, so while the build runs
+ * every ID given to mdb_index_values by a writer is recorded. The
+ * merge skips the recorded IDs, and the catch-up reindexes their
+ * entries as they are now. Writes are serialized, so the recorded
+ * IDs can't change while the build has a write txn open. The last
+ * catch-up txn takes all that's left and ends the recording.
+ *
+ * The build starts over after a change of the index configuration.
+ */
+
+#define MDB_IXB_CHUNK	1024	/* IDs read by a task at a time */
+#define MDB_IXB_SORTMEM	(128*1024*1024)	/* keys kept in memory by all tasks */
+#define MDB_IXB_TXNIDS	10000	/* IDs written per write txn */
+
+/* results of the phases besides LDAP/LMDB errors */
+#define IXB_RESTART	(-2)
+#define IXB_STOP	(-3)
+
+enum {
+	IXB_IDLE = 0,
+	IXB_SCAN,
+	IXB_MERGE,
+	IXB_CATCHUP
+};
+
+static const char *ixb_phases[] = { "idle", "scan", "merge", "catchup" };
+
+typedef struct ixb_task {
+	OpExtra it_oe;		/* lets the indexer find the sorters */
+	struct mdb_ixbuild *it_ib;
+	mdb_keysort *it_ks;	/* keys of each attr, then its ordered keys */
+	void *it_cookie;
+	int it_started;
+} ixb_task;
+
+struct mdb_ixbuild {
+	ldap_pvt_thread_mutex_t ib_mutex;
+	ldap_pvt_thread_cond_t ib_cond;
+	BackendDB *ib_be;
+	int ib_restart;
+	int ib_err;
+	int ib_nattrs;		/* mi_nattrs when the build started */
+	ID ib_last;			/* last ID when the scan started */
+	ID ib_claim;		/* first ID no task has taken */
+	int ib_ntasks;
+	int ib_running;		/* tasks submitted but not finished */
+	ixb_task *ib_tasks;	/* the first is the build's own */
+	/* IDs changed by writers, sorted up to ib_nsorted */
+	ID *ib_dirty;
+	size_t ib_ndirty;
+	size_t ib_nsorted;
+	size_t ib_dmax;
+	/* progress of the current phase */
+	int ib_phase;
+	unsigned long ib_done;
+	unsigned long ib_total;
+	time_t ib_start;
+};
+
+void
+mdb_ixbuild_dirty( struct mdb_info *mdb, ID id )
+{
+	mdb_ixbuild *ib = mdb->mi_ixbuild;
+
+	ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+	if ( !ib->ib_ndirty || ib->ib_dirty[ib->ib_ndirty-1] != id ) {
+		if ( ib->ib_ndirty == ib->ib_dmax ) {
+			ib->ib_dmax = ib->ib_dmax ? ib->ib_dmax * 2 : 1024;
+			ib->ib_dirty = ch_realloc( ib->ib_dirty,
+				ib->ib_dmax * sizeof(ID) );
+		}
+		ib->ib_dirty[ib->ib_ndirty++] = id;
+	}
+	ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+}
+
+static int
+ixb_idcmp( const void *v1, const void *v2 )
+{
+	ID i1 = *(ID *)v1, i2 = *(ID *)v2;
+
+	return i1 < i2 ? -1 : i1 > i2;
+}
+
+/* Sort the IDs recorded since the last time, and drop repeats.
+ * Called with ib_mutex held.
+ */
+static void
+ixb_dirty_sort( mdb_ixbuild *ib )
+{
+	ID *ids = ib->ib_dirty, *tmp;
+	size_t i, j, k, n = ib->ib_ndirty, m = ib->ib_nsorted;
+
+	if ( m == n )
+		return;
+	qsort( ids + m, n - m, sizeof(ID), ixb_idcmp );
+	if ( m && ids[m-1] >= ids[m] ) {
+		tmp = ch_malloc( ( n - m ) * sizeof(ID) );
+		AC_MEMCPY( tmp, ids + m, ( n - m ) * sizeof(ID) );
+		i = m;
+		j = n - m;
+		k = n;
+		while ( j ) {
+			if ( i && ids[i-1] > tmp[j-1] )
+				ids[--k] = ids[--i];
+			else
+				ids[--k] = tmp[--j];
+		}
+		ch_free( tmp );
+	}
+	for ( i = j = 1; i < n; i++ ) {
+		if ( ids[i] != ids[j-1] )
+			ids[j++] = ids[i];
+	}
+	ib->ib_ndirty = ib->ib_nsorted = j;
+}
+
+/* Only valid in a write txn, after ixb_dirty_sort */
+static int
+ixb_dirty_has( mdb_ixbuild *ib, ID id )
+{
+	return ib->ib_nsorted && bsearch( &id, ib->ib_dirty, ib->ib_nsorted,
+		sizeof(ID), ixb_idcmp ) != NULL;
+}
+
+static int
+ixb_txn_begin( mdb_ixbuild *ib, MDB_txn **txn )
+{
+	struct mdb_info *mdb = (struct mdb_info *) ib->ib_be->be_private;
+	int rc;
+
+	rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, txn );
+	if ( rc == 0 ) {
+		ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+		ixb_dirty_sort( ib );
+		ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+	}
+	return rc;
+}
+
+/* Let a pause of the server go ahead, the caller must have no txn
+ * open. Tells if the build must start over, or stop.
+ */
+static int
+ixb_pausecheck( mdb_ixbuild *ib )
+{
+	int rc;
+
+	if ( ldap_pvt_thread_pool_pausing( &connection_pool ))
+		ldap_pvt_thread_pool_pausecheck( &connection_pool );
+	if ( slapd_shutdown )
+		return IXB_STOP;
+	ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+	rc = ib->ib_restart ? IXB_RESTART : 0;
+	ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+	return rc;
+}
+
+static void
+ixb_phase( mdb_ixbuild *ib, int phase, unsigned long total )
+{
+	ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+	ib->ib_phase = phase;
+	ib->ib_done = 0;
+	ib->ib_total = total;
+	ib->ib_start = slap_get_time();
+	ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+}
+
+mdb_keysort *
+mdb_ixbuild_sorter( Operation *op, AttrInfo *ai, int ordered )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_ixbuild *ib = mdb->mi_ixbuild;
+	OpExtra *oex;
+
+	LDAP_SLIST_FOREACH( oex, &op->o_extra, oe_next ) {
+		if ( oex->oe_key == ib ) {
+			ixb_task *it = (ixb_task *)oex;
+			assert( ai->ai_idx < ib->ib_nattrs );
+			return &it->it_ks[ordered ? ib->ib_nattrs + ai->ai_idx : ai->ai_idx];
+		}
+	}
+	return NULL;
+}
+
+/* Take chunks of the range until there are none left, collecting
+ * the keys of their entries. Gives up at a pause.
+ */
+static void
+ixb_scan( mdb_ixbuild *ib, ixb_task *it, void *ctx )
+{
+	BackendDB *be = ib->ib_be;
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	Connection conn = {0};
+	OperationBuffer opbuf;
+	Operation *op;
+	mdb_op_info opinfo = {{{0}}}, *moi = &opinfo;
+	MDB_cursor *mc = NULL;
+	MDB_val key, data;
+	Entry *e;
+	ID id, lo, hi;
+	size_t used;
+	unsigned long n;
+	int i, rc;
+
+	connection_fake_init( &conn, &opbuf, ctx );
+	op = &opbuf.ob_op;
+	op->o_bd = be;
+
+	rc = mdb_opinfo_get( op, mdb, 1, &moi );
+	if ( rc )
+		goto leave;
+	/* renewed for each chunk */
+	mdb_txn_reset( moi->moi_txn );
+	it->it_oe.oe_key = ib;
+	LDAP_SLIST_INSERT_HEAD( &op->o_extra, &it->it_oe, oe_next );
+
+	for (;;) {
+		ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+		if ( ib->ib_restart || ib->ib_err || ib->ib_claim > ib->ib_last ||
+			ldap_pvt_thread_pool_pausing( &connection_pool ) ||
+			slapd_shutdown ) {
+			ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+			break;
+		}
+		lo = ib->ib_claim;
+		hi = ib->ib_last - lo < MDB_IXB_CHUNK ?
+			ib->ib_last : lo + MDB_IXB_CHUNK - 1;
+		ib->ib_claim = hi + 1;
+		ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+
+		rc = mdb_txn_renew( moi->moi_txn );
+		if ( rc )
+			break;
+		if ( mc )
+			rc = mdb_cursor_renew( moi->moi_txn, mc );
+		else
+			rc = mdb_cursor_open( moi->moi_txn, mdb->mi_id2entry, &mc );
+
+		n = 0;
+		id = lo;
+		key.mv_data = &id;
+		key.mv_size = sizeof(ID);
+		if ( rc == 0 )
+			rc = mdb_cursor_get( mc, &key, &data, MDB_SET_RANGE );
+		while ( rc == 0 ) {
+			memcpy( &id, key.mv_data, sizeof(ID) );
+			if ( id > hi )
+				break;
+			/* stubs of missing parents have no data */
+			if ( data.mv_size ) {
+				rc = mdb_entry_decode( op, moi->moi_txn, &data, id, &e );
+				if ( rc )
+					break;
+				e->e_id = id;
+				BER_BVZERO( &e->e_name );
+				BER_BVZERO( &e->e_nname );
+				rc = mdb_index_entry( op, moi->moi_txn, MDB_INDEX_UPDATE_OP, e );
+				mdb_entry_return( op, e );
+				if ( rc )
+					break;
+				n++;
+			}
+			rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT );
+		}
+		if ( rc == MDB_NOTFOUND )
+			rc = 0;
+		mdb_txn_reset( moi->moi_txn );
+
+		used = 0;
+		for ( i = 0; i < 2 * ib->ib_nattrs; i++ )
+			used += it->it_ks[i].ks_used;
+		if ( !rc && used > MDB_IXB_SORTMEM / ib->ib_ntasks ) {
+			for ( i = 0; i < 2 * ib->ib_nattrs && !rc; i++ )
+				rc = mdb_keysort_spill( &it->it_ks[i] );
+		}
+
+		ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+		ib->ib_done += n;
+		if ( rc && !ib->ib_err )
+			ib->ib_err = rc;
+		ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+		if ( rc )
+			break;
+	}
+
+	if ( mc )
+		mdb_cursor_close( mc );
+	LDAP_SLIST_REMOVE( &op->o_extra, &it->it_oe, OpExtra, oe_next );
+	LDAP_SLIST_REMOVE( &op->o_extra, &moi->moi_oe, OpExtra, oe_next );
+leave:
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_ixbuild_run)
+			": database %s: reading entries failed: %s (%d)\n",
+			be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+		ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+		if ( !ib->ib_err )
+			ib->ib_err = rc;
+		ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+	}
+}
+
+static void *
+ixb_task_run( void *ctx, void *arg )
+{
+	ixb_task *it = arg;
+	mdb_ixbuild *ib = it->it_ib;
+
+	ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+	it->it_started = 1;
+	ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+
+	ixb_scan( ib, it, ctx );
+
+	ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+	ib->ib_running--;
+	ldap_pvt_thread_cond_broadcast( &ib->ib_cond );
+	ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+	return NULL;
+}
+
+/* Scan with the help of the other tasks. They all leave when the
+ * server pauses, and are started again once it resumes.
+ */
+static int
+ixb_scan_all( mdb_ixbuild *ib, void *ctx )
+{
+	int i, ntasks, done, rc;
+
+	for (;;) {
+		ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+		for ( i = 1; i < ib->ib_ntasks; i++ ) {
+			ixb_task *it = &ib->ib_tasks[i];
+			it->it_started = 0;
+			if ( ldap_pvt_thread_pool_submit2( &connection_pool,
+				ixb_task_run, it, &it->it_cookie ))
+				break;
+			ib->ib_running++;
+		}
+		ntasks = i;
+		ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+
+		ixb_scan( ib, &ib->ib_tasks[0], ctx );
+
+		ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+		/* tasks still queued won't run while the pool pauses */
+		for ( i = 1; i < ntasks; i++ ) {
+			if ( !ib->ib_tasks[i].it_started &&
+				ldap_pvt_thread_pool_retract( ib->ib_tasks[i].it_cookie ) > 0 )
+				ib->ib_running--;
+		}
+		while ( ib->ib_running )
+			ldap_pvt_thread_cond_wait( &ib->ib_cond, &ib->ib_mutex );
+		rc = ib->ib_err;
+		done = ib->ib_claim > ib->ib_last;
+		ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+		if ( rc || done )
+			return rc;
+
+		rc = ixb_pausecheck( ib );
+		if ( rc )
+			return rc;
+	}
+}
+
+typedef struct ixb_merge {
+	mdb_ixbuild *im_ib;
+	AttrInfo *im_ai;
+	MDB_dbi im_dbi;
+	int im_ordered;
+	size_t im_maxids;
+	MDB_txn *im_txn;
+	MDB_cursor *im_mc;
+	size_t im_puts;
+} ixb_merge;
+
+/* Write one key. Entries changed since they were read are left to
+ * the catch-up. Of a key with too many IDs for a list, the first ones
+ * and the last are enough to get the same range.
+ */
+static int
+ixb_put( void *arg, MDB_val *key, ID *ids, size_t n, ID last )
+{
+	ixb_merge *im = arg;
+	mdb_ixbuild *ib = im->im_ib;
+	struct berval keys[2];
+	MDB_val data;
+	size_t i, kept = 0;
+	ID id, high = NOID;
+	int rc = 0;
+
+	if ( !im->im_txn ) {
+		rc = ixb_txn_begin( ib, &im->im_txn );
+		if ( rc == 0 )
+			rc = mdb_cursor_open( im->im_txn, im->im_dbi, &im->im_mc );
+		if ( rc )
+			return rc;
+	}
+
+	keys[0].bv_val = key->mv_data;
+	keys[0].bv_len = key->mv_size;
+	BER_BVZERO( &keys[1] );
+	for ( i = 0; i <= n && rc == 0; i++ ) {
+		if ( i < n ) {
+			id = ids[i];
+			if ( ixb_dirty_has( ib, id ))
+				continue;
+			/* the dirty ones don't count toward the limit */
+			if ( im->im_maxids && kept >= im->im_maxids ) {
+				high = id;
+				continue;
+			}
+		} else if ( high != NOID ) {
+			id = high;
+		} else {
+			break;
+		}
+		if ( im->im_ordered ) {
+			data.mv_data = &id;
+			data.mv_size = sizeof(ID);
+			rc = mdb_cursor_put( im->im_mc, key, &data, MDB_NODUPDATA );
+			if ( rc == MDB_KEYEXIST )
+				rc = 0;
+		} else {
+			rc = mdb_idl_insert_keys( ib->ib_be, im->im_mc, keys, id,
+				&im->im_ai->ai_stats );
+		}
+		kept++;
+	}
+	if ( rc )
+		return rc;
+
+	ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+	ib->ib_done += n;
+	ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+
+	im->im_puts += kept;
+	if ( im->im_puts >= MDB_IXB_TXNIDS ) {
+		im->im_puts = 0;
+		rc = mdb_txn_commit( im->im_txn );
+		im->im_txn = NULL;
+		if ( rc == 0 )
+			rc = ixb_pausecheck( ib );
+	}
+	return rc;
+}
+
+/* Merge the keys collected by all the tasks into the index DBs */
+static int
+ixb_merge_all( mdb_ixbuild *ib )
+{
+	struct mdb_info *mdb = (struct mdb_info *) ib->ib_be->be_private;
+	mdb_keysort **ks;
+	ixb_merge im;
+	unsigned long total = 0;
+	int i, t, nks, rc = 0;
+
+	for ( i = 0; i < 2 * ib->ib_nattrs; i++ )
+		for ( t = 0; t < ib->ib_ntasks; t++ )
+			total += ib->ib_tasks[t].it_ks[i].ks_count;
+	ixb_phase( ib, IXB_MERGE, total );
+
+	ks = ch_malloc( ib->ib_ntasks * sizeof( mdb_keysort * ));
+	for ( i = 0; i < 2 * ib->ib_nattrs && rc == 0; i++ ) {
+		AttrInfo *ai = mdb->mi_attrs[i % ib->ib_nattrs];
+
+		nks = 0;
+		for ( t = 0; t < ib->ib_ntasks; t++ ) {
+			if ( ib->ib_tasks[t].it_ks[i].ks_count )
+				ks[nks++] = &ib->ib_tasks[t].it_ks[i];
+		}
+		if ( !nks )
+			continue;
+
+		memset( &im, 0, sizeof( im ));
+		im.im_ib = ib;
+		im.im_ai = ai;
+		im.im_ordered = i >= ib->ib_nattrs;
+		im.im_dbi = im.im_ordered ? ai->ai_odbi : ai->ai_dbi;
+		if ( !im.im_ordered && !mdb->mi_idl_runs )
+			im.im_maxids = MDB_idl_db_max + 1;
+		rc = mdb_keysort_merge( ks, nks, 0, ixb_put, &im );
+		if ( im.im_txn ) {
+			if ( rc )
+				mdb_txn_abort( im.im_txn );
+			else
+				rc = mdb_txn_commit( im.im_txn );
+		}
+		if ( rc && rc != IXB_RESTART && rc != IXB_STOP )
+			Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_ixbuild_run)
+				": database %s: writing %s index failed: %s (%d)\n",
+				ib->ib_be->be_suffix[0].bv_val,
+				ai->ai_desc->ad_cname.bv_val,
+				rc == -1 ? "cannot read sorted keys" :
+				mdb_strerror(rc), rc );
+		for ( t = 0; t < ib->ib_ntasks; t++ )
+			mdb_keysort_clear( &ib->ib_tasks[t].it_ks[i] );
+	}
+	ch_free( ks );
+	return rc;
+}
+
+/* Reindex the entries changed during the build. The txn that finds
+ * nothing more left to do turns off the recording.
+ */
+static int
+ixb_catchup( mdb_ixbuild *ib, Operation *op )
+{
+	struct mdb_info *mdb = (struct mdb_info *) ib->ib_be->be_private;
+	MDB_txn *txn;
+	MDB_cursor *mc;
+	Entry *e;
+	ID *ids = NULL;
+	size_t i, n;
+	int rc, last;
+
+	ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+	n = ib->ib_ndirty;
+	ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+	ixb_phase( ib, IXB_CATCHUP, n );
+
+	for (;;) {
+		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+		if ( rc )
+			break;
+
+		ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+		ixb_dirty_sort( ib );
+		n = ib->ib_ndirty < MDB_IXB_TXNIDS ? ib->ib_ndirty : MDB_IXB_TXNIDS;
+		ids = ch_realloc( ids, ( n + 1 ) * sizeof(ID) );
+		AC_MEMCPY( ids, ib->ib_dirty, n * sizeof(ID) );
+		ib->ib_ndirty -= n;
+		AC_MEMCPY( ib->ib_dirty, ib->ib_dirty + n, ib->ib_ndirty * sizeof(ID) );
+		ib->ib_nsorted = ib->ib_ndirty;
+		last = !ib->ib_ndirty;
+		ib->ib_total = ib->ib_done + n + ib->ib_ndirty;
+		ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+
+		rc = mdb_cursor_open( txn, mdb->mi_id2entry, &mc );
+		for ( i = 0; i < n && rc == 0; i++ ) {
+			rc = mdb_id2entry( op, mc, ids[i], &e );
+			if ( rc == MDB_NOTFOUND ) {
+				/* deleted */
+				rc = 0;
+				continue;
+			}
+			if ( rc )
+				break;
+			rc = mdb_index_entry( op, txn, MDB_INDEX_UPDATE_OP, e );
+			mdb_entry_return( op, e );
+		}
+		if ( rc == 0 )
+			mdb_cursor_close( mc );
+		if ( rc == 0 && last ) {
+			/* the builders didn't count, the writers will from now on */
+			for ( i = 0; i < mdb->mi_nattrs && rc == 0; i++ ) {
+				AttrInfo *ai = mdb->mi_attrs[i];
+				if ( ai->ai_newmask && ai->ai_dbi &&
+					!( ai->ai_indexmask & MDB_INDEX_DELETING ))
+					rc = mdb_idxstats_scan( txn, mdb, ai );
+			}
+		}
+		if ( rc == 0 && last )
+			mdb->mi_flags &= ~MDB_IX_BUILD;
+		if ( rc )
+			mdb_txn_abort( txn );
+		else
+			rc = mdb_txn_commit( txn );
+		if ( rc )
+			break;
+
+		ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+		ib->ib_done += n;
+		ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+		if ( last )
+			break;
+		rc = ixb_pausecheck( ib );
+		if ( rc )
+			break;
+	}
+	ch_free( ids );
+	if ( rc && rc != IXB_RESTART && rc != IXB_STOP )
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_ixbuild_run)
+			": database %s: reindexing changed entries failed: %s (%d)\n",
+			ib->ib_be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+	return rc;
+}
+
+/* Set up the tasks, and start recording the writes in the same txn
+ * that finds the end of the range.
+ */
+static int
+ixb_start( mdb_ixbuild *ib )
+{
+	struct mdb_info *mdb = (struct mdb_info *) ib->ib_be->be_private;
+	MDB_txn *txn;
+	MDB_cursor *mc;
+	MDB_val key;
+	MDB_stat st;
+	ID last = 0;
+	int i, rc, ntasks;
+
+	/* leave most of the pool to the clients */
+	ntasks = connection_pool_max / 4;
+	if ( ntasks < 1 )
+		ntasks = 1;
+
+	ib->ib_nattrs = mdb->mi_nattrs;
+	for ( i = 0; i < mdb->mi_nattrs; i++ )
+		mdb->mi_attrs[i]->ai_idx = i;
+	ib->ib_ntasks = ntasks;
+	ib->ib_tasks = ch_calloc( ntasks, sizeof( ixb_task ));
+	for ( i = 0; i < ntasks; i++ ) {
+		ib->ib_tasks[i].it_ib = ib;
+		ib->ib_tasks[i].it_ks = ch_calloc( 2 * ib->ib_nattrs + 1,
+			sizeof( mdb_keysort ));
+	}
+
+	rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+	if ( rc )
+		return rc;
+	rc = mdb_cursor_open( txn, mdb->mi_id2entry, &mc );
+	if ( rc == 0 ) {
+		if ( mdb_cursor_get( mc, &key, NULL, MDB_LAST ) == 0 )
+			memcpy( &last, key.mv_data, sizeof(ID) );
+		mdb_cursor_close( mc );
+		rc = mdb_stat( txn, mdb->mi_id2entry, &st );
+	}
+	if ( rc == 0 ) {
+		ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+		ib->ib_restart = 0;
+		ib->ib_err = 0;
+		ib->ib_last = last;
+		ib->ib_claim = 1;
+		ib->ib_ndirty = ib->ib_nsorted = 0;
+		ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+		mdb->mi_flags |= MDB_IX_BUILD;
+		ixb_phase( ib, IXB_SCAN, st.ms_entries );
+	}
+	/* nothing was written */
+	mdb_txn_abort( txn );
+	return rc;
+}
+
+static void
+ixb_end( mdb_ixbuild *ib )
+{
+	int i, t;
+
+	for ( t = 0; t < ib->ib_ntasks; t++ ) {
+		for ( i = 0; i < 2 * ib->ib_nattrs; i++ )
+			mdb_keysort_clear( &ib->ib_tasks[t].it_ks[i] );
+		ch_free( ib->ib_tasks[t].it_ks );
+	}
+	ch_free( ib->ib_tasks );
+	ib->ib_tasks = NULL;
+	ib->ib_ntasks = 0;
+}
+
+/* The runqueue task building the new indexes */
+void *
+mdb_ixbuild_run( void *ctx, void *arg )
+{
+	struct re_s *rtask = arg;
+	BackendDB *be = rtask->arg;
+	struct mdb_info *mdb = be->be_private;
+	mdb_ixbuild *ib;
+
+	Connection conn = {0};
+	OperationBuffer opbuf;
+	Operation *op;
+
+	int i, rc;
+
+	connection_fake_init( &conn, &opbuf, ctx );
+	op = &opbuf.ob_op;
+
+	op->o_bd = be;
+
+	if ( !mdb->mi_ixbuild ) {
+		ib = ch_calloc( 1, sizeof( mdb_ixbuild ));
+		ldap_pvt_thread_mutex_init( &ib->ib_mutex );
+		ldap_pvt_thread_cond_init( &ib->ib_cond );
+		ib->ib_be = be;
+		mdb->mi_ixbuild = ib;
+	}
+	ib = mdb->mi_ixbuild;
+
+	do {
+		Debug( LDAP_DEBUG_STATS, LDAP_XSTRING(mdb_ixbuild_run)
+			": database %s: building new indexes\n",
+			be->be_suffix[0].bv_val );
+		rc = ixb_start( ib );
+		if ( rc == 0 )
+			rc = ixb_scan_all( ib, ctx );
+		if ( rc == 0 )
+			rc = ixb_merge_all( ib );
+		if ( rc == 0 )
+			rc = ixb_catchup( ib, op );
+		ixb_end( ib );
+	} while ( rc == IXB_RESTART );
+
+	mdb->mi_flags &= ~MDB_IX_BUILD;
+	ixb_phase( ib, IXB_IDLE, 0 );
+
+	if ( rc == 0 ) {
+		for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+			if ( mdb->mi_attrs[ i ]->ai_indexmask & MDB_INDEX_DELETING
+				|| mdb->mi_attrs[ i ]->ai_newmask == 0 )
+			{
+				continue;
+			}
+			mdb->mi_attrs[ i ]->ai_indexmask = mdb->mi_attrs[ i ]->ai_newmask;
+			mdb->mi_attrs[ i ]->ai_newmask = 0;
+		}
+		Debug( LDAP_DEBUG_STATS, LDAP_XSTRING(mdb_ixbuild_run)
+			": database %s: new indexes are ready\n",
+			be->be_suffix[0].bv_val );
+	} else if ( rc != IXB_STOP ) {
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_ixbuild_run)
+			": database %s: index build failed, "
+			"the new indexes won't be used until slapindex is run\n",
+			be->be_suffix[0].bv_val );
+	}
+
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
+	mdb->mi_index_task = NULL;
+	ldap_pvt_runqueue_remove( &slapd_rq, rtask );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+
+	return NULL;
+}
+
+/* The index configuration has changed, called while the server is
+ * paused.
+ */
+void
+mdb_ixbuild_restart( struct mdb_info *mdb )
+{
+	mdb_ixbuild *ib = mdb->mi_ixbuild;
+
+	if ( !ib )
+		return;
+	ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+	ib->ib_restart = 1;
+	ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+}
+
+int
+mdb_ixbuild_stats( mdb_ixbuild *ib, struct berval *bv )
+{
+	long elapsed, eta = -1;
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &ib->ib_mutex );
+	if ( ib->ib_phase == IXB_IDLE ) {
+		ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+		return -1;
+	}
+	elapsed = slap_get_time() - ib->ib_start;
+	if ( ib->ib_done >= ib->ib_total )
+		eta = 0;
+	else if ( ib->ib_done )
+		eta = (double)elapsed * ( ib->ib_total - ib->ib_done ) / ib->ib_done;
+	i = snprintf( bv->bv_val, bv->bv_len,
+		"phase=%s#done=%lu#total=%lu#elapsed=%ld#eta=%ld",
+		ixb_phases[ib->ib_phase], ib->ib_done, ib->ib_total,
+		elapsed, eta );
+	ldap_pvt_thread_mutex_unlock( &ib->ib_mutex );
+	if ( i < 0 || i >= bv->bv_len )
+		return -1;
+	bv->bv_len = i;
+	return 0;
+}
+
+void
+mdb_ixbuild_free( struct mdb_info *mdb )
+{
+	mdb_ixbuild *ib = mdb->mi_ixbuild;
+
+	if ( !ib )
+		return;
+	ldap_pvt_thread_cond_destroy( &ib->ib_cond );
+	ldap_pvt_thread_mutex_destroy( &ib->ib_mutex );
+	ch_free( ib->ib_dirty );
+	ch_free( ib );
+	mdb->mi_ixbuild = NULL;
+}
@@ -70,3 +70,39 @@ mdb_key_read(
 
 	return rc;
 }
+
+/* count the IDs under a key */
+int
+mdb_key_count(
+	MDB_txn *txn,
+	MDB_dbi dbi,
+	struct berval *k,
+	ID *count
+)
+{
+	int rc;
+	MDB_val key;
+#ifndef MISALIGNED_OK
+	int kbuf[2];
+#endif
+
+#ifndef MISALIGNED_OK
+	if (k->bv_len & ALIGNER) {
+		key.mv_size = sizeof(kbuf);
+		key.mv_data = kbuf;
+		kbuf[1] = 0;
+		memcpy(kbuf, k->bv_val, k->bv_len);
+	} else
+#endif
+	{
+		key.mv_size = k->bv_len;
+		key.mv_data = k->bv_val;
+	}
+
+	rc = mdb_idl_count_key( txn, dbi, &key, count );
+
+	Debug( LDAP_DEBUG_TRACE, "<= mdb_key_count: %ld (%d)\n",
+		(long) *count, rc );
+
+	return rc;
+}
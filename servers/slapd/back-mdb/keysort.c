@@ -0,0 +1,359 @@
+/* keysort.c - ldap mdb back-end sorted runs of index keys */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+#include <ac/errno.h>
+#include <limits.h>
+
+#include "back-mdb.h"
+#include "idl.h"
+
+/* Index keys of many entries, collected so that they can be written
+ * to an index DB in key order instead of one entry at a time, which
+ * writes all over the B-tree. The caller decides when the records in
+ * memory are sorted and spilled to a temporary file as a sorted run.
+ * The runs of one or more sorters are merged in the end, and handed
+ * back one slot at a time in the default LMDB key order.
+ */
+
+/* bytes read from a run at a time */
+#define MDB_KS_RUNBUF	65536
+
+#ifdef _WIN32
+#define fseeko	_fseeki64
+#endif
+
+typedef struct ks_rec {
+	ID kr_id;
+	unsigned short kr_len;
+	char kr_key[1];
+} ks_rec;
+
+#define KR_HDR	offsetof( ks_rec, kr_key )
+#define KR_SIZE(len)	(( KR_HDR + (len) + sizeof(ID) - 1 ) & ~( sizeof(ID) - 1 ))
+
+int
+mdb_keysort_add( mdb_keysort *ks, struct berval *keys, ID id )
+{
+	ks_rec *kr;
+	size_t size;
+	int k;
+
+	for ( k=0; keys[k].bv_val; k++ ) {
+		assert( keys[k].bv_len <= USHRT_MAX );
+		size = KR_SIZE( keys[k].bv_len );
+		if ( ks->ks_used + size > ks->ks_size ) {
+			if ( !ks->ks_size )
+				ks->ks_size = MDB_KS_RUNBUF;
+			while ( ks->ks_used + size > ks->ks_size )
+				ks->ks_size *= 2;
+			ks->ks_buf = ch_realloc( ks->ks_buf, ks->ks_size );
+		}
+		kr = (ks_rec *)(ks->ks_buf + ks->ks_used);
+		kr->kr_id = id;
+		kr->kr_len = keys[k].bv_len;
+		memcpy( kr->kr_key, keys[k].bv_val, keys[k].bv_len );
+		ks->ks_used += size;
+		ks->ks_count++;
+	}
+	return 0;
+}
+
+/* An mdb_idl_keyfunc for the indexer, mc is the sorter */
+int
+mdb_keysort_keys(
+	BackendDB *be,
+	MDB_cursor *mc,
+	struct berval *keys,
+	ID id,
+	mdb_idxstats *st )
+{
+	return mdb_keysort_add( (mdb_keysort *)mc, keys, id );
+}
+
+/* Same order as LMDB's default key compare, then by ID */
+static int
+ks_cmp( const ks_rec *k1, const ks_rec *k2 )
+{
+	int rc;
+
+	rc = memcmp( k1->kr_key, k2->kr_key,
+		k1->kr_len < k2->kr_len ? k1->kr_len : k2->kr_len );
+	if ( rc )
+		return rc;
+	if ( k1->kr_len != k2->kr_len )
+		return k1->kr_len < k2->kr_len ? -1 : 1;
+	if ( k1->kr_id != k2->kr_id )
+		return k1->kr_id < k2->kr_id ? -1 : 1;
+	return 0;
+}
+
+static int
+ks_qcmp( const void *v1, const void *v2 )
+{
+	return ks_cmp( *(ks_rec **)v1, *(ks_rec **)v2 );
+}
+
+/* The records in memory, sorted */
+static ks_rec **
+ks_sort( mdb_keysort *ks, size_t *np )
+{
+	ks_rec **recs, *kr;
+	size_t n = 0, off;
+
+	for ( off = 0; off < ks->ks_used; off += KR_SIZE( kr->kr_len )) {
+		kr = (ks_rec *)(ks->ks_buf + off);
+		n++;
+	}
+	recs = ch_malloc(( n + 1 ) * sizeof( ks_rec * ));
+	n = 0;
+	for ( off = 0; off < ks->ks_used; off += KR_SIZE( kr->kr_len )) {
+		kr = (ks_rec *)(ks->ks_buf + off);
+		recs[n++] = kr;
+	}
+	qsort( recs, n, sizeof( ks_rec * ), ks_qcmp );
+	*np = n;
+	return recs;
+}
+
+/* Write the records in memory to the run file as one more run */
+int
+mdb_keysort_spill( mdb_keysort *ks )
+{
+	ks_rec **recs;
+	off_t end;
+	size_t i, n, size;
+	int rc = 0;
+
+	if ( !ks->ks_used )
+		return 0;
+	if ( !ks->ks_fp ) {
+		ks->ks_fp = tmpfile();
+		if ( !ks->ks_fp )
+			return errno ? errno : -1;
+	}
+	recs = ks_sort( ks, &n );
+	ks->ks_runs = ch_realloc( ks->ks_runs, ( ks->ks_nruns + 2 ) * sizeof( off_t ));
+	if ( !ks->ks_nruns )
+		ks->ks_runs[0] = 0;
+	end = ks->ks_runs[ks->ks_nruns];
+	for ( i=0; i<n; i++ ) {
+		size = KR_SIZE( recs[i]->kr_len );
+		if ( fwrite( recs[i], 1, size, ks->ks_fp ) != size ) {
+			rc = errno ? errno : -1;
+			break;
+		}
+		end += size;
+	}
+	ch_free( recs );
+	if ( !rc && fflush( ks->ks_fp ))
+		rc = errno ? errno : -1;
+	if ( rc )
+		return rc;
+	ks->ks_runs[++ks->ks_nruns] = end;
+	ks->ks_used = 0;
+	ks->ks_mark = 0;
+	return 0;
+}
+
+/* Drop everything collected */
+void
+mdb_keysort_clear( mdb_keysort *ks )
+{
+	if ( ks->ks_fp )
+		fclose( ks->ks_fp );
+	ch_free( ks->ks_runs );
+	ch_free( ks->ks_buf );
+	memset( ks, 0, sizeof( mdb_keysort ));
+}
+
+typedef struct ks_run {
+	FILE *rn_fp;
+	off_t rn_off;		/* unread part of the run */
+	off_t rn_end;
+	char *rn_buf;
+	size_t rn_pos;
+	size_t rn_len;
+	ks_rec **rn_recs;	/* or the sorted records in memory */
+	size_t rn_next;
+	size_t rn_nrecs;
+	ks_rec *rn_cur;		/* NULL at the end */
+} ks_run;
+
+static int
+ks_next( ks_run *rn )
+{
+	size_t avail, got;
+
+	if ( !rn->rn_fp ) {
+		rn->rn_cur = rn->rn_next < rn->rn_nrecs ?
+			rn->rn_recs[rn->rn_next++] : NULL;
+		return 0;
+	}
+
+	if ( rn->rn_cur )
+		rn->rn_pos += KR_SIZE( rn->rn_cur->kr_len );
+	avail = rn->rn_len - rn->rn_pos;
+	if ( avail < KR_HDR || avail <
+		KR_SIZE( ((ks_rec *)(rn->rn_buf + rn->rn_pos))->kr_len ))
+	{
+		AC_MEMCPY( rn->rn_buf, rn->rn_buf + rn->rn_pos, avail );
+		rn->rn_pos = 0;
+		got = MDB_KS_RUNBUF - avail;
+		if ( got > rn->rn_end - rn->rn_off )
+			got = rn->rn_end - rn->rn_off;
+		if ( got ) {
+			if ( fseeko( rn->rn_fp, rn->rn_off, SEEK_SET ) ||
+				fread( rn->rn_buf + avail, 1, got, rn->rn_fp ) != got )
+				return -1;
+			rn->rn_off += got;
+		}
+		rn->rn_len = avail += got;
+		if ( !avail ) {
+			rn->rn_cur = NULL;
+			return 0;
+		}
+		if ( avail < KR_HDR || avail <
+			KR_SIZE( ((ks_rec *)rn->rn_buf)->kr_len ))
+			return -1;
+	}
+	rn->rn_cur = (ks_rec *)(rn->rn_buf + rn->rn_pos);
+	return 0;
+}
+
+/* Restore the heap order of runs below slot i */
+static void
+ks_sift( ks_run **heap, int n, int i )
+{
+	ks_run *rn = heap[i];
+	int j;
+
+	while (( j = 2*i + 1 ) < n ) {
+		if ( j+1 < n && ks_cmp( heap[j+1]->rn_cur,
+			heap[j]->rn_cur ) < 0 )
+			j++;
+		if ( ks_cmp( rn->rn_cur, heap[j]->rn_cur ) <= 0 )
+			break;
+		heap[i] = heap[j];
+		i = j;
+	}
+	heap[i] = rn;
+}
+
+/* Merge the runs and the records in memory of nks sorters. The put
+ * callback gets each key with its IDs in order and without repeats.
+ * With maxids set, only the first maxids IDs of a key are passed in
+ * ids while n counts them all and last is the highest. Returns -1 if
+ * the runs can't be read, or what put returned if it wasn't 0.
+ */
+int
+mdb_keysort_merge(
+	mdb_keysort **ks,
+	int nks,
+	size_t maxids,
+	mdb_keysort_put *put,
+	void *arg )
+{
+	MDB_val key;
+	ks_run *runs, **heap;
+	ks_rec *kr;
+	char *kbuf;
+	ID *ids = NULL, last = NOID;
+	size_t n = 0, idmax = 0;
+	int i, j, nruns = 0, nheap = 0, rc = 0;
+
+	for ( i=0; i<nks; i++ )
+		nruns += ks[i]->ks_nruns + 1;
+	runs = ch_calloc( nruns, sizeof( ks_run ));
+	heap = ch_malloc( nruns * sizeof( ks_run * ));
+	nruns = 0;
+	for ( i=0; i<nks; i++ ) {
+		for ( j=0; j<ks[i]->ks_nruns; j++, nruns++ ) {
+			runs[nruns].rn_fp = ks[i]->ks_fp;
+			runs[nruns].rn_off = ks[i]->ks_runs[j];
+			runs[nruns].rn_end = ks[i]->ks_runs[j+1];
+			runs[nruns].rn_buf = ch_malloc( MDB_KS_RUNBUF );
+		}
+		runs[nruns].rn_recs = ks_sort( ks[i], &runs[nruns].rn_nrecs );
+		nruns++;
+	}
+	for ( i=0; i<nruns; i++ ) {
+		if ( ks_next( &runs[i] )) {
+			rc = -1;
+			goto done;
+		}
+		if ( runs[i].rn_cur )
+			heap[nheap++] = &runs[i];
+	}
+	for ( i = nheap/2 - 1; i >= 0; i-- )
+		ks_sift( heap, nheap, i );
+
+	kbuf = ch_malloc( USHRT_MAX + 1 );
+	key.mv_data = kbuf;
+	key.mv_size = 0;
+	while ( nheap || n ) {
+		kr = nheap ? heap[0]->rn_cur : NULL;
+		if ( n && ( !kr || kr->kr_len != key.mv_size ||
+			memcmp( kr->kr_key, kbuf, key.mv_size )))
+		{
+			/* end of a slot */
+			rc = put( arg, &key, ids, n, last );
+			if ( rc )
+				break;
+			n = 0;
+		}
+		if ( !kr )
+			break;
+		if ( !n ) {
+			key.mv_size = kr->kr_len;
+			memcpy( kbuf, kr->kr_key, kr->kr_len );
+		}
+		/* a value may produce the same key twice */
+		if ( !n || kr->kr_id != last ) {
+			if ( !maxids || n < maxids ) {
+				if ( n == idmax ) {
+					idmax = idmax ? idmax * 2 : 1024;
+					ids = ch_realloc( ids, idmax * sizeof(ID) );
+				}
+				ids[n] = kr->kr_id;
+			}
+			last = kr->kr_id;
+			n++;
+		}
+		if ( ks_next( heap[0] )) {
+			rc = -1;
+			break;
+		}
+		if ( !heap[0]->rn_cur )
+			heap[0] = heap[--nheap];
+		if ( nheap )
+			ks_sift( heap, nheap, 0 );
+	}
+	ch_free( kbuf );
+	ch_free( ids );
+
+done:
+	for ( i=0; i<nruns; i++ ) {
+		ch_free( runs[i].rn_buf );
+		ch_free( runs[i].rn_recs );
+	}
+	ch_free( runs );
+	ch_free( heap );
+	return rc;
+}
@@ -50,13 +50,18 @@ mdb_modify_idxflags(
 			if ( ap ) ap->a_flags |= SLAP_ATTR_IXDEL;
 
 			/* ITS#8678 FIXME
-			 * If using 32bit hashes, or substring index, must account for
-			 * possible index collisions. If no substring index, and using
-			 * 64bit hashes, assume we don't need to check for collisions.
+			 * If using 32bit hashes, or substring, ngram or ordered index,
+			 * must account for possible index collisions. Substring and ngram
+			 * keys are shared by any values with a common fragment, and
+			 * ordered keys by values alike in their leading part, whatever
+			 * the hash size. Otherwise, using 64bit hashes, assume we don't
+			 * need to check for collisions.
 			 *
 			 * In 2.5 use refcounts and avoid all of this mess.
 			 */
-			if (!slap_hash64(-1) || (ai->ai_indexmask & SLAP_INDEX_SUBSTR)) {
+			if (!slap_hash64(-1) ||
+				( ai->ai_indexmask &
+				( SLAP_INDEX_SUBSTR|SLAP_INDEX_NGRAM|SLAP_INDEX_ORDERED ))) {
 				/* Find all other attrs that index to same slot */
 				for ( ap = newattrs; ap; ap = ap->a_next ) {
 					ai = mdb_index_mask( op->o_bd, ap->a_desc, &ix2 );
@@ -74,6 +79,27 @@ mdb_modify_idxflags(
 	}
 }
 
+/* Store the separately kept values of a again, in the configured format */
+static int
+mdb_modify_mval_reformat(
+	Operation *op,
+	MDB_cursor *mvc,
+	ID id,
+	Attribute *a,
+	unsigned runs )
+{
+	Attribute a_dummy;
+	int rc;
+
+	a_dummy.a_desc = a->a_desc;
+	a_dummy.a_numvals = 0;
+	rc = mdb_mval_del( op, mvc, id, &a_dummy, 0 );
+	if ( rc )
+		return rc;
+	a->a_flags = ( a->a_flags & ~SLAP_ATTR_BIG_RUNS ) | runs;
+	return mdb_mval_put( op, mvc, id, a, runs );
+}
+
 int mdb_modify_internal(
 	Operation *op,
 	MDB_txn *tid,
@@ -173,12 +199,14 @@ do_add:
 				Debug(LDAP_DEBUG_ARGS, "mdb_modify_internal: %d %s\n",
 					err, *text );
 			} else {
-				unsigned hi;
+				unsigned hi, runs;
 				if (!aold)
 					anew = attr_find( e->e_attrs, mod->sm_desc );
 				else
 					anew = aold;
 				mdb_attr_multi_thresh( mdb, mod->sm_desc, &hi, NULL );
+				runs = mdb_attr_multi_runs( mdb, mod->sm_desc ) ?
+					SLAP_ATTR_BIG_RUNS : 0;
 				/* check for big multivalued attrs */
 				if ( anew->a_numvals > hi )
 					anew->a_flags |= SLAP_ATTR_BIG_MULTI;
@@ -191,15 +219,20 @@ mval_fail:					strncpy( textbuf, mdb_strerror( err ), textlen );
 							break;
 						}
 					}
-					/* if prev was set, just add new values */
-					if (a_flags & SLAP_ATTR_BIG_MULTI ) {
+					if (!(a_flags & SLAP_ATTR_BIG_MULTI)) {
+						anew->a_flags = ( anew->a_flags & ~SLAP_ATTR_BIG_RUNS ) | runs;
+						err = mdb_mval_put(op, mvc, e->e_id, anew, runs);
+					} else if (( a_flags & SLAP_ATTR_BIG_RUNS ) != runs ) {
+						/* store them all, as configured now */
+						err = mdb_modify_mval_reformat( op, mvc, e->e_id,
+							anew, runs );
+					} else {
+						/* just add new values */
 						anew = (Attribute *)mod;
 						/* Tweak nvals */
 						if (!anew->a_nvals)
 							anew->a_nvals = anew->a_vals;
-					}
-					err = mdb_mval_put(op, mvc, e->e_id, anew);
-					if (a_flags & SLAP_ATTR_BIG_MULTI ) {
+						err = mdb_mval_put(op, mvc, e->e_id, anew, runs);
 						/* Undo nvals tweak */
 						if (anew->a_nvals == anew->a_vals)
 							anew->a_nvals = NULL;
@@ -249,11 +282,20 @@ do_del:
 					if ( mod->sm_numvals ) {
 						anew = attr_find( e->e_attrs, mod->sm_desc );
 						if ( anew ) {
-							unsigned lo;
+							unsigned lo, runs;
 							mdb_attr_multi_thresh( mdb, mod->sm_desc, NULL, &lo );
+							runs = mdb_attr_multi_runs( mdb, mod->sm_desc ) ?
+								SLAP_ATTR_BIG_RUNS : 0;
 							if ( anew->a_numvals < lo ) {
-								anew->a_flags ^= SLAP_ATTR_BIG_MULTI;
+								anew->a_flags &= ~(SLAP_ATTR_BIG_MULTI|SLAP_ATTR_BIG_RUNS);
 								anew = NULL;
+							} else if (( a_flags & SLAP_ATTR_BIG_RUNS ) != runs ) {
+								/* store the rest as configured now */
+								err = mdb_modify_mval_reformat( op, mvc,
+									e->e_id, anew, runs );
+								if ( err )
+									goto mval_fail;
+								break;
 							} else {
 								anew = (Attribute *)mod;
 							}
@@ -267,7 +309,8 @@ do_del:
 						anew->a_desc = mod->sm_desc;
 						anew->a_numvals = 0;
 					}
-					err = mdb_mval_del( op, mvc, e->e_id, anew );
+					err = mdb_mval_del( op, mvc, e->e_id, anew,
+						a_flags & SLAP_ATTR_BIG_RUNS );
 					if ( err )
 						goto mval_fail;
 				}
@@ -297,25 +340,29 @@ do_del:
 					anew = &a_dummy;
 					anew->a_desc = mod->sm_desc;
 					anew->a_numvals = 0;
-					err = mdb_mval_del( op, mvc, e->e_id, anew );
+					err = mdb_mval_del( op, mvc, e->e_id, anew, 0 );
 					if (err)
 						goto mval_fail;
 				}
 				anew = attr_find( e->e_attrs, mod->sm_desc );
 				mdb_attr_multi_thresh( mdb, mod->sm_desc, &hi, NULL );
 				if (mod->sm_numvals > hi) {
+					anew->a_flags &= ~SLAP_ATTR_BIG_RUNS;
 					anew->a_flags |= SLAP_ATTR_BIG_MULTI;
+					if ( mdb_attr_multi_runs( mdb, mod->sm_desc ))
+						anew->a_flags |= SLAP_ATTR_BIG_RUNS;
 					if (!mvc) {
 						err = mdb_cursor_open( tid, mdb->mi_dbis[MDB_ID2VAL], &mvc );
 						if (err)
 							goto mval_fail;
 					}
-					err = mdb_mval_put(op, mvc, e->e_id, anew);
+					err = mdb_mval_put(op, mvc, e->e_id, anew,
+						anew->a_flags & SLAP_ATTR_BIG_RUNS);
 					if (err)
 						goto mval_fail;
 				} else if (anew) {
 					/* revert back to normal attr */
-					anew->a_flags &= ~SLAP_ATTR_BIG_MULTI;
+					anew->a_flags &= ~(SLAP_ATTR_BIG_MULTI|SLAP_ATTR_BIG_RUNS);
 				}
 			}
 			break;
@@ -443,16 +490,19 @@ do_del:
 	/* start with deleting the old index entries */
 	for ( ap = save_attrs; ap != NULL; ap = ap->a_next ) {
 		if ( ap->a_flags & SLAP_ATTR_IXDEL ) {
-			struct berval *vals;
+			struct berval *vals, *keep = NULL;
 			Attribute *a2;
 			ap->a_flags &= ~SLAP_ATTR_IXDEL;
 			a2 = attr_find( e->e_attrs, ap->a_desc );
 			if ( a2 ) {
 				/* need to detect which values were deleted */
 				int i, j, k;
-				/* let add know there were deletes */
+				/* the keys of deleted values may be shared with
+				 * remaining ones, leave those in place instead of
+				 * having add index all remaining values again
+				 */
 				if ( a2->a_flags & SLAP_ATTR_IXADD )
-					a2->a_flags |= SLAP_ATTR_IXDEL;
+					keep = a2->a_nvals;
 				vals = op->o_tmpalloc( (ap->a_numvals + 1) *
 					sizeof(struct berval), op->o_tmpmemctx );
 				j = 0;
@@ -486,8 +536,8 @@ do_del:
 			}
 			rc = 0;
 			if ( !BER_BVISNULL( vals )) {
-				rc = mdb_index_values( op, tid, ap->a_desc,
-					vals, e->e_id, SLAP_INDEX_DELETE_OP );
+				rc = mdb_index_values_keep( op, tid, ap->a_desc,
+					vals, keep, e->e_id );
 				if ( rc != LDAP_SUCCESS ) {
 					Debug( LDAP_DEBUG_ANY,
 						"%s: attribute \"%s\" index delete failure\n",
@@ -760,12 +810,12 @@ mdb_modify( Operation *op, SlapReply *rs )
 		opinfo.moi_oe.oe_key = NULL;
 		if( op->o_noop ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_txngroup_abort( mdb, moi, txn );
 			rs->sr_err = LDAP_X_NO_OPERATION;
 			txn = NULL;
 			goto return_results;
 		} else {
-			rs->sr_err = mdb_txn_commit( txn );
+			rs->sr_err = mdb_txngroup_commit( mdb, moi, txn );
 			if ( rs->sr_err )
 				mdb->mi_numads = numads;
 			txn = NULL;
@@ -811,7 +861,7 @@ done:
 	if( moi == &opinfo ) {
 		if( txn != NULL ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_txngroup_abort( mdb, moi, txn );
 		}
 		if ( opinfo.moi_oe.oe_key ) {
 			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
@@ -50,6 +50,20 @@ static AttributeDescription *ad_olmMDBReadersMax,
 
 static AttributeDescription *ad_olmMDBEntries;
 
+static AttributeDescription *ad_olmMDBIndexStats;
+
+static AttributeDescription *ad_olmMDBDNFilter;
+
+static AttributeDescription *ad_olmMDBEntryCache;
+
+static AttributeDescription *ad_olmMDBGroupCommit;
+
+static AttributeDescription *ad_olmMDBIndexBuild;
+
+static AttributeDescription *ad_olmMDBTrickle;
+
+static AttributeDescription *ad_olmMDBReaderAge;
+
 /*
  * NOTE: there's some confusion in monitor OID arc;
  * by now, let's consider:
@@ -143,6 +157,62 @@ static struct {
 		"NO-USER-MODIFICATION "
 		"USAGE dSAOperation )",
 		&ad_olmMDBEntries },
+
+	{ "( olmMDBAttributes:7 "
+		"NAME ( 'olmMDBIndexStats' ) "
+		"DESC 'Keys, average ID list length and ranges of each index' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBIndexStats },
+
+	{ "( olmMDBAttributes:8 "
+		"NAME ( 'olmMDBDNFilter' ) "
+		"DESC 'Size, fill, false positive rate and use of the DN filter' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBDNFilter },
+
+	{ "( olmMDBAttributes:9 "
+		"NAME ( 'olmMDBEntryCache' ) "
+		"DESC 'Size, hits and misses of the entry cache' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBEntryCache },
+
+	{ "( olmMDBAttributes:10 "
+		"NAME ( 'olmMDBGroupCommit' ) "
+		"DESC 'Commits shared by several writes and the writes in them' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBGroupCommit },
+
+	{ "( olmMDBAttributes:11 "
+		"NAME ( 'olmMDBIndexBuild' ) "
+		"DESC 'Phase and progress of the online index build' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBIndexBuild },
+
+	{ "( olmMDBAttributes:12 "
+		"NAME ( 'olmMDBTrickle' ) "
+		"DESC 'Writeback of dirty pages between checkpoints, and time spent syncing' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBTrickle },
+
+	{ "( olmMDBAttributes:13 "
+		"NAME ( 'olmMDBReaderAge' ) "
+		"DESC 'Age of the oldest read transaction, and old readers reported and aborted' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmMDBReaderAge },
 	{ NULL }
 };
 
@@ -162,12 +232,60 @@ static struct {
 #endif /* MDB_MONITOR_IDX */
 			"$ olmMDBPagesMax $ olmMDBPagesUsed $ olmMDBPagesFree "
 			"$ olmMDBReadersMax $ olmMDBReadersUsed $ olmMDBEntries "
+			"$ olmMDBIndexStats $ olmMDBDNFilter $ olmMDBEntryCache "
+			"$ olmMDBGroupCommit $ olmMDBIndexBuild $ olmMDBTrickle "
+			"$ olmMDBReaderAge "
 			") )",
 		&oc_olmMDBDatabase },
 
 	{ NULL }
 };
 
+/* Build the olmMDBIndexStats values, one per index database:
+ * <attr>#keys=<n>#ids=<n>#avgIDL=<n>#ranges=<n>
+ */
+static BerVarray
+mdb_monitor_idxstats( struct mdb_info *mdb )
+{
+	BerVarray vals = NULL;
+	struct berval bv;
+	char buf[ BUFSIZ ];
+	MDB_txn *txn;
+	int i;
+
+	if ( mdb_txn_begin( mdb->mi_dbenv, NULL, MDB_RDONLY, &txn ))
+		return NULL;
+
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		AttrInfo *ai = mdb->mi_attrs[i];
+		mdb_idxstats stats, *st = &stats;
+		unsigned long lists, avg;
+
+		if ( !ai->ai_dbi || !ai->ai_indexmask ||
+			( ai->ai_indexmask & MDB_INDEX_DELETING ))
+			continue;
+
+		/* the writers keep them, there's nothing to count here */
+		if ( mdb_idxstats_get( txn, mdb, ai, st ))
+			continue;
+
+		lists = st->is_keys > st->is_ranges ?
+			st->is_keys - st->is_ranges : 0;
+		avg = lists ? ( st->is_ids * 10 + lists / 2 ) / lists : 0;
+		bv.bv_val = buf;
+		bv.bv_len = snprintf( buf, sizeof( buf ),
+			"%s#keys=%lu#ids=%lu#avgIDL=%lu.%lu#ranges=%lu",
+			ai->ai_desc->ad_cname.bv_val, st->is_keys, st->is_ids,
+			avg / 10, avg % 10, st->is_ranges );
+		if ( bv.bv_len >= sizeof( buf ))
+			continue;
+		value_add_one( &vals, &bv );
+	}
+	mdb_txn_abort( txn );
+
+	return vals;
+}
+
 static int
 mdb_monitor_update(
 	Operation	*op,
@@ -182,6 +300,7 @@ mdb_monitor_update(
 	MDB_stat mst;
 	MDB_envinfo mei;
 	MDB_txn *txn;
+	BerVarray vals;
 	int rc;
 
 #ifdef MDB_MONITOR_IDX
@@ -240,12 +359,109 @@ mdb_monitor_update(
 
 		mdb_txn_abort( txn );
 
+		vals = mdb_monitor_idxstats( mdb );
+
+		a = attr_find( e->e_attrs, ad_olmMDBIndexStats );
+		if ( vals != NULL ) {
+			if ( a == NULL ) {
+				Attribute	**ap;
+
+				for ( ap = &e->e_attrs; *ap != NULL; ap = &(*ap)->a_next )
+					;
+				*ap = attr_alloc( ad_olmMDBIndexStats );
+				a = *ap;
+			} else {
+				assert( a->a_nvals == a->a_vals );
+				ber_bvarray_free( a->a_vals );
+			}
+			a->a_vals = vals;
+			a->a_nvals = a->a_vals;
+			a->a_numvals = 0;
+			while ( !BER_BVISNULL( &vals[ a->a_numvals ] ))
+				a->a_numvals++;
+		} else if ( a != NULL ) {
+			attr_delete( &e->e_attrs, ad_olmMDBIndexStats );
+		}
+
 		a = attr_find( e->e_attrs, ad_olmMDBPagesFree );
 		assert( a != NULL );
 		bv.bv_val = buf;
 		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", pages );
 		ber_bvreplace( &a->a_vals[ 0 ], &bv );
 	}
+
+	a = attr_find( e->e_attrs, ad_olmMDBDNFilter );
+	bv.bv_val = buf;
+	bv.bv_len = sizeof( buf );
+	if ( mdb->mi_dnf && !mdb_dnfilter_stats( mdb->mi_dnf, &bv )) {
+		if ( a != NULL )
+			ber_bvreplace( &a->a_vals[ 0 ], &bv );
+		else
+			attr_merge_one( e, ad_olmMDBDNFilter, &bv, NULL );
+	} else if ( a != NULL ) {
+		attr_delete( &e->e_attrs, ad_olmMDBDNFilter );
+	}
+
+	a = attr_find( e->e_attrs, ad_olmMDBEntryCache );
+	bv.bv_val = buf;
+	bv.bv_len = sizeof( buf );
+	if ( mdb->mi_ecache && !mdb_ecache_stats( mdb->mi_ecache, &bv )) {
+		if ( a != NULL )
+			ber_bvreplace( &a->a_vals[ 0 ], &bv );
+		else
+			attr_merge_one( e, ad_olmMDBEntryCache, &bv, NULL );
+	} else if ( a != NULL ) {
+		attr_delete( &e->e_attrs, ad_olmMDBEntryCache );
+	}
+
+	a = attr_find( e->e_attrs, ad_olmMDBGroupCommit );
+	bv.bv_val = buf;
+	bv.bv_len = sizeof( buf );
+	if ( mdb_txngroup_active( mdb ) &&
+		!mdb_txngroup_stats( mdb->mi_txngroup, &bv )) {
+		if ( a != NULL )
+			ber_bvreplace( &a->a_vals[ 0 ], &bv );
+		else
+			attr_merge_one( e, ad_olmMDBGroupCommit, &bv, NULL );
+	} else if ( a != NULL ) {
+		attr_delete( &e->e_attrs, ad_olmMDBGroupCommit );
+	}
+
+	a = attr_find( e->e_attrs, ad_olmMDBIndexBuild );
+	bv.bv_val = buf;
+	bv.bv_len = sizeof( buf );
+	if ( mdb->mi_ixbuild && !mdb_ixbuild_stats( mdb->mi_ixbuild, &bv )) {
+		if ( a != NULL )
+			ber_bvreplace( &a->a_vals[ 0 ], &bv );
+		else
+			attr_merge_one( e, ad_olmMDBIndexBuild, &bv, NULL );
+	} else if ( a != NULL ) {
+		attr_delete( &e->e_attrs, ad_olmMDBIndexBuild );
+	}
+
+	a = attr_find( e->e_attrs, ad_olmMDBTrickle );
+	bv.bv_val = buf;
+	bv.bv_len = sizeof( buf );
+	if ( mdb->mi_flusher && !mdb_flush_stats( mdb->mi_flusher, &bv )) {
+		if ( a != NULL )
+			ber_bvreplace( &a->a_vals[ 0 ], &bv );
+		else
+			attr_merge_one( e, ad_olmMDBTrickle, &bv, NULL );
+	} else if ( a != NULL ) {
+		attr_delete( &e->e_attrs, ad_olmMDBTrickle );
+	}
+
+	a = attr_find( e->e_attrs, ad_olmMDBReaderAge );
+	bv.bv_val = buf;
+	bv.bv_len = sizeof( buf );
+	if ( mdb->mi_rdwatch && !mdb_rdwatch_stats( mdb->mi_rdwatch, &bv )) {
+		if ( a != NULL )
+			ber_bvreplace( &a->a_vals[ 0 ], &bv );
+		else
+			attr_merge_one( e, ad_olmMDBReaderAge, &bv, NULL );
+	} else if ( a != NULL ) {
+		attr_delete( &e->e_attrs, ad_olmMDBReaderAge );
+	}
 	return SLAP_CB_CONTINUE;
 }
 
@@ -0,0 +1,562 @@
+/* mvruns.c - ldap mdb back-end sorted runs of multival attributes */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-mdb.h"
+
+/* An attribute split out by multival normally has an id2v record for
+ * each value, holding a full copy of it. With the runs option the
+ * values are kept in sorted blocks instead, each block one id2v record
+ * with as many consecutive values as fit in a dupsort item. A value is
+ * stored as the number of leading and trailing bytes it shares with
+ * the one before it, and the bytes in between. The DNs of a member
+ * list mostly differ only in their RDN values, so they take a few
+ * bytes each. An original value that differs from its normalized one
+ * is coded the same way against it.
+ *
+ * The blocks sort on their first value, see mdb_id2v_dupsort(), so
+ * the block that holds a value is found with a single lookup, and
+ * adding or deleting a value rewrites only that block. A block that
+ * grows too big is split until its parts fit.
+ *
+ * Block layout: a 2 byte count of values, then for each value the
+ * shared prefix length, shared suffix length and length of the middle
+ * of its normalized form, the middle bytes, and a flag telling if the
+ * original value follows, coded against the normalized one. The
+ * numbers are base 128 varints. The first value of a block shares
+ * nothing, so it can be read in place.
+ */
+
+/* leave bulk loaded blocks some room for values added later */
+#define MVR_FILL(max)	((max) - (max) / 4)
+
+#define MVR_MAXVALS	65535
+
+static unsigned char *
+mvr_putnum( unsigned char *p, unsigned char *end, ber_len_t v )
+{
+	do {
+		if ( p >= end )
+			return NULL;
+		*p++ = ( v & 0x7f ) | ( v > 0x7f ? 0x80 : 0 );
+		v >>= 7;
+	} while ( v );
+	return p;
+}
+
+static const unsigned char *
+mvr_getnum( const unsigned char *p, const unsigned char *end, ber_len_t *v )
+{
+	int shift = 0;
+
+	*v = 0;
+	do {
+		if ( p >= end || shift > 28 )
+			return NULL;
+		*v |= (ber_len_t)( *p & 0x7f ) << shift;
+		shift += 7;
+	} while ( *p++ & 0x80 );
+	return p;
+}
+
+/* Code cur against prev */
+static unsigned char *
+mvr_putval( unsigned char *p, unsigned char *end,
+	struct berval *prev, struct berval *cur )
+{
+	ber_len_t pre = 0, suf = 0, max;
+
+	max = prev->bv_len < cur->bv_len ? prev->bv_len : cur->bv_len;
+	while ( pre < max && prev->bv_val[pre] == cur->bv_val[pre] )
+		pre++;
+	max -= pre;
+	while ( suf < max && prev->bv_val[prev->bv_len - suf - 1] ==
+		cur->bv_val[cur->bv_len - suf - 1] )
+		suf++;
+
+	if ( !( p = mvr_putnum( p, end, pre )) ||
+		!( p = mvr_putnum( p, end, suf )) ||
+		!( p = mvr_putnum( p, end, cur->bv_len - pre - suf )) ||
+		cur->bv_len - pre - suf > (ber_len_t)( end - p ))
+		return NULL;
+	memcpy( p, cur->bv_val + pre, cur->bv_len - pre - suf );
+	return p + cur->bv_len - pre - suf;
+}
+
+/* Read a value coded against prev into out, with a NUL after it.
+ * With out NULL only its length is set.
+ */
+static const unsigned char *
+mvr_getval( const unsigned char *p, const unsigned char *end,
+	struct berval *prev, char *out, ber_len_t room, struct berval *cur )
+{
+	ber_len_t pre, suf, mid;
+
+	if ( !( p = mvr_getnum( p, end, &pre )) ||
+		!( p = mvr_getnum( p, end, &suf )) ||
+		!( p = mvr_getnum( p, end, &mid )) ||
+		mid > (ber_len_t)( end - p ) ||
+		pre > prev->bv_len || suf > prev->bv_len - pre )
+		return NULL;
+	cur->bv_len = pre + mid + suf;
+	if ( out ) {
+		if ( cur->bv_len >= room )
+			return NULL;
+		memcpy( out, prev->bv_val, pre );
+		memcpy( out + pre, p, mid );
+		memcpy( out + pre + mid, prev->bv_val + prev->bv_len - suf, suf );
+		out[cur->bv_len] = '\0';
+		cur->bv_val = out;
+	}
+	return p + mid;
+}
+
+/* The first normalized value of a block, in place */
+int
+mdb_mvrun_first( const MDB_val *blk, struct berval *bv )
+{
+	const unsigned char *p = (unsigned char *)blk->mv_data + 2;
+	const unsigned char *end = (unsigned char *)blk->mv_data + blk->mv_size;
+	ber_len_t pre, suf;
+
+	if ( blk->mv_size < 2 ||
+		!( p = mvr_getnum( p, end, &pre )) ||
+		!( p = mvr_getnum( p, end, &suf )) ||
+		!( p = mvr_getnum( p, end, &bv->bv_len )) ||
+		pre || suf || bv->bv_len > (ber_len_t)( end - p ))
+		return -1;
+	bv->bv_val = (char *)p;
+	return 0;
+}
+
+/* Expand the values of a block into out, which has room for outlen
+ * bytes, and at most max values. Original values that are the same as
+ * the normalized ones share their bytes, v may be NULL if they always
+ * are. With out NULL, only the count and the room needed are set.
+ */
+static int
+mvr_decode( const MDB_val *blk, struct berval *nv, struct berval *v,
+	unsigned max, char *out, ber_len_t outlen, unsigned *np, ber_len_t *lenp )
+{
+	const unsigned char *p = (unsigned char *)blk->mv_data + 2;
+	const unsigned char *end = (unsigned char *)blk->mv_data + blk->mv_size;
+	struct berval prev, bn, bv;
+	ber_len_t len = 0, flag;
+	unsigned short n;
+	unsigned i;
+
+	if ( blk->mv_size < 2 )
+		return -1;
+	memcpy( &n, blk->mv_data, 2 );
+	if ( out && n > max )
+		return -1;
+	BER_BVSTR( &prev, "" );
+	for ( i=0; i<n; i++ ) {
+		if ( !( p = mvr_getval( p, end, &prev, out ? out + len : NULL,
+			outlen - len, &bn )))
+			return -1;
+		len += bn.bv_len + 1;
+		if ( !( p = mvr_getnum( p, end, &flag )))
+			return -1;
+		if ( flag ) {
+			if ( !( p = mvr_getval( p, end, &bn, out ? out + len : NULL,
+				outlen - len, &bv )))
+				return -1;
+			len += bv.bv_len + 1;
+		} else {
+			bv = bn;
+		}
+		if ( out ) {
+			nv[i] = bn;
+			if ( v )
+				v[i] = bv;
+			else if ( flag )
+				return -1;
+		}
+		prev = bn;
+	}
+	if ( p != end )
+		return -1;
+	*np = n;
+	if ( lenp )
+		*lenp = len;
+	return 0;
+}
+
+/* Code values [0,n) of nv and v into a block of at most cap bytes.
+ * Returns its size, or 0 if they don't fit.
+ */
+static unsigned
+mvr_encode( struct berval *nv, struct berval *v, unsigned n,
+	unsigned char *buf, unsigned cap )
+{
+	unsigned char *p = buf + 2, *end = buf + cap;
+	struct berval prev;
+	unsigned short s = n;
+	unsigned i;
+
+	if ( cap < 2 || n > MVR_MAXVALS )
+		return 0;
+	memcpy( buf, &s, 2 );
+	BER_BVSTR( &prev, "" );
+	for ( i=0; i<n; i++ ) {
+		if ( !( p = mvr_putval( p, end, &prev, &nv[i] )))
+			return 0;
+		if ( v && v[i].bv_val != nv[i].bv_val && !bvmatch( &v[i], &nv[i] )) {
+			if ( !( p = mvr_putnum( p, end, 1 )) ||
+				!( p = mvr_putval( p, end, &nv[i], &v[i] )))
+				return 0;
+		} else {
+			if ( !( p = mvr_putnum( p, end, 0 )))
+				return 0;
+		}
+		prev = nv[i];
+	}
+	return p - buf;
+}
+
+static void
+mvr_key( struct mdb_info *mdb, ID id, AttributeDescription *ad,
+	char *ivk, MDB_val *key, MDB_val *data )
+{
+	unsigned short s = mdb->mi_adxs[ad->ad_index];
+
+	memcpy( ivk, &id, sizeof(ID) );
+	memcpy( ivk+sizeof(ID), &s, 2 );
+	key->mv_data = ivk;
+	key->mv_size = sizeof(ID)+2;
+	/* as in mdb_mval_put */
+	if (( ad->ad_type->sat_flags & SLAP_AT_ORDERED ) ||
+		ad == slap_schema.si_ad_objectClass )
+		data[2].mv_data = NULL;
+	else
+		data[2].mv_data = ad;
+	data[2].mv_size = MDB_MV_RUNS;
+}
+
+/* Position mc on the block where nv belongs: the last one whose first
+ * value isn't above it, or the first one if there is none.
+ * The cursor ops may point the key they're given into the page, which
+ * our own writes then change under us, so they always get a copy.
+ */
+static int
+mvr_find( MDB_cursor *mc, MDB_val *key, MDB_val *data, struct berval *nv )
+{
+	struct berval first;
+	MDB_val k = *key;
+	int rc;
+
+	data[1].mv_data = nv->bv_val;
+	data[1].mv_size = nv->bv_len;
+	rc = mdb_cursor_get( mc, &k, data, MDB_GET_BOTH_RANGE );
+	if ( rc == MDB_NOTFOUND ) {
+		/* past the first value of the last block, if any */
+		rc = mdb_cursor_get( mc, &k, data, MDB_SET );
+		if ( rc == 0 )
+			rc = mdb_cursor_get( mc, &k, data, MDB_LAST_DUP );
+		return rc;
+	}
+	if ( rc )
+		return rc;
+	if ( mdb_mvrun_first( data, &first ))
+		return MDB_CORRUPTED;
+	if ( !mdb_id2v_match( data[2].mv_data, nv, &first ))
+		return 0;
+	rc = mdb_cursor_get( mc, &k, data, MDB_PREV_DUP );
+	if ( rc == MDB_NOTFOUND ) {
+		/* before the first block */
+		k = *key;
+		data[1].mv_data = nv->bv_val;
+		data[1].mv_size = nv->bv_len;
+		rc = mdb_cursor_get( mc, &k, data, MDB_GET_BOTH_RANGE );
+	}
+	return rc;
+}
+
+/* Replace the block mc is on with the n values in nv and v, split
+ * into as many blocks as it takes for each to fit. What doesn't fit
+ * is halved until it does, so the blocks of a value that was added
+ * to a full one still start out about half full.
+ */
+static int
+mvr_rewrite( Operation *op, MDB_cursor *mc, MDB_val *key, MDB_val *data,
+	struct berval *nv, struct berval *v, unsigned n )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	unsigned max = mdb_env_get_maxkeysize( mdb->mi_dbenv );
+	unsigned char *buf;
+	unsigned len = 0, cnt, i;
+	MDB_val k;
+	int rc;
+
+	rc = mdb_cursor_del( mc, 0 );
+	if ( rc || !n )
+		return rc;
+
+	buf = op->o_tmpalloc( max, op->o_tmpmemctx );
+	for ( i=0; i<n; i += cnt ) {
+		for ( cnt = n - i; cnt; cnt /= 2 ) {
+			if (( len = mvr_encode( nv + i, v ? v + i : NULL, cnt, buf, max )))
+				break;
+		}
+		if ( !cnt ) {
+			/* a single value too big for a block */
+			rc = MDB_BAD_VALSIZE;
+			break;
+		}
+		data[0].mv_data = buf;
+		data[0].mv_size = len;
+		data[1].mv_data = nv[i].bv_val;
+		data[1].mv_size = nv[i].bv_len;
+		k = *key;
+		rc = mdb_cursor_put( mc, &k, data, 0 );
+		if ( rc )
+			break;
+	}
+	op->o_tmpfree( buf, op->o_tmpmemctx );
+	return rc;
+}
+
+/* Expand the block in data into temporary arrays, with room for one
+ * more value.
+ */
+static int
+mvr_load( Operation *op, MDB_val *data, struct berval **nvp,
+	struct berval **vp, unsigned *np )
+{
+	struct berval *nv;
+	ber_len_t len;
+	unsigned n;
+
+	if ( mvr_decode( data, NULL, NULL, 0, NULL, 0, &n, &len ))
+		return MDB_CORRUPTED;
+	nv = op->o_tmpalloc( 2 * ( n + 1 ) * sizeof(struct berval) + len,
+		op->o_tmpmemctx );
+	if ( mvr_decode( data, nv, nv + n + 1, n, (char *)( nv + 2 * ( n + 1 )),
+		len, &n, NULL )) {
+		op->o_tmpfree( nv, op->o_tmpmemctx );
+		return MDB_CORRUPTED;
+	}
+	*nvp = nv;
+	*vp = nv + n + 1;
+	*np = n;
+	return 0;
+}
+
+/* Sort the indices in ix by the normalized values they refer to */
+static void
+mvr_sort( AttributeDescription *ad, struct berval *nv,
+	unsigned *ix, unsigned *tmp, unsigned n )
+{
+	unsigned i, j, k, h = n / 2;
+
+	if ( n < 2 )
+		return;
+	mvr_sort( ad, nv, ix, tmp, h );
+	mvr_sort( ad, nv, ix + h, tmp, n - h );
+	for ( i=0, j=h, k=0; i<h && j<n; ) {
+		if ( mdb_id2v_match( ad, &nv[ix[j]], &nv[ix[i]] ) < 0 )
+			tmp[k++] = ix[j++];
+		else
+			tmp[k++] = ix[i++];
+	}
+	while ( i<h )
+		tmp[k++] = ix[i++];
+	while ( j<n )
+		tmp[k++] = ix[j++];
+	memcpy( ix, tmp, n * sizeof(unsigned) );
+}
+
+/* Store all of a's values for an attribute that has none stored yet */
+static int
+mvr_load_all( Operation *op, MDB_cursor *mc, MDB_val *key, MDB_val *data,
+	Attribute *a )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	unsigned max = mdb_env_get_maxkeysize( mdb->mi_dbenv );
+	unsigned fill = MVR_FILL( max );
+	unsigned *ix, i, first, len = 0, blen;
+	struct berval *v = a->a_nvals != a->a_vals ? a->a_vals : NULL;
+	struct berval *snv, *sv = NULL;
+	unsigned char *buf;
+	MDB_val k;
+	int rc = 0;
+
+	ix = op->o_tmpalloc( 2 * a->a_numvals * sizeof(unsigned), op->o_tmpmemctx );
+	for ( i=0; i<a->a_numvals; i++ )
+		ix[i] = i;
+	mvr_sort( data[2].mv_data, a->a_nvals, ix, ix + a->a_numvals, a->a_numvals );
+	snv = op->o_tmpalloc( 2 * a->a_numvals * sizeof(struct berval),
+		op->o_tmpmemctx );
+	for ( i=0; i<a->a_numvals; i++ )
+		snv[i] = a->a_nvals[ix[i]];
+	if ( v ) {
+		sv = snv + a->a_numvals;
+		for ( i=0; i<a->a_numvals; i++ )
+			sv[i] = v[ix[i]];
+	}
+	op->o_tmpfree( ix, op->o_tmpmemctx );
+
+	/* fill each block as far as it goes */
+	buf = op->o_tmpalloc( 2 * max, op->o_tmpmemctx );
+	for ( first=0, i=1; first < a->a_numvals; i++ ) {
+		if ( i <= a->a_numvals && ( blen = mvr_encode( snv + first,
+			sv ? sv + first : NULL, i - first, buf + max, fill ))) {
+			/* keep the last one that fit */
+			memcpy( buf, buf + max, blen );
+			len = blen;
+			continue;
+		}
+		if ( i - first == 1 ) {
+			/* a value on its own may use the whole block */
+			if ( !( len = mvr_encode( snv + first, sv ? sv + first : NULL,
+				1, buf, max ))) {
+				rc = MDB_BAD_VALSIZE;
+				break;
+			}
+			i++;
+		}
+		data[0].mv_data = buf;
+		data[0].mv_size = len;
+		data[1].mv_data = snv[first].bv_val;
+		data[1].mv_size = snv[first].bv_len;
+		k = *key;
+		rc = mdb_cursor_put( mc, &k, data, MDB_APPENDDUP );
+		if ( rc )
+			break;
+		first = --i;
+	}
+	op->o_tmpfree( buf, op->o_tmpmemctx );
+	op->o_tmpfree( snv, op->o_tmpmemctx );
+	return rc;
+}
+
+int
+mdb_mvrun_put( Operation *op, MDB_cursor *mc, ID id, Attribute *a )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_val key, data[3];
+	char ivk[sizeof(ID)+2];
+	struct berval *nv, *v;
+	unsigned i, j, n;
+	int rc, match;
+
+	mvr_key( mdb, id, a->a_desc, ivk, &key, data );
+	rc = mdb_cursor_get( mc, &key, data, MDB_SET );
+	if ( rc == MDB_NOTFOUND )
+		return mvr_load_all( op, mc, &key, data, a );
+	if ( rc )
+		return rc;
+
+	for ( i=0; i<a->a_numvals; i++ ) {
+		rc = mvr_find( mc, &key, data, &a->a_nvals[i] );
+		if ( rc || ( rc = mvr_load( op, data, &nv, &v, &n )))
+			break;
+		for ( j=0, match=1; j<n; j++ ) {
+			match = mdb_id2v_match( data[2].mv_data, &a->a_nvals[i], &nv[j] );
+			if ( match <= 0 )
+				break;
+		}
+		/* permissive modify passes on values that are there already */
+		if ( j == n || match ) {
+			memmove( nv + j + 1, nv + j, ( n - j ) * sizeof(struct berval) );
+			memmove( v + j + 1, v + j, ( n - j ) * sizeof(struct berval) );
+			nv[j] = a->a_nvals[i];
+			v[j] = a->a_vals[i];
+			rc = mvr_rewrite( op, mc, &key, data, nv, v, n + 1 );
+		}
+		op->o_tmpfree( nv, op->o_tmpmemctx );
+		if ( rc )
+			break;
+	}
+	return rc;
+}
+
+int
+mdb_mvrun_del( Operation *op, MDB_cursor *mc, ID id, Attribute *a )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_val key, data[3];
+	char ivk[sizeof(ID)+2];
+	struct berval *nv, *v;
+	unsigned i, j, n;
+	int rc = 0;
+
+	mvr_key( mdb, id, a->a_desc, ivk, &key, data );
+	for ( i=0; i<a->a_numvals; i++ ) {
+		rc = mvr_find( mc, &key, data, &a->a_nvals[i] );
+		if ( rc || ( rc = mvr_load( op, data, &nv, &v, &n )))
+			break;
+		for ( j=0; j<n; j++ ) {
+			if ( !mdb_id2v_match( data[2].mv_data, &a->a_nvals[i], &nv[j] ))
+				break;
+		}
+		if ( j < n ) {
+			memmove( nv + j, nv + j + 1, ( n - j - 1 ) * sizeof(struct berval) );
+			memmove( v + j, v + j + 1, ( n - j - 1 ) * sizeof(struct berval) );
+			rc = mvr_rewrite( op, mc, &key, data, nv, v, n - 1 );
+		}
+		/* else it wasn't there, as permissive modify allows */
+		op->o_tmpfree( nv, op->o_tmpmemctx );
+		if ( rc )
+			break;
+	}
+	return rc;
+}
+
+/* Read the values of a into the bervals after a_vals, and their bytes
+ * into *buf, which has room for *left of them.
+ */
+int
+mdb_mvrun_get( Operation *op, MDB_cursor *mc, ID id, Attribute *a,
+	int have_nvals, unsigned char **buf, ber_len_t *left )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_val key, data[3];
+	char ivk[sizeof(ID)+2];
+	unsigned i, n, max = a->a_numvals;
+	ber_len_t len;
+	int rc;
+
+	mvr_key( mdb, id, a->a_desc, ivk, &key, data );
+	if ( have_nvals )
+		a->a_nvals = a->a_vals + a->a_numvals + 1;
+	else
+		a->a_nvals = a->a_vals;
+	for ( i=0, rc = mdb_cursor_get( mc, &key, data, MDB_SET ); !rc;
+		rc = mdb_cursor_get( mc, &key, data, MDB_NEXT_DUP )) {
+		if ( mvr_decode( data, a->a_nvals + i, have_nvals ? a->a_vals + i : NULL,
+			max - i, (char *)*buf, *left, &n, &len )) {
+			rc = MDB_CORRUPTED;
+			break;
+		}
+		i += n;
+		*buf += len;
+		*left -= len;
+	}
+	if ( rc == MDB_NOTFOUND )
+		rc = 0;
+	a->a_numvals = i;
+	BER_BVZERO(&a->a_vals[i]);
+	if ( have_nvals ) {
+		BER_BVZERO(&a->a_nvals[i]);
+	}
+	return rc;
+}
@@ -0,0 +1,341 @@
+/* ngram.c - ldap mdb back-end positional n-gram substring indexes */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "slap.h"
+#include "back-mdb.h"
+#include "idl.h"
+
+/* An ngram index keys each trigram of a normalized value together
+ * with its offset in the value modulo MDB_NG_POS. Values are padded
+ * with two start and two end marks, so the grams of a value "smith"
+ * are "^^s" "^sm" "smi" "mit" "ith" "th$" "h$$" at offsets 0 to 6.
+ *
+ * The grams of a substring fragment must all appear at the same
+ * distances from each other as they do in the fragment. Its
+ * candidates are the union, over every alignment of the fragment
+ * modulo MDB_NG_POS, of the intersection of its grams' keys at those
+ * offsets. Initial fragments only have the alignment 0.
+ *
+ * Fragments of an any or final assertion shorter than a gram can't
+ * be looked up and are left to the filter test.
+ */
+
+#define MDB_NG_LEN	3	/* bytes in a gram */
+#define MDB_NG_POS	8	/* offsets are kept modulo this */
+#define MDB_NG_MAXGRAMS	6	/* grams of a fragment looked up */
+#define MDB_NG_BEGIN	0xff	/* never in UTF-8 */
+#define MDB_NG_END	0xfe
+#define MDB_NG_PREFIX	'#'
+#define MDB_NG_KEYLEN	( 1 + MDB_NG_LEN + 1 )
+
+/* The grams only work for rules that match fragments of the
+ * normalized values byte for byte.
+ */
+int
+mdb_ngram_ok( MatchingRule *mr )
+{
+	static const char *rules[] = {
+		"caseExactSubstringsMatch",	/* the directoryString rules */
+		"octetStringSubstringsMatch",
+		NULL
+	};
+	MatchingRule *r;
+	int i;
+
+	if ( !mr || !mr->smr_match )
+		return 0;
+	for ( i = 0; rules[i]; i++ ) {
+		r = mr_find( rules[i] );
+		if ( r && r->smr_match == mr->smr_match )
+			return 1;
+	}
+	return 0;
+}
+
+static void
+ng_key( unsigned char *key, unsigned char *gram, unsigned pos )
+{
+	key[0] = MDB_NG_PREFIX;
+	AC_MEMCPY( key+1, gram, MDB_NG_LEN );
+	key[1+MDB_NG_LEN] = pos % MDB_NG_POS;
+}
+
+static int
+ng_keycmp( const void *a, const void *b )
+{
+	return memcmp( ((struct berval *)a)->bv_val,
+		((struct berval *)b)->bv_val, MDB_NG_KEYLEN );
+}
+
+/* The distinct keys of a set of values, in one block of tmp memory
+ * for the caller to op->o_tmpfree.
+ */
+int
+mdb_ngram_keys(
+	Operation *op,
+	BerVarray vals,
+	BerVarray *keysp )
+{
+	BerVarray keys;
+	unsigned char *ptr, gram[MDB_NG_LEN];
+	ber_len_t len, i, j;
+	int n = 0, k;
+
+	*keysp = NULL;
+	for ( k = 0; !BER_BVISNULL( &vals[k] ); k++ )
+		n += vals[k].bv_len + 2;
+	if ( !n )
+		return 0;
+
+	keys = op->o_tmpalloc( ( n + 1 ) * sizeof( struct berval ) +
+		n * MDB_NG_KEYLEN, op->o_tmpmemctx );
+	ptr = (unsigned char *)( keys + n + 1 );
+	n = 0;
+	for ( k = 0; !BER_BVISNULL( &vals[k] ); k++ ) {
+		len = vals[k].bv_len;
+		for ( i = 0; i < len + 2; i++ ) {
+			/* the gram at offset i of the padded value */
+			for ( j = 0; j < MDB_NG_LEN; j++ ) {
+				if ( i + j < 2 )
+					gram[j] = MDB_NG_BEGIN;
+				else if ( i + j < len + 2 )
+					gram[j] = vals[k].bv_val[i + j - 2];
+				else
+					gram[j] = MDB_NG_END;
+			}
+			ng_key( ptr, gram, i );
+			keys[n].bv_val = (char *)ptr;
+			keys[n].bv_len = MDB_NG_KEYLEN;
+			ptr += MDB_NG_KEYLEN;
+			n++;
+		}
+	}
+
+	/* values repeat grams, the index wants each key once */
+	qsort( keys, n, sizeof( struct berval ), ng_keycmp );
+	for ( i = 1, k = 1; i < n; i++ ) {
+		if ( memcmp( keys[i].bv_val, keys[k-1].bv_val, MDB_NG_KEYLEN ))
+			keys[k++] = keys[i];
+	}
+	BER_BVZERO( &keys[k] );
+	*keysp = keys;
+	return 0;
+}
+
+typedef struct ng_frag {
+	unsigned char nf_buf[SLAP_TEXT_BUFLEN];	/* padded fragment */
+	int nf_grams;	/* grams in it */
+	int nf_anchored;	/* offset is known to be 0 */
+} ng_frag;
+
+/* Pad a fragment, returns its number of grams */
+static int
+ng_frag_init( ng_frag *nf, struct berval *bv, int type )
+{
+	unsigned char *ptr = nf->nf_buf;
+	ber_len_t len = bv->bv_len;
+
+	/* long fragments are looked up by their start */
+	if ( len > sizeof( nf->nf_buf ) - 2 )
+		len = sizeof( nf->nf_buf ) - 2;
+	if ( type == SLAP_INDEX_SUBSTR_INITIAL ) {
+		*ptr++ = MDB_NG_BEGIN;
+		*ptr++ = MDB_NG_BEGIN;
+	}
+	AC_MEMCPY( ptr, bv->bv_val, len );
+	ptr += len;
+	if ( type == SLAP_INDEX_SUBSTR_FINAL && len == bv->bv_len ) {
+		*ptr++ = MDB_NG_END;
+		*ptr++ = MDB_NG_END;
+	}
+	nf->nf_anchored = type == SLAP_INDEX_SUBSTR_INITIAL;
+	nf->nf_grams = ptr - nf->nf_buf - ( MDB_NG_LEN - 1 );
+	if ( nf->nf_grams < 0 )
+		nf->nf_grams = 0;
+	return nf->nf_grams;
+}
+
+/* Offset of the i'th of the grams looked up */
+static int
+ng_frag_off( ng_frag *nf, int i, int n )
+{
+	if ( n < 2 )
+		return 0;
+	return i * ( nf->nf_grams - 1 ) / ( n - 1 );
+}
+
+static int
+ng_read( Operation *op, MDB_txn *rtxn, MDB_dbi dbi, ng_frag *nf,
+	int off, int pos, ID *ids )
+{
+	unsigned char kbuf[MDB_NG_KEYLEN];
+	struct berval key;
+	int rc;
+
+	ng_key( kbuf, nf->nf_buf + off, pos );
+	key.bv_val = (char *)kbuf;
+	key.bv_len = MDB_NG_KEYLEN;
+	rc = mdb_key_read( op->o_bd, rtxn, dbi, &key, ids, NULL, 0 );
+	if ( rc == MDB_NOTFOUND ) {
+		MDB_IDL_ZERO( ids );
+		rc = 0;
+	}
+	return rc;
+}
+
+/* The candidates for one fragment, into res. acc and tmp are scratch */
+static int
+ng_frag_candidates(
+	Operation *op,
+	MDB_txn *rtxn,
+	MDB_dbi dbi,
+	ng_frag *nf,
+	ID *res,
+	ID *acc,
+	ID *tmp )
+{
+	int n, i, s, rc = 0;
+
+	n = nf->nf_grams < MDB_NG_MAXGRAMS ? nf->nf_grams : MDB_NG_MAXGRAMS;
+	MDB_IDL_ZERO( res );
+	for ( s = 0; s < ( nf->nf_anchored ? 1 : MDB_NG_POS ); s++ ) {
+		for ( i = 0; i < n; i++ ) {
+			int off = ng_frag_off( nf, i, n );
+			rc = ng_read( op, rtxn, dbi, nf, off, s + off,
+				i ? tmp : acc );
+			if ( rc )
+				return rc;
+			if ( i )
+				mdb_idl_intersection( op, acc, tmp );
+			if ( MDB_IDL_IS_ZERO( acc ))
+				break;
+		}
+		if ( MDB_IDL_IS_ZERO( acc ))
+			continue;
+		if ( MDB_IDL_IS_ZERO( res ))
+			MDB_IDL_CPY( res, acc );
+		else
+			mdb_idl_union( op, res, acc );
+	}
+	return rc;
+}
+
+/* Narrow ids down to the candidates of one fragment */
+static int
+ng_narrow(
+	Operation *op,
+	MDB_txn *rtxn,
+	MDB_dbi dbi,
+	struct berval *bv,
+	int type,
+	ID *ids,
+	ID *res,
+	ID *tmp )
+{
+	ng_frag nf;
+	int rc;
+
+	if ( MDB_IDL_IS_ZERO( ids ) || !ng_frag_init( &nf, bv, type ))
+		return 0;
+	rc = ng_frag_candidates( op, rtxn, dbi, &nf, res,
+		res + MDB_idl_um_size, tmp );
+	if ( rc == 0 )
+		mdb_idl_intersection( op, ids, res );
+	return rc;
+}
+
+/* The candidates of a substrings assertion. ids is left as all
+ * IDs if none of its fragments could be looked up.
+ */
+int
+mdb_ngram_candidates(
+	Operation *op,
+	MDB_txn *rtxn,
+	MDB_dbi dbi,
+	SubstringsAssertion *sub,
+	ID *ids,
+	ID *tmp )
+{
+	ID *res;
+	int i, rc = 0;
+
+	MDB_IDL_ALL( ids );
+	res = ch_malloc( 2 * MDB_idl_um_size * sizeof( ID ));
+
+	if ( !BER_BVISNULL( &sub->sa_initial ))
+		rc = ng_narrow( op, rtxn, dbi, &sub->sa_initial,
+			SLAP_INDEX_SUBSTR_INITIAL, ids, res, tmp );
+	for ( i = 0; rc == 0 && sub->sa_any && !BER_BVISNULL( &sub->sa_any[i] ); i++ )
+		rc = ng_narrow( op, rtxn, dbi, &sub->sa_any[i],
+			SLAP_INDEX_SUBSTR_ANY, ids, res, tmp );
+	if ( rc == 0 && !BER_BVISNULL( &sub->sa_final ))
+		rc = ng_narrow( op, rtxn, dbi, &sub->sa_final,
+			SLAP_INDEX_SUBSTR_FINAL, ids, res, tmp );
+
+	ch_free( res );
+	return rc;
+}
+
+/* Estimate the candidates of a substrings assertion from the counts
+ * of its grams at every offset, NOID if it can't be looked up.
+ */
+ID
+mdb_ngram_estimate(
+	MDB_txn *rtxn,
+	MDB_dbi dbi,
+	SubstringsAssertion *sub )
+{
+	ng_frag nf;
+	unsigned char kbuf[MDB_NG_KEYLEN];
+	struct berval key;
+	ID est = NOID, sum, count;
+	int n, i, s, rc;
+
+	key.bv_val = (char *)kbuf;
+	key.bv_len = MDB_NG_KEYLEN;
+
+	/* the start or the end of the value says the most */
+	if ( !BER_BVISNULL( &sub->sa_initial ))
+		ng_frag_init( &nf, &sub->sa_initial, SLAP_INDEX_SUBSTR_INITIAL );
+	else if ( !BER_BVISNULL( &sub->sa_final ))
+		ng_frag_init( &nf, &sub->sa_final, SLAP_INDEX_SUBSTR_FINAL );
+	else if ( sub->sa_any )
+		ng_frag_init( &nf, &sub->sa_any[0], SLAP_INDEX_SUBSTR_ANY );
+	else
+		return NOID;
+
+	n = nf.nf_grams < MDB_NG_MAXGRAMS ? nf.nf_grams : MDB_NG_MAXGRAMS;
+	for ( i = 0; i < n; i++ ) {
+		int off = ng_frag_off( &nf, i, n );
+		sum = 0;
+		for ( s = 0; s < ( nf.nf_anchored ? 1 : MDB_NG_POS ); s++ ) {
+			ng_key( kbuf, nf.nf_buf + off, s + off );
+			rc = mdb_key_count( rtxn, dbi, &key, &count );
+			if ( rc == 0 )
+				sum += count;
+			else if ( rc != MDB_NOTFOUND )
+				return NOID;
+		}
+		if ( sum < est )
+			est = sum;
+	}
+	return est;
+}
@@ -0,0 +1,794 @@
+/* ordered.c - ldap mdb back-end ordered indexes */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "slap.h"
+#include "back-mdb.h"
+#include "idl.h"
+
+/* An ordered index maps each value, encoded so that the plain LMDB
+ * key order is the order of the attribute's ordering rule, to the
+ * IDs of the entries holding it. A sorted search walks it instead
+ * of collecting and sorting its results.
+ *
+ * Values longer than the maximum key size are truncated, entries
+ * whose values only differ beyond that are returned in ID order.
+ */
+
+/* Don't walk an index that is this many times larger than the
+ * candidate list, sorting the few results is cheaper.
+ */
+#define MDB_ORDWALK_RATIO	16
+
+/* Candidates tested before passing over any for a VLV */
+#define MDB_ORDWALK_SAMPLE	32
+
+int
+mdb_order_kind( MatchingRule *mr )
+{
+	static const struct {
+		char *name;
+		int kind;
+	} kinds[] = {
+		/* also used by caseIgnoreOrderingMatch and friends */
+		{ "octetStringOrderingMatch", MDB_ORDER_OCTET },
+		{ "generalizedTimeOrderingMatch", MDB_ORDER_TIME },
+		{ "integerOrderingMatch", MDB_ORDER_INT },
+		{ NULL, 0 }
+	};
+	MatchingRule *r;
+	int i;
+
+	for ( i = 0; kinds[i].name; i++ ) {
+		r = mr_find( kinds[i].name );
+		if ( r && r->smr_match == mr->smr_match )
+			return kinds[i].kind;
+	}
+	return 0;
+}
+
+/* Encode a normalized value as a key of at most max bytes. The
+ * result points into the value itself or into buf.
+ */
+static void
+order_key( int kind, struct berval *val, MDB_val *key, char *buf,
+	ber_len_t max )
+{
+	ber_len_t i, n;
+	char *ptr;
+
+	key->mv_data = val->bv_val;
+	key->mv_size = val->bv_len;
+
+	switch ( kind ) {
+	case MDB_ORDER_TIME:
+		/* fractions sort after whole seconds without the Z */
+		if ( key->mv_size && val->bv_val[key->mv_size-1] == 'Z' )
+			key->mv_size--;
+		break;
+
+	case MDB_ORDER_INT: {
+		/* negative numbers first, the more digits the lower, and
+		 * their digits complemented
+		 */
+		int neg = 0;
+		ber_uint_t len;
+
+		ptr = val->bv_val;
+		n = val->bv_len;
+		if ( n && *ptr == '-' ) {
+			neg = 1;
+			ptr++;
+			n--;
+		}
+		len = neg ? ~n : n;
+		buf[0] = neg ? 1 : 2;
+		buf[1] = len >> 24;
+		buf[2] = len >> 16;
+		buf[3] = len >> 8;
+		buf[4] = len;
+		for ( i = 0; i < n && i + 5 < max; i++ )
+			buf[i+5] = neg ? '0' + '9' - ptr[i] : ptr[i];
+		key->mv_data = buf;
+		key->mv_size = i + 5;
+		} break;
+
+	default:
+		/* LMDB keys can't be empty */
+		if ( !key->mv_size ) {
+			buf[0] = '\0';
+			key->mv_data = buf;
+			key->mv_size = 1;
+		}
+		break;
+	}
+	if ( key->mv_size > max )
+		key->mv_size = max;
+}
+
+/* the default LMDB key comparison */
+static int
+order_cmp( MDB_val *a, MDB_val *b )
+{
+	ber_len_t n = a->mv_size < b->mv_size ? a->mv_size : b->mv_size;
+	int rc = memcmp( a->mv_data, b->mv_data, n );
+
+	if ( rc == 0 )
+		rc = ( a->mv_size > b->mv_size ) - ( a->mv_size < b->mv_size );
+	return rc;
+}
+
+int
+mdb_order_index(
+	Operation *op,
+	MDB_txn *txn,
+	AttrInfo *ai,
+	BerVarray vals,
+	ID id,
+	int opid )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_cursor *mc;
+	MDB_val key, data;
+	char *buf;
+	int i, rc, max;
+
+	rc = mdb_cursor_open( txn, ai->ai_odbi, &mc );
+	if ( rc )
+		return rc;
+
+	max = mdb_env_get_maxkeysize( mdb->mi_dbenv );
+	buf = op->o_tmpalloc( max, op->o_tmpmemctx );
+
+	for ( i = 0; vals[i].bv_val; i++ ) {
+		order_key( ai->ai_order, &vals[i], &key, buf, max );
+		data.mv_size = sizeof(ID);
+		data.mv_data = &id;
+		if ( opid == SLAP_INDEX_ADD_OP ) {
+			rc = mdb_cursor_put( mc, &key, &data, MDB_NODUPDATA );
+			if ( rc == MDB_KEYEXIST )
+				rc = 0;
+		} else {
+			rc = mdb_cursor_get( mc, &key, &data, MDB_GET_BOTH );
+			if ( rc == 0 )
+				rc = mdb_cursor_del( mc, 0 );
+			else if ( rc == MDB_NOTFOUND )
+				rc = 0;
+		}
+		if ( rc )
+			break;
+	}
+
+	op->o_tmpfree( buf, op->o_tmpmemctx );
+	mdb_cursor_close( mc );
+	return rc;
+}
+
+/* Collect the ordered keys of the values instead of storing them */
+int
+mdb_order_keys(
+	Operation *op,
+	AttrInfo *ai,
+	BerVarray vals,
+	ID id,
+	mdb_keysort *ks )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	struct berval keys[2];
+	MDB_val key;
+	char *buf;
+	int i, rc = 0, max;
+
+	max = mdb_env_get_maxkeysize( mdb->mi_dbenv );
+	buf = op->o_tmpalloc( max, op->o_tmpmemctx );
+
+	BER_BVZERO( &keys[1] );
+	for ( i = 0; vals[i].bv_val && !rc; i++ ) {
+		order_key( ai->ai_order, &vals[i], &key, buf, max );
+		keys[0].bv_val = key.mv_data;
+		keys[0].bv_len = key.mv_size;
+		rc = mdb_keysort_add( ks, keys, id );
+	}
+
+	op->o_tmpfree( buf, op->o_tmpmemctx );
+	return rc;
+}
+
+/* A walk first returns the candidates found in the index, in index
+ * order, then the ones without a value, in ID order. Backwards the
+ * ones without a value come first. Since the rest of the search tests
+ * and sends each ID as it comes, the candidates are tracked by bitmaps
+ * rather than collected. Whatever the index missed, e.g. because the
+ * entry changed while the read txn was released, is returned at the
+ * end rather than lost.
+ */
+enum {
+	OW_MISSING,	/* backwards, the candidates without a key */
+	OW_WALK,
+	OW_REST,	/* the candidates not returned yet */
+	OW_DONE
+};
+
+struct mdb_ordwalk {
+	AttrInfo *ow_ai;
+	MDB_cursor *ow_mc;
+	ID *ow_ids;
+	ID ow_first;
+	ID ow_last;
+	ID ow_cursor;	/* in ow_ids, outside of the walk */
+	int ow_phase;
+	int ow_started;
+	int ow_pending;	/* cursor already on the next item */
+	int ow_reverse;
+	ID ow_nslots;
+	OpExtraSort *ow_oes;
+	ber_len_t ow_max;
+	ID ow_id;	/* last ID returned from the index */
+	ID ow_slot;	/* and its slot */
+	MDB_val ow_key;	/* and its key */
+	char *ow_keybuf;
+	char *ow_tmp;
+	unsigned char *ow_sent;	/* by candidate slot */
+	unsigned char *ow_keyed;	/* backwards or for a VLV, has a key */
+	unsigned char *ow_low;	/* for a VLV, scratch */
+};
+
+#define OW_ISSET(map,i)	((map)[(i) >> 3] & (1 << ((i) & 7)))
+#define OW_SET(map,i)	((map)[(i) >> 3] |= (1 << ((i) & 7)))
+
+/* Position of id in the candidate bitmap, NOID if not a candidate */
+static ID
+ordwalk_slot( mdb_ordwalk *ow, ID id )
+{
+	ID *ids = ow->ow_ids;
+	unsigned i;
+
+	if ( id < ow->ow_first || id > ow->ow_last )
+		return NOID;
+	if ( MDB_IDL_IS_RANGE( ids ))
+		return id - ow->ow_first;
+	if ( MDB_IDL_IS_RUNS( ids )) {
+		i = mdb_idl_runs_search( ids, id );
+		if ( i < MDB_IDL_RUNS_N( ids ) && id >= MDB_IDL_RUN_LO( ids, i ))
+			return id - ow->ow_first;
+		return NOID;
+	}
+	i = mdb_idl_search( ids, id );
+	if ( i <= ids[0] && ids[i] == id )
+		return i - 1;
+	return NOID;
+}
+
+/* First ID of the last key. MDB_LAST leaves the cursor flagged at
+ * the end of the DB, where MDB_NEXT_DUP wouldn't move, so look the
+ * key up again.
+ */
+static int
+ordwalk_last( MDB_cursor *mc, MDB_val *key, MDB_val *data )
+{
+	int rc = mdb_cursor_get( mc, key, data, MDB_LAST );
+
+	if ( rc == 0 )
+		rc = mdb_cursor_get( mc, key, data, MDB_SET_KEY );
+	return rc;
+}
+
+/* Mark the candidates that have a key in map and count them. With a
+ * value, also count those whose least key is below it, and those
+ * whose least key is at most it. Stops after the first key at which
+ * the ones left number at most rest, leaving the cursor on it.
+ */
+static int
+ordwalk_count( mdb_ordwalk *ow, unsigned char *map, MDB_val *vkey,
+	ID rest, ID *nkeyed, ID *nlt, ID *nle )
+{
+	MDB_cursor *mc = ow->ow_mc;
+	MDB_val key, data;
+	ID id, *ptr, *end, n = 0;
+	int rc, cmp;
+
+	*nlt = *nle = NOID;
+	rc = mdb_cursor_get( mc, &key, &data, MDB_FIRST );
+	while ( rc == 0 ) {
+		if ( vkey ) {
+			cmp = order_cmp( &key, vkey );
+			if ( cmp >= 0 && *nlt == NOID )
+				*nlt = n;
+			if ( cmp > 0 && *nle == NOID )
+				*nle = n;
+		}
+		rc = mdb_cursor_get( mc, &key, &data, MDB_GET_MULTIPLE );
+		while ( rc == 0 ) {
+			ptr = data.mv_data;
+			end = ptr + data.mv_size / sizeof(ID);
+			for ( ; ptr < end; ptr++ ) {
+				memcpy( &id, ptr, sizeof(ID) );
+				id = ordwalk_slot( ow, id );
+				if ( id != NOID && !OW_ISSET( map, id )) {
+					OW_SET( map, id );
+					n++;
+				}
+			}
+			rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_MULTIPLE );
+		}
+		if ( rc == MDB_NOTFOUND ) {
+			if ( rest != NOID && *nkeyed - n <= rest )
+				return 0;
+			rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_NODUP );
+		}
+	}
+	if ( rc != MDB_NOTFOUND )
+		return rc;
+	if ( *nlt == NOID )
+		*nlt = n;
+	if ( *nle == NOID )
+		*nle = n;
+	*nkeyed = n;
+	return 0;
+}
+
+/* Mark up to n candidates without a key as sent, in ID order */
+static ID
+ordwalk_skip_missing( mdb_ordwalk *ow, ID n )
+{
+	ID id, i, cursor = 0, done = 0;
+
+	for ( id = mdb_idl_first( ow->ow_ids, &cursor );
+		done < n && id != NOID && id <= ow->ow_last;
+		id = mdb_idl_next( ow->ow_ids, &cursor ))
+	{
+		i = ordwalk_slot( ow, id );
+		if ( i == NOID || OW_ISSET( ow->ow_keyed, i ) ||
+			OW_ISSET( ow->ow_sent, i ))
+			continue;
+		OW_SET( ow->ow_sent, i );
+		done++;
+	}
+	return done;
+}
+
+/* Counting candidates is only of use if they are the results, i.e.
+ * the index answered the filter. Test it on a few of them to tell.
+ */
+static int
+ordwalk_exact( Operation *op, MDB_cursor *mci, mdb_ordwalk *ow )
+{
+	Entry *e;
+	ID i, id;
+	int rc;
+
+	for ( i = 0; i < MDB_ORDWALK_SAMPLE; i++ ) {
+		id = ow->ow_nslots * i / MDB_ORDWALK_SAMPLE;
+		if ( MDB_IDL_IS_RANGE( ow->ow_ids ) || MDB_IDL_IS_RUNS( ow->ow_ids ))
+			id += ow->ow_first;
+		else
+			id = ow->ow_ids[id + 1];
+		if ( ordwalk_slot( ow, id ) == NOID )
+			continue;
+		rc = mdb_id2entry( op, mci, id, &e );
+		if ( rc == MDB_NOTFOUND )
+			continue;
+		if ( rc )
+			return 0;
+		rc = test_filter( op, e, op->ors_filter );
+		mdb_entry_return( op, e );
+		if ( rc != LDAP_COMPARE_TRUE )
+			return 0;
+	}
+	return 1;
+}
+
+/* Pass over the entries before a VLV window, see OpExtraSort. They
+ * are counted from the index alone, without fetching any entry, and
+ * marked as sent. The walk then starts at the first key still needed.
+ * Forwards an entry is met at its least key first, so it can be
+ * marked there. Backwards it comes at its least key last, so count
+ * upwards the ones that have a key at or below the one to start at,
+ * the rest are passed over.
+ */
+static int
+ordwalk_seek( Operation *op, mdb_ordwalk *ow, OpExtraSort *oes )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_cursor *mc = ow->ow_mc;
+	MDB_val key, data, vkey, *vp = NULL;
+	MDB_stat ms;
+	ID nkeyed, nlt, nle, ncand, nmissing, total, pos, skip, n = 0;
+	ID id, i, *ptr, *end;
+	int rc;
+
+	if ( !BER_BVISNULL( &oes->oe_value )) {
+		order_key( ow->ow_ai->ai_order, &oes->oe_value, &vkey,
+			ow->ow_tmp, ow->ow_max );
+		vp = &vkey;
+	}
+	rc = ordwalk_count( ow, ow->ow_keyed, vp, NOID, &nkeyed, &nlt, &nle );
+	if ( rc )
+		return rc;
+
+	/* ranges may have gaps, don't count more than there are */
+	if ( MDB_IDL_IS_RUNS( ow->ow_ids ))
+		ncand = mdb_idl_runs_count( ow->ow_ids );
+	else
+		ncand = ow->ow_nslots;
+	if ( MDB_IDL_IS_RANGE( ow->ow_ids ) || MDB_IDL_IS_RUNS( ow->ow_ids )) {
+		rc = mdb_stat( mdb_cursor_txn( mc ), mdb->mi_id2entry, &ms );
+		if ( rc )
+			return rc;
+		if ( ncand > ms.ms_entries )
+			ncand = ms.ms_entries;
+	}
+	nmissing = ncand > nkeyed ? ncand - nkeyed : 0;
+	total = nkeyed + nmissing;
+	if ( !total || total > INT_MAX )
+		return 0;
+
+	if ( !vp ) {
+		pos = oes->oe_position( op, total );
+		if ( !pos )
+			return 0;
+	} else if ( !ow->ow_reverse ) {
+		pos = nlt + 1;
+	} else {
+		pos = nmissing + nkeyed - nle + 1;
+	}
+	skip = pos > (ID)oes->oe_before + 1 ? pos - oes->oe_before - 1 : 0;
+
+	if ( !skip ) {
+		/* nothing to pass over */
+	} else if ( !ow->ow_reverse ) {
+		rc = mdb_cursor_get( mc, &key, &data, MDB_FIRST );
+		while ( rc == 0 ) {
+			rc = mdb_cursor_get( mc, &key, &data, MDB_GET_MULTIPLE );
+			while ( rc == 0 ) {
+				ptr = data.mv_data;
+				end = ptr + data.mv_size / sizeof(ID);
+				for ( ; ptr < end; ptr++ ) {
+					memcpy( &id, ptr, sizeof(ID) );
+					i = ordwalk_slot( ow, id );
+					if ( i == NOID || OW_ISSET( ow->ow_sent, i ))
+						continue;
+					OW_SET( ow->ow_sent, i );
+					if ( ++n == skip )
+						goto found;
+				}
+				rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_MULTIPLE );
+			}
+			if ( rc == MDB_NOTFOUND )
+				rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_NODUP );
+		}
+		if ( rc != MDB_NOTFOUND )
+			return rc;
+		/* into the ones without a key */
+		n += ordwalk_skip_missing( ow, skip - n );
+		ow->ow_phase = OW_REST;
+		goto done;
+found:
+		data.mv_size = sizeof(ID);
+		data.mv_data = &id;
+		rc = mdb_cursor_get( mc, &key, &data, MDB_GET_BOTH );
+		if ( rc )
+			return rc;
+		ow->ow_started = 1;
+		ow->ow_pending = 1;
+	} else {
+		n = ordwalk_skip_missing( ow, skip );
+		if ( n < skip ) {
+			ID rest = skip - n;
+
+			rc = ordwalk_count( ow, ow->ow_low, NULL, rest,
+				&nkeyed, &nlt, &nle );
+			if ( rc )
+				return rc;
+			for ( i = 0; i < ow->ow_nslots; i++ ) {
+				if ( OW_ISSET( ow->ow_keyed, i ) &&
+					!OW_ISSET( ow->ow_low, i ))
+				{
+					OW_SET( ow->ow_sent, i );
+					n++;
+				}
+			}
+			rc = mdb_cursor_get( mc, &key, &data, MDB_FIRST_DUP );
+			if ( rc )
+				return rc;
+			ow->ow_phase = OW_WALK;
+			ow->ow_started = 1;
+			ow->ow_pending = 1;
+		}
+	}
+
+done:
+	oes->oe_total = total;
+	oes->oe_skipped = n;
+	return 0;
+}
+
+mdb_ordwalk *
+mdb_ordwalk_start( Operation *op, MDB_cursor *mci, ID *ids, ID ncand )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	MDB_txn *txn = mdb_cursor_txn( mci );
+	OpExtra *oex;
+	OpExtraSort *oes = NULL;
+	AttrInfo *ai;
+	mdb_ordwalk *ow;
+	MDB_stat ms;
+	MDB_val key, data;
+	ID first, last, nslots, id, nkeyed, nlt, nle;
+	ber_len_t max;
+	int rc;
+
+	LDAP_SLIST_FOREACH( oex, &op->o_extra, oe_next ) {
+		if ( oex->oe_key == (void *)do_search ) {
+			oes = (OpExtraSort *)oex;
+			break;
+		}
+	}
+	/* the results of glued databases are just concatenated */
+	if ( !oes || oes->oe_op != op || oes->oe_sorted ||
+		SLAP_GLUE_INSTANCE( op->o_bd ) || SLAP_GLUE_SUBORDINATE( op->o_bd ))
+		return NULL;
+
+	ai = mdb_attr_mask( mdb, oes->oe_ad );
+	if ( !ai || !ai->ai_odbi ||
+		!( ai->ai_indexmask & SLAP_INDEX_ORDERED ) ||
+		( ai->ai_indexmask & MDB_INDEX_DELETING ) ||
+		mdb_order_kind( oes->oe_mr ) != ai->ai_order )
+		return NULL;
+
+	if ( mdb_stat( txn, ai->ai_odbi, &ms ) ||
+		ncand < ms.ms_entries / MDB_ORDWALK_RATIO )
+		return NULL;
+
+	first = MDB_IDL_FIRST( ids );
+	last = MDB_IDL_LAST( ids );
+	if ( MDB_IDL_IS_RANGE( ids )) {
+		/* ranges may be open ended */
+		if ( mdb_cursor_get( mci, &key, &data, MDB_LAST ))
+			return NULL;
+		memcpy( &id, key.mv_data, sizeof(ID) );
+		if ( id < last )
+			last = id;
+		if ( last < first )
+			return NULL;
+	}
+	if ( MDB_IDL_IS_RANGE( ids ) || MDB_IDL_IS_RUNS( ids ))
+		nslots = last - first + 1;
+	else
+		nslots = ids[0];
+
+	max = mdb_env_get_maxkeysize( mdb->mi_dbenv );
+	ow = ch_calloc( 1, sizeof( mdb_ordwalk ) + 2 * max +
+		3 * ( nslots / 8 + 1 ));
+	ow->ow_keybuf = (char *)(ow + 1);
+	ow->ow_tmp = ow->ow_keybuf + max;
+	ow->ow_sent = (unsigned char *)( ow->ow_tmp + max );
+	ow->ow_keyed = ow->ow_sent + nslots / 8 + 1;
+	ow->ow_low = ow->ow_keyed + nslots / 8 + 1;
+	ow->ow_max = max;
+	ow->ow_ai = ai;
+	ow->ow_ids = ids;
+	ow->ow_first = first;
+	ow->ow_last = last;
+	ow->ow_nslots = nslots;
+	ow->ow_reverse = oes->oe_reverse;
+	ow->ow_oes = oes;
+
+	rc = mdb_cursor_open( txn, ai->ai_odbi, &ow->ow_mc );
+	if ( rc ) {
+		ch_free( ow );
+		return NULL;
+	}
+
+	ow->ow_phase = ow->ow_reverse ? OW_MISSING : OW_WALK;
+	oes->oe_total = 0;
+	oes->oe_skipped = 0;
+	/* the candidates only stand for the results if the scope is
+	 * the whole database
+	 */
+	if ( oes->oe_vlv && ( op->ors_scope == LDAP_SCOPE_SUBTREE ||
+		op->ors_scope == LDAP_SCOPE_SUBORDINATE ) &&
+		be_issuffix( op->o_bd, &op->o_req_ndn ) &&
+		ordwalk_exact( op, mci, ow ))
+	{
+		rc = ordwalk_seek( op, ow, oes );
+	} else if ( ow->ow_reverse ) {
+		/* find the candidates with a key, the others go first */
+		rc = ordwalk_count( ow, ow->ow_keyed, NULL, NOID,
+			&nkeyed, &nlt, &nle );
+	}
+	if ( rc ) {
+		mdb_ordwalk_end( ow );
+		return NULL;
+	}
+
+	oes->oe_sorted = 1;
+	return ow;
+}
+
+ID
+mdb_ordwalk_next( mdb_ordwalk *ow )
+{
+	MDB_cursor *mc = ow->ow_mc;
+	MDB_val key, data;
+	ID id, i;
+	int rc;
+
+	/* the window of a VLV is complete */
+	if ( ow->ow_oes->oe_done )
+		return NOID;
+
+	for (;;) {
+		switch ( ow->ow_phase ) {
+		case OW_WALK:
+			if ( ow->ow_pending ) {
+				ow->ow_pending = 0;
+				rc = mdb_cursor_get( mc, &key, &data, MDB_GET_CURRENT );
+			} else if ( !ow->ow_reverse ) {
+				rc = mdb_cursor_get( mc, &key, &data,
+					ow->ow_started ? MDB_NEXT : MDB_FIRST );
+			} else if ( !ow->ow_started ) {
+				/* keys backwards, but the IDs of a key in the same
+				 * order as a forward sort would keep them
+				 */
+				rc = ordwalk_last( mc, &key, &data );
+			} else {
+				rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_DUP );
+				if ( rc == MDB_NOTFOUND ) {
+					rc = mdb_cursor_get( mc, &key, &data, MDB_PREV_NODUP );
+					if ( rc == 0 )
+						rc = mdb_cursor_get( mc, &key, &data, MDB_FIRST_DUP );
+				}
+			}
+			ow->ow_started = 1;
+			if ( rc ) {
+				ow->ow_phase = OW_REST;
+				ow->ow_started = 0;
+				continue;
+			}
+			memcpy( &id, data.mv_data, sizeof(ID) );
+			i = ordwalk_slot( ow, id );
+			if ( i == NOID || OW_ISSET( ow->ow_sent, i ))
+				continue;
+			ow->ow_id = id;
+			ow->ow_slot = i;
+			ow->ow_key.mv_size = key.mv_size;
+			ow->ow_key.mv_data = ow->ow_keybuf;
+			AC_MEMCPY( ow->ow_keybuf, key.mv_data, key.mv_size );
+			return id;
+
+		case OW_MISSING:
+		case OW_REST:
+			if ( ow->ow_started ) {
+				id = mdb_idl_next( ow->ow_ids, &ow->ow_cursor );
+			} else {
+				ow->ow_cursor = 0;
+				id = mdb_idl_first( ow->ow_ids, &ow->ow_cursor );
+				ow->ow_started = 1;
+			}
+			if ( id == NOID || id > ow->ow_last ) {
+				ow->ow_phase++;
+				ow->ow_started = 0;
+				continue;
+			}
+			i = ordwalk_slot( ow, id );
+			if ( i == NOID || OW_ISSET( ow->ow_sent, i ) ||
+				( ow->ow_phase == OW_MISSING && OW_ISSET( ow->ow_keyed, i )))
+				continue;
+			ow->ow_slot = i;
+			return id;
+
+		default:
+			return NOID;
+		}
+	}
+}
+
+/* Tell whether the entry just returned belongs at this position */
+int
+mdb_ordwalk_check( mdb_ordwalk *ow, Entry *e )
+{
+	Attribute *a = attr_find( e->e_attrs, ow->ow_ai->ai_desc );
+	MDB_val key;
+	unsigned i;
+	int cmp, found = 0;
+
+	if ( ow->ow_phase == OW_MISSING ) {
+		if ( a )
+			return 0;
+	} else if ( ow->ow_phase == OW_WALK ) {
+		/* An entry sorts by its least value. Going backwards it is
+		 * met at its greatest one first, and a key may also be stale.
+		 * Either way it comes again at the right key, or at the end.
+		 */
+		if ( !a )
+			return 0;
+		for ( i = 0; i < a->a_numvals; i++ ) {
+			order_key( ow->ow_ai->ai_order, &a->a_nvals[i], &key,
+				ow->ow_tmp, ow->ow_max );
+			cmp = order_cmp( &key, &ow->ow_key );
+			if ( cmp < 0 )
+				return 0;
+			if ( cmp == 0 )
+				found = 1;
+		}
+		if ( !found )
+			return 0;
+	}
+	OW_SET( ow->ow_sent, ow->ow_slot );
+	return 1;
+}
+
+/* Pick up where we left off in a renewed read txn */
+int
+mdb_ordwalk_renew( mdb_ordwalk *ow, MDB_txn *txn )
+{
+	MDB_cursor *mc = ow->ow_mc;
+	MDB_val key, data;
+	int rc;
+
+	rc = mdb_cursor_renew( txn, mc );
+	if ( rc || ow->ow_phase != OW_WALK || !ow->ow_started )
+		return rc;
+
+	key = ow->ow_key;
+	data.mv_size = sizeof(ID);
+	data.mv_data = &ow->ow_id;
+	rc = mdb_cursor_get( mc, &key, &data, MDB_GET_BOTH );
+	if ( rc != MDB_NOTFOUND )
+		return rc;
+
+	/* it's gone, stop on whatever came after it */
+	key = ow->ow_key;
+	data.mv_size = sizeof(ID);
+	data.mv_data = &ow->ow_id;
+	rc = mdb_cursor_get( mc, &key, &data, MDB_GET_BOTH_RANGE );
+	if ( rc == MDB_NOTFOUND ) {
+		key = ow->ow_key;
+		rc = mdb_cursor_get( mc, &key, &data, MDB_SET_RANGE );
+		if ( !ow->ow_reverse ) {
+			if ( rc == 0 && !order_cmp( &key, &ow->ow_key ))
+				rc = mdb_cursor_get( mc, &key, &data, MDB_NEXT_NODUP );
+		} else {
+			if ( rc == 0 ) {
+				rc = mdb_cursor_get( mc, &key, &data, MDB_PREV_NODUP );
+				if ( rc == 0 )
+					rc = mdb_cursor_get( mc, &key, &data, MDB_FIRST_DUP );
+			} else if ( rc == MDB_NOTFOUND ) {
+				rc = ordwalk_last( mc, &key, &data );
+			}
+		}
+	}
+	if ( rc == 0 ) {
+		ow->ow_pending = 1;
+	} else if ( rc == MDB_NOTFOUND ) {
+		ow->ow_phase = OW_REST;
+		ow->ow_started = 0;
+		rc = 0;
+	}
+	return rc;
+}
+
+void
+mdb_ordwalk_end( mdb_ordwalk *ow )
+{
+	mdb_cursor_close( ow->ow_mc );
+	ch_free( ow );
+}
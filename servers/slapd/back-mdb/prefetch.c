@@ -0,0 +1,279 @@
+/* prefetch.c - ldap mdb back-end readahead of search candidates */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+#include "back-mdb.h"
+#include "idl.h"
+
+/* When the map doesn't fit in memory, every id2entry page a search
+ * looks at may be a page fault, and the search waits for each read
+ * in turn. Prefetch tasks from the connection pool take the next
+ * chunks of candidates in turn, up to prefetch IDs ahead of the
+ * search, each in its own read txn. They take the faults on the leaf
+ * pages themselves, and ask the kernel to start reading the overflow
+ * pages of large entries without waiting for them. Neighbouring IDs
+ * mostly share a leaf page, so a task works through a whole chunk,
+ * and the tasks wait for different pages: there are as many reads in
+ * flight as there are tasks. The search then mostly finds its pages
+ * in memory. The tasks only ever touch pages, so it doesn't matter
+ * that their snapshots may be newer than the search's.
+ */
+
+#define MDB_PREFETCH_MAX	4096
+#define MDB_PREFETCH_CHUNK	32	/* IDs a task takes at a time */
+
+struct mdb_prefetch {
+	Operation *pf_op;
+	ID *pf_cands;
+	ID pf_cursor;		/* of the tasks in pf_cands */
+	ID pf_cur;			/* ID the search is at */
+	ID pf_wait;			/* the task waits for the search to get here */
+	unsigned pf_nslots;
+	unsigned long pf_n;	/* chunks taken */
+	ID *pf_ring;		/* first IDs of the last pf_nslots of them */
+	int pf_ntasks;
+	int pf_running;		/* tasks submitted but not finished */
+	int pf_stop;
+	ldap_pvt_thread_mutex_t pf_mutex;
+	ldap_pvt_thread_cond_t pf_cond;
+	struct pf_task {
+		mdb_prefetch *pt_pf;
+		void *pt_cookie;
+		int pt_started;
+	} pf_tasks[1];
+};
+
+/* Bring in the pages of one entry, and of its DN that the search
+ * looks up to check the scope
+ */
+static void
+mdb_prefetch_entry( Operation *op, MDB_txn *txn, MDB_cursor *mci,
+	MDB_cursor **mcd, ID id, size_t psize )
+{
+	struct berval name, nname;
+	MDB_val key, data;
+
+	if ( !mdb_id2name( op, txn, mcd, id, &name, &nname )) {
+		op->o_tmpfree( name.bv_val, op->o_tmpmemctx );
+		op->o_tmpfree( nname.bv_val, op->o_tmpmemctx );
+	}
+
+	key.mv_data = &id;
+	key.mv_size = sizeof(ID);
+	/* faults the leaf page in */
+	if ( mdb_cursor_get( mci, &key, &data, MDB_SET ) || data.mv_size < psize / 2 )
+		return;
+#ifdef MADV_WILLNEED
+	/* a large entry is on overflow pages that nothing touched yet */
+	{
+		uintptr_t lo = (uintptr_t)data.mv_data & ~(uintptr_t)( psize - 1 );
+		uintptr_t hi = (uintptr_t)data.mv_data + data.mv_size;
+		madvise( (void *)lo, hi - lo, MADV_WILLNEED );
+	}
+#endif
+}
+
+static void *
+mdb_prefetch_task( void *ctx, void *arg )
+{
+	struct pf_task *pt = arg;
+	mdb_prefetch *pf = pt->pt_pf;
+	struct mdb_info *mdb = (struct mdb_info *) pf->pf_op->o_bd->be_private;
+	Operation op2 = *pf->pf_op;
+	Opheader oh = *op2.o_hdr;
+	mdb_op_info opinfo = {{{0}}}, *moi = &opinfo;
+	MDB_cursor *mci = NULL, *mcd = NULL;
+	MDB_stat st;
+	ID ids[MDB_PREFETCH_CHUNK], *slot;
+	unsigned i, n, nentries = 0;
+
+	ldap_pvt_thread_mutex_lock( &pf->pf_mutex );
+	pt->pt_started = 1;
+	ldap_pvt_thread_mutex_unlock( &pf->pf_mutex );
+
+	oh.oh_threadctx = ctx;
+	oh.oh_tmpmemctx = slap_sl_mem_create( SLAP_SLAB_SIZE, SLAP_SLAB_STACK,
+		ctx, 1 );
+	oh.oh_tmpmfuncs = &slap_sl_mfuncs;
+	op2.o_hdr = &oh;
+	LDAP_SLIST_INIT( &op2.o_extra );
+
+	if ( mdb_opinfo_get( &op2, mdb, 1, &moi ))
+		goto leave;
+	if ( mdb_cursor_open( moi->moi_txn, mdb->mi_id2entry, &mci ))
+		goto done;
+	mdb_env_stat( mdb->mi_dbenv, &st );
+
+	for (;;) {
+		ldap_pvt_thread_mutex_lock( &pf->pf_mutex );
+		/* stay ahead of the search by at most pf_nslots chunks */
+		slot = &pf->pf_ring[pf->pf_n % pf->pf_nslots];
+		while ( !pf->pf_stop && pf->pf_n >= pf->pf_nslots &&
+			*slot > pf->pf_cur &&
+			!ldap_pvt_thread_pool_pausing( &connection_pool ))
+		{
+			pf->pf_wait = *slot;
+			ldap_pvt_thread_cond_wait( &pf->pf_cond, &pf->pf_mutex );
+			slot = &pf->pf_ring[pf->pf_n % pf->pf_nslots];
+		}
+		pf->pf_wait = NOID;
+		n = 0;
+		if ( !pf->pf_stop && !pf->pf_op->o_abandon && !slapd_shutdown &&
+			!ldap_pvt_thread_pool_pausing( &connection_pool )) {
+			while ( n < MDB_PREFETCH_CHUNK && ( ids[n] =
+				mdb_idl_next( pf->pf_cands, &pf->pf_cursor )) != NOID )
+				n++;
+		}
+		if ( !n ) {
+			pf->pf_stop = 1;
+			ldap_pvt_thread_cond_broadcast( &pf->pf_cond );
+			ldap_pvt_thread_mutex_unlock( &pf->pf_mutex );
+			break;
+		}
+		*slot = ids[0];
+		pf->pf_n++;
+		ldap_pvt_thread_mutex_unlock( &pf->pf_mutex );
+
+		for ( i = 0; i < n; i++ )
+			mdb_prefetch_entry( &op2, moi->moi_txn, mci, &mcd, ids[i],
+				st.ms_psize );
+
+		/* don't hold on to an old snapshot, as with rtxnsize */
+		nentries += n;
+		if ( mdb->mi_rtxn_size && nentries >= mdb->mi_rtxn_size ) {
+			MDB_envinfo ei;
+			nentries = 0;
+			mdb_env_info( mdb->mi_dbenv, &ei );
+			if ( ei.me_last_txnid > mdb_txn_id( moi->moi_txn )) {
+				mdb_txn_reset( moi->moi_txn );
+				mdb_txn_renew( moi->moi_txn );
+				mdb_cursor_renew( moi->moi_txn, mci );
+				if ( mcd )
+					mdb_cursor_renew( moi->moi_txn, mcd );
+			}
+		}
+	}
+
+	if ( mcd )
+		mdb_cursor_close( mcd );
+	mdb_cursor_close( mci );
+done:
+	mdb_txn_reset( moi->moi_txn );
+	LDAP_SLIST_REMOVE( &op2.o_extra, &moi->moi_oe, OpExtra, oe_next );
+leave:
+	ldap_pvt_thread_mutex_lock( &pf->pf_mutex );
+	pf->pf_running--;
+	ldap_pvt_thread_cond_broadcast( &pf->pf_cond );
+	ldap_pvt_thread_mutex_unlock( &pf->pf_mutex );
+	return NULL;
+}
+
+/* Start prefetching the candidates after cursor. Returns NULL if
+ * prefetch is off or there aren't enough candidates to bother.
+ */
+mdb_prefetch *
+mdb_prefetch_start( Operation *op, ID *candidates, ID cursor )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_prefetch *pf;
+	unsigned max = mdb->mi_prefetch;
+	int i, ntasks = mdb->mi_prefetch_tasks;
+
+	if ( !max || !op->o_threadctx || ( slapMode & SLAP_TOOL_MODE ) ||
+		MDB_IDL_N( candidates ) < 2 )
+		return NULL;
+	if ( max > MDB_PREFETCH_MAX )
+		max = MDB_PREFETCH_MAX;
+	/* leave the pool some threads for other operations */
+	if ( ntasks > connection_pool_max / 2 )
+		ntasks = connection_pool_max / 2;
+	if ( ntasks < 1 )
+		return NULL;
+
+	max /= MDB_PREFETCH_CHUNK;
+	if ( max < ntasks )
+		max = ntasks;
+
+	pf = ch_calloc( 1, sizeof( mdb_prefetch ) +
+		( ntasks - 1 ) * sizeof( struct pf_task ) + max * sizeof( ID ));
+	pf->pf_op = op;
+	pf->pf_cands = candidates;
+	pf->pf_cursor = cursor;
+	pf->pf_wait = NOID;
+	pf->pf_nslots = max;
+	pf->pf_ring = (ID *)( pf->pf_tasks + ntasks );
+	ldap_pvt_thread_mutex_init( &pf->pf_mutex );
+	ldap_pvt_thread_cond_init( &pf->pf_cond );
+
+	ldap_pvt_thread_mutex_lock( &pf->pf_mutex );
+	for ( i = 0; i < ntasks; i++ ) {
+		struct pf_task *pt = &pf->pf_tasks[i];
+		pt->pt_pf = pf;
+		if ( ldap_pvt_thread_pool_submit2( &connection_pool,
+			mdb_prefetch_task, pt, &pt->pt_cookie ))
+			break;
+		pf->pf_running++;
+	}
+	pf->pf_ntasks = i;
+	ldap_pvt_thread_mutex_unlock( &pf->pf_mutex );
+	if ( !i ) {
+		mdb_prefetch_end( pf );
+		return NULL;
+	}
+	return pf;
+}
+
+/* The search has got to id */
+void
+mdb_prefetch_pos( mdb_prefetch *pf, ID id )
+{
+	ldap_pvt_thread_mutex_lock( &pf->pf_mutex );
+	pf->pf_cur = id;
+	if ( id >= pf->pf_wait )
+		ldap_pvt_thread_cond_broadcast( &pf->pf_cond );
+	ldap_pvt_thread_mutex_unlock( &pf->pf_mutex );
+}
+
+/* Stop the tasks and wait for them before freeing it all */
+void
+mdb_prefetch_end( mdb_prefetch *pf )
+{
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &pf->pf_mutex );
+	pf->pf_stop = 1;
+	ldap_pvt_thread_cond_broadcast( &pf->pf_cond );
+	/* the pool may never get to them if it's busy or pausing */
+	for ( i = 0; i < pf->pf_ntasks; i++ ) {
+		if ( !pf->pf_tasks[i].pt_started &&
+			ldap_pvt_thread_pool_retract( pf->pf_tasks[i].pt_cookie ) > 0 )
+			pf->pf_running--;
+	}
+	while ( pf->pf_running )
+		ldap_pvt_thread_cond_wait( &pf->pf_cond, &pf->pf_mutex );
+	ldap_pvt_thread_mutex_unlock( &pf->pf_mutex );
+
+	ldap_pvt_thread_cond_destroy( &pf->pf_cond );
+	ldap_pvt_thread_mutex_destroy( &pf->pf_mutex );
+	ch_free( pf );
+}
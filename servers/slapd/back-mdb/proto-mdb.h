@@ -34,6 +34,7 @@ int mdb_attr_slot( struct mdb_info *mdb,
 
 int mdb_attr_dbs_open( BackendDB *be, MDB_txn *txn, struct config_reply_s *cr );
 void mdb_attr_dbs_close( struct mdb_info *mdb );
+int mdb_attr_order_drop( BackendDB *be, struct config_reply_s *cr );
 
 int mdb_attr_index_config LDAP_P(( struct mdb_info *mdb,
 	const char *fname, int lineno,
@@ -52,6 +53,7 @@ void mdb_attr_multi_unparse LDAP_P(( struct mdb_info *mdb, BerVarray *bva ));
 
 void mdb_attr_multi_thresh LDAP_P(( struct mdb_info *mdb, AttributeDescription *ad,
 	unsigned *hi, unsigned *lo ));
+int mdb_attr_multi_runs LDAP_P(( struct mdb_info *mdb, AttributeDescription *ad ));
 
 void mdb_attr_info_free( AttrInfo *ai );
 
@@ -160,8 +162,84 @@ void mdb_dn2id_wrestore(
 	Operation *op,
 	struct IdScopes *isc );
 
+int mdb_dn2id_filter(
+	MDB_txn *txn,
+	struct mdb_info *mdb,
+	mdb_dnfilter *df,
+	ID id,
+	struct berval *ndn );
+
 MDB_cmp_func mdb_dup_compare;
 
+/*
+ * dnfilter.c
+ */
+
+mdb_dnfilter *mdb_dnfilter_new( unsigned long size, unsigned long entries );
+void mdb_dnfilter_free( mdb_dnfilter *df );
+void mdb_dnfilter_add( mdb_dnfilter *df, struct berval *ndn );
+int mdb_dnfilter_has( mdb_dnfilter *df, struct berval *ndn );
+void mdb_dnfilter_miss( mdb_dnfilter *df, int caught );
+int mdb_dnfilter_open( BackendDB *be, MDB_txn *txn );
+void mdb_dnfilter_close( struct mdb_info *mdb );
+int mdb_dnfilter_stats( mdb_dnfilter *df, struct berval *bv );
+
+/*
+ * ecache.c
+ */
+
+mdb_ecache *mdb_ecache_new( unsigned long size );
+void mdb_ecache_free( mdb_ecache *ec );
+int mdb_ecache_get( Operation *op, mdb_ecache *ec, MDB_txn *txn, ID id,
+	Entry **e );
+void mdb_ecache_return( Entry *e );
+void mdb_ecache_put( mdb_ecache *ec, MDB_txn *txn, Entry *e );
+void mdb_ecache_del( mdb_ecache *ec, MDB_txn *txn, ID id );
+int mdb_ecache_open( BackendDB *be );
+void mdb_ecache_close( struct mdb_info *mdb );
+int mdb_ecache_stats( mdb_ecache *ec, struct berval *bv );
+
+/*
+ * txngroup.c
+ */
+
+int mdb_txngroup_open( struct mdb_info *mdb );
+void mdb_txngroup_close( struct mdb_info *mdb );
+int mdb_txngroup_active( struct mdb_info *mdb );
+int mdb_txngroup_begin( struct mdb_info *mdb, MDB_txn **txnp );
+int mdb_txngroup_commit( struct mdb_info *mdb, mdb_op_info *moi,
+	MDB_txn *txn );
+void mdb_txngroup_abort( struct mdb_info *mdb, mdb_op_info *moi,
+	MDB_txn *txn );
+int mdb_txngroup_stats( mdb_txngroup *tg, struct berval *bv );
+
+/*
+ * flush.c
+ */
+
+int mdb_flush_open( BackendDB *be );
+void mdb_flush_close( struct mdb_info *mdb );
+int mdb_flush_sync( struct mdb_info *mdb );
+int mdb_flush_stats( mdb_flusher *fl, struct berval *bv );
+
+/*
+ * prefetch.c
+ */
+
+mdb_prefetch *mdb_prefetch_start( Operation *op, ID *candidates, ID cursor );
+void mdb_prefetch_pos( mdb_prefetch *pf, ID id );
+void mdb_prefetch_end( mdb_prefetch *pf );
+
+/*
+ * rdwatch.c
+ */
+
+int mdb_rdwatch_open( BackendDB *be );
+void mdb_rdwatch_close( struct mdb_info *mdb );
+int mdb_rdwatch_expired( Operation *op, struct mdb_info *mdb, MDB_txn *txn );
+int mdb_rdwatch_stats( mdb_rdwatch *rw, struct berval *bv );
+
+
 /*
  * filterentry.c
  */
@@ -180,6 +258,8 @@ int mdb_filter_candidates(
 
 MDB_cmp_func mdb_id2v_compare;
 MDB_cmp_func mdb_id2v_dupsort;
+int mdb_id2v_match( AttributeDescription *ad, struct berval *bv1,
+	struct berval *bv2 );
 
 int mdb_id2entry_add(
 	Operation *op,
@@ -216,12 +296,32 @@ BI_entry_get_rw mdb_entry_get;
 BI_op_txn mdb_txn;
 
 int mdb_entry_decode( Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **e );
+int mdb_entry_partial( Operation *op, MDB_txn *txn, MDB_val *data, ID id,
+	mdb_attrwant *aw, Entry **e );
 
 void mdb_reader_flush( MDB_env *env );
 int mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **moi );
+mdb_ecache *mdb_opinfo_ecache( Operation *op, struct mdb_info *mdb, MDB_txn *txn );
+
+int mdb_mval_put(Operation *op, MDB_cursor *mc, ID id, Attribute *a, int runs);
+int mdb_mval_del(Operation *op, MDB_cursor *mc, ID id, Attribute *a, int runs);
+
+/*
+ * compress.c
+ */
 
-int mdb_mval_put(Operation *op, MDB_cursor *mc, ID id, Attribute *a);
-int mdb_mval_del(Operation *op, MDB_cursor *mc, ID id, Attribute *a);
+int mdb_zip_want( struct mdb_info *mdb, Attribute *a, ber_len_t size );
+void mdb_zip_free( struct mdb_info *mdb );
+
+/*
+ * mvruns.c
+ */
+
+int mdb_mvrun_first( const MDB_val *blk, struct berval *bv );
+int mdb_mvrun_put( Operation *op, MDB_cursor *mc, ID id, Attribute *a );
+int mdb_mvrun_del( Operation *op, MDB_cursor *mc, ID id, Attribute *a );
+int mdb_mvrun_get( Operation *op, MDB_cursor *mc, ID id, Attribute *a,
+	int have_nvals, unsigned char **buf, ber_len_t *left );
 
 /*
  * idl.c
@@ -238,24 +338,55 @@ int mdb_idl_fetch_key(
 	MDB_cursor	**saved_cursor,
 	int                     get_flag );
 
+int mdb_idl_count_key(
+	MDB_txn		*txn,
+	MDB_dbi		dbi,
+	MDB_val		*key,
+	ID			*count );
+
 int mdb_idl_insert( ID *ids, ID id );
 
+int mdb_idl_stats(
+	MDB_txn		*txn,
+	MDB_dbi		dbi,
+	mdb_idxstats	*st );
+
+int mdb_idxstats_get(
+	MDB_txn		*txn,
+	struct mdb_info	*mdb,
+	AttrInfo	*ai,
+	mdb_idxstats	*st );
+
+int mdb_idxstats_put(
+	MDB_txn		*txn,
+	struct mdb_info	*mdb,
+	AttrInfo	*ai,
+	mdb_idxstats	*st );
+
+int mdb_idxstats_scan(
+	MDB_txn		*txn,
+	struct mdb_info	*mdb,
+	AttrInfo	*ai );
+
 typedef int (mdb_idl_keyfunc)(
 	BackendDB *be,
 	MDB_cursor *mc,
 	struct berval *key,
-	ID id );
+	ID id,
+	mdb_idxstats *st );
 
 mdb_idl_keyfunc mdb_idl_insert_keys;
 mdb_idl_keyfunc mdb_idl_delete_keys;
 
 int
 mdb_idl_intersection(
+	Operation *op,
 	ID *a,
 	ID *b );
 
 int
 mdb_idl_union(
+	Operation *op,
 	ID *a,
 	ID *b );
 
@@ -266,6 +397,31 @@ void mdb_idl_sort( ID *ids, ID *tmp );
 int mdb_idl_append( ID *a, ID *b );
 int mdb_idl_append_one( ID *ids, ID id );
 
+/*
+ * keysort.c
+ */
+
+typedef int (mdb_keysort_put)( void *arg, MDB_val *key,
+	ID *ids, size_t n, ID last );
+
+int mdb_keysort_add( mdb_keysort *ks, struct berval *keys, ID id );
+mdb_idl_keyfunc mdb_keysort_keys;
+int mdb_keysort_spill( mdb_keysort *ks );
+void mdb_keysort_clear( mdb_keysort *ks );
+int mdb_keysort_merge( mdb_keysort **ks, int nks, size_t maxids,
+	mdb_keysort_put *put, void *arg );
+
+/*
+ * ixbuild.c
+ */
+
+void *mdb_ixbuild_run( void *ctx, void *arg );
+void mdb_ixbuild_restart( struct mdb_info *mdb );
+void mdb_ixbuild_dirty( struct mdb_info *mdb, ID id );
+mdb_keysort *mdb_ixbuild_sorter( Operation *op, AttrInfo *ai, int ordered );
+int mdb_ixbuild_stats( mdb_ixbuild *ib, struct berval *bv );
+void mdb_ixbuild_free( struct mdb_info *mdb );
+
 
 /*
  * index.c
@@ -295,6 +451,15 @@ mdb_index_values LDAP_P((
 	ID id,
 	int opid ));
 
+extern int
+mdb_index_values_keep LDAP_P((
+	Operation *op,
+	MDB_txn *txn,
+	AttributeDescription *desc,
+	BerVarray vals,
+	BerVarray keep,
+	ID id ));
+
 extern int
 mdb_index_recset LDAP_P((
 	struct mdb_info *mdb,
@@ -333,6 +498,13 @@ mdb_key_read(
     MDB_cursor **saved_cursor,
         int get_flags );
 
+extern int
+mdb_key_count(
+	MDB_txn *txn,
+	MDB_dbi dbi,
+	struct berval *k,
+	ID *count );
+
 /*
  * nextid.c
  */
@@ -369,6 +541,41 @@ mdb_monitor_idx_add(
 	slap_mask_t		type );
 #endif /* MDB_MONITOR_IDX */
 
+/*
+ * ordered.c
+ */
+
+int mdb_order_kind( MatchingRule *mr );
+int mdb_order_index( Operation *op, MDB_txn *txn, AttrInfo *ai,
+	BerVarray vals, ID id, int opid );
+int mdb_order_keys( Operation *op, AttrInfo *ai, BerVarray vals,
+	ID id, mdb_keysort *ks );
+
+mdb_ordwalk *mdb_ordwalk_start( Operation *op, MDB_cursor *mci,
+	ID *ids, ID ncand );
+ID mdb_ordwalk_next( mdb_ordwalk *ow );
+int mdb_ordwalk_check( mdb_ordwalk *ow, Entry *e );
+int mdb_ordwalk_renew( mdb_ordwalk *ow, MDB_txn *txn );
+void mdb_ordwalk_end( mdb_ordwalk *ow );
+
+/*
+ * ngram.c
+ */
+
+int mdb_ngram_ok( MatchingRule *mr );
+int mdb_ngram_keys( Operation *op, BerVarray vals, BerVarray *keysp );
+int mdb_ngram_candidates( Operation *op, MDB_txn *rtxn, MDB_dbi dbi,
+	SubstringsAssertion *sub, ID *ids, ID *tmp );
+ID mdb_ngram_estimate( MDB_txn *rtxn, MDB_dbi dbi,
+	SubstringsAssertion *sub );
+
+/*
+ * search.c
+ */
+
+SLAP_CTRL_PARSE_FN mdb_explain_parse;
+int mdb_attrwant_test( mdb_attrwant *aw, int i, AttributeDescription *ad );
+
 /*
  * former external.h
  */
@@ -405,6 +612,7 @@ extern BI_tool_entry_modify		mdb_tool_entry_modify;
 extern BI_tool_entry_delete		mdb_tool_entry_delete;
 
 extern mdb_idl_keyfunc mdb_tool_idl_add;
+extern mdb_idl_keyfunc mdb_tool_bulk_add;
 
 LDAP_END_DECL
 
@@ -0,0 +1,283 @@
+/* rdwatch.c - ldap mdb back-end watchdog of old read transactions */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+#include <ac/time.h>
+
+#include "back-mdb.h"
+
+#include "ldap_rq.h"
+
+/* A read txn keeps every page of its snapshot from being reused, so
+ * while one stays open the pages freed by later writes pile up in the
+ * freelist and the map grows. LMDB's reader table only tells which
+ * snapshot each reader uses, not since when. The watchdog samples the
+ * last committed txnid, and the time a txnid was first seen is when
+ * all older snapshots stopped being the latest one: the age of a
+ * reader is the time since its snapshot was superseded. Readers of the
+ * latest snapshot pin nothing and are never old.
+ *
+ * Each tick reclaims the slots of dead processes, and logs the oldest
+ * reader once it is older than readerage. With abort set, searches of
+ * this server whose snapshot is that old give up; other readers can
+ * only be reported.
+ */
+
+#define MDB_RDW_SAMPLES	64
+
+typedef struct rdw_sample {
+	size_t rs_txnid;
+	time_t rs_time;
+} rdw_sample;
+
+struct mdb_rdwatch {
+	ldap_pvt_thread_mutex_t rw_mutex;
+	struct re_s *rw_task;
+	rdw_sample rw_samples[MDB_RDW_SAMPLES];
+	int rw_first;
+	int rw_nsamples;
+	size_t rw_logged;	/* txnid of the last reader reported */
+	/* the oldest reader at the last tick */
+	unsigned rw_readers;
+	int rw_pid;
+	unsigned long rw_tid;
+	size_t rw_lag;		/* commits since its snapshot */
+	long rw_age;		/* seconds */
+	/* totals */
+	unsigned long rw_ticks;
+	unsigned long rw_reported;
+	unsigned long rw_aborted;
+	unsigned long rw_reclaimed;
+};
+
+typedef struct rdw_oldest {
+	unsigned ro_readers;
+	int ro_pid;
+	unsigned long ro_tid;
+	unsigned long ro_txnid;
+} rdw_oldest;
+
+/* An MDB_msg_func for mdb_reader_list, slots without a txn show "-" */
+static int
+mdb_rdwatch_reader( const char *msg, void *ctx )
+{
+	rdw_oldest *ro = ctx;
+	unsigned long tid, txnid;
+	int pid;
+
+	if ( sscanf( msg, "%d %lx %lu", &pid, &tid, &txnid ) != 3 )
+		return 0;
+	ro->ro_readers++;
+	if ( txnid < ro->ro_txnid ) {
+		ro->ro_txnid = txnid;
+		ro->ro_pid = pid;
+		ro->ro_tid = tid;
+	}
+	return 0;
+}
+
+static void
+mdb_rdwatch_tick( struct mdb_info *mdb, mdb_rdwatch *rw )
+{
+	MDB_envinfo ei;
+	rdw_oldest ro = { 0, 0, 0, (unsigned long)-1 };
+	rdw_sample *rs;
+	time_t now = slap_get_time();
+	size_t stale = 0;
+	int i, n, dead = 0;
+
+	mdb_reader_check( mdb->mi_dbenv, &dead );
+	mdb_env_info( mdb->mi_dbenv, &ei );
+	mdb_reader_list( mdb->mi_dbenv, mdb_rdwatch_reader, &ro );
+
+	ldap_pvt_thread_mutex_lock( &rw->rw_mutex );
+	rw->rw_ticks++;
+	rw->rw_reclaimed += dead;
+
+	/* remember when the latest snapshot was first seen */
+	n = rw->rw_nsamples;
+	if ( !n || rw->rw_samples[( rw->rw_first + n - 1 ) %
+		MDB_RDW_SAMPLES].rs_txnid != ei.me_last_txnid )
+	{
+		if ( n == MDB_RDW_SAMPLES ) {
+			rw->rw_first = ( rw->rw_first + 1 ) % MDB_RDW_SAMPLES;
+			n--;
+		}
+		rs = &rw->rw_samples[( rw->rw_first + n ) % MDB_RDW_SAMPLES];
+		rs->rs_txnid = ei.me_last_txnid;
+		rs->rs_time = now;
+		rw->rw_nsamples = ++n;
+	}
+
+	/* The oldest reader was superseded when the first txnid past
+	 * its own was seen, readers older than our samples at least
+	 * before the first one.
+	 */
+	rw->rw_readers = ro.ro_readers;
+	rw->rw_pid = 0;
+	rw->rw_tid = 0;
+	rw->rw_lag = 0;
+	rw->rw_age = 0;
+	if ( ro.ro_readers && ro.ro_txnid < ei.me_last_txnid ) {
+		rw->rw_pid = ro.ro_pid;
+		rw->rw_tid = ro.ro_tid;
+		rw->rw_lag = ei.me_last_txnid - ro.ro_txnid;
+		for ( i=0; i<n; i++ ) {
+			rs = &rw->rw_samples[( rw->rw_first + i ) % MDB_RDW_SAMPLES];
+			if ( rs->rs_txnid > ro.ro_txnid ) {
+				rw->rw_age = now - rs->rs_time;
+				break;
+			}
+		}
+	}
+
+	/* readers below the newest txnid seen readerage ago are too old */
+	for ( i=n; i-- > 0; ) {
+		rs = &rw->rw_samples[( rw->rw_first + i ) % MDB_RDW_SAMPLES];
+		if ( now - rs->rs_time >= mdb->mi_rdage ) {
+			stale = rs->rs_txnid;
+			break;
+		}
+	}
+	mdb->mi_rdstale = mdb->mi_rdabort ? stale : 0;
+
+	if ( rw->rw_age >= mdb->mi_rdage && ro.ro_txnid != rw->rw_logged ) {
+		rw->rw_logged = ro.ro_txnid;
+		rw->rw_reported++;
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_rdwatch_tick)
+			": reader pid=%d thread=%lx has used txn %lu for %ld seconds,"
+			" %lu commits behind\n",
+			ro.ro_pid, ro.ro_tid, ro.ro_txnid, rw->rw_age,
+			(unsigned long) rw->rw_lag );
+	}
+	ldap_pvt_thread_mutex_unlock( &rw->rw_mutex );
+
+	if ( dead ) {
+		Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_rdwatch_tick)
+			": cleared %d reader slots of dead processes\n", dead );
+	}
+}
+
+static void *
+mdb_rdwatch_task( void *ctx, void *arg )
+{
+	struct re_s *rtask = arg;
+	struct mdb_info *mdb = rtask->arg;
+
+	if ( mdb->mi_rdwatch && mdb->mi_dbenv )
+		mdb_rdwatch_tick( mdb, mdb->mi_rdwatch );
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	return NULL;
+}
+
+int
+mdb_rdwatch_open( BackendDB *be )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	mdb_rdwatch *rw;
+	int interval;
+
+	if ( mdb->mi_rdwatch || !mdb->mi_rdage ||
+		!( slapMode & SLAP_SERVER_MODE ))
+		return 0;
+
+	rw = ch_calloc( 1, sizeof( mdb_rdwatch ));
+	ldap_pvt_thread_mutex_init( &rw->rw_mutex );
+	rw->rw_logged = (size_t)-1;
+	mdb->mi_rdwatch = rw;
+
+	/* the samples cover a few times readerage */
+	interval = mdb->mi_rdage / 16;
+	if ( interval < 1 )
+		interval = 1;
+	else if ( interval > 60 )
+		interval = 60;
+
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	rw->rw_task = ldap_pvt_runqueue_insert( &slapd_rq, interval,
+		mdb_rdwatch_task, mdb, LDAP_XSTRING(mdb_rdwatch_task),
+		be->be_suffix[0].bv_val );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	return 0;
+}
+
+void
+mdb_rdwatch_close( struct mdb_info *mdb )
+{
+	mdb_rdwatch *rw = mdb->mi_rdwatch;
+
+	mdb->mi_rdstale = 0;
+	if ( !rw )
+		return;
+
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	if ( ldap_pvt_runqueue_isrunning( &slapd_rq, rw->rw_task ) )
+		ldap_pvt_runqueue_stoptask( &slapd_rq, rw->rw_task );
+	ldap_pvt_runqueue_remove( &slapd_rq, rw->rw_task );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+
+	mdb->mi_rdwatch = NULL;
+	ldap_pvt_thread_mutex_destroy( &rw->rw_mutex );
+	ch_free( rw );
+}
+
+/* True if the search using txn should give up, its snapshot is older
+ * than readerage and abort is set.
+ */
+int
+mdb_rdwatch_expired( Operation *op, struct mdb_info *mdb, MDB_txn *txn )
+{
+	mdb_rdwatch *rw = mdb->mi_rdwatch;
+	size_t stale = mdb->mi_rdstale;
+
+	if ( !stale || mdb_txn_id( txn ) >= stale )
+		return 0;
+
+	Debug( LDAP_DEBUG_STATS, "%s " LDAP_XSTRING(mdb_rdwatch_expired)
+		": read txn %lu older than %u seconds, aborting\n",
+		op->o_log_prefix, (unsigned long) mdb_txn_id( txn ),
+		mdb->mi_rdage );
+	if ( rw ) {
+		ldap_pvt_thread_mutex_lock( &rw->rw_mutex );
+		rw->rw_aborted++;
+		ldap_pvt_thread_mutex_unlock( &rw->rw_mutex );
+	}
+	return 1;
+}
+
+int
+mdb_rdwatch_stats( mdb_rdwatch *rw, struct berval *bv )
+{
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &rw->rw_mutex );
+	i = snprintf( bv->bv_val, bv->bv_len,
+		"readers=%u#oldest=%ld#lag=%lu#pid=%d#thread=%lx"
+		"#ticks=%lu#reported=%lu#aborted=%lu#reclaimed=%lu",
+		rw->rw_readers, rw->rw_age, (unsigned long) rw->rw_lag,
+		rw->rw_pid, rw->rw_tid,
+		rw->rw_ticks, rw->rw_reported, rw->rw_aborted, rw->rw_reclaimed );
+	ldap_pvt_thread_mutex_unlock( &rw->rw_mutex );
+	if ( i < 0 || i >= bv->bv_len )
+		return -1;
+	bv->bv_len = i;
+	return 0;
+}
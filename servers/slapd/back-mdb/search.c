@@ -27,6 +27,8 @@ static int base_candidate(
 	Entry	*e,
 	ID		*ids );
 
+int mdb_explain_cid;
+
 static int search_candidates(
 	Operation *op,
 	SlapReply *rs,
@@ -416,6 +418,644 @@ mdb_waitfixup( Operation *op, ww_ctx *ww, MDB_cursor *mci, MDB_cursor *mcd, IdSc
 	return rc;
 }
 
+/* Note that attribute ad gets tested, return -1 if there are too many */
+static int
+attrwant_add( mdb_attrwant *aw, AttributeDescription *ad )
+{
+	int i;
+
+	if ( !ad )
+		return 0;
+	for ( i = 0; i < aw->aw_ntested; i++ )
+		if ( aw->aw_tested[i] == ad )
+			return 0;
+	if ( aw->aw_ntested == MDB_AW_MAXADS )
+		return -1;
+	aw->aw_tested[aw->aw_ntested++] = ad;
+	return 0;
+}
+
+/* Add the attributes f tests to aw, return -1 if there are too many
+ * or the filter can test any attribute.
+ */
+static int
+attrwant_filter( mdb_attrwant *aw, Filter *f )
+{
+	AttributeDescription *ad;
+
+	switch ( f->f_choice & SLAPD_FILTER_MASK ) {
+	case LDAP_FILTER_AND:
+	case LDAP_FILTER_OR:
+		for ( f = f->f_list; f; f = f->f_next )
+			if ( attrwant_filter( aw, f ))
+				return -1;
+		return 0;
+	case LDAP_FILTER_NOT:
+		return attrwant_filter( aw, f->f_not );
+	case LDAP_FILTER_PRESENT:
+		ad = f->f_desc;
+		break;
+	case LDAP_FILTER_EQUALITY:
+	case LDAP_FILTER_GE:
+	case LDAP_FILTER_LE:
+	case LDAP_FILTER_APPROX:
+#ifdef LDAP_COMP_MATCH
+		if ( f->f_ava->aa_cf )
+			return -1;
+#endif
+		ad = f->f_av_desc;
+		break;
+	case LDAP_FILTER_SUBSTRINGS:
+		ad = f->f_sub_desc;
+		break;
+	case LDAP_FILTER_EXT:
+		/* without a type, all attributes are tested */
+		ad = f->f_mr_desc;
+		if ( !ad )
+			return -1;
+		break;
+	default:
+		/* computed */
+		return 0;
+	}
+	return attrwant_add( aw, ad );
+}
+
+/* Decide if the search can skip decoding the attributes of its
+ * candidates that nothing will look at, and set up aw if so.
+ * Anything that may look at all of an entry, or at attributes we
+ * can't tell in advance, rules it out.
+ */
+static int
+search_attrwant( Operation *op, mdb_attrwant *aw )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	AttributeName *an = op->ors_attrs;
+	AccessControl *acls[2], *a;
+	slap_callback *sc;
+	Access *b;
+	int i;
+
+	/* no list, or all user or all operational attributes */
+	if ( !an || BER_BVISNULL( &an->an_name ) ||
+		an_find( an, &AllUser ) || an_find( an, &AllOper ))
+		return 0;
+
+	/* overlays may look at whatever entries are returned */
+	for ( sc = op->o_callback; sc; sc = sc->sc_next )
+		if ( sc->sc_response )
+			return 0;
+#ifdef LDAP_SLAPI
+	if ( op->o_pb )
+		return 0;
+#endif
+
+	aw->aw_attrs = an;
+	aw->aw_ntested = 0;
+	if ( attrwant_filter( aw, op->ors_filter ))
+		return 0;
+
+	/* ACLs can look at the entry through their filters, DN attributes
+	 * and the members of the entry itself as a group. Sets, dynamic
+	 * ACLs and dynamic groups, whose URL filters the user entry may
+	 * be tested against, can look at anything.
+	 */
+	if ( !be_isroot( op )) {
+		acls[0] = op->o_bd->be_acl;
+		acls[1] = frontendDB->be_acl;
+		for ( i = 0; i < 2; i++ ) {
+			for ( a = acls[i]; a; a = a->acl_next ) {
+				if ( a->acl_filter && attrwant_filter( aw, a->acl_filter ))
+					return 0;
+				for ( b = a->acl_access; b; b = b->a_next ) {
+					if ( !BER_BVISEMPTY( &b->a_set_pat ))
+						return 0;
+#ifdef SLAP_DYNACL
+					if ( b->a_dynacl )
+						return 0;
+#endif
+					if ( b->a_group_at && is_at_subtype(
+						b->a_group_at->ad_type,
+						slap_schema.si_ad_labeledURI->ad_type ))
+						return 0;
+					if ( attrwant_add( aw, b->a_dn_at ) ||
+						attrwant_add( aw, b->a_realdn_at ) ||
+						attrwant_add( aw, b->a_group_at ))
+						return 0;
+				}
+			}
+		}
+	}
+
+	aw->aw_nads = mdb->mi_numads;
+	aw->aw_want = op->o_tmpcalloc( aw->aw_nads + 1, 1, op->o_tmpmemctx );
+	return 1;
+}
+
+/* Return true if attribute ad, with index i in this DB, must be decoded */
+int
+mdb_attrwant_test( mdb_attrwant *aw, int i, AttributeDescription *ad )
+{
+	int j, want;
+
+	/* added since the search started */
+	if ( i > aw->aw_nads )
+		return 1;
+	if ( aw->aw_want[i] )
+		return aw->aw_want[i] == 1;
+
+	/* the search itself checks for referrals */
+	want = ad == slap_schema.si_ad_objectClass ||
+		ad == slap_schema.si_ad_ref ||
+		( aw->aw_attrs && ad_inlist( ad, aw->aw_attrs ));
+	for ( j = 0; !want && j < aw->aw_ntested; j++ )
+		want = is_ad_subtype( ad, aw->aw_tested[j] );
+	aw->aw_want[i] = want ? 1 : 2;
+	return want;
+}
+
+/* Parallel scan of large candidate ranges. Tasks from the connection
+ * pool each take a chunk of the range, test its entries against the
+ * filter in their own read txn and keep the IDs that may have to be
+ * returned, noting which of them matched. The searching thread consumes
+ * the chunks in ID order and only has to fetch and send the matches,
+ * so entries are still sent in order and only one thread ever writes
+ * to the client. A match is only taken as final if the task saw the
+ * same snapshot as the search, otherwise the filter is tested again.
+ */
+#define PSCAN_CHUNK	1024	/* IDs in one chunk of the range */
+#define PSCAN_MIN	(4 * PSCAN_CHUNK)	/* smallest range worth splitting */
+#define PSCAN_NONE	((unsigned)-1)
+
+typedef struct pscan_slot {
+	unsigned ps_chunk;		/* chunk held here, or PSCAN_NONE */
+	unsigned ps_n;			/* IDs kept from it */
+	unsigned ps_scanned;	/* entries tested */
+	ID ps_txnid;			/* snapshot they were tested in */
+	ID ps_ids[PSCAN_CHUNK];
+	char ps_match[PSCAN_CHUNK];	/* passed the filter and its ACLs */
+} pscan_slot;
+
+struct pscan_ctx;
+
+typedef struct pscan_task {
+	struct pscan_ctx *pt_ps;
+	void *pt_cookie;
+	int pt_started;
+} pscan_task;
+
+typedef struct pscan_ctx {
+	Operation *ps_op;
+	ID *ps_cands;
+	ID ps_first, ps_last;
+	ID ps_base;
+	mdb_attrwant *ps_aw;	/* of the search, or NULL */
+	mdb_trace *ps_trace;
+	unsigned ps_nchunks;
+	unsigned ps_claim;		/* next chunk nobody has taken */
+	unsigned ps_cur;		/* chunk being returned */
+	unsigned ps_pos;		/* position in the current chunk */
+	int ps_ready;			/* current chunk is complete */
+	unsigned ps_nslots;
+	pscan_slot *ps_slots;
+	int ps_ntasks;
+	int ps_running;			/* tasks submitted but not finished */
+	int ps_stop;
+	pscan_task *ps_tasks;
+	ldap_pvt_thread_mutex_t ps_mutex;
+	ldap_pvt_thread_cond_t ps_cond;
+} pscan_ctx;
+
+/* Fill slot with the IDs of chunk c that the search must look at:
+ * the base, referrals, and the entries that match the filter. Only
+ * the last are flagged as matches, the search checks the others.
+ */
+static void
+pscan_chunk( Operation *op, MDB_txn *txn, MDB_cursor *mci, MDB_cursor **mcd,
+	mdb_attrwant *aw, pscan_ctx *ps, unsigned c, pscan_slot *slot )
+{
+	ID lo = ps->ps_first + (ID)c * PSCAN_CHUNK;
+	ID hi = lo + PSCAN_CHUNK - 1, id;
+	ID *cands = ps->ps_cands;
+	MDB_val key, data;
+	Entry *e;
+	unsigned i;
+	int rc, match;
+
+	if ( hi > ps->ps_last )
+		hi = ps->ps_last;
+	slot->ps_n = 0;
+	slot->ps_scanned = 0;
+	slot->ps_txnid = mdb_txn_id( txn );
+
+	key.mv_data = &lo;
+	key.mv_size = sizeof(ID);
+	for ( rc = mdb_cursor_get( mci, &key, &data, MDB_SET_RANGE ); !rc;
+		rc = mdb_cursor_get( mci, &key, &data, MDB_NEXT )) {
+		memcpy( &id, key.mv_data, sizeof(ID) );
+		if ( id > hi )
+			break;
+		/* stubs from missing parents */
+		if ( !data.mv_size )
+			continue;
+		if ( MDB_IDL_IS_RUNS( cands )) {
+			i = mdb_idl_runs_search( cands, id );
+			if ( i >= MDB_IDL_RUNS_N( cands ) ||
+				id < MDB_IDL_RUN_LO( cands, i ))
+				continue;
+		}
+		match = 0;
+		if ( id == ps->ps_base )
+			goto keep;
+
+		slot->ps_scanned++;
+		/* on any error, leave it to the search to report */
+		if ( mdb_entry_partial( op, txn, &data, id, aw, &e ))
+			goto keep;
+		e->e_id = id;
+		BER_BVZERO( &e->e_name );
+		BER_BVZERO( &e->e_nname );
+		/* ACLs in the filter need the DN */
+		if ( mdb_id2name( op, txn, mcd, id, &e->e_name, &e->e_nname )) {
+			mdb_entry_return( op, e );
+			goto keep;
+		}
+		rc = !get_manageDSAit( op ) && is_entry_referral( e );
+		if ( !rc )
+			match = rc = test_filter( op, e, op->ors_filter ) ==
+				LDAP_COMPARE_TRUE;
+		mdb_entry_return( op, e );
+		if ( !rc )
+			continue;
+keep:
+		slot->ps_match[slot->ps_n] = match;
+		slot->ps_ids[slot->ps_n++] = id;
+	}
+}
+
+static void *
+pscan_task_run( void *ctx, void *arg )
+{
+	pscan_task *pt = arg;
+	pscan_ctx *ps = pt->pt_ps;
+	struct mdb_info *mdb = (struct mdb_info *) ps->ps_op->o_bd->be_private;
+	Operation op2 = *ps->ps_op;
+	Opheader oh = *op2.o_hdr;
+	mdb_op_info opinfo = {{{0}}}, *moi = &opinfo;
+	MDB_cursor *mci = NULL, *mcd = NULL;
+	mdb_attrwant aw, *awp = NULL;
+	unsigned c, nentries = 0;
+	int stop;
+
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	pt->pt_started = 1;
+	stop = ps->ps_stop;
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+	if ( stop )
+		goto leave;
+
+	oh.oh_threadctx = ctx;
+	oh.oh_tmpmemctx = slap_sl_mem_create( SLAP_SLAB_SIZE, SLAP_SLAB_STACK,
+		ctx, 1 );
+	oh.oh_tmpmfuncs = &slap_sl_mfuncs;
+	op2.o_hdr = &oh;
+	op2.o_callback = NULL;
+	op2.o_groups = NULL;
+	LDAP_SLIST_INIT( &op2.o_extra );
+
+	/* only the filter is tested here */
+	if ( ps->ps_aw ) {
+		aw = *ps->ps_aw;
+		aw.aw_attrs = NULL;
+		aw.aw_want = op2.o_tmpcalloc( aw.aw_nads + 1, 1, op2.o_tmpmemctx );
+		awp = &aw;
+	}
+
+	if ( mdb_opinfo_get( &op2, mdb, 1, &moi ))
+		goto leave;
+	if ( mdb_cursor_open( moi->moi_txn, mdb->mi_id2entry, &mci ))
+		goto done;
+
+	for (;;) {
+		ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+		/* wait for the search to free a slot */
+		while ( !ps->ps_stop && ps->ps_claim < ps->ps_nchunks &&
+			ps->ps_claim >= ps->ps_cur + ps->ps_nslots &&
+			!ldap_pvt_thread_pool_pausing( &connection_pool ))
+			ldap_pvt_thread_cond_wait( &ps->ps_cond, &ps->ps_mutex );
+		/* the search thread finishes the rest if we go away */
+		if ( ps->ps_stop || ps->ps_claim >= ps->ps_nchunks ||
+			ps->ps_claim >= ps->ps_cur + ps->ps_nslots ||
+			ldap_pvt_thread_pool_pausing( &connection_pool ) ||
+			ps->ps_op->o_abandon || slapd_shutdown ) {
+			ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+			break;
+		}
+		c = ps->ps_claim++;
+		ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+
+		pscan_chunk( &op2, moi->moi_txn, mci, &mcd, awp, ps, c,
+			&ps->ps_slots[c % ps->ps_nslots] );
+
+		ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+		ps->ps_slots[c % ps->ps_nslots].ps_chunk = c;
+		ldap_pvt_thread_cond_broadcast( &ps->ps_cond );
+		ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+
+		/* don't hold on to an old snapshot, as with rtxnsize */
+		nentries += PSCAN_CHUNK;
+		if ( mdb->mi_rtxn_size && nentries >= mdb->mi_rtxn_size ) {
+			MDB_envinfo ei;
+			nentries = 0;
+			mdb_env_info( mdb->mi_dbenv, &ei );
+			if ( ei.me_last_txnid > mdb_txn_id( moi->moi_txn )) {
+				mdb_txn_reset( moi->moi_txn );
+				mdb_txn_renew( moi->moi_txn );
+				mdb_cursor_renew( moi->moi_txn, mci );
+				if ( mcd )
+					mdb_cursor_renew( moi->moi_txn, mcd );
+			}
+		}
+	}
+
+	if ( mcd )
+		mdb_cursor_close( mcd );
+	mdb_cursor_close( mci );
+done:
+	mdb_txn_reset( moi->moi_txn );
+	LDAP_SLIST_REMOVE( &op2.o_extra, &moi->moi_oe, OpExtra, oe_next );
+	slap_op_groups_free( &op2 );
+leave:
+	if ( awp )
+		op2.o_tmpfree( aw.aw_want, op2.o_tmpmemctx );
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	ps->ps_running--;
+	ldap_pvt_thread_cond_broadcast( &ps->ps_cond );
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+	return NULL;
+}
+
+/* Set up a parallel scan of candidates and start its tasks.
+ * Returns NULL if the search should just scan them itself.
+ */
+static pscan_ctx *
+pscan_start( Operation *op, MDB_cursor *mci, ID *candidates, ID base,
+	mdb_attrwant *aw, mdb_trace *mt )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	pscan_ctx *ps;
+	MDB_val key;
+	ID last;
+	int i, ntasks = mdb->mi_search_threads;
+
+	/* leave the pool some threads for other operations */
+	if ( ntasks > connection_pool_max / 2 )
+		ntasks = connection_pool_max / 2;
+	if ( ntasks < 1 )
+		return NULL;
+
+	if ( mdb_cursor_get( mci, &key, NULL, MDB_LAST ))
+		return NULL;
+	memcpy( &last, key.mv_data, sizeof(ID) );
+	if ( last > MDB_IDL_LAST( candidates ))
+		last = MDB_IDL_LAST( candidates );
+	if ( last < MDB_IDL_FIRST( candidates ) ||
+		last - MDB_IDL_FIRST( candidates ) < PSCAN_MIN )
+		return NULL;
+
+	ps = ch_calloc( 1, sizeof( pscan_ctx ) +
+		2 * ntasks * sizeof( pscan_slot ) + ntasks * sizeof( pscan_task ));
+	ps->ps_op = op;
+	ps->ps_cands = candidates;
+	ps->ps_first = MDB_IDL_FIRST( candidates );
+	ps->ps_last = last;
+	ps->ps_base = base;
+	ps->ps_aw = aw;
+	ps->ps_trace = mt;
+	ps->ps_nchunks = ( last - ps->ps_first ) / PSCAN_CHUNK + 1;
+	ps->ps_nslots = 2 * ntasks;
+	ps->ps_slots = (pscan_slot *)( ps + 1 );
+	for ( i = 0; i < ps->ps_nslots; i++ )
+		ps->ps_slots[i].ps_chunk = PSCAN_NONE;
+	ps->ps_tasks = (pscan_task *)( ps->ps_slots + ps->ps_nslots );
+	ldap_pvt_thread_mutex_init( &ps->ps_mutex );
+	ldap_pvt_thread_cond_init( &ps->ps_cond );
+
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	for ( i = 0; i < ntasks; i++ ) {
+		pscan_task *pt = &ps->ps_tasks[i];
+		pt->pt_ps = ps;
+		if ( ldap_pvt_thread_pool_submit2( &connection_pool,
+			pscan_task_run, pt, &pt->pt_cookie ))
+			break;
+		ps->ps_running++;
+	}
+	ps->ps_ntasks = i;
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+
+	Debug( LDAP_DEBUG_TRACE, LDAP_XSTRING(mdb_search)
+		": scanning %u chunks with %d tasks\n",
+		ps->ps_nchunks, ps->ps_ntasks );
+	return ps;
+}
+
+/* Return the next ID the search must look at, in ID order. Sets
+ * matched if it passed the filter in the search's own snapshot.
+ */
+static ID
+pscan_next( pscan_ctx *ps, Operation *op, MDB_txn *txn, MDB_cursor *mci,
+	int *matched )
+{
+	pscan_slot *slot = &ps->ps_slots[ps->ps_cur % ps->ps_nslots];
+	MDB_cursor *mcd;
+	ID id;
+
+	if ( ps->ps_ready && ps->ps_pos < slot->ps_n ) {
+		*matched = slot->ps_match[ps->ps_pos] &&
+			slot->ps_txnid == mdb_txn_id( txn );
+		return slot->ps_ids[ps->ps_pos++];
+	}
+
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	for (;;) {
+		if ( ps->ps_cur >= ps->ps_nchunks ) {
+			id = NOID;
+			break;
+		}
+		slot = &ps->ps_slots[ps->ps_cur % ps->ps_nslots];
+		if ( slot->ps_chunk == ps->ps_cur ) {
+			if ( !ps->ps_ready ) {
+				ps->ps_ready = 1;
+				if ( ps->ps_trace )
+					ps->ps_trace->mt_scanned += slot->ps_scanned;
+			}
+			if ( ps->ps_pos < slot->ps_n ) {
+				*matched = slot->ps_match[ps->ps_pos] &&
+					slot->ps_txnid == mdb_txn_id( txn );
+				id = slot->ps_ids[ps->ps_pos++];
+				break;
+			}
+			/* done with it, hand the slot back */
+			slot->ps_chunk = PSCAN_NONE;
+			ps->ps_cur++;
+			ps->ps_pos = 0;
+			ps->ps_ready = 0;
+			ldap_pvt_thread_cond_broadcast( &ps->ps_cond );
+		} else if ( ps->ps_claim == ps->ps_cur ) {
+			/* no task has got to it, do it here */
+			unsigned c = ps->ps_claim++;
+			ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+			mcd = NULL;
+			pscan_chunk( op, txn, mci, &mcd, ps->ps_aw, ps, c, slot );
+			if ( mcd )
+				mdb_cursor_close( mcd );
+			ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+			slot->ps_chunk = c;
+		} else {
+			ldap_pvt_thread_cond_wait( &ps->ps_cond, &ps->ps_mutex );
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+	return id;
+}
+
+/* Stop the tasks and wait for them before freeing the scan */
+static void
+pscan_end( pscan_ctx *ps )
+{
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &ps->ps_mutex );
+	ps->ps_stop = 1;
+	ldap_pvt_thread_cond_broadcast( &ps->ps_cond );
+	/* tasks still queued will never get to run if the pool is
+	 * busy or pausing, take them back rather than wait for them
+	 */
+	for ( i = 0; i < ps->ps_ntasks; i++ ) {
+		if ( !ps->ps_tasks[i].pt_started &&
+			ldap_pvt_thread_pool_retract( ps->ps_tasks[i].pt_cookie ) > 0 )
+			ps->ps_running--;
+	}
+	while ( ps->ps_running )
+		ldap_pvt_thread_cond_wait( &ps->ps_cond, &ps->ps_mutex );
+	ldap_pvt_thread_mutex_unlock( &ps->ps_mutex );
+
+	ldap_pvt_thread_cond_destroy( &ps->ps_cond );
+	ldap_pvt_thread_mutex_destroy( &ps->ps_mutex );
+	ch_free( ps );
+}
+
+int
+mdb_explain_parse(
+	Operation *op,
+	SlapReply *rs,
+	LDAPControl *ctrl )
+{
+	if ( op->o_ctrlflag[mdb_explain_cid] != SLAP_CONTROL_NONE ) {
+		rs->sr_text = "explain control specified multiple times";
+		return LDAP_PROTOCOL_ERROR;
+	}
+
+	if ( !BER_BVISNULL( &ctrl->ldctl_value )) {
+		rs->sr_text = "explain control value not absent";
+		return LDAP_PROTOCOL_ERROR;
+	}
+
+	op->o_ctrlflag[mdb_explain_cid] = ctrl->ldctl_iscritical
+		? SLAP_CONTROL_CRITICAL
+		: SLAP_CONTROL_NONCRITICAL;
+
+	return LDAP_SUCCESS;
+}
+
+/* Return the microseconds since *tv, and restart it from now */
+static long
+mdb_trace_lap( struct timeval *tv )
+{
+	struct timeval now;
+	long usec;
+
+	gettimeofday( &now, NULL );
+	usec = ( now.tv_sec - tv->tv_sec ) * 1000000L +
+		now.tv_usec - tv->tv_usec;
+	*tv = now;
+	return usec;
+}
+
+/* ber_int_t is only 32 bits, saturate rather than wrap */
+#define	TRACE_MAX	0x7fffffffL
+#define	TRACE_INT(id)	( (id) == NOID ? -1 : \
+	(id) > TRACE_MAX ? (ber_int_t)TRACE_MAX : (ber_int_t)(id) )
+#define	TRACE_USEC(us)	( (us) < 0 ? 0 : \
+	(us) > TRACE_MAX ? (ber_int_t)TRACE_MAX : (ber_int_t)(us) )
+
+/* Attach the trace to the search result:
+ *
+ *	SEQUENCE {
+ *		plan		OCTET STRING,
+ *		candidates	INTEGER,
+ *		scanned		INTEGER,
+ *		returned	INTEGER,
+ *		candidateTime	INTEGER,	-- microseconds
+ *		scanTime	INTEGER,	-- microseconds
+ *		components	SEQUENCE OF SEQUENCE {
+ *			depth		INTEGER,
+ *			filter		OCTET STRING,
+ *			estimate	INTEGER,	-- -1 if none
+ *			size		INTEGER }	-- -1 if skipped
+ *	}
+ */
+static int
+mdb_explain_response( Operation *op, SlapReply *rs )
+{
+	mdb_trace *mt = op->o_callback->sc_private;
+	BerElementBuffer berbuf;
+	BerElement *ber = (BerElement *)&berbuf;
+	struct berval ctrlval;
+	LDAPControl *ctrl, *ctrlsp[2];
+	int i;
+
+	if ( rs->sr_type != REP_RESULT )
+		return SLAP_CB_CONTINUE;
+
+	if ( mt->mt_plan )
+		mt->mt_scan_usec = mdb_trace_lap( &mt->mt_start );
+
+	ber_init2( ber, NULL, LBER_USE_DER );
+	ber_printf( ber, "{siiiii{", mt->mt_plan ? mt->mt_plan : "none",
+		TRACE_INT( mt->mt_candidates ), TRACE_INT( mt->mt_scanned ),
+		rs->sr_nentries, TRACE_USEC( mt->mt_cand_usec ),
+		TRACE_USEC( mt->mt_scan_usec ));
+	for ( i = 0; i < mt->mt_ncomp; i++ ) {
+		mdb_trace_comp *tc = &mt->mt_comps[i];
+		ber_printf( ber, "{iOii}", tc->tc_depth, &tc->tc_filter,
+			TRACE_INT( tc->tc_est ), TRACE_INT( tc->tc_size ));
+	}
+	if ( ber_printf( ber, "}}" ) == -1 ||
+		ber_flatten2( ber, &ctrlval, 0 ) == -1 ) {
+		ber_free_buf( ber );
+		return SLAP_CB_CONTINUE;
+	}
+
+	ctrl = op->o_tmpcalloc( 1,
+		sizeof( LDAPControl ) + ctrlval.bv_len + 1,
+		op->o_tmpmemctx );
+	ctrl->ldctl_value.bv_val = (char *)&ctrl[ 1 ];
+	ctrl->ldctl_oid = LDAP_CONTROL_X_SEARCH_EXPLAIN;
+	ctrl->ldctl_iscritical = 0;
+	ctrl->ldctl_value.bv_len = ctrlval.bv_len;
+	AC_MEMCPY( ctrl->ldctl_value.bv_val, ctrlval.bv_val, ctrlval.bv_len );
+	ctrl->ldctl_value.bv_val[ ctrl->ldctl_value.bv_len ] = '\0';
+
+	ber_free_buf( ber );
+
+	ctrlsp[0] = ctrl;
+	ctrlsp[1] = NULL;
+	slap_add_ctrls( op, rs, ctrlsp );
+
+	return SLAP_CB_CONTINUE;
+}
+
 int
 mdb_search( Operation *op, SlapReply *rs )
 {
@@ -436,6 +1076,14 @@ mdb_search( Operation *op, SlapReply *rs )
 	MDB_cursor	*mci, *mcd;
 	ww_ctx wwctx;
 	slap_callback cb = { 0 };
+	mdb_trace	trace, *mt = NULL;
+	slap_callback xcb = { 0 };
+	pscan_ctx	*ps = NULL;
+	int		psmatch = 0;
+	mdb_prefetch	*pf = NULL;
+	mdb_ordwalk	*ow = NULL;
+	mdb_attrwant	aw, *awp = NULL;
+	mdb_ecache	*ec;
 
 	mdb_op_info	opinfo = {{{0}}}, *moi = &opinfo;
 	MDB_txn			*ltid = NULL;
@@ -455,6 +1103,7 @@ mdb_search( Operation *op, SlapReply *rs )
 	}
 
 	ltid = moi->moi_txn;
+	ec = mdb_opinfo_ecache( op, mdb, ltid );
 
 	rs->sr_err = mdb_cursor_open( ltid, mdb->mi_id2entry, &mci );
 	if ( rs->sr_err ) {
@@ -478,6 +1127,25 @@ mdb_search( Operation *op, SlapReply *rs )
 		candidates = ch_malloc(( MDB_idl_um_size + MDB_idl_db_size ) * sizeof ( ID ));
 		iscopes = candidates + MDB_idl_um_size;
 	}
+
+	/* before we add our own callbacks */
+	if ( search_attrwant( op, &aw ))
+		awp = &aw;
+
+	/* nested internal searches don't get a trace of their own */
+	if ( op->o_ctrlflag[mdb_explain_cid] &&
+		op->o_controls[mdb_explain_cid] == NULL ) {
+		memset( &trace, 0, sizeof( trace ));
+		trace.mt_est = NOID;
+		gettimeofday( &trace.mt_start, NULL );
+		mt = &trace;
+		op->o_controls[mdb_explain_cid] = mt;
+
+		xcb.sc_response = mdb_explain_response;
+		xcb.sc_private = mt;
+		xcb.sc_next = op->o_callback;
+		op->o_callback = &xcb;
+	}
 	isc.mt = ltid;
 	isc.mc = mcd;
 	isc.scopes = scopes;
@@ -596,6 +1264,28 @@ dn2entry_retry:
 		goto done;
 	}
 
+	/* The trace counts candidates for every filter term, including
+	 * attributes the requester may not read.
+	 */
+	if ( mt && !be_isroot( op ) &&
+		!access_allowed( op, e, slap_schema.si_ad_entry, NULL,
+			ACL_MANAGE, NULL ) )
+	{
+		slap_callback **scp;
+
+		for ( scp = &op->o_callback; *scp; scp = &(*scp)->sc_next ) {
+			if ( *scp == &xcb ) {
+				*scp = xcb.sc_next;
+				break;
+			}
+		}
+		rs->sr_err = LDAP_INSUFFICIENT_ACCESS;
+		rs->sr_text = "explain control requires manage access";
+		mdb_entry_return( op,e);
+		send_ldap_result( op, rs );
+		goto done;
+	}
+
 	if ( !manageDSAit && is_entry_referral( e ) ) {
 		/* entry is a referral */
 		struct berval matched_dn = BER_BVNULL;
@@ -693,6 +1383,17 @@ dn2entry_retry:
 		}
 	}
 
+	if ( mt ) {
+		mt->mt_cand_usec = mdb_trace_lap( &mt->mt_start );
+		mt->mt_candidates = ncand;
+		if ( op->ors_scope == LDAP_SCOPE_BASE )
+			mt->mt_plan = "base";
+		else if ( MDB_IDL_IS_RANGE( candidates ))
+			mt->mt_plan = "range";
+		else
+			mt->mt_plan = "index";
+	}
+
 	/* start cursor at beginning of candidates.
 	 */
 	cursor = 0;
@@ -762,12 +1463,53 @@ adminlimit:
 		}
 		if ( id == (ID)ps->ps_cookie )
 			id = mdb_idl_next( candidates, &cursor );
+		if ( id != NOID )
+			pf = mdb_prefetch_start( op, candidates, cursor );
 		nsubs = ncand;	/* always bypass scope'd search */
 		goto loop_begin;
 	}
+	/* Return the entries in the order of a sort the caller asked
+	 * for by walking an ordered index. The scope is checked per
+	 * candidate.
+	 */
+	if ( op->ors_scope != LDAP_SCOPE_BASE &&
+		( ow = mdb_ordwalk_start( op, mci, candidates,
+			nsubs < ncand ? nsubs : ncand )))
+	{
+		if ( mt )
+			mt->mt_plan = "ordered";
+		nsubs = ncand;
+		/* the sort key must be decoded */
+		if ( awp ) {
+			op->o_tmpfree( aw.aw_want, op->o_tmpmemctx );
+			awp = NULL;
+		}
+	}
+	/* Split a large range among pool threads if the scope covers
+	 * most of it. Only if we have our own snapshot, the tasks can't
+	 * see changes in an enclosing write txn. A plain (objectClass=*)
+	 * would just be tested twice.
+	 */
+	if ( !ow && mdb->mi_search_threads && moi == &opinfo &&
+		op->o_threadctx && !( slapMode & SLAP_TOOL_MODE ) &&
+		( MDB_IDL_IS_RANGE( candidates ) ||
+		MDB_IDL_IS_RUNS( candidates )) &&
+		ncand >= PSCAN_MIN && nsubs >= ncand / 2 &&
+		( op->ors_filter->f_choice != LDAP_FILTER_PRESENT ||
+		op->ors_filter->f_desc != slap_schema.si_ad_objectClass ))
+	{
+		ps = pscan_start( op, mci, candidates, base->e_id, awp, mt );
+		if ( ps ) {
+			if ( mt )
+				mt->mt_plan = "parallel";
+			nsubs = ncand;	/* check scope per candidate */
+		}
+	}
 	if ( nsubs < ncand ) {
 		int rc;
 		/* Do scope-based search */
+		if ( mt )
+			mt->mt_plan = "scope";
 
 		/* if any alias scopes were set, save them */
 		if (scopes[0].mid > 1) {
@@ -792,8 +1534,14 @@ adminlimit:
 		else
 			id = isc.id;
 		cscope = 0;
+	} else if ( ow ) {
+		id = mdb_ordwalk_next( ow );
+	} else if ( ps ) {
+		id = pscan_next( ps, op, ltid, mci, &psmatch );
 	} else {
 		id = mdb_idl_first( candidates, &cursor );
+		if ( id != NOID )
+			pf = mdb_prefetch_start( op, candidates, cursor );
 	}
 
 	while (id != NOID)
@@ -802,6 +1550,8 @@ adminlimit:
 		MDB_val edata;
 
 loop_begin:
+		if ( pf )
+			mdb_prefetch_pos( pf, id );
 
 		/* check for abandon */
 		if ( op->o_abandon ) {
@@ -810,6 +1560,14 @@ loop_begin:
 			goto done;
 		}
 
+		/* our snapshot is pinning too many freed pages */
+		if ( mdb->mi_rdstale && mdb_rdwatch_expired( op, mdb, ltid )) {
+			rs->sr_err = LDAP_ADMINLIMIT_EXCEEDED;
+			rs->sr_text = "read transaction exceeded maximum age";
+			send_ldap_result( op, rs );
+			goto done;
+		}
+
 		/* mostly needed by internal searches,
 		 * e.g. related to syncrepl, for whom
 		 * abandon does not get set... */
@@ -839,6 +1597,11 @@ loop_begin:
 				if ( id >= MDB_IDL_RANGE_FIRST( candidates ) &&
 					id <= MDB_IDL_RANGE_LAST( candidates ))
 					scopeok = 1;
+			} else if (MDB_IDL_IS_RUNS( candidates )) {
+				i = mdb_idl_runs_search( candidates, id );
+				if ( i < MDB_IDL_RUNS_N( candidates ) &&
+					id >= MDB_IDL_RUN_LO( candidates, i ))
+					scopeok = 1;
 			} else {
 				i = mdb_idl_search( candidates, id );
 				if (i <= candidates[0] && candidates[i] == id )
@@ -898,13 +1661,14 @@ loop_begin:
 scopeok:
 		if ( id == base->e_id ) {
 			e = base;
-		} else {
-
-			/* get the entry */
+		} else if ( !ec || mdb_ecache_get( op, ec, ltid, id, &e )) {
+			/* get the entry. Scans don't add it to the cache,
+			 * only direct lookups do.
+			 */
 			rs->sr_err = mdb_id2edata( op, mci, id, &edata );
 			if ( rs->sr_err == MDB_NOTFOUND ) {
 notfound:
-				if( nsubs < ncand )
+				if( nsubs < ncand || ps || ow )
 					goto loop_continue;
 
 				if( !MDB_IDL_IS_RANGE(candidates) ) {
@@ -936,7 +1700,7 @@ notfound:
 				goto done;
 			}
 
-			rs->sr_err = mdb_entry_decode( op, ltid, &edata, id, &e );
+			rs->sr_err = mdb_entry_partial( op, ltid, &edata, id, awp, &e );
 			if ( rs->sr_err ) {
 				rs->sr_err = LDAP_OTHER;
 				rs->sr_text = "internal error in mdb_entry_decode";
@@ -948,6 +1712,14 @@ notfound:
 			e->e_nname.bv_val = NULL;
 		}
 
+		/* not yet, or not at all, in sort order */
+		if ( ow && !mdb_ordwalk_check( ow, e ))
+			goto loop_continue;
+
+		/* a parallel scan counts the entries its tasks tested */
+		if ( mt && !ps )
+			mt->mt_scanned++;
+
 		if ( is_entry_subentry( e ) ) {
 			if( op->oq_search.rs_scope != LDAP_SCOPE_BASE ) {
 				if(!get_subentries_visibility( op )) {
@@ -1073,7 +1845,10 @@ notfound:
 		}
 
 		/* if it matches the filter and scope, send it */
-		rs->sr_err = test_filter( op, e, op->oq_search.rs_filter );
+		if ( psmatch )
+			rs->sr_err = LDAP_COMPARE_TRUE;	/* a scan task tested it */
+		else
+			rs->sr_err = test_filter( op, e, op->oq_search.rs_filter );
 
 		if ( rs->sr_err == LDAP_COMPARE_TRUE ) {
 			/* check size limit */
@@ -1146,6 +1921,8 @@ loop_continue:
 		}
 		if ( wwctx.flag ) {
 			rs->sr_err = mdb_waitfixup( op, &wwctx, mci, mcd, &isc );
+			if ( !rs->sr_err && ow )
+				rs->sr_err = mdb_ordwalk_renew( ow, ltid ) ? LDAP_OTHER : 0;
 			if ( rs->sr_err ) {
 				send_ldap_result( op, rs );
 				goto done;
@@ -1187,6 +1964,10 @@ loop_continue:
 				}
 			} else
 				id = isc.id;
+		} else if ( ow ) {
+			id = mdb_ordwalk_next( ow );
+		} else if ( ps ) {
+			id = pscan_next( ps, op, ltid, mci, &psmatch );
 		} else {
 			id = mdb_idl_next( candidates, &cursor );
 		}
@@ -1206,6 +1987,12 @@ nochange:
 	rs->sr_err = LDAP_SUCCESS;
 
 done:
+	if ( ow )
+		mdb_ordwalk_end( ow );
+	if ( ps )
+		pscan_end( ps );
+	if ( pf )
+		mdb_prefetch_end( pf );
 	if ( cb.sc_private ) {
 		/* remove our writewait callback */
 		slap_callback **scp = &op->o_callback;
@@ -1217,6 +2004,22 @@ done:
 			}
 		}
 	}
+	if ( mt ) {
+		/* remove our explain callback */
+		slap_callback **scp;
+		int i;
+
+		for ( scp = &op->o_callback; *scp; scp = &(*scp)->sc_next ) {
+			if ( *scp == &xcb ) {
+				*scp = xcb.sc_next;
+				break;
+			}
+		}
+		for ( i = 0; i < mt->mt_ncomp; i++ )
+			op->o_tmpfree( mt->mt_comps[i].tc_filter.bv_val, op->o_tmpmemctx );
+		op->o_tmpfree( mt->mt_comps, op->o_tmpmemctx );
+		op->o_controls[mdb_explain_cid] = NULL;
+	}
 	mdb_cursor_close( mcd );
 	mdb_cursor_close( mci );
 	if ( moi == &opinfo ) {
@@ -1229,6 +2032,8 @@ done:
 		ber_bvarray_free( rs->sr_v2ref );
 		rs->sr_v2ref = NULL;
 	}
+	if ( awp )
+		op->o_tmpfree( aw.aw_want, op->o_tmpmemctx );
 	if (base)
 		mdb_entry_return( op, base );
 	scope_chunk_ret( op, scopes );
@@ -98,6 +98,9 @@ static int	mdb_writes, mdb_writes_per_commit;
 static int
 mdb_tool_entry_get_int( BackendDB *be, ID id, Entry **ep );
 
+static int mdb_tool_bulk_flush( BackendDB *be );
+static int mdb_tool_bulk_done;
+
 int mdb_tool_entry_open(
 	BackendDB *be, int mode )
 {
@@ -217,6 +220,9 @@ int mdb_tool_entry_close(
 		}
 		mdb_tool_txn = NULL;
 	}
+	if ( mdb_tool_bulk_flush( be ))
+		return -1;
+	mdb_tool_bulk_done = 0;
 	if( txi ) {
 		int rc;
 		if (( rc = mdb_txn_commit( txi ))) {
@@ -642,6 +648,233 @@ mdb_tool_index_finish()
 	return rc;
 }
 
+/* Bulk loading: when slapadd -q fills an empty database, the index
+ * keys of the entries are collected instead of being inserted into
+ * the index DBs one entry at a time, which writes all over the
+ * B-trees. The keys of each index are sorted and spilled to a
+ * temporary file as a sorted run whenever the collected keys take
+ * more than MDB_TOOL_SORTMEM. When the load ends the runs of each
+ * index are merged, and every slot is appended to its DB in key
+ * order, so each page is written once.
+ *
+ * Keys collected since the last commit are dropped if the txn
+ * is aborted. Runs are only spilled right after a commit.
+ *
+ * slapadd's parser threads don't get this far: the keys are computed
+ * here, by the thread adding the entries, which assigns their IDs.
+ * Handing each entry's indexes to other threads, as the IDL cache
+ * does, costs more in hand-offs than the key generation it spreads.
+ */
+#ifndef MDB_TOOL_SORTMEM
+#define MDB_TOOL_SORTMEM	(256*1024*1024)
+#endif
+
+/* IDs appended to the index DBs per commit */
+#define MDB_TOOL_BULK_IDS	(1024*1024)
+
+static mdb_keysort *mdb_tool_bulks;
+
+/* Collect keys from the indexer, mc is the index's AttrInfo */
+int mdb_tool_bulk_add(
+	BackendDB *be,
+	MDB_cursor *mc,
+	struct berval *keys,
+	ID id,
+	mdb_idxstats *st )
+{
+	AttrInfo *ai = (AttrInfo *)mc;
+
+	return mdb_keysort_add( &mdb_tool_bulks[ai->ai_idx], keys, id );
+}
+
+/* Called when the tool txn has ended. Keys of an aborted txn are
+ * dropped, once committed they may be spilled.
+ */
+static int
+mdb_tool_bulk_mark( struct mdb_info *mdb, int committed )
+{
+	size_t total = 0;
+	int i, rc = 0;
+
+	if ( !mdb_tool_bulks )
+		return 0;
+	for ( i=0; i<mdb->mi_nattrs; i++ ) {
+		mdb_keysort *ks = &mdb_tool_bulks[i];
+		if ( !committed )
+			ks->ks_used = ks->ks_mark;
+		total += ks->ks_used;
+	}
+	for ( i=0; i<mdb->mi_nattrs; i++ ) {
+		mdb_keysort *ks = &mdb_tool_bulks[i];
+		if ( total > MDB_TOOL_SORTMEM && !rc ) {
+			rc = mdb_keysort_spill( ks );
+			if ( rc )
+				Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_tool_bulk_mark)
+					": spilling %s keys failed: %s (%d)\n",
+					mdb->mi_attrs[i]->ai_desc->ad_cname.bv_val,
+					mdb_strerror( rc ), rc );
+		}
+		ks->ks_mark = ks->ks_used;
+	}
+	return rc;
+}
+
+/* Collect the keys of an empty database being loaded in quick mode */
+static void
+mdb_tool_bulk_start( struct mdb_info *mdb, MDB_txn *txn )
+{
+	MDB_stat st;
+	int i;
+
+	if ( mdb_tool_bulks || mdb_tool_bulk_done )
+		return;
+	mdb_tool_bulk_done = 1;
+	if (( slapMode & (SLAP_TOOL_QUICK|SLAP_TOOL_READONLY)) != SLAP_TOOL_QUICK ||
+		!mdb->mi_nattrs )
+		return;
+#ifdef MDB_TOOL_IDL_CACHING
+	/* the index threads have their own IDL caches */
+	if ( mdb_tool_threads > 1 )
+		return;
+#endif
+	if ( mdb_stat( txn, mdb->mi_id2entry, &st ) || st.ms_entries )
+		return;
+
+	mdb_tool_bulks = ch_calloc( mdb->mi_nattrs, sizeof( mdb_keysort ));
+	for ( i=0; i<mdb->mi_nattrs; i++ )
+		mdb->mi_attrs[i]->ai_idx = i;
+	mdb->mi_flags |= MDB_BULK_LOAD;
+}
+
+typedef struct bulk_merge {
+	struct mdb_info *bm_mdb;
+	AttrInfo *bm_ai;
+	MDB_txn *bm_txn;
+	MDB_cursor *bm_mc;
+	size_t bm_puts;
+} bulk_merge;
+
+/* Append one slot. Slots that don't fit in a list are stored as
+ * a range unless idlruns is set, like mdb_idl_insert_keys does.
+ */
+static int
+mdb_tool_bulk_put( void *arg, MDB_val *key, ID *ids, size_t n, ID last )
+{
+	bulk_merge *bm = arg;
+	mdb_idxstats *st = &bm->bm_ai->ai_stats;
+	MDB_val data[2];
+	ID range[3];
+	size_t puts = n;
+	int rc;
+
+	if ( !bm->bm_txn ) {
+		rc = mdb_txn_begin( bm->bm_mdb->mi_dbenv, NULL, 0, &bm->bm_txn );
+		if ( rc )
+			return rc;
+		rc = mdb_cursor_open( bm->bm_txn, bm->bm_ai->ai_dbi, &bm->bm_mc );
+		if ( rc )
+			return rc;
+	}
+
+	data[0].mv_size = sizeof(ID);
+	if ( n > MDB_idl_db_max && !bm->bm_mdb->mi_idl_runs ) {
+		range[0] = 0;
+		range[1] = ids[0];
+		range[2] = last;
+		data[0].mv_data = range;
+		data[1].mv_size = 3;
+		st->is_ranges++;
+	} else {
+		data[0].mv_data = ids;
+		data[1].mv_size = n;
+		st->is_ids += n;
+	}
+	st->is_keys++;
+	n = data[1].mv_size;
+	data[1].mv_size = 1;
+	rc = mdb_cursor_put( bm->bm_mc, key, data, MDB_APPEND );
+	if ( rc == 0 && n > 1 ) {
+		data[0].mv_data = (ID *)data[0].mv_data + 1;
+		data[1].mv_size = n - 1;
+		rc = mdb_cursor_put( bm->bm_mc, key, data, MDB_APPENDDUP|MDB_MULTIPLE );
+	}
+	if ( rc )
+		return rc;
+
+	bm->bm_puts += puts;
+	if ( bm->bm_puts >= MDB_TOOL_BULK_IDS ) {
+		rc = mdb_txn_commit( bm->bm_txn );
+		bm->bm_txn = NULL;
+		bm->bm_puts = 0;
+	}
+	return rc;
+}
+
+/* Merge the runs of one index into its DB */
+static int
+mdb_tool_bulk_merge( BackendDB *be, AttrInfo *ai, mdb_keysort *ks )
+{
+	bulk_merge bm = {0};
+	int rc;
+
+	bm.bm_mdb = (struct mdb_info *) be->be_private;
+	bm.bm_ai = ai;
+	rc = mdb_keysort_merge( &ks, 1,
+		bm.bm_mdb->mi_idl_runs ? 0 : MDB_idl_db_max + 1,
+		mdb_tool_bulk_put, &bm );
+	if ( bm.bm_txn ) {
+		if ( rc )
+			mdb_txn_abort( bm.bm_txn );
+		else
+			rc = mdb_txn_commit( bm.bm_txn );
+	}
+	return rc;
+}
+
+/* Write the collected keys to the index DBs, and stop collecting */
+static int
+mdb_tool_bulk_flush( BackendDB *be )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	int i, rc = 0;
+
+	if ( !mdb_tool_bulks )
+		return 0;
+	mdb->mi_flags &= ~MDB_BULK_LOAD;
+
+	if ( mdb_tool_txn ) {
+		rc = mdb_txn_commit( mdb_tool_txn );
+		mdb_tool_txn = NULL;
+		idcursor = NULL;
+		for ( i=0; i<mdb->mi_nattrs; i++ )
+			mdb->mi_attrs[i]->ai_cursor = NULL;
+		mdb_writes = 0;
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_tool_bulk_flush)
+				": txn_commit failed: %s (%d)\n",
+				mdb_strerror(rc), rc );
+		}
+	}
+
+	for ( i=0; i<mdb->mi_nattrs; i++ ) {
+		mdb_keysort *ks = &mdb_tool_bulks[i];
+		if ( !rc ) {
+			rc = mdb_tool_bulk_merge( be, mdb->mi_attrs[i], ks );
+			if ( rc ) {
+				Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_tool_bulk_flush)
+					": writing %s index failed: %s (%d)\n",
+					mdb->mi_attrs[i]->ai_desc->ad_cname.bv_val,
+					rc == -1 ? "cannot read sorted keys" :
+					mdb_strerror(rc), rc );
+			}
+		}
+		mdb_keysort_clear( ks );
+	}
+	ch_free( mdb_tool_bulks );
+	mdb_tool_bulks = NULL;
+	return rc;
+}
+
 ID mdb_tool_entry_put(
 	BackendDB *be,
 	Entry *e,
@@ -689,6 +922,7 @@ ID mdb_tool_entry_put(
 			ID dummy;
 			mdb_next_id( be, idcursor, &dummy );
 		}
+		mdb_tool_bulk_start( mdb, mdb_tool_txn );
 		rc = mdb_cursor_open( mdb_tool_txn, mdb->mi_dn2id, &mcp );
 		if( rc != 0 ) {
 			snprintf( text->bv_val, text->bv_len,
@@ -763,6 +997,7 @@ done:
 			mdb_tool_txn = NULL;
 			idcursor = NULL;
 			if( rc != 0 ) {
+				mdb_tool_bulk_mark( mdb, 0 );
 				mdb->mi_numads = 0;
 				snprintf( text->bv_val, text->bv_len,
 						"txn_commit failed: %s (%d)",
@@ -771,6 +1006,11 @@ done:
 					"=> " LDAP_XSTRING(mdb_tool_entry_put) ": %s\n",
 					text->bv_val );
 				e->e_id = NOID;
+			} else if (( rc = mdb_tool_bulk_mark( mdb, 1 ))) {
+				snprintf( text->bv_val, text->bv_len,
+						"spilling sorted index keys failed: %s (%d)",
+						mdb_strerror(rc), rc );
+				e->e_id = NOID;
 			}
 		}
 
@@ -779,6 +1019,7 @@ done:
 		mdb_txn_abort( mdb_tool_txn );
 		mdb_tool_txn = NULL;
 		idcursor = NULL;
+		mdb_tool_bulk_mark( mdb, 0 );
 		for ( i=0; i<mdb->mi_nattrs; i++ )
 			mdb->mi_attrs[i]->ai_cursor = NULL;
 		mdb_writes = 0;
@@ -902,6 +1143,17 @@ int mdb_tool_entry_reindex(
 					mdb_strerror(rc), rc );
 				return -1;
 			}
+			if ( mi->mi_attrs[i]->ai_odbi ) {
+				rc = mdb_drop( txi, mi->mi_attrs[i]->ai_odbi, 0 );
+				if ( rc ) {
+					Debug( LDAP_DEBUG_ANY,
+						LDAP_XSTRING(mdb_tool_entry_reindex)
+						": (Truncate) mdb_drop(%s;ordered) failed: %s (%d)\n",
+						mi->mi_attrs[i]->ai_desc->ad_cname.bv_val,
+						mdb_strerror(rc), rc );
+					return -1;
+				}
+			}
 		}
 		slapMode ^= SLAP_TRUNCATE_MODE;
 	}
@@ -1001,6 +1253,11 @@ ID mdb_tool_entry_modify(
 		mdb_cursor_close( cursor );
 		cursor = NULL;
 	}
+	if ( mdb_tool_bulk_flush( be )) {
+		snprintf( text->bv_val, text->bv_len,
+			"writing sorted index keys failed" );
+		return NOID;
+	}
 	if ( !mdb_tool_txn ) {
 		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &mdb_tool_txn );
 		if( rc != 0 ) {
@@ -1091,6 +1348,11 @@ int mdb_tool_entry_delete(
 		mdb_cursor_close( cursor );
 		cursor = NULL;
 	}
+	if ( mdb_tool_bulk_flush( be )) {
+		snprintf( text->bv_val, text->bv_len,
+			"writing sorted index keys failed" );
+		return LDAP_OTHER;
+	}
 	if( !mdb_tool_txn ) {
 		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &mdb_tool_txn );
 		if( rc != 0 ) {
@@ -1403,7 +1665,8 @@ int mdb_tool_idl_add(
 	BackendDB *be,
 	MDB_cursor *mc,
 	struct berval *keys,
-	ID id )
+	ID id,
+	mdb_idxstats *st )
 {
 	MDB_dbi dbi;
 	mdb_tool_idl_cache *ic, itmp;
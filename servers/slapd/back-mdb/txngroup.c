@@ -0,0 +1,317 @@
+/* txngroup.c - ldap mdb back-end group commit */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+#include <ac/socket.h>
+#include <ac/time.h>
+
+#include "back-mdb.h"
+
+/* Write operations arriving close together share one write txn, so
+ * they pay for one sync between them instead of one each.
+ *
+ * The first writer to find no group open becomes its leader: it
+ * begins the shared txn, which holds the LMDB writer lock, and later
+ * commits it from the same thread. Every member, the leader too, does
+ * its work in a nested txn of the shared one. One member at a time
+ * has a nested txn open; committing it merges the changes into the
+ * group, aborting it drops them without disturbing the others.
+ *
+ * Once its own operation is done, the leader waits up to the window
+ * for others to join, giving up early when a slice of the window
+ * passes without anyone joining. It then commits the shared txn and
+ * hands the result to every member, none of which has sent its
+ * response before the changes are on disk.
+ *
+ * LMDB wants a txn to be used by one thread only. The shared txn and
+ * its nested ones pass between threads, but are never used by two at
+ * once: a member touches the txns only while its nested txn is
+ * tg_child, and the leader commits the shared txn only once no nested
+ * txn is open. Each hand-over goes through tg_mutex. Write txns don't
+ * use thread-local storage; the one thing tied to a thread is the
+ * writer lock, which the leader's thread takes when it begins the
+ * shared txn and releases when it commits it.
+ *
+ * Other write txns, of lazyCommit ops or those opened for LDAP txns
+ * and entry_get, don't join. They hold the writer lock on their own,
+ * so tg_mutex is never held while waiting for that lock, and they end
+ * without taking tg_mutex.
+ */
+struct mdb_txnwait {
+	struct mdb_txnwait *tw_next;
+	int tw_rc;
+	int tw_done;
+};
+
+struct mdb_txngroup {
+	ldap_pvt_thread_mutex_t tg_mutex;
+	ldap_pvt_thread_cond_t tg_cond;
+	MDB_txn *tg_txn;	/* the shared txn */
+	MDB_txn *tg_child;	/* the nested txn in use */
+	MDB_txn *tg_leader;	/* the leader's nested txn */
+	struct mdb_txnwait *tg_waiters;
+	int tg_members;	/* nested txns committed into tg_txn */
+	int tg_joining;	/* writers waiting for their turn */
+	int tg_opening;	/* the leader is beginning tg_txn */
+	int tg_closing;	/* the leader is committing tg_txn */
+	int tg_numads;	/* mi_numads when tg_txn began */
+	/* totals */
+	unsigned long tg_groups;
+	unsigned long tg_ops;
+	unsigned long tg_largest;
+	unsigned long tg_failed;
+};
+
+#define MDB_TG_SLICES	4
+
+int
+mdb_txngroup_open( struct mdb_info *mdb )
+{
+	mdb_txngroup *tg;
+
+	if ( mdb->mi_txngroup || !( slapMode & SLAP_SERVER_MODE ))
+		return 0;
+
+	tg = ch_calloc( 1, sizeof( mdb_txngroup ));
+	ldap_pvt_thread_mutex_init( &tg->tg_mutex );
+	ldap_pvt_thread_cond_init( &tg->tg_cond );
+	mdb->mi_txngroup = tg;
+	return 0;
+}
+
+void
+mdb_txngroup_close( struct mdb_info *mdb )
+{
+	mdb_txngroup *tg = mdb->mi_txngroup;
+
+	if ( !tg )
+		return;
+	assert( tg->tg_txn == NULL );
+	ldap_pvt_thread_cond_destroy( &tg->tg_cond );
+	ldap_pvt_thread_mutex_destroy( &tg->tg_mutex );
+	ch_free( tg );
+	mdb->mi_txngroup = NULL;
+}
+
+/* Nonzero if write txns of this database should be grouped */
+int
+mdb_txngroup_active( struct mdb_info *mdb )
+{
+	/* LMDB can't nest txns in a writable map */
+	return mdb->mi_txngroup && mdb->mi_txng_window &&
+		!( mdb->mi_dbenv_flags & MDB_WRITEMAP );
+}
+
+/* Begin an operation's write txn, nested in the group's */
+int
+mdb_txngroup_begin( struct mdb_info *mdb, MDB_txn **txnp )
+{
+	mdb_txngroup *tg = mdb->mi_txngroup;
+	MDB_txn *txn;
+	int rc, leader = 0;
+
+	ldap_pvt_thread_mutex_lock( &tg->tg_mutex );
+	tg->tg_joining++;
+	while ( tg->tg_opening || tg->tg_closing || tg->tg_child ||
+		( tg->tg_txn && tg->tg_members >= mdb->mi_txng_max ))
+		ldap_pvt_thread_cond_wait( &tg->tg_cond, &tg->tg_mutex );
+	tg->tg_joining--;
+
+	if ( !tg->tg_txn ) {
+		/* wait for the writer lock without the mutex */
+		tg->tg_opening = 1;
+		ldap_pvt_thread_mutex_unlock( &tg->tg_mutex );
+		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+		ldap_pvt_thread_mutex_lock( &tg->tg_mutex );
+		tg->tg_opening = 0;
+		if ( rc ) {
+			ldap_pvt_thread_cond_broadcast( &tg->tg_cond );
+			ldap_pvt_thread_mutex_unlock( &tg->tg_mutex );
+			return rc;
+		}
+		tg->tg_txn = txn;
+		tg->tg_numads = mdb->mi_numads;
+		tg->tg_members = 0;
+		leader = 1;
+	}
+
+	rc = mdb_txn_begin( mdb->mi_dbenv, tg->tg_txn, 0, &txn );
+	if ( rc == 0 ) {
+		tg->tg_child = txn;
+		if ( leader )
+			tg->tg_leader = txn;
+		*txnp = txn;
+	} else if ( leader ) {
+		mdb_txn_abort( tg->tg_txn );
+		tg->tg_txn = NULL;
+		ldap_pvt_thread_cond_broadcast( &tg->tg_cond );
+	}
+	ldap_pvt_thread_mutex_unlock( &tg->tg_mutex );
+	return rc;
+}
+
+/* Wait for others to join, then commit the shared txn. Called by
+ * the leader with the mutex held.
+ */
+static int
+txngroup_finish( struct mdb_info *mdb, mdb_txngroup *tg )
+{
+	struct mdb_txnwait *tw;
+	struct timeval tv;
+	unsigned long waited = 0, slice;
+	int members, rc = 0;
+
+	slice = mdb->mi_txng_window / MDB_TG_SLICES;
+	if ( !slice )
+		slice = 1;
+	ldap_pvt_thread_cond_broadcast( &tg->tg_cond );
+	while ( waited < mdb->mi_txng_window &&
+		tg->tg_members < mdb->mi_txng_max )
+	{
+		members = tg->tg_members;
+		ldap_pvt_thread_mutex_unlock( &tg->tg_mutex );
+		tv.tv_sec = slice / 1000000;
+		tv.tv_usec = slice % 1000000;
+		select( 0, NULL, NULL, NULL, &tv );
+		ldap_pvt_thread_mutex_lock( &tg->tg_mutex );
+		waited += slice;
+		/* nobody else is writing */
+		if ( tg->tg_members == members && !tg->tg_child && !tg->tg_joining )
+			break;
+	}
+
+	tg->tg_closing = 1;
+	while ( tg->tg_child )
+		ldap_pvt_thread_cond_wait( &tg->tg_cond, &tg->tg_mutex );
+
+	if ( tg->tg_members ) {
+		ldap_pvt_thread_mutex_unlock( &tg->tg_mutex );
+		rc = mdb_txn_commit( tg->tg_txn );
+		ldap_pvt_thread_mutex_lock( &tg->tg_mutex );
+		if ( rc ) {
+			mdb->mi_numads = tg->tg_numads;
+			tg->tg_failed++;
+			Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(txngroup_finish)
+				": commit of %d operations failed: %s (%d)\n",
+				tg->tg_members, mdb_strerror( rc ), rc );
+		}
+		tg->tg_groups++;
+		tg->tg_ops += tg->tg_members;
+		if ( tg->tg_members > tg->tg_largest )
+			tg->tg_largest = tg->tg_members;
+	} else {
+		mdb_txn_abort( tg->tg_txn );
+	}
+
+	for ( tw = tg->tg_waiters; tw; tw = tw->tw_next ) {
+		tw->tw_rc = rc;
+		tw->tw_done = 1;
+	}
+	tg->tg_waiters = NULL;
+	tg->tg_txn = NULL;
+	tg->tg_leader = NULL;
+	tg->tg_members = 0;
+	tg->tg_closing = 0;
+	ldap_pvt_thread_cond_broadcast( &tg->tg_cond );
+	return rc;
+}
+
+/* End an operation's write txn. Txns that aren't the group's
+ * are committed or aborted on their own.
+ */
+static int
+txngroup_end( struct mdb_info *mdb, mdb_op_info *moi, MDB_txn *txn,
+	int commit )
+{
+	mdb_txngroup *tg = mdb->mi_txngroup;
+	struct mdb_txnwait tw;
+	int rc = 0, grc, leader;
+
+	if ( !( moi->moi_flag & MOI_GROUPED )) {
+		if ( commit )
+			return mdb_txn_commit( txn );
+		mdb_txn_abort( txn );
+		return 0;
+	}
+	moi->moi_flag &= ~MOI_GROUPED;
+
+	ldap_pvt_thread_mutex_lock( &tg->tg_mutex );
+	assert( txn == tg->tg_child );
+
+	/* the address may be reused by a later member's txn */
+	leader = txn == tg->tg_leader;
+	if ( leader )
+		tg->tg_leader = NULL;
+	if ( commit ) {
+		rc = mdb_txn_commit( txn );
+		if ( rc == 0 )
+			tg->tg_members++;
+	} else {
+		mdb_txn_abort( txn );
+	}
+	tg->tg_child = NULL;
+
+	if ( leader ) {
+		grc = txngroup_finish( mdb, tg );
+		if ( commit && rc == 0 )
+			rc = grc;
+	} else if ( commit && rc == 0 ) {
+		tw.tw_done = 0;
+		tw.tw_rc = 0;
+		tw.tw_next = tg->tg_waiters;
+		tg->tg_waiters = &tw;
+		ldap_pvt_thread_cond_broadcast( &tg->tg_cond );
+		while ( !tw.tw_done )
+			ldap_pvt_thread_cond_wait( &tg->tg_cond, &tg->tg_mutex );
+		rc = tw.tw_rc;
+	} else {
+		ldap_pvt_thread_cond_broadcast( &tg->tg_cond );
+	}
+	ldap_pvt_thread_mutex_unlock( &tg->tg_mutex );
+	return rc;
+}
+
+int
+mdb_txngroup_commit( struct mdb_info *mdb, mdb_op_info *moi, MDB_txn *txn )
+{
+	return txngroup_end( mdb, moi, txn, 1 );
+}
+
+void
+mdb_txngroup_abort( struct mdb_info *mdb, mdb_op_info *moi, MDB_txn *txn )
+{
+	txngroup_end( mdb, moi, txn, 0 );
+}
+
+/* groups=<n>#ops=<n>#largest=<n>#failed=<n> */
+int
+mdb_txngroup_stats( mdb_txngroup *tg, struct berval *bv )
+{
+	int i;
+
+	ldap_pvt_thread_mutex_lock( &tg->tg_mutex );
+	i = snprintf( bv->bv_val, bv->bv_len,
+		"groups=%lu#ops=%lu#largest=%lu#failed=%lu",
+		tg->tg_groups, tg->tg_ops, tg->tg_largest, tg->tg_failed );
+	ldap_pvt_thread_mutex_unlock( &tg->tg_mutex );
+	if ( i < 0 || i >= bv->bv_len )
+		return -1;
+	bv->bv_len = i;
+	return 0;
+}
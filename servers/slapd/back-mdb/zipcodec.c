@@ -0,0 +1,197 @@
+/* zipcodec.c - ldap mdb back-end value compression codec */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <ac/string.h>
+
+#include "zipcodec.h"
+
+/* The codec is a plain LZ77 in the LZ4 block layout: each sequence
+ * is a token, whose high nibble is the number of literals and low
+ * nibble the match length less MDB_ZIP_MINMATCH, 15 meaning that
+ * bytes of up to 255 each follow, then the literals, then the match
+ * as a 2 byte little-endian offset back into the output. The last
+ * sequence has only literals.
+ */
+
+#define MDB_ZIP_MINMATCH	4
+#define MDB_ZIP_HASHLOG	12
+#define MDB_ZIP_MAXOFF	65535
+
+#define ZIP_HASH(p)	((zip_read32(p) * 2654435761U) >> (32 - MDB_ZIP_HASHLOG))
+
+static unsigned int
+zip_read32( const unsigned char *p )
+{
+	unsigned int v;
+	memcpy( &v, p, sizeof(v) );
+	return v;
+}
+
+/* Append a length that didn't fit its nibble */
+static unsigned char *
+zip_putlen( unsigned char *op, unsigned char *oend, unsigned len )
+{
+	for ( ; len >= 255; len -= 255 ) {
+		if ( op >= oend )
+			return NULL;
+		*op++ = 255;
+	}
+	if ( op >= oend )
+		return NULL;
+	*op++ = len;
+	return op;
+}
+
+/* Compress slen bytes of src into dst. Returns the compressed size,
+ * or 0 if it wouldn't fit in dcap bytes.
+ */
+unsigned
+mdb_zip_pack( const unsigned char *src, unsigned slen,
+	unsigned char *dst, unsigned dcap )
+{
+	unsigned table[1 << MDB_ZIP_HASHLOG];
+	const unsigned char *ip = src, *anchor = src, *ref;
+	const unsigned char *iend = src + slen;
+	const unsigned char *mlimit = iend - MDB_ZIP_MINMATCH;
+	unsigned char *op = dst, *oend = dst + dcap, *token;
+	unsigned lit, mlen, misses = 0;
+
+	memset( table, 0, sizeof(table) );
+
+	while ( slen >= MDB_ZIP_MINMATCH && ip <= mlimit ) {
+		unsigned h = ZIP_HASH( ip );
+		ref = src + table[h];
+		table[h] = ip - src;
+		if ( ref >= ip || ip - ref > MDB_ZIP_MAXOFF ||
+			zip_read32( ref ) != zip_read32( ip ))
+		{
+			/* go faster through data that doesn't compress */
+			ip += 1 + ( misses++ >> 5 );
+			continue;
+		}
+		misses = 0;
+
+		for ( mlen = MDB_ZIP_MINMATCH;
+			ip + mlen < iend && ref[mlen] == ip[mlen]; mlen++ )
+			;
+
+		lit = ip - anchor;
+		if ( op + 1 + lit + 2 > oend )
+			return 0;
+		token = op++;
+		if ( lit >= 15 ) {
+			*token = 15 << 4;
+			if ( !( op = zip_putlen( op, oend, lit - 15 )) ||
+				op + lit + 2 > oend )
+				return 0;
+		} else {
+			*token = lit << 4;
+		}
+		memcpy( op, anchor, lit );
+		op += lit;
+		*op++ = ( ip - ref ) & 0xff;
+		*op++ = ( ip - ref ) >> 8;
+		if ( mlen - MDB_ZIP_MINMATCH >= 15 ) {
+			*token |= 15;
+			if ( !( op = zip_putlen( op, oend, mlen - MDB_ZIP_MINMATCH - 15 )))
+				return 0;
+		} else {
+			*token |= mlen - MDB_ZIP_MINMATCH;
+		}
+
+		ip += mlen;
+		anchor = ip;
+		/* let a repeat of what precedes the next position be found */
+		if ( ip - 2 <= mlimit )
+			table[ZIP_HASH( ip - 2 )] = ip - 2 - src;
+	}
+
+	/* the rest goes as literals */
+	lit = iend - anchor;
+	if ( op + 1 + lit > oend )
+		return 0;
+	token = op++;
+	if ( lit >= 15 ) {
+		*token = 15 << 4;
+		if ( !( op = zip_putlen( op, oend, lit - 15 )) || op + lit > oend )
+			return 0;
+	} else {
+		*token = lit << 4;
+	}
+	memcpy( op, anchor, lit );
+	op += lit;
+	return op - dst;
+}
+
+/* Expand clen bytes of src, which must come out as dlen bytes exactly.
+ * Returns 0 on success, -1 if the data is damaged.
+ */
+int
+mdb_zip_unpack( const unsigned char *src, unsigned clen,
+	unsigned char *dst, unsigned dlen )
+{
+	const unsigned char *ip = src, *iend = src + clen;
+	unsigned char *op = dst, *oend = dst + dlen;
+	const unsigned char *ref;
+	unsigned len, off, b;
+
+	while ( ip < iend ) {
+		unsigned token = *ip++;
+
+		len = token >> 4;
+		if ( len == 15 ) {
+			do {
+				if ( ip >= iend )
+					return -1;
+				b = *ip++;
+				len += b;
+			} while ( b == 255 );
+		}
+		if ( len > (unsigned)( iend - ip ) || len > (unsigned)( oend - op ))
+			return -1;
+		memcpy( op, ip, len );
+		ip += len;
+		op += len;
+		if ( ip == iend )
+			break;
+
+		if ( iend - ip < 2 )
+			return -1;
+		off = ip[0] | ( ip[1] << 8 );
+		ip += 2;
+		if ( !off || off > (unsigned)( op - dst ))
+			return -1;
+		len = token & 15;
+		if ( len == 15 ) {
+			do {
+				if ( ip >= iend )
+					return -1;
+				b = *ip++;
+				len += b;
+			} while ( b == 255 );
+		}
+		len += MDB_ZIP_MINMATCH;
+		if ( len > (unsigned)( oend - op ))
+			return -1;
+		/* may overlap what it's copying */
+		ref = op - off;
+		while ( len-- )
+			*op++ = *ref++;
+	}
+	return op == oend ? 0 : -1;
+}
@@ -0,0 +1,36 @@
+/* zipcodec.h - ldap mdb back-end value compression codec */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#ifndef _MDB_ZIPCODEC_H_
+#define _MDB_ZIPCODEC_H_
+
+/* The codec has no slapd dependencies so that it can also be linked
+ * into tests/progs/zip-test.
+ */
+
+/* Compress slen bytes of src into dst. Returns the compressed size,
+ * or 0 if it wouldn't fit in dcap bytes.
+ */
+unsigned mdb_zip_pack( const unsigned char *src, unsigned slen,
+	unsigned char *dst, unsigned dcap );
+
+/* Expand clen bytes of src, which must come out as dlen bytes exactly.
+ * Returns 0 on success, -1 if the data is damaged.
+ */
+int mdb_zip_unpack( const unsigned char *src, unsigned clen,
+	unsigned char *dst, unsigned dlen );
+
+#endif
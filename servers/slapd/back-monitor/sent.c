@@ -43,6 +43,8 @@ enum {
 	MONITOR_SENT_PDU,
 	MONITOR_SENT_ENTRIES,
 	MONITOR_SENT_REFERRALS,
+	MONITOR_SENT_GROUP_HITS,
+	MONITOR_SENT_GROUP_MISSES,
 
 	MONITOR_SENT_LAST
 };
@@ -55,6 +57,8 @@ struct monitor_sent_t {
 	{ BER_BVC("cn=PDU"),		BER_BVNULL },
 	{ BER_BVC("cn=Entries"),	BER_BVNULL },
 	{ BER_BVC("cn=Referrals"),	BER_BVNULL },
+	{ BER_BVC("cn=Group Cache Hits"),	BER_BVNULL },
+	{ BER_BVC("cn=Group Cache Misses"),	BER_BVNULL },
 	{ BER_BVNULL,			BER_BVNULL }
 };
 
@@ -184,6 +188,15 @@ monitor_subsys_sent_update(
 		return SLAP_CB_CONTINUE;
 	}
 
+	if ( i == MONITOR_SENT_GROUP_HITS || i == MONITOR_SENT_GROUP_MISSES ) {
+		unsigned long hits, misses;
+
+		slap_group_cache_counters( &hits, &misses );
+		ldap_pvt_mp_init_set( n,
+			i == MONITOR_SENT_GROUP_HITS ? hits : misses );
+		goto done;
+	}
+
 	ldap_pvt_thread_mutex_lock(&slap_counters.sc_mutex);
 	switch ( i ) {
 	case MONITOR_SENT_ENTRIES:
@@ -226,7 +239,8 @@ monitor_subsys_sent_update(
 		assert(0);
 	}
 	ldap_pvt_thread_mutex_unlock(&slap_counters.sc_mutex);
-	
+
+done:
 	a = attr_find( e->e_attrs, mi->mi_ad_monitorCounter );
 	assert( a != NULL );
 
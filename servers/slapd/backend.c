@@ -1452,7 +1452,7 @@ fe_acl_group(
 	Entry *e;
 	void *o_priv = op->o_private, *e_priv = NULL;
 	Attribute *a;
-	int rc;
+	int rc, rc2 = LDAP_SUCCESS, gcache;
 	GroupAssertion *g;
 	Backend *be = op->o_bd;
 	OpExtra		*oex;
@@ -1484,13 +1484,29 @@ fe_acl_group(
 		goto done;
 	}
 
+	/* Only static groups read from the database are shared with
+	 * other operations; a dynamic group also depends on the user
+	 * entry, and the target may be a modified copy of the group.
+	 */
+	gcache = slap_group_cache_max && op->o_tag != LDAP_REQ_BIND &&
+		!op->o_do_not_cache &&
+		!is_at_subtype( group_at->ad_type,
+			slap_schema.si_ad_labeledURI->ad_type ) &&
+		!( target && dn_match( &target->e_nname, gr_ndn ) );
+
+	if ( gcache && slap_group_cache_get( op, gr_ndn, op_ndn,
+		group_oc, group_at, &rc ) == 0 )
+	{
+		goto cache;
+	}
+
 	if ( target && dn_match( &target->e_nname, gr_ndn ) ) {
 		e = target;
 		rc = 0;
 
 	} else {
 		op->o_private = NULL;
-		rc = be_entry_get_rw( op, gr_ndn, group_oc, group_at, 0, &e );
+		rc2 = rc = be_entry_get_rw( op, gr_ndn, group_oc, group_at, 0, &e );
 		e_priv = op->o_private;
 		op->o_private = o_priv;
 	}
@@ -1644,6 +1660,16 @@ loopit:
 		rc = LDAP_NO_SUCH_OBJECT;
 	}
 
+	/* don't remember transient failures */
+	if ( gcache && ( rc2 == LDAP_SUCCESS ||
+		rc2 == LDAP_NO_SUCH_OBJECT || rc2 == LDAP_NO_SUCH_ATTRIBUTE ) &&
+		( rc == LDAP_SUCCESS || rc == LDAP_COMPARE_FALSE ||
+		rc == LDAP_NO_SUCH_ATTRIBUTE || rc == LDAP_NO_SUCH_OBJECT ) )
+	{
+		slap_group_cache_put( op, gr_ndn, op_ndn, group_oc, group_at, rc );
+	}
+
+cache:
 	if ( op->o_tag != LDAP_REQ_BIND && !op->o_do_not_cache ) {
 		g = op->o_tmpalloc( sizeof( GroupAssertion ) + gr_ndn->bv_len,
 			op->o_tmpmemctx );
@@ -60,6 +60,9 @@ static slap_overinst * glue_tool_inst( BackendInfo *bi);
 
 static slap_response glue_op_response;
 
+static int glue_sub_op( Operation *op, SlapReply *rs, BackendDB *b0,
+	slap_overinst *on, slap_operation_t which );
+
 /* Just like select_backend, but only for our backends */
 static BackendDB *
 glue_back_select (
@@ -220,6 +223,258 @@ glue_op_response ( Operation *op, SlapReply *rs )
 	return 0;
 }
 
+/* Apply the RDN changes of a modrdn to the copy of an entry that is
+ * being moved to another database.
+ */
+static int
+glue_move_mods( Operation *op, SlapReply *rs, Entry *e, char *textbuf )
+{
+	Modifications *ml;
+	short mop;
+	int rc = LDAP_SUCCESS;
+
+	for ( ml = op->orr_modlist; ml && rc == LDAP_SUCCESS; ml = ml->sml_next ) {
+		mop = ml->sml_op;
+		switch ( mop ) {
+		case LDAP_MOD_ADD:
+		case SLAP_MOD_SOFTADD:
+			ml->sml_op = LDAP_MOD_ADD;
+			rc = modify_add_values( e, &ml->sml_mod, 1,
+				&rs->sr_text, textbuf, SLAP_TEXT_BUFLEN );
+			break;
+		case LDAP_MOD_DELETE:
+		case SLAP_MOD_SOFTDEL:
+			ml->sml_op = LDAP_MOD_DELETE;
+			rc = modify_delete_values( e, &ml->sml_mod, 1,
+				&rs->sr_text, textbuf, SLAP_TEXT_BUFLEN );
+			if ( rc == LDAP_NO_SUCH_ATTRIBUTE )
+				rc = LDAP_SUCCESS;
+			break;
+		}
+		ml->sml_op = mop;
+	}
+
+	/* let the add stamp it afresh */
+	attr_delete( &e->e_attrs, slap_schema.si_ad_entryCSN );
+	attr_delete( &e->e_attrs, slap_schema.si_ad_modifiersName );
+	attr_delete( &e->e_attrs, slap_schema.si_ad_modifyTimestamp );
+	return rc;
+}
+
+static int
+glue_move_cb( Operation *op, SlapReply *rs )
+{
+	if ( rs->sr_type == REP_RESULT && rs->sr_text )
+		snprintf( op->o_callback->sc_private, SLAP_TEXT_BUFLEN,
+			"%s", rs->sr_text );
+	return 0;
+}
+
+/* Check the access a modrdn of e to nndn needs, as back-mdb does:
+ * write to the entry and its naming attributes, delete from the
+ * children of the old parent and add to the children of the new one.
+ */
+static int
+glue_move_access( Operation *op, SlapReply *rs, BackendDB *bsrc,
+	BackendDB *bdst, Entry *e, struct berval *nndn )
+{
+	Entry *p = NULL;
+	struct berval pndn;
+	int rc;
+
+	op->o_bd = bsrc;
+	if ( !access_allowed( op, e, slap_schema.si_ad_entry, NULL,
+		ACL_WRITE, NULL ) ) {
+		rs->sr_text = "no write access to old entry";
+		return LDAP_INSUFFICIENT_ACCESS;
+	}
+	if ( !acl_check_modlist( op, e, op->orr_modlist ) ) {
+		rs->sr_text = "no write access to naming attributes";
+		return LDAP_INSUFFICIENT_ACCESS;
+	}
+
+	dnParent( &op->o_req_ndn, &pndn );
+	rc = be_entry_get_rw( op, &pndn, NULL, NULL, 0, &p );
+	if ( rc != LDAP_SUCCESS ) {
+		rs->sr_text = "parent does not exist";
+		return rc;
+	}
+	rc = access_allowed( op, p, slap_schema.si_ad_children, NULL,
+		op->orr_nnewSup ? ACL_WDEL : ACL_WRITE, NULL );
+	be_entry_release_r( op, p );
+	if ( !rc ) {
+		rs->sr_text = "no write access to parent's children";
+		return LDAP_INSUFFICIENT_ACCESS;
+	}
+
+	op->o_bd = bdst;
+	dnParent( nndn, &pndn );
+	rc = be_entry_get_rw( op, &pndn, NULL, NULL, 0, &p );
+	if ( rc != LDAP_SUCCESS ) {
+		rs->sr_text = "new superior not found";
+		return rc;
+	}
+	rc = access_allowed( op, p, slap_schema.si_ad_children, NULL,
+		ACL_WADD, NULL );
+	be_entry_release_r( op, p );
+	if ( !rc ) {
+		rs->sr_text = "no write access to new superior's children";
+		return LDAP_INSUFFICIENT_ACCESS;
+	}
+	return LDAP_SUCCESS;
+}
+
+/* A modrdn whose new DN lands in another of our databases: add the
+ * renamed entry there and delete it from where it was. Only leaf
+ * entries can be moved this way, a subtree would have to be copied
+ * entry by entry without any atomicity. Access is checked as for the
+ * modrdn, the add and delete are then done as the rootdn of each
+ * database.
+ */
+static int
+glue_op_move( Operation *op, SlapReply *rs, BackendDB *b0,
+	slap_overinst *on, BackendDB *bsrc, BackendDB *bdst,
+	struct berval *nndn )
+{
+	glueinfo *gi = (glueinfo *)on->on_bi.bi_private;
+	Operation op2;
+	SlapReply rs2 = { REP_RESULT };
+	slap_callback cb = { NULL, glue_move_cb, NULL, NULL };
+	Entry *e = NULL, *e2 = NULL;
+	struct berval pdn;
+	char textbuf[SLAP_TEXT_BUFLEN];
+	int i, rc, hs = LDAP_COMPARE_FALSE;
+
+	/* the suffix entry of a database stays where it is */
+	if ( dn_match( nndn, &bdst->be_nsuffix[0] ) ) {
+		rs->sr_err = LDAP_AFFECTS_MULTIPLE_DSAS;
+		rs->sr_text = "cannot rename onto the suffix of a glued database";
+		goto done;
+	}
+
+	if ( BER_BVISEMPTY( &bsrc->be_rootndn ) ||
+		BER_BVISEMPTY( &bdst->be_rootndn ) ) {
+		rs->sr_err = LDAP_UNWILLING_TO_PERFORM;
+		rs->sr_text = "cannot move entries of a database without a rootdn";
+		goto done;
+	}
+
+	/* refuse to strand any of the glued databases */
+	for ( i = gi->gi_nodes; i >= 0; i-- ) {
+		BackendDB *be = i == gi->gi_nodes ? b0 : gi->gi_n[i].gn_be;
+		if ( dnIsSuffix( &be->be_nsuffix[0], &op->o_req_ndn ) ) {
+			hs = LDAP_COMPARE_TRUE;
+			break;
+		}
+	}
+
+	op->o_bd = bsrc;
+	if ( hs != LDAP_COMPARE_TRUE ) {
+		rs->sr_err = be_entry_get_rw( op, &op->o_req_ndn, NULL, NULL, 0, &e );
+		if ( rs->sr_err != LDAP_SUCCESS )
+			goto done;
+		if ( op->o_bd->be_has_subordinates )
+			op->o_bd->be_has_subordinates( op, e, &hs );
+		if ( hs != LDAP_COMPARE_TRUE ) {
+			rs->sr_err = glue_move_access( op, rs, bsrc, bdst, e, nndn );
+			if ( rs->sr_err == LDAP_SUCCESS )
+				e2 = entry_dup( e );
+			op->o_bd = bsrc;
+		}
+		be_entry_release_r( op, e );
+	}
+	if ( hs == LDAP_COMPARE_TRUE ) {
+		rs->sr_err = LDAP_AFFECTS_MULTIPLE_DSAS;
+		rs->sr_text = "cannot move a subtree between glued databases";
+		goto done;
+	}
+	if ( !e2 )
+		goto done;
+
+	ch_free( e2->e_name.bv_val );
+	ch_free( e2->e_nname.bv_val );
+	if ( op->orr_newSup )
+		pdn = *op->orr_newSup;
+	else
+		dnParent( &op->o_req_dn, &pdn );
+	build_new_dn( &e2->e_name, &pdn, &op->orr_newrdn, NULL );
+	ber_dupbv( &e2->e_nname, nndn );
+
+	rs->sr_err = glue_move_mods( op, rs, e2, textbuf );
+	if ( rs->sr_err != LDAP_SUCCESS )
+		goto done;
+	/* it is the requestor who modified it, not the rootdn */
+	if ( SLAP_LASTMOD( bdst ) ) {
+		if ( BER_BVISEMPTY( &op->o_ndn ) ) {
+			struct berval anon = BER_BVC( SLAPD_ANONYMOUS );
+			attr_merge_one( e2, slap_schema.si_ad_modifiersName,
+				&anon, &anon );
+		} else {
+			attr_merge_one( e2, slap_schema.si_ad_modifiersName,
+				&op->o_dn, &op->o_ndn );
+		}
+	}
+
+	textbuf[0] = '\0';
+	cb.sc_private = textbuf;
+	op2 = *op;
+	op2.o_callback = &cb;
+	op2.o_bd = bdst;
+	op2.o_dn = bdst->be_rootdn;
+	op2.o_ndn = bdst->be_rootndn;
+	op2.o_tag = LDAP_REQ_ADD;
+	op2.o_req_dn = e2->e_name;
+	op2.o_req_ndn = e2->e_nname;
+	op2.ora_e = e2;
+	op2.ora_modlist = NULL;
+	glue_sub_op( &op2, &rs2, b0, on, op_add );
+	if ( rs2.sr_err != LDAP_SUCCESS ) {
+		rs->sr_err = rs2.sr_err;
+		rs->sr_text = textbuf[0] ? textbuf : NULL;
+		goto done;
+	}
+
+	rs_reinit( &rs2, REP_RESULT );
+	textbuf[0] = '\0';
+	op2.o_bd = bsrc;
+	op2.o_dn = bsrc->be_rootdn;
+	op2.o_ndn = bsrc->be_rootndn;
+	op2.o_tag = LDAP_REQ_DELETE;
+	op2.o_req_dn = op->o_req_dn;
+	op2.o_req_ndn = op->o_req_ndn;
+	glue_sub_op( &op2, &rs2, b0, on, op_delete );
+	rs->sr_err = rs2.sr_err;
+	rs->sr_text = textbuf[0] ? textbuf : NULL;
+	if ( rs2.sr_err != LDAP_SUCCESS ) {
+		/* take the copy out again */
+		rc = rs2.sr_err;
+		rs_reinit( &rs2, REP_RESULT );
+		cb.sc_response = slap_null_cb;
+		op2.o_bd = bdst;
+		op2.o_req_dn = e2->e_name;
+		op2.o_req_ndn = e2->e_nname;
+		op2.o_dn = bdst->be_rootdn;
+		op2.o_ndn = bdst->be_rootndn;
+		glue_sub_op( &op2, &rs2, b0, on, op_delete );
+		if ( rs2.sr_err != LDAP_SUCCESS ) {
+			Debug( LDAP_DEBUG_ANY, "%s glue_op_move: "
+				"delete of \"%s\" failed (%d), "
+				"and so did removing its copy \"%s\" (%d)\n",
+				op->o_log_prefix, op->o_req_dn.bv_val, rc,
+				e2->e_name.bv_val, rs2.sr_err );
+			rs->sr_err = LDAP_OTHER;
+			rs->sr_text = "entry left in both databases";
+		}
+	}
+
+done:
+	op->o_bd = b0;
+	if ( e2 )
+		entry_free( e2 );
+	send_ldap_result( op, rs );
+	return rs->sr_err;
+}
+
 static int
 glue_op_func ( Operation *op, SlapReply *rs )
 {
@@ -229,6 +484,30 @@ glue_op_func ( Operation *op, SlapReply *rs )
 	slap_operation_t which = op_bind;
 	int rc;
 
+	if ( op->o_tag == LDAP_REQ_MODRDN ) {
+		BackendDB *bsrc, *bdst;
+		struct berval pndn, nndn;
+
+		if ( op->orr_nnewSup )
+			pndn = *op->orr_nnewSup;
+		else
+			dnParent( &op->o_req_ndn, &pndn );
+		build_new_dn( &nndn, &pndn, &op->orr_nnewrdn, op->o_tmpmemctx );
+		/* glue_back_select() drops bd_info when it picks b0 */
+		bsrc = glue_back_select( b0, &op->o_req_ndn );
+		b0->bd_info = bi0;
+		bdst = glue_back_select( b0, &nndn );
+		b0->bd_info = on->on_info->oi_orig;
+		rc = SLAP_CB_CONTINUE;
+		if ( bsrc != bdst )
+			rc = glue_op_move( op, rs, b0, on, bsrc, bdst, &nndn );
+		op->o_tmpfree( nndn.bv_val, op->o_tmpmemctx );
+		op->o_bd = b0;
+		op->o_bd->bd_info = bi0;
+		if ( rc != SLAP_CB_CONTINUE )
+			return rc;
+	}
+
 	op->o_bd = glue_back_select (b0, &op->o_req_ndn);
 
 	/* If we're on the primary backend, let overlay framework handle it */
@@ -350,22 +629,23 @@ glue_chk_controls ( Operation *op, SlapReply *rs )
 /* ITS#4615 - overlays configured above the glue overlay should be
  * invoked for the entire glued tree. Overlays configured below the
  * glue overlay should only be invoked on the primary backend.
- * So, if we're searching on any subordinates, we need to force the
+ * So, if we're operating on any subordinates, we need to force the
  * current overlay chain to stop processing, without stopping the
  * overall callback flow.
  */
 static int
-glue_sub_search( Operation *op, SlapReply *rs, BackendDB *b0,
-	slap_overinst *on )
+glue_sub_op( Operation *op, SlapReply *rs, BackendDB *b0,
+	slap_overinst *on, slap_operation_t which )
 {
+	BackendInfo *bi = op->o_bd->bd_info;
+
 	/* Process any overlays on the primary backend */
 	if ( op->o_bd == b0 && on->on_next ) {
-		BackendInfo *bi = op->o_bd->bd_info;
 		int rc = SLAP_CB_CONTINUE;
 		for ( on=on->on_next; on; on=on->on_next ) {
 			op->o_bd->bd_info = (BackendInfo *)on;
-			if ( on->on_bi.bi_op_search ) {
-				rc = on->on_bi.bi_op_search( op, rs );
+			if ( (&on->on_bi.bi_op_bind)[ which ] ) {
+				rc = (&on->on_bi.bi_op_bind)[ which ]( op, rs );
 				if ( rc != SLAP_CB_CONTINUE )
 					break;
 			}
@@ -374,7 +654,8 @@ glue_sub_search( Operation *op, SlapReply *rs, BackendDB *b0,
 		if ( rc != SLAP_CB_CONTINUE )
 			return rc;
 	}
-	return op->o_bd->be_search( op, rs );
+	return (&bi->bi_op_bind)[ which ] ?
+		(&bi->bi_op_bind)[ which ]( op, rs ) : LDAP_UNWILLING_TO_PERFORM;
 }
 
 static const ID glueID = NOID;
@@ -523,7 +804,7 @@ glue_op_search ( Operation *op, SlapReply *rs )
 			} else if (scope0 == LDAP_SCOPE_SUBTREE &&
 				dn_match(&op->o_bd->be_nsuffix[0], &ndn))
 			{
-				rs->sr_err = glue_sub_search( op, rs, b0, on );
+				rs->sr_err = glue_sub_op( op, rs, b0, on, op_search );
 
 			} else if (scope0 == LDAP_SCOPE_SUBTREE &&
 				dnIsSuffix(&op->o_bd->be_nsuffix[0], &ndn))
@@ -531,7 +812,7 @@ glue_op_search ( Operation *op, SlapReply *rs )
 				struct berval mdn, mndn;
 				mdn = op->o_req_dn = op->o_bd->be_suffix[0];
 				mndn = op->o_req_ndn = op->o_bd->be_nsuffix[0];
-				rs->sr_err = glue_sub_search( op, rs, b0, on );
+				rs->sr_err = glue_sub_op( op, rs, b0, on, op_search );
 				if ( rs->sr_err == LDAP_NO_SUCH_OBJECT ) {
 					gs.err = LDAP_SUCCESS;
 				}
@@ -541,7 +822,7 @@ glue_op_search ( Operation *op, SlapReply *rs )
 					op->o_req_ndn = ndn;
 
 			} else if (dnIsSuffix(&ndn, &op->o_bd->be_nsuffix[0])) {
-				rs->sr_err = glue_sub_search( op, rs, b0, on );
+				rs->sr_err = glue_sub_op( op, rs, b0, on, op_search );
 			}
 
 			switch ( gs.err ) {
@@ -201,6 +201,7 @@ enum {
 	CFG_TLS_CACERT,
 	CFG_TLS_CERT,
 	CFG_TLS_KEY,
+	CFG_DNCACHE,
 
 	CFG_LAST
 };
@@ -378,6 +379,10 @@ static ConfigTable config_back_cf_table[] = {
 		&config_disallows, "( OLcfgGlAt:15 NAME 'olcDisallows' "
 			"EQUALITY caseIgnoreMatch "
 			"SYNTAX OMsDirectoryString )", NULL, NULL },
+	{ "dncache", "entries", 2, 2, 0, ARG_UINT|ARG_MAGIC|CFG_DNCACHE,
+		&config_generic, "( OLcfgGlAt:102 NAME 'olcDNCache' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "ditcontentrule",	NULL, 0, 0, 0, ARG_MAGIC|CFG_DIT|ARG_NO_DELETE|ARG_NO_INSERT,
 		&config_generic, "( OLcfgGlAt:16 NAME 'olcDitContentRules' "
 			"DESC 'OpenLDAP DIT content rules' "
@@ -402,6 +407,10 @@ static ConfigTable config_back_cf_table[] = {
 		&config_generic, "( OLcfgDbAt:0.17 NAME 'olcHidden' "
 			"EQUALITY booleanMatch "
 			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
+	{ "groupcache", "entries", 2, 2, 0, ARG_UINT,
+		&slap_group_cache_max, "( OLcfgGlAt:101 NAME 'olcGroupCache' "
+			"EQUALITY integerMatch "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "idletimeout", "timeout", 2, 2, 0, ARG_INT,
 		&global_idletimeout, "( OLcfgGlAt:18 NAME 'olcIdleTimeout' "
 			"EQUALITY integerMatch "
@@ -939,7 +948,7 @@ static ConfigOCs cf_ocs[] = {
 		 "olcAttributeOptions $ olcAuthIDRewrite $ "
 		 "olcAuthzPolicy $ olcAuthzRegexp $ olcConcurrency $ "
 		 "olcConnMaxPending $ olcConnMaxPendingAuth $ "
-		 "olcDisallows $ olcGentleHUP $ olcIdleTimeout $ "
+		 "olcDisallows $ olcDNCache $ olcGentleHUP $ olcGroupCache $ olcIdleTimeout $ "
 		 "olcIndexSubstrIfMaxLen $ olcIndexSubstrIfMinLen $ "
 		 "olcIndexSubstrAnyLen $ olcIndexSubstrAnyStep $ olcIndexHash64 $ "
 		 "olcIndexIntLen $ "
@@ -1074,6 +1083,9 @@ config_generic(ConfigArgs *c) {
 		case CFG_LTHREADS:
 			c->value_uint = slapd_daemon_threads;
 			break;
+		case CFG_DNCACHE:
+			c->value_uint = slap_dn_cache_max;
+			break;
 		case CFG_SALT:
 			if ( passwd_salt )
 				c->value_string = ch_strdup( passwd_salt );
@@ -1430,6 +1442,10 @@ config_generic(ConfigArgs *c) {
 		case CFG_SYNC_SUBENTRY:
 			break;
 
+		case CFG_DNCACHE:
+			dn_cache_resize( 0 );
+			break;
+
 #ifdef LDAP_SLAPI
 		case CFG_PLUGIN:
 			slapi_int_unregister_plugins(c->be, c->valx);
@@ -1853,6 +1869,10 @@ config_generic(ConfigArgs *c) {
 			}
 			break;
 
+		case CFG_DNCACHE:
+			dn_cache_resize( c->value_uint );
+			break;
+
 		case CFG_SALT:
 			if ( passwd_salt ) ch_free( passwd_salt );
 			passwd_salt = c->value_string;
@@ -44,6 +44,87 @@ BerMemoryFunctions ch_mfuncs = {
 	(BER_MEMFREE_FN *)ch_free 
 };
 
+#ifdef SLAP_HEAP_COUNT
+/*
+ * Debugging aid: count the global heap allocations made by a worker
+ * thread while it executes an operation, i.e. everything that did not
+ * land in the thread's slab.  connection_operation() points a thread
+ * key at the counter of the running operation.
+ */
+static ldap_pvt_thread_mutex_t	heap_count_mutex;
+static unsigned long		heap_count_ops[SLAP_OP_LAST];
+static unsigned long		heap_count_allocs[SLAP_OP_LAST];
+
+static const char *heap_count_names[SLAP_OP_LAST] = {
+	"bind", "unbind", "search", "compare", "modify",
+	"modrdn", "add", "delete", "abandon", "extended"
+};
+
+#define heap_count_key	((void *)slap_heap_count_begin)
+
+void
+slap_heap_count_incr( void )
+{
+	void *ctx = ldap_pvt_thread_pool_context();
+	unsigned long *count = NULL;
+
+	if ( ctx && ldap_pvt_thread_pool_getkey( ctx, heap_count_key,
+			(void **)&count, NULL ) == 0 && count )
+		(*count)++;
+}
+
+void
+slap_heap_count_init( void )
+{
+	ldap_pvt_thread_mutex_init( &heap_count_mutex );
+}
+
+void
+slap_heap_count_begin( void *ctx, unsigned long *count )
+{
+	*count = 0;
+	ldap_pvt_thread_pool_setkey( ctx, heap_count_key, count, NULL,
+		NULL, NULL );
+}
+
+void
+slap_heap_count_end( Operation *op, void *ctx, int opidx,
+	unsigned long *count )
+{
+	ldap_pvt_thread_pool_setkey( ctx, heap_count_key, NULL, NULL,
+		NULL, NULL );
+
+	ldap_pvt_thread_mutex_lock( &heap_count_mutex );
+	heap_count_ops[opidx]++;
+	heap_count_allocs[opidx] += *count;
+	ldap_pvt_thread_mutex_unlock( &heap_count_mutex );
+
+	if ( *count ) {
+		Debug( LDAP_DEBUG_STATS, "%s HEAP %s allocs=%lu\n",
+			op->o_log_prefix, heap_count_names[opidx], *count );
+	}
+}
+
+void
+slap_heap_count_report( void )
+{
+	int i;
+
+	for ( i = 0; i < SLAP_OP_LAST; i++ ) {
+		if ( !heap_count_ops[i] )
+			continue;
+		Debug( LDAP_DEBUG_ANY, "heap count: %s ops=%lu allocs=%lu\n",
+			heap_count_names[i], heap_count_ops[i],
+			heap_count_allocs[i] );
+	}
+	ldap_pvt_thread_mutex_destroy( &heap_count_mutex );
+}
+
+#define HEAP_COUNT()	slap_heap_count_incr()
+#else
+#define HEAP_COUNT()
+#endif
+
 void *
 ch_malloc(
     ber_len_t	size
@@ -51,6 +132,7 @@ ch_malloc(
 {
 	void	*new;
 
+	HEAP_COUNT();
 	if ( (new = (void *) ber_memalloc_x( size, NULL )) == NULL ) {
 		Debug( LDAP_DEBUG_ANY, "ch_malloc of %lu bytes failed\n",
 			(long) size );
@@ -83,6 +165,7 @@ ch_realloc(
 		return slap_sl_realloc( block, size, ctx );
 	}
 
+	HEAP_COUNT();
 	if ( (new = (void *) ber_memrealloc_x( block, size, NULL )) == NULL ) {
 		Debug( LDAP_DEBUG_ANY, "ch_realloc of %lu bytes failed\n",
 			(long) size );
@@ -101,6 +184,7 @@ ch_calloc(
 {
 	void	*new;
 
+	HEAP_COUNT();
 	if ( (new = (void *) ber_memcalloc_x( nelem, size, NULL )) == NULL ) {
 		Debug( LDAP_DEBUG_ANY, "ch_calloc of %lu elems of %lu bytes failed\n",
 		  (long) nelem, (long) size );
@@ -118,6 +202,7 @@ ch_strdup(
 {
 	char	*new;
 
+	HEAP_COUNT();
 	if ( (new = ber_strdup_x( string, NULL )) == NULL ) {
 		Debug( LDAP_DEBUG_ANY, "ch_strdup(%s) failed\n", string );
 		assert( 0 );
@@ -1074,6 +1074,9 @@ connection_operation( void *ctx, void *arg_v )
 	void *memctx = NULL;
 	void *memctx_null = NULL;
 	ber_len_t memsiz;
+#ifdef SLAP_HEAP_COUNT
+	unsigned long heapcount;
+#endif
 
 	gettimeofday( &op->o_qtime, NULL );
 	op->o_qtime.tv_usec -= op->o_tusec;
@@ -1160,7 +1163,13 @@ connection_operation( void *ctx, void *arg_v )
 	opidx = slap_req2op( tag );
 	assert( opidx != SLAP_OP_LAST );
 	INCR_OP_INITIATED( opidx );
+#ifdef SLAP_HEAP_COUNT
+	slap_heap_count_begin( ctx, &heapcount );
+#endif
 	rc = (*(opfun[opidx]))( op, &rs );
+#ifdef SLAP_HEAP_COUNT
+	slap_heap_count_end( op, ctx, opidx, &heapcount );
+#endif
 
 operations_error:
 	if ( rc == SLAPD_DISCONNECT ) {
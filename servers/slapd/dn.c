@@ -412,6 +412,172 @@ LDAPDN_rewrite( LDAPDN dn, unsigned flags, void *ctx )
 	return LDAP_SUCCESS;
 }
 
+/*
+ * Cache of raw DN -> (pretty, normalized) DN, shared by all threads.
+ * It is a direct-mapped table of slap_dn_cache_max slots keyed by the
+ * exact bytes of the raw DN; a colliding DN simply replaces the old
+ * one.  Slots are guarded by a fixed set of striped mutexes.  Results
+ * depend on the attribute types known to the schema, so each slot
+ * records slap_schema_gen and is ignored once the schema changed.
+ * dnNormalize() stores DNs without their pretty form, which it doesn't
+ * compute; dnPrettyNormal() takes such a slot as a miss and fills it in.
+ */
+typedef struct DNCacheEntry {
+	unsigned long	de_gen;
+	struct berval	de_raw;
+	struct berval	de_pretty;
+	struct berval	de_normal;
+} DNCacheEntry;
+
+#define DNC_LOCKS	64
+#define DNC_MAXLEN	512	/* longer DNs are not worth keeping */
+
+unsigned slap_dn_cache_max;
+
+static ldap_pvt_thread_mutex_t	dnc_mutex[DNC_LOCKS];
+static DNCacheEntry		**dnc_table;
+static unsigned			dnc_size;
+
+static unsigned
+dn_cache_hash( struct berval *bv )
+{
+	unsigned h = 2166136261U;
+	ber_len_t i;
+
+	for ( i = 0; i < bv->bv_len; i++ ) {
+		h ^= (unsigned char)bv->bv_val[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+int
+dn_cache_init( void )
+{
+	int i;
+
+	for ( i = 0; i < DNC_LOCKS; i++ )
+		ldap_pvt_thread_mutex_init( &dnc_mutex[i] );
+	return 0;
+}
+
+/* Set the number of slots; 0 disables and frees the cache */
+void
+dn_cache_resize( unsigned max )
+{
+	DNCacheEntry **old;
+	unsigned i, size, osize;
+
+	/* round down to a power of 2 so slots are picked by masking */
+	for ( size = max ? 1 : 0; size && size <= max / 2; size <<= 1 )
+		;
+
+	for ( i = 0; i < DNC_LOCKS; i++ )
+		ldap_pvt_thread_mutex_lock( &dnc_mutex[i] );
+	old = dnc_table;
+	osize = dnc_size;
+	dnc_table = size ? ch_calloc( size, sizeof( DNCacheEntry * ) ) : NULL;
+	dnc_size = size;
+	slap_dn_cache_max = max;
+	for ( i = 0; i < DNC_LOCKS; i++ )
+		ldap_pvt_thread_mutex_unlock( &dnc_mutex[i] );
+
+	for ( i = 0; i < osize; i++ )
+		ch_free( old[i] );
+	ch_free( old );
+}
+
+void
+dn_cache_destroy( void )
+{
+	int i;
+
+	dn_cache_resize( 0 );
+	for ( i = 0; i < DNC_LOCKS; i++ )
+		ldap_pvt_thread_mutex_destroy( &dnc_mutex[i] );
+}
+
+/* Copy the cached forms of val into ctx memory; pretty may be NULL */
+static int
+dn_cache_get(
+	struct berval *val,
+	struct berval *pretty,
+	struct berval *normal,
+	void *ctx )
+{
+	DNCacheEntry *de;
+	unsigned h;
+	int rc = -1;
+
+	if ( !dnc_size || val->bv_len > DNC_MAXLEN )
+		return -1;
+
+	h = dn_cache_hash( val );
+	ldap_pvt_thread_mutex_lock( &dnc_mutex[h % DNC_LOCKS] );
+	if ( dnc_size ) {
+		de = dnc_table[h & ( dnc_size - 1 )];
+		if ( de && de->de_gen == slap_schema_gen && bvmatch( &de->de_raw, val ) &&
+			( !pretty || !BER_BVISNULL( &de->de_pretty )))
+		{
+			if ( pretty )
+				ber_dupbv_x( pretty, &de->de_pretty, ctx );
+			ber_dupbv_x( normal, &de->de_normal, ctx );
+			rc = 0;
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &dnc_mutex[h % DNC_LOCKS] );
+
+	return rc;
+}
+
+/* Store the forms of val; pretty may be NULL */
+static void
+dn_cache_put(
+	struct berval *val,
+	struct berval *pretty,
+	struct berval *normal )
+{
+	DNCacheEntry *de, *old = NULL;
+	unsigned h;
+	char *ptr;
+
+	if ( !dnc_size || val->bv_len > DNC_MAXLEN )
+		return;
+
+	de = ch_malloc( sizeof( DNCacheEntry ) + val->bv_len +
+		( pretty ? pretty->bv_len + 1 : 0 ) + normal->bv_len + 2 );
+	de->de_gen = slap_schema_gen;
+	ptr = (char *)(de + 1);
+	de->de_raw.bv_val = ptr;
+	de->de_raw.bv_len = val->bv_len;
+	AC_MEMCPY( ptr, val->bv_val, val->bv_len + 1 );
+	ptr += val->bv_len + 1;
+	if ( pretty ) {
+		de->de_pretty.bv_val = ptr;
+		de->de_pretty.bv_len = pretty->bv_len;
+		AC_MEMCPY( ptr, pretty->bv_val, pretty->bv_len + 1 );
+		ptr += pretty->bv_len + 1;
+	} else {
+		BER_BVZERO( &de->de_pretty );
+	}
+	de->de_normal.bv_val = ptr;
+	de->de_normal.bv_len = normal->bv_len;
+	AC_MEMCPY( ptr, normal->bv_val, normal->bv_len + 1 );
+
+	h = dn_cache_hash( val );
+	ldap_pvt_thread_mutex_lock( &dnc_mutex[h % DNC_LOCKS] );
+	if ( dnc_size ) {
+		DNCacheEntry **slot = &dnc_table[h & ( dnc_size - 1 )];
+		old = *slot;
+		*slot = de;
+	} else {
+		old = de;
+	}
+	ldap_pvt_thread_mutex_unlock( &dnc_mutex[h % DNC_LOCKS] );
+
+	ch_free( old );
+}
+
 int
 dnNormalize(
     slap_mask_t use,
@@ -426,7 +592,10 @@ dnNormalize(
 
 	Debug( LDAP_DEBUG_TRACE, ">>> dnNormalize: <%s>\n", val->bv_val ? val->bv_val : "" );
 
-	if ( val->bv_len != 0 ) {
+	if ( val->bv_len != 0 && dn_cache_get( val, NULL, out, ctx ) == 0 ) {
+		/* cached */
+
+	} else if ( val->bv_len != 0 ) {
 		LDAPDN		dn = NULL;
 		int		rc;
 
@@ -459,6 +628,8 @@ dnNormalize(
 		if ( rc != LDAP_SUCCESS ) {
 			return LDAP_INVALID_SYNTAX;
 		}
+
+		dn_cache_put( val, NULL, out );
 	} else {
 		ber_dupbv_x( out, val, ctx );
 	}
@@ -715,6 +886,9 @@ dnPrettyNormal(
 		/* too big */
 		return LDAP_INVALID_SYNTAX;
 
+	} else if ( dn_cache_get( val, pretty, normal, ctx ) == 0 ) {
+		/* cached */
+
 	} else {
 		LDAPDN		dn = NULL;
 		int		rc;
@@ -766,6 +940,8 @@ dnPrettyNormal(
 			pretty->bv_len = 0;
 			return LDAP_INVALID_SYNTAX;
 		}
+
+		dn_cache_put( val, pretty, normal );
 	}
 
 	Debug( LDAP_DEBUG_TRACE, "<<< dnPrettyNormal: <%s>, <%s>\n",
@@ -0,0 +1,321 @@
+/* groupcache.c - server-wide group membership cache */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 1998-2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/*
+ * ACL "group=" clauses are resolved by fe_acl_group(), which keeps its
+ * answers on op->o_groups for the lifetime of a single operation only.
+ * This module keeps the same answers across operations, keyed by
+ * (group DN, member DN, database, objectClass, attribute), so that a
+ * large static group is not re-fetched and re-scanned by every search.
+ *
+ * The cache holds at most slap_group_cache_max member records and is
+ * disabled when that is zero.  Records are evicted in LRU order.
+ * Every successful write is reported through slap_group_cache_purge(),
+ * which drops the records of the written entry (all records for a
+ * rename, since that may move a whole subtree of groups).
+ *
+ * A reader may have computed its answer from a snapshot taken before
+ * a concurrent write was purged.  Each purge bumps a generation number
+ * and remembers a hash of the purged DN in a small ring; an operation
+ * records the generation it started at, and its answers are not stored
+ * if a purge since then may have touched the same group.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+
+#include <ac/string.h>
+
+#include "slap.h"
+
+unsigned slap_group_cache_max;
+
+typedef struct GroupCacheGroup {
+	struct berval		gg_ndn;
+	Avlnode			*gg_members;
+} GroupCacheGroup;
+
+typedef struct GroupCacheEntry {
+	LDAP_TAILQ_ENTRY(GroupCacheEntry) gc_lru;
+	GroupCacheGroup		*gc_group;
+	Backend			*gc_be;
+	ObjectClass		*gc_oc;
+	AttributeDescription	*gc_at;
+	int			gc_res;
+	struct berval		gc_ndn;
+} GroupCacheEntry;
+
+/* number of recent purges remembered for the stale insert check */
+#define GC_RING_SIZE	64
+#define GC_RING_ALL	0
+
+static ldap_pvt_thread_mutex_t	gc_mutex;
+static Avlnode			*gc_groups;
+static LDAP_TAILQ_HEAD(gc_lru_h, GroupCacheEntry) gc_lru
+	= LDAP_TAILQ_HEAD_INITIALIZER(gc_lru);
+static unsigned			gc_count;
+static unsigned long		gc_gen;
+static unsigned			gc_ring[GC_RING_SIZE];
+static unsigned long		gc_hits, gc_misses;
+
+static unsigned
+gc_hash( struct berval *ndn )
+{
+	unsigned h = 2166136261U;
+	ber_len_t i;
+
+	for ( i = 0; i < ndn->bv_len; i++ ) {
+		h ^= (unsigned char)ndn->bv_val[i];
+		h *= 16777619U;
+	}
+	/* GC_RING_ALL is reserved for "everything purged" */
+	return h ? h : 1;
+}
+
+static int
+gc_group_cmp( const void *v1, const void *v2 )
+{
+	const GroupCacheGroup *g1 = v1, *g2 = v2;
+	int rc = g1->gg_ndn.bv_len - g2->gg_ndn.bv_len;
+
+	if ( rc == 0 )
+		rc = memcmp( g1->gg_ndn.bv_val, g2->gg_ndn.bv_val,
+			g1->gg_ndn.bv_len );
+	return rc;
+}
+
+static int
+gc_entry_cmp( const void *v1, const void *v2 )
+{
+	const GroupCacheEntry *e1 = v1, *e2 = v2;
+	int rc;
+
+	if ( e1->gc_be != e2->gc_be )
+		return e1->gc_be < e2->gc_be ? -1 : 1;
+	if ( e1->gc_oc != e2->gc_oc )
+		return e1->gc_oc < e2->gc_oc ? -1 : 1;
+	if ( e1->gc_at != e2->gc_at )
+		return e1->gc_at < e2->gc_at ? -1 : 1;
+	rc = e1->gc_ndn.bv_len - e2->gc_ndn.bv_len;
+	if ( rc == 0 )
+		rc = memcmp( e1->gc_ndn.bv_val, e2->gc_ndn.bv_val,
+			e1->gc_ndn.bv_len );
+	return rc;
+}
+
+/* caller holds gc_mutex */
+static void
+gc_entry_free( void *v )
+{
+	GroupCacheEntry *ge = v;
+
+	LDAP_TAILQ_REMOVE( &gc_lru, ge, gc_lru );
+	gc_count--;
+	ch_free( ge );
+}
+
+/* caller holds gc_mutex */
+static void
+gc_group_free( void *v )
+{
+	GroupCacheGroup *gg = v;
+
+	avl_free( gg->gg_members, gc_entry_free );
+	ch_free( gg );
+}
+
+/* caller holds gc_mutex */
+static void
+gc_entry_evict( GroupCacheEntry *ge )
+{
+	GroupCacheGroup *gg = ge->gc_group;
+
+	avl_delete( &gg->gg_members, ge, gc_entry_cmp );
+	gc_entry_free( ge );
+	if ( gg->gg_members == NULL ) {
+		avl_delete( &gc_groups, gg, gc_group_cmp );
+		ch_free( gg );
+	}
+}
+
+int
+slap_group_cache_init( void )
+{
+	return ldap_pvt_thread_mutex_init( &gc_mutex );
+}
+
+void
+slap_group_cache_destroy( void )
+{
+	avl_free( gc_groups, gc_group_free );
+	gc_groups = NULL;
+	ldap_pvt_thread_mutex_destroy( &gc_mutex );
+}
+
+/* Returns 0 and sets *res on a hit */
+int
+slap_group_cache_get(
+	Operation *op,
+	struct berval *gr_ndn,
+	struct berval *op_ndn,
+	ObjectClass *group_oc,
+	AttributeDescription *group_at,
+	int *res )
+{
+	GroupCacheGroup gtmp, *gg;
+	GroupCacheEntry etmp, *ge = NULL;
+
+	if ( !slap_group_cache_max )
+		return -1;
+
+	gtmp.gg_ndn = *gr_ndn;
+	etmp.gc_be = op->o_bd;
+	etmp.gc_oc = group_oc;
+	etmp.gc_at = group_at;
+	etmp.gc_ndn = *op_ndn;
+
+	ldap_pvt_thread_mutex_lock( &gc_mutex );
+	gg = avl_find( gc_groups, &gtmp, gc_group_cmp );
+	if ( gg )
+		ge = avl_find( gg->gg_members, &etmp, gc_entry_cmp );
+	if ( ge ) {
+		*res = ge->gc_res;
+		LDAP_TAILQ_REMOVE( &gc_lru, ge, gc_lru );
+		LDAP_TAILQ_INSERT_HEAD( &gc_lru, ge, gc_lru );
+		gc_hits++;
+	} else {
+		gc_misses++;
+	}
+	ldap_pvt_thread_mutex_unlock( &gc_mutex );
+
+	return ge ? 0 : -1;
+}
+
+void
+slap_group_cache_put(
+	Operation *op,
+	struct berval *gr_ndn,
+	struct berval *op_ndn,
+	ObjectClass *group_oc,
+	AttributeDescription *group_at,
+	int res )
+{
+	GroupCacheGroup gtmp, *gg;
+	GroupCacheEntry *ge;
+	unsigned long g;
+	unsigned h;
+
+	if ( !slap_group_cache_max )
+		return;
+
+	h = gc_hash( gr_ndn );
+
+	ldap_pvt_thread_mutex_lock( &gc_mutex );
+
+	/* drop answers that may predate a write to this group */
+	if ( gc_gen - op->o_gcgen >= GC_RING_SIZE )
+		goto done;
+	for ( g = op->o_gcgen + 1; g <= gc_gen; g++ ) {
+		unsigned r = gc_ring[ g % GC_RING_SIZE ];
+		if ( r == GC_RING_ALL || r == h )
+			goto done;
+	}
+
+	gtmp.gg_ndn = *gr_ndn;
+	gg = avl_find( gc_groups, &gtmp, gc_group_cmp );
+	if ( gg == NULL ) {
+		gg = ch_malloc( sizeof( GroupCacheGroup ) + gr_ndn->bv_len + 1 );
+		gg->gg_ndn.bv_len = gr_ndn->bv_len;
+		gg->gg_ndn.bv_val = (char *)(gg + 1);
+		AC_MEMCPY( gg->gg_ndn.bv_val, gr_ndn->bv_val, gr_ndn->bv_len + 1 );
+		gg->gg_members = NULL;
+		avl_insert( &gc_groups, gg, gc_group_cmp, avl_dup_error );
+	}
+
+	ge = ch_malloc( sizeof( GroupCacheEntry ) + op_ndn->bv_len + 1 );
+	ge->gc_group = gg;
+	ge->gc_be = op->o_bd;
+	ge->gc_oc = group_oc;
+	ge->gc_at = group_at;
+	ge->gc_res = res;
+	ge->gc_ndn.bv_len = op_ndn->bv_len;
+	ge->gc_ndn.bv_val = (char *)(ge + 1);
+	AC_MEMCPY( ge->gc_ndn.bv_val, op_ndn->bv_val, op_ndn->bv_len + 1 );
+
+	if ( avl_insert( &gg->gg_members, ge, gc_entry_cmp, avl_dup_error ) ) {
+		/* another thread got there first */
+		ch_free( ge );
+		goto done;
+	}
+	LDAP_TAILQ_INSERT_HEAD( &gc_lru, ge, gc_lru );
+	gc_count++;
+
+	while ( gc_count > slap_group_cache_max ) {
+		gc_entry_evict( LDAP_TAILQ_LAST( &gc_lru, gc_lru_h ) );
+	}
+
+done:
+	ldap_pvt_thread_mutex_unlock( &gc_mutex );
+}
+
+/* Forget everything known about ndn, or everything if ndn is NULL */
+void
+slap_group_cache_purge( struct berval *ndn )
+{
+	GroupCacheGroup gtmp, *gg;
+	unsigned h = ndn ? gc_hash( ndn ) : GC_RING_ALL;
+
+	ldap_pvt_thread_mutex_lock( &gc_mutex );
+	gc_gen++;
+	gc_ring[ gc_gen % GC_RING_SIZE ] = h;
+
+	if ( ndn == NULL || !slap_group_cache_max ) {
+		avl_free( gc_groups, gc_group_free );
+		gc_groups = NULL;
+	} else {
+		gtmp.gg_ndn = *ndn;
+		gg = avl_delete( &gc_groups, &gtmp, gc_group_cmp );
+		if ( gg )
+			gc_group_free( gg );
+	}
+	ldap_pvt_thread_mutex_unlock( &gc_mutex );
+}
+
+/* Generation to stamp a new operation with */
+unsigned long
+slap_group_cache_gen( void )
+{
+	unsigned long gen;
+
+	/* 0 is always safe, the ring check just becomes stricter */
+	if ( !slap_group_cache_max )
+		return 0;
+
+	ldap_pvt_thread_mutex_lock( &gc_mutex );
+	gen = gc_gen;
+	ldap_pvt_thread_mutex_unlock( &gc_mutex );
+	return gen;
+}
+
+void
+slap_group_cache_counters( unsigned long *hits, unsigned long *misses )
+{
+	ldap_pvt_thread_mutex_lock( &gc_mutex );
+	*hits = gc_hits;
+	*misses = gc_misses;
+	ldap_pvt_thread_mutex_unlock( &gc_mutex );
+}
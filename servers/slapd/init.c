@@ -139,6 +139,11 @@ slap_init( int mode, const char *name )
 				connection_pool_max, 0, connection_pool_queues);
 
 		slap_counters_init( &slap_counters );
+		slap_group_cache_init();
+		dn_cache_init();
+#ifdef SLAP_HEAP_COUNT
+		slap_heap_count_init();
+#endif
 
 		ldap_pvt_thread_mutex_init( &slapd_rq.rq_mutex );
 		LDAP_STAILQ_INIT( &slapd_rq.task_list );
@@ -254,6 +259,12 @@ int slap_destroy(void)
 
 	rc = backend_destroy();
 
+	slap_group_cache_destroy();
+	dn_cache_destroy();
+#ifdef SLAP_HEAP_COUNT
+	slap_heap_count_report();
+#endif
+
 	slap_sasl_destroy();
 
 	/* rootdse destroy goes before entry_destroy()
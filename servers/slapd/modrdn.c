@@ -295,8 +295,14 @@ fe_op_modrdn( Operation *op, SlapReply *rs )
 		goto cleanup;
 	}
 
-	/* check that destination DN is in the same backend as source DN */
-	if ( select_backend( &dest_ndn, 0 ) != op->o_bd ) {
+	/* check that destination DN is in the same backend as source DN,
+	 * or at least within the same glued namingContext, where the
+	 * glue overlay moves it across
+	 */
+	if ( select_backend( &dest_ndn, 0 ) != op->o_bd &&
+		!( SLAP_GLUE_INSTANCE( op_be ) &&
+			select_backend( &dest_ndn, 1 ) == op_be ))
+	{
 			send_ldap_error( op, rs, LDAP_AFFECTS_MULTIPLE_DSAS,
 				"cannot rename between DSAs" );
 			goto cleanup;
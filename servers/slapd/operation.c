@@ -208,6 +208,7 @@ slap_op_alloc(
 
 	slap_op_time( &op->o_time, &op->o_tincr );
 	op->o_opid = id;
+	op->o_gcgen = slap_group_cache_gen();
 
 #if defined( LDAP_SLAPI )
 	if ( slapi_plugins_used ) {
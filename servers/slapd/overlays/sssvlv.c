@@ -103,6 +103,31 @@ typedef struct sssvlv_info
 	int svi_max_percon; /* max concurrent sorts per con */
 } sssvlv_info;
 
+/* A sort offered to the backend, see OpExtraSort. When the backend
+ * takes it, the entries of a plain sort pass straight through and a
+ * VLV only keeps the DNs of its window.
+ */
+typedef struct sort_hint
+{
+	OpExtraSort sh_oes;
+	int sh_mode;
+	int sh_target;	/* VLV target, guessed until the count is known */
+	int sh_found;
+	int sh_total;	/* entries seen by the previous pass, or -1 */
+	int sh_rerun;	/* the guess was wrong, search again */
+	int sh_noseek;	/* don't let the backend pass over entries */
+	struct berval sh_value;	/* normalized VLV assertion value */
+	struct berval *sh_dns;
+	int sh_head;
+	int sh_num;
+	int sh_size;
+} sort_hint;
+
+#define SH_SORT		0	/* no VLV */
+#define SH_LAST		1	/* the last entries */
+#define SH_OFFSET	2	/* around sh_target */
+#define SH_VALUE	3	/* around the first entry >= sh_value */
+
 typedef struct sort_op
 {
 	TAvlnode *so_tree;
@@ -117,6 +142,7 @@ typedef struct sort_op
 	int so_session;
 	unsigned long so_vcontext;
 	int so_running;
+	sort_hint *so_hint;
 } sort_op;
 
 /* There is only one conn table for all overlay instances */
@@ -641,6 +667,213 @@ static void send_page( Operation *op, SlapReply *rs, sort_op *so )
 	op->o_bd = be;
 }
 
+static void window_add( Operation *op, sort_hint *sh, struct berval *dn )
+{
+	if ( sh->sh_head + sh->sh_num == sh->sh_size ) {
+		if ( sh->sh_head && sh->sh_head >= sh->sh_num ) {
+			AC_MEMCPY( sh->sh_dns, sh->sh_dns + sh->sh_head,
+				sh->sh_num * sizeof(struct berval));
+			sh->sh_head = 0;
+		} else {
+			sh->sh_size = sh->sh_size ? sh->sh_size * 2 : 16;
+			sh->sh_dns = op->o_tmprealloc( sh->sh_dns,
+				sh->sh_size * sizeof(struct berval), op->o_tmpmemctx );
+		}
+	}
+	ber_dupbv_x( &sh->sh_dns[sh->sh_head + sh->sh_num], dn, op->o_tmpmemctx );
+	sh->sh_num++;
+}
+
+/* Drop the oldest DNs until at most max are left */
+static void window_trim( Operation *op, sort_hint *sh, int max )
+{
+	while ( sh->sh_num > max ) {
+		op->o_tmpfree( sh->sh_dns[sh->sh_head].bv_val, op->o_tmpmemctx );
+		sh->sh_head++;
+		sh->sh_num--;
+	}
+}
+
+/* The target of a VLV by offset in a list of total entries, 0 if
+ * it is out of range
+ */
+static int vlv_position( Operation *op, int total )
+{
+	vlv_ctrl *vc = op->o_controls[vlv_cid];
+	int target;
+
+	if ( vc->vc_offset == vc->vc_count )
+		return total;
+	if ( vc->vc_offset == 1 )
+		return 1;
+	if ( vc->vc_count && vc->vc_count != total ) {
+		if ( vc->vc_offset > vc->vc_count )
+			return 0;
+		target = total * vc->vc_offset / vc->vc_count;
+		return target > 1 ? target : 1;
+	}
+	if ( vc->vc_offset > total )
+		return 0;
+	return vc->vc_offset;
+}
+
+/* Keep an entry of a VLV over sorted results if it may be in the
+ * window. The target position is only known in advance when the
+ * offset is relative to a count the client got right, or when the
+ * backend passed over the entries before the window.
+ */
+static void window_entry(
+	Operation		*op,
+	SlapReply		*rs,
+	sort_op			*so)
+{
+	sort_hint *sh = so->so_hint;
+	vlv_ctrl *vc = op->o_controls[vlv_cid];
+	int n;
+
+	if ( sh->sh_oes.oe_total && !so->so_nentries ) {
+		so->so_nentries = sh->sh_oes.oe_skipped;
+		if ( sh->sh_mode == SH_OFFSET )
+			sh->sh_target = vlv_position( op, sh->sh_oes.oe_total );
+	}
+	n = ++so->so_nentries;
+
+	switch ( sh->sh_mode ) {
+	case SH_LAST:
+		window_add( op, sh, &rs->sr_entry->e_nname );
+		window_trim( op, sh, vc->vc_before < INT_MAX ? vc->vc_before + 1 : INT_MAX );
+		break;
+
+	case SH_OFFSET:
+		if ( sh->sh_target - n <= vc->vc_before &&
+			n - ( sh->sh_target > 1 ? sh->sh_target : 1 ) <= vc->vc_after )
+			window_add( op, sh, &rs->sr_entry->e_nname );
+		if ( sh->sh_oes.oe_total &&
+			n - ( sh->sh_target > 1 ? sh->sh_target : 1 ) >= vc->vc_after )
+			sh->sh_oes.oe_done = 1;
+		break;
+
+	case SH_VALUE:
+		if ( !sh->sh_found ) {
+			sort_key *sk = &so->so_ctrl->sc_keys[0];
+			MatchingRule *mr = sk->sk_ordering;
+			Attribute *a;
+			int cmp;
+
+			a = attr_find( rs->sr_entry->e_attrs, sk->sk_ad );
+			if ( a ) {
+				struct berval *bv = a->a_numvals > 1 ?
+					select_value( a, sk ) : a->a_nvals;
+				mr->smr_match( &cmp, 0, mr->smr_syntax, mr, bv,
+					&sh->sh_value );
+				cmp *= sk->sk_direction;
+			} else {
+				/* sorts after all values */
+				cmp = sk->sk_direction;
+			}
+			if ( cmp >= 0 ) {
+				sh->sh_found = 1;
+				sh->sh_target = n;
+				window_trim( op, sh, vc->vc_before );
+				window_add( op, sh, &rs->sr_entry->e_nname );
+			} else {
+				/* the last ones are sent if none matches */
+				window_add( op, sh, &rs->sr_entry->e_nname );
+				window_trim( op, sh, vc->vc_before > 1 ? vc->vc_before : 1 );
+			}
+		} else if ( n - sh->sh_target <= vc->vc_after ) {
+			window_add( op, sh, &rs->sr_entry->e_nname );
+		}
+		if ( sh->sh_found && sh->sh_oes.oe_total &&
+			n - sh->sh_target >= vc->vc_after )
+			sh->sh_oes.oe_done = 1;
+		break;
+	}
+}
+
+/* send_list() for a window collected by window_entry(). Returns
+ * nonzero if the search must be repeated to find the right window.
+ */
+static int send_window(
+	Operation		*op,
+	SlapReply		*rs,
+	sort_op			*so)
+{
+	sort_hint *sh = so->so_hint;
+	vlv_ctrl *vc = op->o_controls[vlv_cid];
+	int i, rc, target;
+	BackendDB *be;
+	Entry *e;
+	LDAPControl *ctrls[2];
+
+	if ( sh->sh_oes.oe_total ) {
+		/* The backend passed over the entries before the window. If
+		 * some of them didn't match, it went too far and the window
+		 * is short, then count them all.
+		 */
+		if ( !so->so_nentries )
+			so->so_nentries = sh->sh_oes.oe_skipped;
+		if ( sh->sh_mode == SH_OFFSET )
+			sh->sh_target = vlv_position( op, sh->sh_oes.oe_total );
+		if ( sh->sh_oes.oe_skipped && (
+			( sh->sh_mode == SH_VALUE &&
+			( sh->sh_found ? sh->sh_target - 1 : so->so_nentries ) -
+			sh->sh_oes.oe_skipped < vc->vc_before ) ||
+			( sh->sh_mode == SH_OFFSET &&
+			so->so_nentries < sh->sh_target ) ||
+			( sh->sh_mode == SH_LAST &&
+			so->so_nentries - sh->sh_oes.oe_skipped <= vc->vc_before )))
+		{
+			sh->sh_noseek = 1;
+			return 1;
+		}
+		so->so_nentries = sh->sh_oes.oe_total;
+	}
+
+	if ( sh->sh_mode == SH_VALUE ) {
+		target = sh->sh_found ? sh->sh_target : so->so_nentries + 1;
+	} else if ( !( target = vlv_position( op, so->so_nentries ))) {
+		so->so_vlv_rc = LDAP_VLV_RANGE_ERROR;
+		pack_vlv_response_control( op, rs, so, ctrls );
+		ctrls[1] = NULL;
+		slap_add_ctrls( op, rs, ctrls );
+		rs->sr_err = LDAP_VLV_ERROR;
+		return 0;
+	}
+	if ( target != sh->sh_target && sh->sh_mode == SH_OFFSET ) {
+		/* only once, give up if the entries keep changing */
+		if ( sh->sh_total < 0 ) {
+			sh->sh_total = so->so_nentries;
+			return 1;
+		}
+	}
+	so->so_vlv_target = target;
+
+	rs->sr_attrs = op->ors_attrs;
+	be = op->o_bd;
+	for ( i = 0; i < sh->sh_num; i++ ) {
+		struct berval *dn = &sh->sh_dns[sh->sh_head + i];
+
+		if ( slapd_shutdown ) break;
+
+		op->o_bd = select_backend( dn, 0 );
+		e = NULL;
+		rc = be_entry_get_rw( op, dn, NULL, NULL, 0, &e );
+
+		if ( e && rc == LDAP_SUCCESS ) {
+			rs->sr_entry = e;
+			rs->sr_flags = REP_ENTRY_MUSTRELEASE;
+			rs->sr_err = send_search_entry( op, rs );
+			if ( rs->sr_err == LDAP_UNAVAILABLE )
+				break;
+		}
+	}
+	so->so_vlv_rc = LDAP_SUCCESS;
+
+	op->o_bd = be;
+	return 0;
+}
+
 static void send_entry(
 	Operation		*op,
 	SlapReply		*rs,
@@ -720,6 +953,36 @@ static int sssvlv_op_response(
 {
 	sort_ctrl *sc = op->o_controls[sss_cid];
 	sort_op *so = op->o_callback->sc_private;
+	sort_hint *sh = so->so_hint;
+
+	if ( sh && sh->sh_oes.oe_sorted ) {
+		/* the backend returns the entries in order */
+		if ( rs->sr_type == REP_SEARCH ) {
+			if ( sh->sh_mode == SH_SORT )
+				return SLAP_CB_CONTINUE;
+			window_entry( op, rs, so );
+			rs->sr_err = LDAP_SUCCESS;
+		} else if ( rs->sr_type == REP_RESULT ) {
+			slap_callback *cb = op->o_callback;
+
+			if ( op->o_callback->sc_response == sssvlv_op_response )
+				op->o_callback = op->o_callback->sc_next;
+			if ( sh->sh_mode != SH_SORT &&
+				( so->so_nentries || sh->sh_oes.oe_skipped ) &&
+				( op->o_ctrlflag[sss_cid] != SLAP_CONTROL_CRITICAL ||
+				rs->sr_err == LDAP_SUCCESS ) &&
+				send_window( op, rs, so ))
+			{
+				/* drop this result, sssvlv_op_search starts over */
+				op->o_callback = cb;
+				sh->sh_rerun = 1;
+				return LDAP_SUCCESS;
+			}
+			so->so_hint = NULL;
+			send_result( op, rs, so );
+		}
+		return rs->sr_err;
+	}
 
 	if ( rs->sr_type == REP_SEARCH ) {
 		int i;
@@ -795,6 +1058,7 @@ static int sssvlv_op_response(
 			op->o_callback = op->o_callback->sc_next;
 		}
 
+		so->so_hint = NULL;
 		send_entry( op, rs, so );
 		send_result( op, rs, so );
 	}
@@ -802,6 +1066,86 @@ static int sssvlv_op_response(
 	return rs->sr_err;
 }
 
+/* Set up the window of a new pass over the entries */
+static void sort_hint_reset(
+	Operation		*op,
+	sort_op			*so,
+	sort_hint		*sh )
+{
+	vlv_ctrl *vc = op->o_controls[vlv_cid];
+
+	window_trim( op, sh, 0 );
+	sh->sh_head = 0;
+	sh->sh_oes.oe_sorted = 0;
+	sh->sh_oes.oe_total = 0;
+	sh->sh_oes.oe_skipped = 0;
+	sh->sh_oes.oe_done = 0;
+	sh->sh_rerun = 0;
+	sh->sh_found = 0;
+	sh->sh_target = 0;
+	so->so_nentries = 0;
+	so->so_hint = sh;
+
+	if ( so->so_vlv <= SLAP_CONTROL_IGNORED ) {
+		sh->sh_mode = SH_SORT;
+	} else if ( !BER_BVISNULL( &vc->vc_value )) {
+		sh->sh_mode = SH_VALUE;
+	} else if ( vc->vc_offset == vc->vc_count ) {
+		sh->sh_mode = SH_LAST;
+	} else {
+		sh->sh_mode = SH_OFFSET;
+		if ( sh->sh_total < 0 ||
+			!( sh->sh_target = vlv_position( op, sh->sh_total )))
+			sh->sh_target = vc->vc_offset;
+	}
+
+	/* let the backend start near the window */
+	sh->sh_oes.oe_vlv = sh->sh_mode != SH_SORT && !sh->sh_noseek;
+	if ( sh->sh_oes.oe_vlv ) {
+		sh->sh_oes.oe_before = vc->vc_before;
+		if ( sh->sh_mode == SH_VALUE )
+			sh->sh_oes.oe_value = sh->sh_value;
+		sh->sh_oes.oe_position = vlv_position;
+	}
+}
+
+/* Offer a single key sort to the backend. Returns nonzero if it
+ * can't be offered.
+ */
+static int sort_hint_init(
+	Operation		*op,
+	sort_op			*so,
+	sort_hint		*sh )
+{
+	sort_key *sk = &so->so_ctrl->sc_keys[0];
+	vlv_ctrl *vc = op->o_controls[vlv_cid];
+
+	memset( sh, 0, sizeof( *sh ));
+	if ( so->so_vlv > SLAP_CONTROL_IGNORED &&
+		!BER_BVISNULL( &vc->vc_value ))
+	{
+		MatchingRule *mr = sk->sk_ordering;
+
+		if ( !mr->smr_normalize ) {
+			sh->sh_value = vc->vc_value;
+		} else if ( mr->smr_normalize( SLAP_MR_VALUE_OF_SYNTAX,
+			mr->smr_syntax, mr, &vc->vc_value, &sh->sh_value,
+			op->o_tmpmemctx ))
+		{
+			/* let send_list() report it */
+			return -1;
+		}
+	}
+	sh->sh_oes.oe.oe_key = (void *)do_search;
+	sh->sh_oes.oe_op = op;
+	sh->sh_oes.oe_ad = sk->sk_ad;
+	sh->sh_oes.oe_mr = sk->sk_ordering;
+	sh->sh_oes.oe_reverse = sk->sk_direction < 0;
+	sh->sh_total = -1;
+	sort_hint_reset( op, so, sh );
+	return 0;
+}
+
 static int sssvlv_op_search(
 	Operation		*op,
 	SlapReply		*rs)
@@ -811,6 +1155,7 @@ static int sssvlv_op_search(
 	int						rc			= SLAP_CB_CONTINUE;
 	int	ok;
 	sort_op *so = NULL, so2;
+	sort_hint sh;
 	sort_ctrl *sc;
 	PagedResultsState *ps;
 	vlv_ctrl *vc;
@@ -971,6 +1316,30 @@ static int sssvlv_op_search(
 			so->so_running = 1;
 
 			op->o_callback		= cb;
+
+			/* Let the backend sort it if it can, then there's
+			 * nothing to keep across requests
+			 */
+			if ( !ps && sc->sc_nkeys == 1 && !sort_hint_init( op, so, &sh )) {
+				LDAP_SLIST_INSERT_HEAD( &op->o_extra, &sh.sh_oes.oe, oe_next );
+				for (;;) {
+					rc = overlay_op_walk( op, rs, op_search, on->on_info,
+						on->on_next );
+					if ( !sh.sh_rerun )
+						break;
+					rs_reinit( rs, REP_RESULT );
+					sort_hint_reset( op, so, &sh );
+				}
+				LDAP_SLIST_REMOVE( &op->o_extra, &sh.sh_oes.oe, OpExtra, oe_next );
+				if ( op->o_callback == cb )
+					op->o_callback = cb->sc_next;
+				window_trim( op, &sh, 0 );
+				if ( sh.sh_dns )
+					op->o_tmpfree( sh.sh_dns, op->o_tmpmemctx );
+				if ( !BER_BVISNULL( &sh.sh_value ) &&
+					sh.sh_value.bv_val != vc->vc_value.bv_val )
+					op->o_tmpfree( sh.sh_value.bv_val, op->o_tmpmemctx );
+			}
 		}
 	} else {
 		if ( so && !so->so_nentries ) {
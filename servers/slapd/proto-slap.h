@@ -221,6 +221,7 @@ LDAP_SLAPD_F( int ) slap_add_opattrs(
  * at.c
  */
 LDAP_SLAPD_V(int) at_oc_cache;
+LDAP_SLAPD_V(unsigned long) slap_schema_gen;
 LDAP_SLAPD_F (void) at_config LDAP_P((
 	const char *fname, int lineno,
 	int argc, char **argv ));
@@ -523,6 +524,15 @@ LDAP_SLAPD_F (void *) ch_realloc LDAP_P(( void *block, ber_len_t size ));
 LDAP_SLAPD_F (void *) ch_calloc LDAP_P(( ber_len_t nelem, ber_len_t size ));
 LDAP_SLAPD_F (char *) ch_strdup LDAP_P(( const char *string ));
 LDAP_SLAPD_F (void) ch_free LDAP_P(( void * ));
+#ifdef SLAP_HEAP_COUNT
+LDAP_SLAPD_F (void) slap_heap_count_incr LDAP_P(( void ));
+LDAP_SLAPD_F (void) slap_heap_count_init LDAP_P(( void ));
+LDAP_SLAPD_F (void) slap_heap_count_begin LDAP_P(( void *ctx,
+	unsigned long *count ));
+LDAP_SLAPD_F (void) slap_heap_count_end LDAP_P(( Operation *op, void *ctx,
+	int opidx, unsigned long *count ));
+LDAP_SLAPD_F (void) slap_heap_count_report LDAP_P(( void ));
+#endif
 
 #ifndef CH_FREE
 #undef free
@@ -936,6 +946,11 @@ LDAP_SLAPD_V (SOCKET *) slapd_ws_sockets;
 #define dn_match(dn1, dn2) 	( ber_bvcmp((dn1), (dn2)) == 0 )
 #define bvmatch(bv1, bv2)	( ((bv1)->bv_len == (bv2)->bv_len) && (memcmp((bv1)->bv_val, (bv2)->bv_val, (bv1)->bv_len) == 0) )
 
+LDAP_SLAPD_V( unsigned ) slap_dn_cache_max;
+LDAP_SLAPD_F (int) dn_cache_init LDAP_P(( void ));
+LDAP_SLAPD_F (void) dn_cache_destroy LDAP_P(( void ));
+LDAP_SLAPD_F (void) dn_cache_resize LDAP_P(( unsigned max ));
+
 LDAP_SLAPD_F (int) dnValidate LDAP_P((
 	Syntax *syntax, 
 	struct berval *val ));
@@ -1169,6 +1184,32 @@ LDAP_SLAPD_V( struct slap_sync_cookie_s ) slap_sync_cookie;
 LDAP_SLAPD_V( void * ) slap_tls_ctx;
 LDAP_SLAPD_V( LDAP * ) slap_tls_ld;
 
+/*
+ * groupcache.c
+ */
+LDAP_SLAPD_V (unsigned) slap_group_cache_max;
+
+LDAP_SLAPD_F (int) slap_group_cache_init LDAP_P(( void ));
+LDAP_SLAPD_F (void) slap_group_cache_destroy LDAP_P(( void ));
+LDAP_SLAPD_F (int) slap_group_cache_get LDAP_P((
+	Operation *op,
+	struct berval *gr_ndn,
+	struct berval *op_ndn,
+	ObjectClass *group_oc,
+	AttributeDescription *group_at,
+	int *res ));
+LDAP_SLAPD_F (void) slap_group_cache_put LDAP_P((
+	Operation *op,
+	struct berval *gr_ndn,
+	struct berval *op_ndn,
+	ObjectClass *group_oc,
+	AttributeDescription *group_at,
+	int res ));
+LDAP_SLAPD_F (void) slap_group_cache_purge LDAP_P(( struct berval *ndn ));
+LDAP_SLAPD_F (unsigned long) slap_group_cache_gen LDAP_P(( void ));
+LDAP_SLAPD_F (void) slap_group_cache_counters LDAP_P((
+	unsigned long *hits, unsigned long *misses ));
+
 /*
  * index.c
  */
@@ -887,6 +887,23 @@ slap_send_ldap_result( Operation *op, SlapReply *rs )
 	assert( !LDAP_API_ERROR( rs->sr_err ) );
 	assert( rs->sr_err != LDAP_PARTIAL_RESULTS );
 
+	/* Every write, internal or from a client, gets here once it
+	 * has been committed; drop any group membership derived from
+	 * the old entry.  A rename may move whole subtrees of groups.
+	 */
+	if ( rs->sr_err == LDAP_SUCCESS ) {
+		switch ( op->o_tag ) {
+		case LDAP_REQ_ADD:
+		case LDAP_REQ_DELETE:
+		case LDAP_REQ_MODIFY:
+			slap_group_cache_purge( &op->o_req_ndn );
+			break;
+		case LDAP_REQ_MODRDN:
+			slap_group_cache_purge( NULL );
+			break;
+		}
+	}
+
 	if ( rs->sr_err == LDAP_REFERRAL ) {
 		if( op->o_domain_scope ) rs->sr_ref = NULL;
 
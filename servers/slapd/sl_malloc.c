@@ -299,6 +299,9 @@ slap_sl_malloc(
 
 	/* ber_set_option calls us like this */
 	if (No_sl_malloc || !ctx) {
+#ifdef SLAP_HEAP_COUNT
+		slap_heap_count_incr();
+#endif
 		newptr = ber_memalloc_x( size, NULL );
 		if ( newptr ) return newptr;
 		Debug(LDAP_DEBUG_ANY, "slap_sl_malloc of %lu bytes failed\n",
@@ -134,6 +134,10 @@ LDAP_BEGIN_DECL
 
 #define MAXREMATCHES (100)
 
+/* number of ACL rules per database, and in the frontend, whose
+ * per-entry result AccessControlState remembers */
+#define SLAP_ACL_MEMO (256)
+
 #define SLAP_MAX_WORKER_THREADS		(16)
 
 #define SLAP_SB_MAX_INCOMING_DEFAULT ((1<<18) - 1)
@@ -250,6 +254,8 @@ typedef struct slap_ssf_set {
 #define SLAP_INDEX_APPROX         0x0008UL
 #define SLAP_INDEX_SUBSTR         0x0010UL
 #define SLAP_INDEX_EXTENDED		  0x0020UL
+#define SLAP_INDEX_ORDERED        0x0040UL	/* values in ordering rule order */
+#define SLAP_INDEX_NGRAM          0x0080UL	/* positional substring grams */
 
 #define SLAP_INDEX_DEFAULT        SLAP_INDEX_EQUALITY
 
@@ -1175,10 +1181,11 @@ struct Attribute {
 #define SLAP_ATTR_DONT_FREE_VALS	0x8U
 #define	SLAP_ATTR_SORTED_VALS		0x10U	/* values are sorted */
 #define	SLAP_ATTR_BIG_MULTI		0x20U	/* for backends */
+#define	SLAP_ATTR_BIG_RUNS		0x40U	/* for backends */
 
 /* These flags persist across an attr_dup() */
 #define	SLAP_ATTR_PERSISTENT_FLAGS \
-	(SLAP_ATTR_SORTED_VALS|SLAP_ATTR_BIG_MULTI)
+	(SLAP_ATTR_SORTED_VALS|SLAP_ATTR_BIG_MULTI|SLAP_ATTR_BIG_RUNS)
 
 	Attribute		*a_next;
 #ifdef LDAP_COMP_MATCH
@@ -1547,6 +1554,8 @@ typedef struct AccessControl {
 	slap_style_t acl_dn_style;
 	regex_t		acl_dn_re;
 	struct berval	acl_dn_pat;
+	struct berval	acl_dn_sfx;	/* literal tail of an anchored regex,
+					 * points into acl_dn_pat */
 	AttributeName	*acl_attrs;
 	MatchingRule	*acl_attrval_mr;
 	slap_style_t	acl_attrval_style;
@@ -1556,6 +1565,10 @@ typedef struct AccessControl {
 	/* "by" part: list of who has what access to the entries */
 	Access	*acl_access;
 
+	/* bit in AccessControlState.as_dn_miss, -1 if none;
+	 * assigned by acl_append() */
+	int		acl_memo;
+
 	struct AccessControl	*acl_next;
 } AccessControl;
 
@@ -1579,8 +1592,16 @@ typedef struct AccessControlState {
 
 	/* True if started to process frontend ACLs */
 	int as_fe_done;
+
+	/* Rules whose entry-only part, i.e. the "to" DN and filter,
+	 * is known not to match as_dn_e; kept across attributes of
+	 * the same entry.  Database rules come first, then frontend
+	 * rules. */
+	Entry *as_dn_e;
+	BackendDB *as_dn_be;
+	unsigned char as_dn_miss[2 * SLAP_ACL_MEMO / 8];
 } AccessControlState;
-#define ACL_STATE_INIT { NULL, ACL_NONE, NULL, 0, 0, ACL_PRIV_NONE, -1, 0 }
+#define ACL_STATE_INIT { NULL, ACL_NONE, NULL, 0, 0, ACL_PRIV_NONE, -1, 0, NULL }
 
 typedef struct AclRegexMatches {        
 	int dn_count;
@@ -2608,6 +2629,35 @@ typedef struct OpExtraDB {
 	BackendDB *oe_db;
 } OpExtraDB;
 
+/* Server side sort of a search, offered to the backend by the
+ * sssvlv overlay. A backend that can return the entries of oe_op
+ * in this order, e.g. by walking an index, sets oe_sorted before
+ * sending the first one. Keyed by do_search.
+ *
+ * For a VLV oe_vlv is set, and the backend may pass over the entries
+ * before the window: those before the normalized oe_value if it is
+ * set, else before position oe_position(oe_op, total), less
+ * oe_before. It then sets oe_total to the number of entries it
+ * expects and oe_skipped to the number it passed over, both may be
+ * estimates. Once the window is complete the overlay sets oe_done,
+ * and the backend may stop.
+ */
+typedef struct OpExtraSort {
+	OpExtra oe;
+	Operation *oe_op;
+	AttributeDescription *oe_ad;
+	MatchingRule *oe_mr;
+	int oe_reverse;
+	int oe_sorted;
+	int oe_vlv;
+	int oe_before;
+	struct berval oe_value;
+	int (*oe_position)( Operation *op, int total );	/* 0 if out of range */
+	int oe_total;
+	int oe_skipped;
+	int oe_done;
+} OpExtraSort;
+
 struct Operation {
 	Opheader *o_hdr;
 
@@ -2700,6 +2750,7 @@ struct Operation {
 #define SLAP_CANCEL_DONE				0x03
 
 	GroupAssertion *o_groups;
+	unsigned long o_gcgen;	/* group cache generation at op start */
 	char o_do_not_cache;	/* don't cache groups from this op */
 	char o_is_auth_check;	/* authorization in progress */
 	char o_dont_replicate;
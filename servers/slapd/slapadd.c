@@ -56,23 +56,38 @@
 
 extern int slap_DN_strict;	/* dn.c */
 
-static char csnbuf[ LDAP_PVT_CSNSTR_BUFSIZE ];
-
 typedef struct Erec {
 	Entry *e;
 	unsigned long lineno;
 	unsigned long nextline;
 } Erec;
 
+/* A record on its way from the LDIF to the database. With several
+ * tool threads, the records are read in turn by parser threads, which
+ * parse them concurrently, and are added in the order they were read.
+ */
 typedef struct Trec {
 	Entry *e;
 	unsigned long lineno;
 	unsigned long nextline;
+	char *buf;
+	int lmax;
 	int rc;
-	int ready;
+	int state;
 } Trec;
 
-static Trec trec;
+#define TREC_FREE	0
+#define TREC_BUSY	1	/* being read or parsed */
+#define TREC_READY	2
+
+/* records queued per parser thread */
+#define TREC_PER_THREAD	16
+
+static Trec *trecs;
+static unsigned long ntrecs;
+static unsigned long trec_read;	/* records handed to parser threads */
+static unsigned long trec_got;	/* records taken for adding */
+static unsigned long trec_nextline;
 static unsigned long sid = SLAP_SYNC_SID_MAX + 1;
 static int checkvals;
 static int enable_meter;
@@ -85,52 +100,63 @@ static int lmax;
 static ldap_pvt_thread_mutex_t add_mutex;
 static ldap_pvt_thread_cond_t add_cond;
 static int add_stop;
+static int add_eof;
+static int ldif_threaded;
 
 /* returns:
  *	1: got a record
  *	0: EOF
  * -1: read failure
+ */
+static int
+readrec(Erec *erec, char **bufp, int *lmaxp)
+{
+	int ldifrc;
+
+	do {
+		erec->lineno = erec->nextline+1;
+		/* nextline is the line number of the end of the current entry */
+		ldifrc = ldif_read_record( ldiffp, &erec->nextline, bufp, lmaxp );
+		if (ldifrc < 1)
+			return ldifrc < 0 ? -1 : 0;
+	} while ( erec->lineno < jumpline );
+
+	if ( enable_meter )
+		lutil_meter_update( &meter,
+				 ftello( ldiffp->fp ),
+				 0);
+	return 1;
+}
+
+/* returns:
+ *	1: got an entry
  * -2: parse failure
  */
 static int
-getrec0(Erec *erec)
+parserec(Erec *erec, char *buf, Operation *op)
 {
 	const char *text;
-	int ldifrc;
 	char textbuf[SLAP_TEXT_BUFLEN] = { '\0' };
 	size_t textlen = sizeof textbuf;
+	char csnbuf[ LDAP_PVT_CSNSTR_BUFSIZE ];
 	struct berval csn;
-	Operation *op = &opbuf.ob_op;
-	op->o_hdr = &opbuf.ob_hdr;
 
-again:
-	erec->lineno = erec->nextline+1;
-	/* nextline is the line number of the end of the current entry */
-	ldifrc = ldif_read_record( ldiffp, &erec->nextline, &buf, &lmax );
-	if (ldifrc < 1)
-		return ldifrc < 0 ? -1 : 0;
 	{
 		BackendDB *bd;
 		Entry *e;
 		int prev_DN_strict;
+		/* the parser threads share the setting */
+		int lenient = !dbnum && !ldif_threaded;
 
-		if ( erec->lineno < jumpline )
-			goto again;
-
-		if ( !dbnum ) {
+		if ( lenient ) {
 			prev_DN_strict = slap_DN_strict;
 			slap_DN_strict = 0;
 		}
 		e = str2entry2( buf, checkvals );
-		if ( !dbnum ) {
+		if ( lenient ) {
 			slap_DN_strict = prev_DN_strict;
 		}
 
-		if ( enable_meter )
-			lutil_meter_update( &meter,
-					 ftello( ldiffp->fp ),
-					 0);
-
 		if( e == NULL ) {
 			fprintf( stderr, "%s: could not parse entry (line=%lu)\n",
 				progname, erec->lineno );
@@ -298,50 +324,101 @@ again:
 				      (!(got & GOT_CSN) ? slap_schema.si_ad_entryCSN->ad_cname.bv_val : ""),
 				      e->e_name.bv_val );
 			}
-
-			sid = slap_tool_update_ctxcsn_check( progname, e );
 		}
 		erec->e = e;
 	}
 	return 1;
 }
 
+/* returns:
+ *	1: got a record
+ *	0: EOF
+ * -1: read failure
+ * -2: parse failure
+ */
+static int
+getrec0(Erec *erec)
+{
+	Operation *op = &opbuf.ob_op;
+	int rc;
+
+	op->o_hdr = &opbuf.ob_hdr;
+	rc = readrec( erec, &buf, &lmax );
+	if ( rc < 1 )
+		return rc;
+	return parserec( erec, buf, op );
+}
+
 static void *
 getrec_thr(void *ctx)
 {
+	OperationBuffer opb;
+	Operation *op = &opb.ob_op;
+	Erec erec;
+	Trec *t;
+
+	memset( &opb, 0, sizeof( opb ));
+	op->o_hdr = &opb.ob_hdr;
 	ldap_pvt_thread_mutex_lock( &add_mutex );
-	while (!add_stop) {
-		trec.rc = getrec0((Erec *)&trec);
-		trec.ready = 1;
-		while (trec.ready)
+	for (;;) {
+		while ( !add_stop && !add_eof &&
+			trecs[trec_read % ntrecs].state != TREC_FREE )
 			ldap_pvt_thread_cond_wait( &add_cond, &add_mutex );
-		/* eof or read failure */
-		if ( trec.rc == 0 || trec.rc == -1 )
+		if ( add_stop || add_eof )
 			break;
+
+		/* records are read in order, and parsed unlocked */
+		t = &trecs[trec_read++ % ntrecs];
+		t->state = TREC_BUSY;
+		erec.nextline = trec_nextline;
+		t->rc = readrec( &erec, &t->buf, &t->lmax );
+		trec_nextline = erec.nextline;
+		t->lineno = erec.lineno;
+		t->nextline = erec.nextline;
+		t->e = NULL;
+		if ( t->rc < 1 ) {
+			/* eof or read failure */
+			add_eof = 1;
+		} else {
+			ldap_pvt_thread_mutex_unlock( &add_mutex );
+			t->rc = parserec( &erec, t->buf, op );
+			ldap_pvt_thread_mutex_lock( &add_mutex );
+			if ( t->rc == 1 )
+				t->e = erec.e;
+		}
+		t->state = TREC_READY;
+		ldap_pvt_thread_cond_broadcast( &add_cond );
 	}
 	ldap_pvt_thread_mutex_unlock( &add_mutex );
 	return NULL;
 }
 
-static int ldif_threaded;
-
 static int
 getrec(Erec *erec)
 {
+	Trec *t;
 	int rc;
-	if ( !ldif_threaded )
-		return getrec0(erec);
-
-	while (!trec.ready)
-		ldap_pvt_thread_yield();
-	erec->e = trec.e;
-	erec->lineno = trec.lineno;
-	erec->nextline = trec.nextline;
-	trec.ready = 0;
-	rc = trec.rc;
-	ldap_pvt_thread_mutex_lock( &add_mutex );
-	ldap_pvt_thread_mutex_unlock( &add_mutex );
-	ldap_pvt_thread_cond_signal( &add_cond );
+
+	if ( !ldif_threaded ) {
+		rc = getrec0(erec);
+	} else {
+		ldap_pvt_thread_mutex_lock( &add_mutex );
+		t = &trecs[trec_got % ntrecs];
+		while ( t->state != TREC_READY )
+			ldap_pvt_thread_cond_wait( &add_cond, &add_mutex );
+		erec->e = t->e;
+		erec->lineno = t->lineno;
+		erec->nextline = t->nextline;
+		rc = t->rc;
+		t->e = NULL;
+		t->state = TREC_FREE;
+		trec_got++;
+		ldap_pvt_thread_cond_broadcast( &add_cond );
+		ldap_pvt_thread_mutex_unlock( &add_mutex );
+	}
+
+	if ( rc == 1 && SLAP_LASTMOD(be) )
+		sid = slap_tool_update_ctxcsn_check( progname, erec->e );
 	return rc;
 }
 
@@ -352,7 +429,8 @@ slapadd( int argc, char **argv )
 	size_t textlen = sizeof textbuf;
 	Erec erec;
 	struct berval bvtext;
-	ldap_pvt_thread_t thr;
+	ldap_pvt_thread_t *thr = NULL;
+	int i, nthr = 0, prev_DN_strict = 0;
 	ID id;
 	Entry *prev = NULL;
 
@@ -424,11 +502,21 @@ slapadd( int argc, char **argv )
 		enable_meter = 0;
 	}
 
+	/* all but this thread parse the LDIF */
 	if ( slap_tool_thread_max > 1 ) {
+		nthr = slap_tool_thread_max - 1;
+		ntrecs = nthr * TREC_PER_THREAD;
+		trecs = ch_calloc( ntrecs, sizeof( Trec ));
+		thr = ch_malloc( nthr * sizeof( ldap_pvt_thread_t ));
 		ldap_pvt_thread_mutex_init( &add_mutex );
 		ldap_pvt_thread_cond_init( &add_cond );
-		ldap_pvt_thread_create( &thr, 0, getrec_thr, NULL );
 		ldif_threaded = 1;
+		if ( !dbnum ) {
+			prev_DN_strict = slap_DN_strict;
+			slap_DN_strict = 0;
+		}
+		for ( i = 0; i < nthr; i++ )
+			ldap_pvt_thread_create( &thr[i], 0, getrec_thr, NULL );
 	}
 
 	erec.nextline = 0;
@@ -479,10 +567,18 @@ slapadd( int argc, char **argv )
 	if ( ldif_threaded ) {
 		ldap_pvt_thread_mutex_lock( &add_mutex );
 		add_stop = 1;
-		trec.ready = 0;
-		ldap_pvt_thread_cond_signal( &add_cond );
+		ldap_pvt_thread_cond_broadcast( &add_cond );
 		ldap_pvt_thread_mutex_unlock( &add_mutex );
-		ldap_pvt_thread_join( thr, NULL );
+		for ( i = 0; i < nthr; i++ )
+			ldap_pvt_thread_join( thr[i], NULL );
+		if ( !dbnum )
+			slap_DN_strict = prev_DN_strict;
+		for ( i = 0; i < ntrecs; i++ ) {
+			if ( trecs[i].e ) entry_free( trecs[i].e );
+			ch_free( trecs[i].buf );
+		}
+		ch_free( trecs );
+		ch_free( thr );
 	}
 	if ( erec.e ) entry_free( erec.e );
 
@@ -0,0 +1,240 @@
+/* idl-bench -- time the back-mdb IDL merge kernels */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/time.h>
+#include <ac/unistd.h>
+
+#include "../../servers/slapd/back-mdb/idlmerge.h"
+
+static const char *progname = "idl-bench";
+
+/* Candidate list sizes seen for multi-clause AND filters: a very
+ * selective clause against a broad one, down to two broad clauses.
+ */
+static const struct {
+	unsigned na, nb;
+} sizes[] = {
+	{ 8, 65535 },
+	{ 100, 65535 },
+	{ 2000, 65535 },
+	{ 20000, 65535 },
+	{ 65535, 65535 },
+	{ 0, 0 }
+};
+
+#define ID_SPACE	1000000
+
+static void
+usage( void )
+{
+	fprintf( stderr,
+		"Usage: %s [-i iterations] [-s seed] [-S]\n"
+		"  -S  only run the scalar kernels\n",
+		progname );
+	exit( EXIT_FAILURE );
+}
+
+/* Fill ids with n sorted IDs. Entries added together tend to share
+ * attribute values, so IDs are drawn in short clustered bursts.
+ */
+static void
+fill( MDB_ID *ids, unsigned n )
+{
+	unsigned i = 0;
+	MDB_ID id = 0, gap = ID_SPACE / n;
+
+	while ( i < n ) {
+		unsigned burst = 1 + rand() % 8;
+		id += 1 + rand() % ( 2 * gap * burst );
+		while ( burst-- && i < n ) {
+			ids[i++] = id;
+			id += 1 + rand() % 2;
+		}
+	}
+}
+
+static double
+now( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Time both operations */
+static void
+run( const char *kern, MDB_ID *a, unsigned na, MDB_ID *b, unsigned nb,
+	MDB_ID *out, MDB_ID *tmp, int iter )
+{
+	double t;
+	unsigned n = 0, m = 0;
+	int i;
+
+	t = now();
+	for ( i = 0; i < iter; i++ ) {
+		n = mdb_idk_intersect( a, na, b, nb, out );
+	}
+	t = now() - t;
+	printf( "  %-8s and %9.1f us", kern, t * 1e6 / iter );
+
+	t = now();
+	for ( i = 0; i < iter; i++ ) {
+		memcpy( tmp, a, na * sizeof(MDB_ID) );
+		m = mdb_idk_union( tmp, na, b, nb, na + nb );
+	}
+	t = now() - t;
+	printf( "   or %9.1f us   (%u, %u)\n", t * 1e6 / iter, n, m );
+}
+
+/* The plain merges, to check the kernels against */
+static void
+reference( MDB_ID *a, unsigned na, MDB_ID *b, unsigned nb,
+	MDB_ID *isect, unsigned *nisect, MDB_ID *uni, unsigned *nuni )
+{
+	unsigned i = 0, j = 0;
+
+	*nisect = *nuni = 0;
+	while ( i < na || j < nb ) {
+		if ( j == nb || ( i < na && a[i] < b[j] )) {
+			uni[(*nuni)++] = a[i++];
+		} else if ( i == na || b[j] < a[i] ) {
+			uni[(*nuni)++] = b[j++];
+		} else {
+			isect[(*nisect)++] = a[i];
+			uni[(*nuni)++] = a[i];
+			i++;
+			j++;
+		}
+	}
+}
+
+static void
+mismatch( const char *kern, const char *what )
+{
+	fprintf( stderr, "%s: %s kernel: wrong result %s\n",
+		progname, kern, what );
+	exit( EXIT_FAILURE );
+}
+
+static int
+differs( MDB_ID *x, unsigned nx, MDB_ID *y, unsigned ny )
+{
+	return nx != ny || memcmp( x, y, nx * sizeof(MDB_ID) );
+}
+
+/* Check the current kernels against the reference results, with the
+ * output in a separate array and in place of either input.
+ */
+static void
+verify( const char *kern, MDB_ID *a, unsigned na, MDB_ID *b, unsigned nb,
+	MDB_ID *isect, unsigned nisect, MDB_ID *uni, unsigned nuni, MDB_ID *tmp )
+{
+	unsigned n;
+
+	n = mdb_idk_intersect( a, na, b, nb, tmp );
+	if ( differs( tmp, n, isect, nisect ))
+		mismatch( kern, "for and" );
+
+	memcpy( tmp, a, na * sizeof(MDB_ID) );
+	n = mdb_idk_intersect( tmp, na, b, nb, tmp );
+	if ( differs( tmp, n, isect, nisect ))
+		mismatch( kern, "for and in place of a" );
+
+	memcpy( tmp, b, nb * sizeof(MDB_ID) );
+	n = mdb_idk_intersect( a, na, tmp, nb, tmp );
+	if ( differs( tmp, n, isect, nisect ))
+		mismatch( kern, "for and in place of b" );
+
+	memcpy( tmp, a, na * sizeof(MDB_ID) );
+	n = mdb_idk_union( tmp, na, b, nb, na + nb );
+	if ( differs( tmp, n, uni, nuni ))
+		mismatch( kern, "for or" );
+
+	/* too big for the room given, a must be left alone */
+	if ( nuni > na ) {
+		memcpy( tmp, a, na * sizeof(MDB_ID) );
+		n = mdb_idk_union( tmp, na, b, nb, nuni - 1 );
+		if ( n != nuni || memcmp( tmp, a, na * sizeof(MDB_ID) ))
+			mismatch( kern, "for or without room" );
+	}
+}
+
+int
+main( int argc, char **argv )
+{
+	MDB_ID *a, *b, *isect, *uni, *tmp;
+	unsigned seed = 1, i, nisect, nuni;
+	int iter = 200, scalar = 0, c;
+	const char *kern;
+
+	while ( (c = getopt( argc, argv, "i:s:S" )) != EOF ) {
+		switch ( c ) {
+		case 'i':
+			iter = atoi( optarg );
+			break;
+		case 's':
+			seed = strtoul( optarg, NULL, 0 );
+			break;
+		case 'S':
+			scalar = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if ( iter < 1 )
+		usage();
+
+	a = malloc( 65536 * sizeof(MDB_ID) );
+	b = malloc( 65536 * sizeof(MDB_ID) );
+	isect = malloc( 65536 * sizeof(MDB_ID) );
+	uni = malloc( 2 * 65536 * sizeof(MDB_ID) );
+	tmp = malloc( 3 * 65536 * sizeof(MDB_ID) );
+	srand( seed );
+
+	for ( i = 0; sizes[i].na; i++ ) {
+		fill( a, sizes[i].na );
+		fill( b, sizes[i].nb );
+		reference( a, sizes[i].na, b, sizes[i].nb, isect, &nisect, uni, &nuni );
+		printf( "%u x %u:\n", sizes[i].na, sizes[i].nb );
+
+		kern = mdb_idk_init( MDB_IDK_SCALAR );
+		verify( kern, a, sizes[i].na, b, sizes[i].nb,
+			isect, nisect, uni, nuni, tmp );
+		run( kern, a, sizes[i].na, b, sizes[i].nb, tmp, tmp + 65536, iter );
+		if ( scalar )
+			continue;
+
+		/* the vector kernels must give the same results */
+		kern = mdb_idk_init( 0 );
+		verify( kern, a, sizes[i].na, b, sizes[i].nb,
+			isect, nisect, uni, nuni, tmp );
+		run( kern, a, sizes[i].na, b, sizes[i].nb, tmp, tmp + 65536, iter );
+	}
+
+	free( tmp );
+	free( uni );
+	free( isect );
+	free( b );
+	free( a );
+	return EXIT_SUCCESS;
+}
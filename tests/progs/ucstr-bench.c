@@ -0,0 +1,701 @@
+/* ucstr-bench -- time UTF-8 normalization of attribute values */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/ctype.h>
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/time.h>
+#include <ac/unistd.h>
+
+#include <lber.h>
+#include <lber_pvt.h>
+#include <ldap_utf8.h>
+#include <ldap_pvt_uc.h>
+
+static const char *progname = "ucstr-bench";
+
+#define NVALS	4096
+
+/* Parts of the values of a typical directory. Most are plain ASCII,
+ * some names carry accents, a few are in other scripts entirely.
+ */
+static const char *givens[] = {
+	"Barbara", "James", "Jennifer", "Mark", "Dorothy", "Ursula",
+	"Bjorn", "John", "Jane", "Robert", "Alice", "Thomas", "Sarah",
+	"Jos\xc3\xa9", "Zo\xc3\xab", "J\xc3\xbcrgen", "Fran\xc3\xa7oise",
+	"\xc3\x85sa", "Se\xc3\xa1n", "\xe5\xa4\xaa\xe9\x83\x8e",
+	"\xd0\x98\xd0\xb2\xd0\xb0\xd0\xbd", NULL
+};
+
+static const char *surnames[] = {
+	"Jensen", "Jones", "Smith", "Doe", "Hampster", "Miller", "Johnson",
+	"Williams", "Brown", "Garcia", "Wilson", "Anderson", "Taylor",
+	"M\xc3\xbcller", "\xc3\x98" "deg\xc3\xa5rd", "Ni\xc3\xb1" "o",
+	"Dvo\xc5\x99\xc3\xa1k", "\xe5\xb1\xb1\xe7\x94\xb0",
+	"\xd0\x9f\xd0\xb5\xd1\x82\xd1\x80\xd0\xbe\xd0\xb2", NULL
+};
+
+static const char *words[] = {
+	"the", "directory", "server", "for", "engineering", "and", "sales",
+	"office", "building", "floor", "room", "team", "of", "Research",
+	"Development", "Caf\xc3\xa9", "na\xc3\xafve", "r\xc3\xa9sum\xc3\xa9",
+	"\xe2\x82\xac" "100", NULL
+};
+
+static unsigned
+count( const char **list )
+{
+	unsigned n;
+
+	for ( n = 0; list[n]; n++ )
+		;
+	return n;
+}
+
+#define PICK(list)	(list[rand() % count( list )])
+
+static int
+gen_cn( char *buf, int max )
+{
+	return snprintf( buf, max, "%s %s", PICK( givens ), PICK( surnames ));
+}
+
+static int
+gen_mail( char *buf, int max )
+{
+	/* only the ASCII names at the head of the lists */
+	return snprintf( buf, max, "%s.%s%d@Example.COM",
+		givens[rand() % 13], surnames[rand() % 13], rand() % 100 );
+}
+
+static int
+gen_dn( char *buf, int max )
+{
+	return snprintf( buf, max, "cn=%s %s,ou=People,dc=Example,dc=com",
+		PICK( givens ), PICK( surnames ));
+}
+
+static int
+gen_description( char *buf, int max )
+{
+	int len = 0, n = 5 + rand() % 20;
+
+	while ( n-- && len < max - 32 ) {
+		len += snprintf( buf + len, max - len, "%s ", PICK( words ));
+	}
+	buf[--len] = '\0';
+	return len;
+}
+
+/* Random characters of every encoded length, with combining marks
+ * after ASCII letters, for checking rather than timing.
+ */
+static int
+gen_mixed( char *buf, int max )
+{
+	static const char *chars[] = {
+		"a", "Z", "q", "M", " ", "-", "0", "@", "[", "`", "{", "\x7f",
+		"\xcc\x81", "\xcc\x88", "\xc3\xa9", "\xc3\x89", "\xc3\x9f",
+		"\xe1\xba\x9e", "\xe2\x84\xab", "\xef\xac\x81",
+		"\xe5\xb1\xb1", "\xf0\x9f\x98\x80", NULL
+	};
+	int len = 0, n = rand() % 40;
+
+	while ( n-- ) {
+		const char *c = rand() % 2 ? chars[rand() % 12] : PICK( chars );
+		int l = strlen( c );
+		if ( len + l >= max )
+			break;
+		memcpy( buf + len, c, l );
+		len += l;
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+static const struct {
+	const char *name;
+	int (*gen)( char *buf, int max );
+} corpora[] = {
+	{ "cn", gen_cn },
+	{ "mail", gen_mail },
+	{ "dn", gen_dn },
+	{ "description", gen_description },
+	{ "mixed", gen_mixed },
+	{ NULL }
+};
+
+static void
+usage( void )
+{
+	fprintf( stderr,
+		"Usage: %s [-i iterations] [-s seed]\n",
+		progname );
+	exit( EXIT_FAILURE );
+}
+
+static double
+now( void )
+{
+	struct timeval tv;
+
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double
+time_normalize( struct berval *(*norm)( struct berval *, struct berval *,
+	unsigned, void * ), struct berval *vals, unsigned flags, int iter )
+{
+	struct berval out;
+	double t;
+	int i, j;
+
+	t = now();
+	for ( i = 0; i < iter; i++ ) {
+		for ( j = 0; j < NVALS; j++ ) {
+			norm( &vals[j], &out, flags, NULL );
+			ber_memfree( out.bv_val );
+		}
+	}
+	return ( now() - t ) * 1e9 / iter / NVALS;
+}
+
+static double
+time_normcmp( int (*cmp)( struct berval *, struct berval *,
+	unsigned, void * ), struct berval *vals, struct berval *alts,
+	unsigned flags, int iter )
+{
+	double t;
+	int i, j;
+
+	t = now();
+	for ( i = 0; i < iter; i++ ) {
+		for ( j = 0; j < NVALS; j++ ) {
+			cmp( &vals[j], &alts[j], flags, NULL );
+		}
+	}
+	return ( now() - t ) * 1e9 / iter / NVALS;
+}
+
+/* The reference: UTF8bvnormalize() and UTF8bvnormcmp() as they were
+ * before the ASCII runs were handled a word at a time.
+ */
+static struct berval *
+bytewise_normalize(
+	struct berval *bv,
+	struct berval *newbv,
+	unsigned flags,
+	void *ctx )
+{
+	int i, j, len, clen, outpos, ucsoutlen, outsize, last;
+	int didnewbv = 0;
+	char *out, *outtmp, *s;
+	ac_uint4 *ucs, *p, *ucsout;
+
+	static unsigned char mask[] = {
+		0, 0x7f, 0x1f, 0x0f, 0x07, 0x03, 0x01 };
+
+	unsigned casefold = flags & LDAP_UTF8_CASEFOLD;
+	unsigned approx = flags & LDAP_UTF8_APPROX;
+
+	if ( bv == NULL ) {
+		return NULL;
+	}
+
+	s = bv->bv_val;
+	len = bv->bv_len;
+
+	if ( len == 0 ) {
+		return ber_dupbv_x( newbv, bv, ctx );
+	}
+
+	if ( !newbv ) {
+		newbv = ber_memalloc_x( sizeof(struct berval), ctx );
+		if ( !newbv ) return NULL;
+		didnewbv = 1;
+	}
+
+	/* Should first check to see if string is already in proper
+	 * normalized form. This is almost as time consuming as
+	 * the normalization though.
+	 */
+
+	/* finish off everything up to character before first non-ascii */
+	if ( LDAP_UTF8_ISASCII( s ) ) {
+		if ( casefold ) {
+			outsize = len + 7;
+			out = (char *) ber_memalloc_x( outsize, ctx );
+			if ( out == NULL ) {
+fail:
+				if ( didnewbv )
+					ber_memfree_x( newbv, ctx );
+				return NULL;
+			}
+			outpos = 0;
+
+			for ( i = 1; (i < len) && LDAP_UTF8_ISASCII(s + i); i++ ) {
+				out[outpos++] = TOLOWER( s[i-1] );
+			}
+			if ( i == len ) {
+				out[outpos++] = TOLOWER( s[len-1] );
+				out[outpos] = '\0';
+				newbv->bv_val = out;
+				newbv->bv_len = outpos;
+				return newbv;
+			}
+		} else {
+			for ( i = 1; (i < len) && LDAP_UTF8_ISASCII(s + i); i++ ) {
+				/* empty */
+			}
+
+			if ( i == len ) {
+				return ber_str2bv_x( s, len, 1, newbv, ctx );
+			}
+
+			outsize = len + 7;
+			out = (char *) ber_memalloc_x( outsize, ctx );
+			if ( out == NULL ) {
+				goto fail;
+			}
+			outpos = i - 1;
+			memcpy(out, s, outpos);
+		}
+	} else {
+		outsize = len + 7;
+		out = (char *) ber_memalloc_x( outsize, ctx );
+		if ( out == NULL ) {
+			goto fail;
+		}
+		outpos = 0;
+		i = 0;
+	}
+
+	p = ucs = ber_memalloc_x( len * sizeof(*ucs), ctx );
+	if ( ucs == NULL ) {
+		ber_memfree_x(out, ctx);
+		goto fail;
+	}
+
+	/* convert character before first non-ascii to ucs-4 */
+	if ( i > 0 ) {
+		*p = casefold ? TOLOWER( s[i-1] ) : s[i-1];
+		p++;
+	}
+
+	/* s[i] is now first non-ascii character */
+	for (;;) {
+		/* s[i] is non-ascii */
+		/* convert everything up to next ascii to ucs-4 */
+		while ( i < len ) {
+			clen = LDAP_UTF8_CHARLEN2( s + i, clen );
+			if ( clen == 0 ) {
+				ber_memfree_x( ucs, ctx );
+				ber_memfree_x( out, ctx );
+				goto fail;
+			}
+			if ( clen == 1 ) {
+				/* ascii */
+				break;
+			}
+			*p = s[i] & mask[clen];
+			i++;
+			for( j = 1; j < clen; j++ ) {
+				if ( (s[i] & 0xc0) != 0x80 ) {
+					ber_memfree_x( ucs, ctx );
+					ber_memfree_x( out, ctx );
+					goto fail;
+				}
+				*p <<= 6;
+				*p |= s[i] & 0x3f;
+				i++;
+			}
+			if ( casefold ) {
+				*p = uctolower( *p );
+			}
+			p++;
+		}
+		/* normalize ucs of length p - ucs */
+		uccompatdecomp( ucs, p - ucs, &ucsout, &ucsoutlen, ctx );
+		if ( approx ) {
+			for ( j = 0; j < ucsoutlen; j++ ) {
+				if ( ucsout[j] < 0x80 ) {
+					out[outpos++] = ucsout[j];
+				}
+			}
+		} else {
+			ucsoutlen = uccanoncomp( ucsout, ucsoutlen );
+			/* convert ucs to utf-8 and store in out */
+			for ( j = 0; j < ucsoutlen; j++ ) {
+				/* allocate more space if not enough room for
+				   6 bytes and terminator */
+				if ( outsize - outpos < 7 ) {
+					outsize = ucsoutlen - j + outpos + 6;
+					outtmp = (char *) ber_memrealloc_x( out, outsize, ctx );
+					if ( outtmp == NULL ) {
+						ber_memfree_x( ucsout, ctx );
+						ber_memfree_x( ucs, ctx );
+						ber_memfree_x( out, ctx );
+						goto fail;
+					}
+					out = outtmp;
+				}
+				outpos += ldap_x_ucs4_to_utf8( ucsout[j], &out[outpos] );
+			}
+		}
+
+		ber_memfree_x( ucsout, ctx );
+		ucsout = NULL;
+
+		if ( i == len ) {
+			break;
+		}
+
+		last = i;
+
+		/* Allocate more space in out if necessary */
+		if (len - i >= outsize - outpos) {
+			outsize += 1 + ((len - i) - (outsize - outpos));
+			outtmp = (char *) ber_memrealloc_x(out, outsize, ctx);
+			if (outtmp == NULL) {
+				ber_memfree_x( ucs, ctx );
+				ber_memfree_x( out, ctx );
+				goto fail;
+			}
+			out = outtmp;
+		}
+
+		/* s[i] is ascii */
+		/* finish off everything up to char before next non-ascii */
+		for ( i++; (i < len) && LDAP_UTF8_ISASCII(s + i); i++ ) {
+			out[outpos++] = casefold ? TOLOWER( s[i-1] ) : s[i-1];
+		}
+		if ( i == len ) {
+			out[outpos++] = casefold ? TOLOWER( s[len-1] ) : s[len-1];
+			break;
+		}
+
+		/* convert character before next non-ascii to ucs-4 */
+		*ucs = casefold ? TOLOWER( s[i-1] ) : s[i-1];
+		p = ucs + 1;
+	}
+
+	ber_memfree_x( ucs, ctx );
+	out[outpos] = '\0';
+	newbv->bv_val = out;
+	newbv->bv_len = outpos;
+	return newbv;
+}
+
+static int
+bytewise_normcmp(
+	struct berval *bv1,
+	struct berval *bv2,
+	unsigned flags,
+	void *ctx )
+{
+	int i, l1, l2, len, ulen, res = 0;
+	char *s1, *s2, *done;
+	ac_uint4 *ucs, *ucsout1, *ucsout2;
+
+	unsigned casefold = flags & LDAP_UTF8_CASEFOLD;
+	unsigned norm1 = flags & LDAP_UTF8_ARG1NFC;
+	unsigned norm2 = flags & LDAP_UTF8_ARG2NFC;
+
+	if (bv1 == NULL) {
+		return bv2 == NULL ? 0 : -1;
+
+	} else if (bv2 == NULL) {
+		return 1;
+	}
+
+	l1 = bv1->bv_len;
+	l2 = bv2->bv_len;
+
+	len = (l1 < l2) ? l1 : l2;
+	if (len == 0) {
+		return l1 == 0 ? (l2 == 0 ? 0 : -1) : 1;
+	}
+
+	s1 = bv1->bv_val;
+	s2 = bv2->bv_val;
+	done = s1 + len;
+
+	while ( (s1 < done) && LDAP_UTF8_ISASCII(s1) && LDAP_UTF8_ISASCII(s2) ) {
+		if (casefold) {
+			char c1 = TOLOWER(*s1);
+			char c2 = TOLOWER(*s2);
+			res = c1 - c2;
+		} else {
+			res = *s1 - *s2;
+		}
+		s1++;
+		s2++;
+		if (res) {
+			/* done unless next character in s1 or s2 is non-ascii */
+			if (s1 < done) {
+				if (!LDAP_UTF8_ISASCII(s1) || !LDAP_UTF8_ISASCII(s2)) {
+					break;
+				}
+			} else if (((len < l1) && !LDAP_UTF8_ISASCII(s1)) ||
+				((len < l2) && !LDAP_UTF8_ISASCII(s2)))
+			{
+				break;
+			}
+			return res;
+		}
+	}
+
+	/* We have encountered non-ascii or strings equal up to len */
+
+	/* set i to number of iterations */
+	i = s1 - done + len;
+	/* passed through loop at least once? */
+	if (i > 0) {
+		if (!res && (s1 == done) &&
+		    ((len == l1) || LDAP_UTF8_ISASCII(s1)) &&
+		    ((len == l2) || LDAP_UTF8_ISASCII(s2))) {
+			/* all ascii and equal up to len */
+			return l1 - l2;
+		}
+
+		/* rewind one char, and do normalized compare from there */
+		s1--;
+		s2--;
+		l1 -= i - 1;
+		l2 -= i - 1;
+	}
+
+	/* Should first check to see if strings are already in
+	 * proper normalized form.
+	 */
+	ucs = ber_memalloc_x( ( ( norm1 || l1 > l2 ) ? l1 : l2 ) * sizeof(*ucs),
+		ctx );
+	if ( ucs == NULL ) {
+		return l1 > l2 ? 1 : -1; /* what to do??? */
+	}
+
+	/*
+	 * XXYYZ: we convert to ucs4 even though -llunicode
+	 * expects ucs2 in an ac_uint4
+	 */
+
+	/* convert and normalize 1st string */
+	for ( i = 0, ulen = 0; i < l1; i += len, ulen++ ) {
+		ucs[ulen] = ldap_x_utf8_to_ucs4( s1 + i );
+		if ( ucs[ulen] == LDAP_UCS4_INVALID ) {
+			ber_memfree_x( ucs, ctx );
+			return -1; /* what to do??? */
+		}
+		len = LDAP_UTF8_CHARLEN( s1 + i );
+	}
+
+	if ( norm1 ) {
+		ucsout1 = ucs;
+		l1 = ulen;
+		ucs = ber_memalloc_x( l2 * sizeof(*ucs), ctx );
+		if ( ucs == NULL ) {
+			ber_memfree_x( ucsout1, ctx );
+			return l1 > l2 ? 1 : -1; /* what to do??? */
+		}
+	} else {
+		uccompatdecomp( ucs, ulen, &ucsout1, &l1, ctx );
+		l1 = uccanoncomp( ucsout1, l1 );
+	}
+
+	/* convert and normalize 2nd string */
+	for ( i = 0, ulen = 0; i < l2; i += len, ulen++ ) {
+		ucs[ulen] = ldap_x_utf8_to_ucs4( s2 + i );
+		if ( ucs[ulen] == LDAP_UCS4_INVALID ) {
+			ber_memfree_x( ucsout1, ctx );
+			ber_memfree_x( ucs, ctx );
+			return 1; /* what to do??? */
+		}
+		len = LDAP_UTF8_CHARLEN( s2 + i );
+	}
+
+	if ( norm2 ) {
+		ucsout2 = ucs;
+		l2 = ulen;
+	} else {
+		uccompatdecomp( ucs, ulen, &ucsout2, &l2, ctx );
+		l2 = uccanoncomp( ucsout2, l2 );
+		ber_memfree_x( ucs, ctx );
+	}
+
+	res = casefold
+		? ucstrncasecmp( ucsout1, ucsout2, l1 < l2 ? l1 : l2 )
+		: ucstrncmp( ucsout1, ucsout2, l1 < l2 ? l1 : l2 );
+	ber_memfree_x( ucsout1, ctx );
+	ber_memfree_x( ucsout2, ctx );
+
+	if ( res != 0 ) {
+		return res;
+	}
+	if ( l1 == l2 ) {
+		return 0;
+	}
+	return l1 > l2 ? 1 : -1;
+}
+
+/* The word-at-a-time code must give what the byte loops give, for
+ * every value and every pair.
+ */
+static int
+check( const char *name, struct berval *vals, struct berval *alts )
+{
+	static const unsigned flags[] = {
+		LDAP_UTF8_NOCASEFOLD, LDAP_UTF8_CASEFOLD,
+		LDAP_UTF8_APPROX, LDAP_UTF8_CASEFOLD | LDAP_UTF8_APPROX,
+	};
+	struct berval a, b;
+	unsigned f;
+	int i, bad = 0;
+
+	for ( f = 0; f < sizeof(flags) / sizeof(flags[0]); f++ ) {
+		for ( i = 0; i < NVALS; i++ ) {
+			UTF8bvnormalize( &vals[i], &a, flags[f], NULL );
+			bytewise_normalize( &vals[i], &b, flags[f], NULL );
+			if ( a.bv_len != b.bv_len ||
+				memcmp( a.bv_val, b.bv_val, a.bv_len )) {
+				fprintf( stderr, "%s: %s: normalize(\"%s\", %u) differs\n",
+					progname, name, vals[i].bv_val, flags[f] );
+				bad++;
+			}
+			ber_memfree( a.bv_val );
+			ber_memfree( b.bv_val );
+
+			if ( flags[f] & LDAP_UTF8_APPROX )
+				continue;
+			if ( UTF8bvnormcmp( &vals[i], &alts[i], flags[f], NULL ) !=
+				bytewise_normcmp( &vals[i], &alts[i], flags[f], NULL )) {
+				fprintf( stderr, "%s: %s: normcmp(\"%s\", \"%s\", %u) differs\n",
+					progname, name, vals[i].bv_val, alts[i].bv_val, flags[f] );
+				bad++;
+			}
+		}
+	}
+	return bad;
+}
+
+/* Something to compare a value with: the same value in another case,
+ * the value cut short, or another value of the corpus.
+ */
+static void
+alternate( struct berval *vals, struct berval *alts )
+{
+	ber_len_t j;
+	int i;
+
+	for ( i = 0; i < NVALS; i++ ) {
+		ber_dupbv( &alts[i], &vals[i] );
+		switch ( rand() % 4 ) {
+		case 0:
+			for ( j = 0; j < alts[i].bv_len; j++ ) {
+				char c = alts[i].bv_val[j];
+				if ( c >= 'a' && c <= 'z' && rand() % 2 )
+					alts[i].bv_val[j] = c - 'a' + 'A';
+			}
+			break;
+		case 1:
+			/* at a character boundary, values are valid UTF-8 */
+			j = rand() % ( alts[i].bv_len + 1 );
+			while ( j < alts[i].bv_len &&
+				( alts[i].bv_val[j] & 0xc0 ) == 0x80 )
+				j--;
+			alts[i].bv_len = j;
+			alts[i].bv_val[j] = '\0';
+			break;
+		case 2:
+			ber_memfree( alts[i].bv_val );
+			ber_dupbv( &alts[i], &vals[rand() % NVALS] );
+			break;
+		}
+	}
+}
+
+int
+main( int argc, char **argv )
+{
+	struct berval *vals, *alts;
+	char buf[512];
+	unsigned seed = 1;
+	int iter = 20, c, i, j, bad = 0;
+
+	while ( (c = getopt( argc, argv, "i:s:" )) != EOF ) {
+		switch ( c ) {
+		case 'i':
+			iter = atoi( optarg );
+			break;
+		case 's':
+			seed = strtoul( optarg, NULL, 0 );
+			break;
+		default:
+			usage();
+		}
+	}
+	if ( iter < 1 )
+		usage();
+
+	vals = malloc( NVALS * sizeof(struct berval) );
+	alts = malloc( NVALS * sizeof(struct berval) );
+	srand( seed );
+
+	printf( "%-12s %23s %23s %23s\n", "ns/value", "normalize",
+		"casefold", "normcmp casefold" );
+	printf( "%-12s %11s %11s %11s %11s %11s %11s\n", "",
+		"bytes", "words", "bytes", "words", "bytes", "words" );
+
+	for ( i = 0; corpora[i].name; i++ ) {
+		for ( j = 0; j < NVALS; j++ ) {
+			corpora[i].gen( buf, sizeof(buf) );
+			ber_str2bv( buf, 0, 1, &vals[j] );
+		}
+		alternate( vals, alts );
+
+		bad += check( corpora[i].name, vals, alts );
+
+		printf( "%-12s %11.1f %11.1f %11.1f %11.1f %11.1f %11.1f\n",
+			corpora[i].name,
+			time_normalize( bytewise_normalize, vals, 0, iter ),
+			time_normalize( UTF8bvnormalize, vals, 0, iter ),
+			time_normalize( bytewise_normalize, vals,
+				LDAP_UTF8_CASEFOLD, iter ),
+			time_normalize( UTF8bvnormalize, vals,
+				LDAP_UTF8_CASEFOLD, iter ),
+			time_normcmp( bytewise_normcmp, vals, alts,
+				LDAP_UTF8_CASEFOLD, iter ),
+			time_normcmp( UTF8bvnormcmp, vals, alts,
+				LDAP_UTF8_CASEFOLD, iter ));
+
+		for ( j = 0; j < NVALS; j++ ) {
+			ber_memfree( vals[j].bv_val );
+			ber_memfree( alts[j].bv_val );
+		}
+	}
+
+	free( alts );
+	free( vals );
+
+	if ( bad ) {
+		fprintf( stderr, "%s: %d results differ\n", progname, bad );
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,324 @@
+/* zip-test -- check the back-mdb value compression codec */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2020 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/stdlib.h>
+#include <ac/string.h>
+#include <ac/unistd.h>
+
+#include "../../servers/slapd/back-mdb/zipcodec.h"
+
+static const char *progname = "zip-test";
+
+/* bytes past the end of each output buffer that must stay untouched */
+#define GUARD	64
+#define GUARD_BYTE	0xa5
+
+#define MAX_LEN	200000
+
+static int failures;
+
+static void
+usage( void )
+{
+	fprintf( stderr,
+		"Usage: %s [-i iterations] [-s seed]\n",
+		progname );
+	exit( EXIT_FAILURE );
+}
+
+static void
+fail( const char *name, const char *what, unsigned len )
+{
+	fprintf( stderr, "%s: %s (%u bytes): %s\n", progname, name, len, what );
+	failures++;
+}
+
+static int
+guard_ok( const unsigned char *buf, unsigned len )
+{
+	unsigned i;
+
+	for ( i = 0; i < GUARD; i++ ) {
+		if ( buf[len + i] != GUARD_BYTE )
+			return 0;
+	}
+	return 1;
+}
+
+/* Room for data that doesn't compress at all: a token and the
+ * literal length bytes besides the data itself.
+ */
+static unsigned
+pack_cap( unsigned len )
+{
+	return len + len / 255 + 16;
+}
+
+/* The values of a large group, as the compress option sees them */
+static unsigned
+gen_members( unsigned char *buf, unsigned max )
+{
+	unsigned len = 0, i;
+
+	for ( i = 0; len + 64 < max; i++ ) {
+		len += sprintf( (char *)buf + len,
+			"uid=user%05u,ou=People,dc=example,dc=com", i );
+	}
+	return len;
+}
+
+/* Free text with repeats at varying distances */
+static unsigned
+gen_text( unsigned char *buf, unsigned max )
+{
+	static const char *words[] = {
+		"directory", "entry", "attribute", "value", "the", "of",
+		"index", "search", "filter", "schema", "replica", "and",
+		NULL
+	};
+	unsigned len = 0, nwords, w;
+
+	for ( nwords = 0; words[nwords]; nwords++ )
+		;
+	while ( len + 16 < max ) {
+		w = rand() % nwords;
+		len += sprintf( (char *)buf + len, "%s ", words[w] );
+	}
+	return len;
+}
+
+static unsigned
+gen_random( unsigned char *buf, unsigned max )
+{
+	unsigned i;
+
+	for ( i = 0; i < max; i++ )
+		buf[i] = rand();
+	return max;
+}
+
+/* One byte over and over, for match lengths far past 255 */
+static unsigned
+gen_run( unsigned char *buf, unsigned max )
+{
+	memset( buf, 'a', max );
+	return max;
+}
+
+/* Blocks repeated from further back than a match offset can reach */
+static unsigned
+gen_far( unsigned char *buf, unsigned max )
+{
+	unsigned len = 70000 < max ? 70000 : max;
+
+	gen_random( buf, len );
+	if ( len + 4096 <= max ) {
+		memcpy( buf + len, buf, 4096 );
+		len += 4096;
+	}
+	return len;
+}
+
+static const struct {
+	const char *name;
+	unsigned (*gen)( unsigned char *buf, unsigned max );
+	unsigned max;
+} corpora[] = {
+	{ "members", gen_members, 4096 },
+	{ "members-large", gen_members, MAX_LEN },
+	{ "text", gen_text, 2048 },
+	{ "random", gen_random, 1024 },
+	{ "random-large", gen_random, 100000 },
+	{ "run", gen_run, MAX_LEN },
+	{ "far", gen_far, MAX_LEN },
+	{ NULL }
+};
+
+/* Pack and unpack src, checking the result and that neither side
+ * writes past its buffer. Returns the compressed size.
+ */
+static unsigned
+round_trip( const char *name, const unsigned char *src, unsigned len,
+	unsigned char *zip, unsigned char *out )
+{
+	unsigned cap = pack_cap( len ), zlen;
+
+	memset( zip + cap, GUARD_BYTE, GUARD );
+	zlen = mdb_zip_pack( src, len, zip, cap );
+	if ( !guard_ok( zip, cap ))
+		fail( name, "pack wrote past its buffer", len );
+	if ( !zlen ) {
+		fail( name, "pack failed with room to spare", len );
+		return 0;
+	}
+
+	memset( out + len, GUARD_BYTE, GUARD );
+	if ( mdb_zip_unpack( zip, zlen, out, len ))
+		fail( name, "unpack failed", len );
+	else if ( memcmp( src, out, len ))
+		fail( name, "unpack gave different data", len );
+	if ( !guard_ok( out, len ))
+		fail( name, "unpack wrote past its buffer", len );
+
+	/* one byte short of what it needs must not fit */
+	if ( zlen > 1 ) {
+		memset( zip + zlen - 1, GUARD_BYTE, GUARD );
+		if ( mdb_zip_pack( src, len, zip, zlen - 1 ))
+			fail( name, "pack claimed to fit in too little room", len );
+		if ( !guard_ok( zip, zlen - 1 ))
+			fail( name, "pack wrote past a short buffer", len );
+		/* put it back for the caller */
+		mdb_zip_pack( src, len, zip, cap );
+	}
+	return zlen;
+}
+
+/* Every prefix of a block must be refused, or expand to the whole
+ * data when all that was cut is an empty final sequence.
+ */
+static void
+truncated( const char *name, const unsigned char *src, unsigned len,
+	const unsigned char *zip, unsigned zlen, unsigned char *out )
+{
+	unsigned k, step = zlen > 4096 ? zlen / 1024 : 1;
+
+	for ( k = 0; k < zlen; k += step ) {
+		memset( out + len, GUARD_BYTE, GUARD );
+		if ( !mdb_zip_unpack( zip, k, out, len ) &&
+			( zlen - k > 1 || memcmp( src, out, len )))
+			fail( name, "truncated block accepted", len );
+		if ( !guard_ok( out, len ))
+			fail( name, "truncated block overran output", len );
+	}
+}
+
+/* Damaged blocks may expand to anything that fits, but must not run
+ * past the output or fail to stop.
+ */
+static void
+corrupted( const char *name, unsigned len, const unsigned char *zip,
+	unsigned zlen, unsigned char *bad, unsigned char *out, int iter )
+{
+	unsigned n, pos;
+	int i;
+
+	for ( i = 0; i < iter; i++ ) {
+		memcpy( bad, zip, zlen );
+		for ( n = 1 + rand() % 4; n; n-- ) {
+			pos = rand() % zlen;
+			bad[pos] = rand() % 3 ? bad[pos] ^ ( 1 << ( rand() % 8 )) : rand();
+		}
+		memset( out + len, GUARD_BYTE, GUARD );
+		mdb_zip_unpack( bad, zlen, out, len );
+		if ( !guard_ok( out, len )) {
+			fail( name, "corrupted block overran output", len );
+			return;
+		}
+	}
+}
+
+/* Hand made blocks that each break one rule of the format */
+static void
+malformed( unsigned char *out )
+{
+	static const struct {
+		const char *what;
+		unsigned char data[8];
+		unsigned len, dlen;
+	} cases[] = {
+		{ "offset of zero", { 0x10, 'a', 0x00, 0x00, 0x00 }, 5, 5 },
+		{ "offset before the start", { 0x10, 'a', 0x02, 0x00, 0x00 }, 5, 5 },
+		{ "literals past the input", { 0x50, 'a', 'b' }, 3, 5 },
+		{ "literals past the output", { 0x30, 'a', 'b', 'c' }, 4, 2 },
+		{ "match past the output", { 0x1f, 'a', 0x01, 0x00, 0x10, 0x00 }, 6, 8 },
+		{ "length bytes past the input", { 0xf0, 0xff, 0xff }, 3, 600 },
+		{ "half an offset", { 0x10, 'a', 0x01 }, 3, 5 },
+		{ "short output", { 0x30, 'a', 'b', 'c' }, 4, 4 },
+		{ NULL }
+	};
+	int i;
+
+	for ( i = 0; cases[i].what; i++ ) {
+		memset( out + cases[i].dlen, GUARD_BYTE, GUARD );
+		if ( !mdb_zip_unpack( cases[i].data, cases[i].len, out, cases[i].dlen ))
+			fail( cases[i].what, "malformed block accepted", cases[i].len );
+		if ( !guard_ok( out, cases[i].dlen ))
+			fail( cases[i].what, "malformed block overran output",
+				cases[i].len );
+	}
+}
+
+int
+main( int argc, char **argv )
+{
+	unsigned char *src, *zip, *bad, *out;
+	unsigned seed = 1, i, len, zlen, cap;
+	int iter = 1000, c;
+
+	while ( (c = getopt( argc, argv, "i:s:" )) != EOF ) {
+		switch ( c ) {
+		case 'i':
+			iter = atoi( optarg );
+			break;
+		case 's':
+			seed = strtoul( optarg, NULL, 0 );
+			break;
+		default:
+			usage();
+		}
+	}
+	if ( iter < 1 )
+		usage();
+
+	cap = pack_cap( MAX_LEN );
+	src = malloc( MAX_LEN );
+	zip = malloc( cap + GUARD );
+	bad = malloc( cap );
+	out = malloc( MAX_LEN + GUARD );
+	srand( seed );
+
+	/* short inputs, down to nothing, take other paths in the packer */
+	for ( len = 0; len <= 32; len++ ) {
+		gen_members( src, 4096 );
+		round_trip( "short", src, len, zip, out );
+	}
+
+	for ( i = 0; corpora[i].name; i++ ) {
+		len = corpora[i].gen( src, corpora[i].max );
+		zlen = round_trip( corpora[i].name, src, len, zip, out );
+		if ( !zlen )
+			continue;
+		printf( "%-14s %7u -> %7u\n", corpora[i].name, len, zlen );
+		truncated( corpora[i].name, src, len, zip, zlen, out );
+		corrupted( corpora[i].name, len, zip, zlen, bad, out, iter );
+	}
+
+	malformed( out );
+
+	free( out );
+	free( bad );
+	free( zip );
+	free( src );
+
+	if ( failures ) {
+		fprintf( stderr, "%s: %d failures\n", progname, failures );
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -148,6 +148,12 @@ PASSWDCONF=$DATADIR/slapd-passwd.conf
 UNDOCONF=$DATADIR/slapd-config-undo.conf
 NAKEDCONF=$DATADIR/slapd-config-naked.conf
 VALREGEXCONF=$DATADIR/slapd-valregex.conf
+NGRAMCONF=$DATADIR/slapd-ngram.conf
+MVRUNSCONF=$DATADIR/slapd-mvruns.conf
+GROUPCACHECONF=$DATADIR/slapd-groupcache.conf
+DNCACHECONF=$DATADIR/slapd-dncache.conf
+GROUPCOMMITCONF=$DATADIR/slapd-groupcommit.conf
+IDXSTATSCONF=$DATADIR/slapd-idxstats.conf
 
 DYNAMICCONF=$DATADIR/slapd-dynamic.ldif
 
@@ -220,6 +226,9 @@ LDAPEXOP="$CLIENTDIR/ldapexop $TOOLARGS"
 SLAPDTESTER=$PROGDIR/slapd-tester
 LDIFFILTER=$PROGDIR/ldif-filter
 SLAPDMTREAD=$PROGDIR/slapd-mtread
+IDLBENCH=$PROGDIR/idl-bench
+ZIPTEST=$PROGDIR/zip-test
+UCSTRBENCH=$PROGDIR/ucstr-bench
 LVL=${SLAPD_DEBUG-0x4105}
 LOCALHOST=localhost
 LOCALIP=127.0.0.1